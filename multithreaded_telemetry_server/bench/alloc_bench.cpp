@@ -0,0 +1,194 @@
+// Выделения памяти из кучи на показание и на объект по пути приема:
+// * установившийся поток: разбор строки и реестр отдельно, затем весь путь
+//   до писателя базы (SQLite и чанки, без журнала) вместе с его потоком;
+// * соединения, которые приходят и уходят: буфер приема из общей кучи
+//   против пула цикла событий;
+// * реестр, который заполняется заново: записи из кучи против пула.
+// Выделения считаются заменой глобального operator new.
+
+#include "../src/chunk_storage.h"
+#include "../src/database.h"
+#include "../src/event_loop.h"
+#include "../src/parser.h"
+#include "../src/pool.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <vector>
+
+// ======================= ПОДСЧЕТ ВЫДЕЛЕНИЙ ПАМЯТИ =======================
+
+static std::atomic<size_t> g_allocations{0};
+
+void *operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// Записи реестра выровнены по строке кэша и идут через эту перегрузку
+void *operator new(size_t size, std::align_val_t align) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    const size_t alignment = static_cast<size_t>(align);
+    if (void *p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+
+constexpr size_t DEVICES = 100;
+constexpr size_t READINGS = 1'000'000;
+constexpr size_t READ_BATCH = 64;       // Показаний за одно чтение из сокета
+// Разогрев: каждое устройство запечатывает пару чанков, дальше считается
+// установившийся режим
+constexpr size_t WARMUP = 2 * ChunkStorage::CHUNK_CAPACITY * DEVICES;
+
+const std::filesystem::path DIR = std::filesystem::temp_directory_path() / "telemetry_alloc_bench";
+
+std::vector<std::string> MakeLines() {
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < DEVICES; ++i) {
+        lines.push_back("device_" + std::to_string(i) + ":temp=21.5,hum=40.25,press=1013.5");
+    }
+    return lines;
+}
+
+// Разбор и реестр, без базы: поток писателя не мешает счету
+void MeasureFront() {
+    const auto lines = MakeLines();
+    DeviceIdTable ids;
+    DeviceRegistry registry(ids);
+    DeviceState state;
+    for (const auto& line : lines) {
+        ParseReading(line, state, ids);
+        registry.UpdateDevice(state);
+    }
+
+    const size_t before = g_allocations.load();
+    for (size_t i = 0; i < READINGS; ++i) {
+        ParseReading(lines[i % DEVICES], state, ids);
+        registry.UpdateDevice(state);
+    }
+    std::cout << "parse + registry: " << static_cast<double>(g_allocations.load() - before) / READINGS
+              << " allocations/reading" << std::endl;
+}
+
+// Весь путь приема вместе с потоком писателя и его остановкой
+void MeasureIngest(const char *name, StorageKind storage) {
+    std::filesystem::remove_all(DIR);
+    std::filesystem::create_directories(DIR);
+
+    DeviceIdTable ids;
+    MetricSchema schema;
+    DeviceRegistry registry(ids);
+    DataBaseOptions options;
+    options.storage = storage;
+    options.path = (DIR / "telemetry.db").string();
+    options.chunk_dir = (DIR / "chunks").string();
+    options.journal_dir.clear();
+    options.synchronous = "OFF";
+
+    const auto lines = MakeLines();
+    size_t allocations = 0;
+    {
+        DataBase db(ids, schema, options);
+        std::vector<DeviceState> readings;
+        std::vector<uint8_t> accepted;
+        readings.reserve(READ_BATCH);
+        DeviceState state;
+
+        auto ingest = [&](size_t count) {
+            for (size_t i = 0; i < count;) {
+                readings.clear();
+                for (size_t k = 0; k < READ_BATCH; ++k, ++i) {
+                    ParseReading(lines[i % DEVICES], state, ids);
+                    readings.push_back(state);
+                }
+                for (const auto& reading : readings) {
+                    registry.UpdateDevice(reading);
+                }
+                db.InsertReadings(readings, accepted);
+            }
+        };
+
+        ingest(WARMUP);
+        const size_t before = g_allocations.load();
+        ingest(READINGS);
+        db.Stop();
+        allocations = g_allocations.load() - before;
+    }
+    std::filesystem::remove_all(DIR);
+
+    std::cout << "ingest, " << name << ": " << static_cast<double>(allocations) / READINGS
+              << " allocations/reading" << std::endl;
+}
+
+// Соединение живет недолго: выделения на одно подключение
+template <typename Make>
+void MeasureConnections(const char *name, Make make) {
+    constexpr size_t CONNECTIONS = 100'000;
+    const size_t before = g_allocations.load();
+    for (size_t i = 0; i < CONNECTIONS; ++i) {
+        auto conn = make();
+        conn->in_.Commit(1);
+    }
+    std::cout << "connections, " << name << ": "
+              << static_cast<double>(g_allocations.load() - before) / CONNECTIONS
+              << " allocations/connection" << std::endl;
+}
+
+// Реестр заполняется с нуля ROUNDS раз на одном ресурсе
+void MeasureRegistry(const char *name, std::pmr::memory_resource *resource) {
+    constexpr size_t ROUNDS = 20;
+    constexpr size_t REGISTRY_DEVICES = 10'000;
+    DeviceIdTable ids;
+    std::vector<DeviceId> devices;
+    for (size_t i = 0; i < REGISTRY_DEVICES; ++i) {
+        devices.push_back(ids.Intern("device_" + std::to_string(i)));
+    }
+
+    const size_t before = g_allocations.load();
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        DeviceRegistry registry(ids, 64, {}, resource);
+        DeviceState state;
+        for (DeviceId id : devices) {
+            state.device_id_ = id;
+            registry.UpdateDevice(state);
+        }
+    }
+    std::cout << "registry, " << name << ": "
+              << static_cast<double>(g_allocations.load() - before) / (ROUNDS * REGISTRY_DEVICES)
+              << " allocations/device" << std::endl;
+}
+
+} // namespace
+
+int main() {
+    std::cout << DEVICES << " devices, " << READINGS << " readings, " << READ_BATCH << " per read" << std::endl;
+    MeasureFront();
+    MeasureIngest("sqlite", StorageKind::kSqlite);
+    MeasureIngest("chunks", StorageKind::kChunks);
+
+    MeasureConnections("heap", [] { return std::make_unique<Connection>(); });
+    std::pmr::unsynchronized_pool_resource loop_pool(ThreadPoolOptions(RingBuffer::DEFAULT_CAPACITY));
+    MeasureConnections("loop pool", [&] { return MakePooled<Connection>(&loop_pool, &loop_pool); });
+
+    MeasureRegistry("new_delete", std::pmr::new_delete_resource());
+    std::pmr::synchronized_pool_resource registry_pool;
+    MeasureRegistry("pool", &registry_pool);
+    return 0;
+}
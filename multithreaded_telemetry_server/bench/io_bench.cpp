@@ -0,0 +1,132 @@
+// Цикл событий на epoll против цикла на io_uring на одной машине: один
+// цикл в своем потоке, клиенты в соседних потоках шлют текстовые строки
+// окнами и ждут подтверждений. Окно 1 - запрос-ответ, где на каждое
+// показание приходится свой recv и send; большое окно - конвейер.
+// Кроме пропускной способности выводится время ЦП потока цикла на показание.
+
+#include "../src/event_loop.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/tcp.h>
+#include <time.h>
+
+namespace {
+
+constexpr const char *PORT = "18090";
+constexpr size_t CLIENTS = 16;
+constexpr std::chrono::seconds DURATION{2};
+constexpr const char *LINE = "bench-device;21.50;40.00;1013.25\n";
+
+// Обработчик без базы и реестра: подтверждает каждую строку
+bool AckFrames(Connection& conn) {
+    protocol::Frame frame;
+    while (true) {
+        const auto status = protocol::NextFrame(conn.in_, conn.scratch_, frame);
+        if (status == protocol::FrameStatus::kIncomplete) {
+            break;
+        }
+        if (status == protocol::FrameStatus::kError) {
+            return false;
+        }
+        conn.acks_.Add(true);
+        conn.in_.Consume(frame.size);
+    }
+    conn.acks_.WriteTo(conn.out_);
+    return true;
+}
+
+double ThreadCpuSeconds() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Окно строк одним send, затем recv до подтверждения всех; возвращает число подтвержденных
+size_t RunClient(size_t window, const std::atomic<bool>& stop) {
+    AddrInfo addr("127.0.0.1", PORT);
+    Socket socket(::socket(addr.Get()->ai_family, addr.Get()->ai_socktype, addr.Get()->ai_protocol));
+    if (socket.GetFd() < 0 || connect(socket.GetFd(), addr.Get()->ai_addr, addr.Get()->ai_addrlen) < 0) {
+        return 0;
+    }
+    int yes = 1;
+    setsockopt(socket.GetFd(), IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    std::string batch;
+    for (size_t i = 0; i < window; ++i) {
+        batch += LINE;
+    }
+    size_t acked = 0;
+    std::string in;
+    char buffer[4096];
+    while (!stop) {
+        if (send(socket.GetFd(), batch.data(), batch.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(batch.size())) {
+            return acked;
+        }
+        size_t pending = window;
+        while (pending != 0) {
+            const ssize_t n = recv(socket.GetFd(), buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                return acked;
+            }
+            in.append(buffer, n);
+            size_t pos;
+            while ((pos = in.find('\n')) != std::string::npos) {
+                // "Ok <n>"
+                const size_t count = std::stoul(in.substr(3, pos - 3));
+                pending -= std::min(pending, count);
+                acked += count;
+                in.erase(0, pos + 1);
+            }
+        }
+    }
+    return acked;
+}
+
+void Measure(IoBackend backend, size_t window) {
+    std::atomic<bool> stop{false};
+    auto loop = MakeIoLoop(PORT, AckFrames, backend);
+    double server_cpu = 0.0;
+    std::thread server([&] {
+        const double start = ThreadCpuSeconds();
+        loop->Run(stop);
+        server_cpu = ThreadCpuSeconds() - start;
+        loop->Drain(std::chrono::milliseconds(100));
+    });
+
+    std::atomic<bool> clients_stop{false};
+    std::vector<std::thread> clients;
+    std::atomic<size_t> acked{0};
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        clients.emplace_back([&] { acked += RunClient(window, clients_stop); });
+    }
+    std::this_thread::sleep_for(DURATION);
+    clients_stop = true;
+    for (auto& client : clients) {
+        client.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stop = true;
+    server.join();
+
+    std::cout << loop->Name() << ", window " << window << ": "
+              << static_cast<uint64_t>(acked / seconds) << " readings/s, loop CPU "
+              << (acked ? server_cpu * 1e9 / acked : 0.0) << " ns/reading" << std::endl;
+}
+
+} // namespace
+
+int main() {
+    std::cout << CLIENTS << " connections, " << DURATION.count() << " s per run" << std::endl;
+    for (size_t window : {1, 64}) {
+        Measure(IoBackend::kEpoll, window);
+        Measure(IoBackend::kUring, window);
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+// Сравнение прежнего ParserData (std::string, istringstream, stod)
+// с ParseReading (string_view, from_chars) на миллионе синтетических строк
+// и с разбором тех же показаний в двоичных кадрах DATA (binary_protocol.h).
+// ParseReading со схемой метрик: на тех же строках (цена гибкости для
+// обычного показания) и на строках с co2 и voltage.
+
+#include "../src/binary_protocol.h"
+#include "../src/parser.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ======================= ПОДСЧЕТ ВЫДЕЛЕНИЙ ПАМЯТИ =======================
+
+static std::atomic<size_t> g_allocations{0};
+
+void *operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+// ======================= ПРЕЖНИЙ ПАРСЕР =======================
+
+struct LegacyDeviceState {
+    std::string device_id_;
+    double temperature_ = 0.0;
+    double humidity_ = 0.0;
+    double pressure_ = 0.0;
+    std::chrono::system_clock::time_point last_update_;
+};
+
+bool ParserData(std::string data, LegacyDeviceState& state) {
+
+    auto colon_pos = data.find(':');
+    if (colon_pos == std::string::npos) {
+        return false;
+    }
+
+    std::string device_id = data.substr(0, colon_pos);
+    std::string readings = data.substr(colon_pos + 1);
+
+    state.device_id_ = device_id;
+    state.last_update_ = std::chrono::system_clock::now();
+
+    std::istringstream ss(readings);
+    std::string token;
+
+    while (std::getline(ss, token, ',')) {
+        auto eq_pos = token.find('=');
+        if (eq_pos == std::string::npos) continue;
+
+        std::string key = token.substr(0,eq_pos);
+        double value = std::stod(token.substr(eq_pos + 1));
+
+        if (key == "temp") {
+            state.temperature_ = value;
+        } else if (key == "hum") {
+            state.humidity_ = value;
+        } else if (key == "press") {
+            state.pressure_ = value;
+        }
+    }
+
+    return true;
+}
+
+// ======================= ЗАМЕР =======================
+
+template <typename State, typename F>
+void Run(const char *name, const std::vector<std::string>& lines, F&& parse) {
+    State state;
+    double checksum = 0.0;
+
+    const size_t allocations_before = g_allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+
+    for (const auto& line : lines) {
+        if (parse(line, state)) {
+            checksum += state.temperature_;
+        }
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const size_t allocations = g_allocations.load() - allocations_before;
+    const double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+
+    std::cout << name << ": "
+              << ns / lines.size() << " ns/line, "
+              << static_cast<double>(allocations) / lines.size() << " allocations/line"
+              << " (checksum " << checksum << ")" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 1'000'000;
+
+    std::vector<std::string> lines;
+    lines.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        lines.push_back("device_" + std::to_string(i % 1000) +
+                        ":temp=" + std::to_string(15 + i % 20) + ".5" +
+                        ",hum=" + std::to_string(40 + i % 50) +
+                        ",press=" + std::to_string(990 + i % 40));
+    }
+
+    std::cout << "Lines: " << count << std::endl;
+
+    Run<LegacyDeviceState>("ParserData  ", lines, [](const std::string& line, LegacyDeviceState& state) {
+        return ParserData(line, state);
+    });
+
+    DeviceIdTable ids;
+    Run<DeviceState>("ParseReading", lines, [&ids](const std::string& line, DeviceState& state) {
+        return ParseReading(line, state, ids);
+    });
+
+    MetricSchema schema;
+    std::vector<MetricSample> extras;
+    uint8_t fields = 0;
+    MetricNameBudget budget;
+    auto parse_with_schema = [&](const std::string& line, DeviceState& state) {
+        extras.clear();
+        return ParseReading(line, state, fields, ids, schema, budget, extras);
+    };
+    Run<DeviceState>("with schema ", lines, parse_with_schema);
+    std::vector<std::string> extended = lines;
+    for (size_t i = 0; i < count; ++i) {
+        extended[i] += ",co2=" + std::to_string(400 + i % 100) + ",voltage=3." + std::to_string(i % 10);
+    }
+    Run<DeviceState>("+co2,voltage", extended, parse_with_schema);
+
+    // Нагрузки кадров DATA без заголовка: заголовок разбирает NextFrame
+    namespace binary = protocol::binary;
+    binary::Bindings bindings;
+    for (uint16_t i = 0; i < 1000; ++i) {
+        bindings.Bind(i, ids.Intern("device_" + std::to_string(i)));
+    }
+    std::vector<std::string> frames;
+    frames.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        std::string frame;
+        binary::AppendData(frame, static_cast<uint16_t>(i % 1000), 0, 15.5 + i % 20, 40.0 + i % 50, 990.0 + i % 40);
+        frames.push_back(frame.substr(binary::HEADER_SIZE));
+    }
+    Run<DeviceState>("DecodeData  ", frames, [&](const std::string& frame, DeviceState& state) {
+        return binary::DecodeData(frame, bindings, state, fields);
+    });
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Запрос с группировкой по интервалам за 30 дней посекундных показаний
+// одного устройства: SQLite (GROUP BY по индексу) против агрегатов чанков.
+// Третий участник - таблицы свертки (rollup_store): тот же запрос
+// читает по строке на интервал. Результаты чанков и свертки сверяются
+// с группировкой сырых показаний в C++.
+// Первый аргумент - каталог для файлов (по умолчанию /tmp).
+
+#include "../src/chunk_storage.h"
+#include "../src/rollup_store.h"
+#include "../src/sqlite_storage.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+constexpr size_t DAYS = 30;
+constexpr size_t READINGS = DAYS * 24 * 3600;
+constexpr size_t BATCH_SIZE = 4096;
+
+using Clock = std::chrono::steady_clock;
+
+double Millis(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+template <typename S>
+void Fill(S& storage, DeviceId id) {
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<int> step(-1, 1);
+    const auto base = std::chrono::system_clock::time_point(std::chrono::seconds(1'700'000'000));
+    double temperature = 20.0;
+
+    std::vector<DeviceState> batch;
+    for (size_t i = 0; i < READINGS; ++i) {
+        temperature += step(rng) * 0.1;
+        DeviceState state;
+        state.device_id_ = id;
+        state.temperature_ = std::round(temperature * 10) / 10;
+        state.humidity_ = 50.0 + static_cast<double>(i % 600) / 60;
+        state.pressure_ = 1013.0;
+        state.last_update_ = base + std::chrono::seconds(i);
+        batch.push_back(state);
+        if (batch.size() == BATCH_SIZE || i + 1 == READINGS) {
+            storage.WriteBatch(batch);
+            batch.clear();
+        }
+    }
+}
+
+// Свертка в том же порядке, что у писателя базы
+class RollupSink {
+public:
+    explicit RollupSink(RollupStore& store) : store_(store) {}
+
+    void WriteBatch(const std::vector<DeviceState>& batch) {
+        for (const auto& state : batch) {
+            accumulator_.Add(state, closed_);
+        }
+        store_.Write(closed_);
+        closed_.clear();
+    }
+
+    void Close() {
+        accumulator_.CloseAll(closed_);
+        store_.Write(closed_);
+        closed_.clear();
+    }
+
+private:
+    RollupStore& store_;
+    RollupAccumulator accumulator_;
+    std::vector<RollupRow> closed_;
+};
+
+// Адаптер для Run: запрос к уровню, подходящему к интервалу
+struct RollupQuery {
+    const RollupStore& store_;
+
+    std::vector<AggregatedPoint> Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                           std::chrono::system_clock::time_point to,
+                                           std::chrono::milliseconds bucket, Aggregation aggregation) const {
+        const RollupTier tier = bucket.count() % ROLLUP_WIDTH_MS[1] == 0 ? RollupTier::kHour : RollupTier::kMinute;
+        // Раньше from показаний нет, поэтому первый неполный интервал берется целиком
+        return store_.Aggregate(tier, id, FloorTo(ToMs(from), bucket.count()), ToMs(to) + 1, bucket.count(), aggregation);
+    }
+};
+
+void Verify(const char *name, const std::vector<AggregatedPoint>& points,
+            const std::map<int64_t, std::pair<uint64_t, double>>& expected) {
+    if (points.size() != expected.size()) {
+        throw std::runtime_error(std::string(name) + " aggregate returned a different number of buckets");
+    }
+    for (const auto& point : points) {
+        const int64_t s = std::chrono::duration_cast<std::chrono::seconds>(point.bucket_start_.time_since_epoch()).count();
+        const auto& [count, sum] = expected.at(s);
+        if (count != point.count_ || std::abs(sum / count - point.temperature_) > 1e-9) {
+            throw std::runtime_error(std::string(name) + " aggregate differs from raw readings");
+        }
+    }
+}
+
+template <typename S>
+std::vector<AggregatedPoint> Run(const char *name, const S& storage, DeviceId id, std::chrono::seconds bucket) {
+    const auto from = std::chrono::system_clock::time_point(std::chrono::seconds(1'700'000'000));
+    const auto to = from + std::chrono::hours(24 * DAYS);
+
+    const auto start = Clock::now();
+    auto points = storage.Aggregate(id, from, to, bucket, Aggregation::kAvg);
+    std::cout << name << " bucket " << bucket.count() << "s: " << Millis(start) << " ms, "
+              << points.size() << " points" << std::endl;
+    return points;
+}
+
+// Эталон: группировка сырых показаний без агрегатов чанков
+std::map<int64_t, std::pair<uint64_t, double>> Reference(const ChunkStorage& storage, DeviceId id, std::chrono::seconds bucket) {
+    std::map<int64_t, std::pair<uint64_t, double>> result;
+    storage.Scan(id, std::chrono::system_clock::time_point::min(), std::chrono::system_clock::time_point::max(),
+                 [&](const DeviceState& state) {
+        const int64_t s = std::chrono::duration_cast<std::chrono::seconds>(state.last_update_.time_since_epoch()).count();
+        auto& [count, sum] = result[s / bucket.count() * bucket.count()];
+        ++count;
+        sum += state.temperature_;
+    });
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    const std::filesystem::path dir = argc > 1 ? argv[1] : "/tmp";
+    const std::string db_path = (dir / "query_bench.db").string();
+    const std::string chunk_dir = (dir / "query_bench_chunks").string();
+    const std::string rollup_path = (dir / "query_bench_rollups.db").string();
+    std::filesystem::remove(db_path);
+    std::filesystem::remove(db_path + "-wal");
+    std::filesystem::remove(db_path + "-shm");
+    std::filesystem::remove_all(chunk_dir);
+    for (const char *suffix : {"", "-wal", "-shm"}) {
+        std::filesystem::remove(rollup_path + suffix);
+    }
+
+    DeviceIdTable ids;
+    const DeviceId id = ids.Intern("device_0");
+    std::cout << "Readings: " << READINGS << " (" << DAYS << " days, 1/s)" << std::endl;
+
+    SqliteStorage sqlite(ids, db_path, "OFF", 64 * 1024);
+    Fill(sqlite, id);
+    ChunkStorage chunks(ids, chunk_dir);
+    Fill(chunks, id);
+    RollupStore rollups(ids, rollup_path);
+    RollupSink sink(rollups);
+    Fill(sink, id);
+    sink.Close();
+    const RollupQuery rollup_query {rollups};
+
+    for (auto bucket : {std::chrono::seconds(3600), std::chrono::seconds(60)}) {
+        Run("sqlite", sqlite, id, bucket);
+        const auto chunk_points = Run("chunks", chunks, id, bucket);
+        const auto rollup_points = Run("rollups", rollup_query, id, bucket);
+
+        const auto expected = Reference(chunks, id, bucket);
+        Verify("chunk", chunk_points, expected);
+        Verify("rollup", rollup_points, expected);
+    }
+
+    return 0;
+}
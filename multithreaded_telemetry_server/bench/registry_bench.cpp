@@ -0,0 +1,141 @@
+// Конкуренция за DeviceRegistry: прежний реестр с одним shared_mutex
+// против шардированного. Каждый поток обновляет случайные устройства,
+// каждая десятая операция - чтение GetDevice.
+
+#include "../src/device.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ======================= ПРЕЖНИЙ РЕЕСТР =======================
+
+struct LegacyDeviceState {
+    std::string device_id_;
+    double temperature_ = 0.0;
+    double humidity_ = 0.0;
+    double pressure_ = 0.0;
+    std::chrono::system_clock::time_point last_update_;
+};
+
+class LegacyDeviceRegistry {
+public:
+    void UpdateDevice(const LegacyDeviceState &state) {
+        std::unique_lock lock(mutex_);
+        devices_[state.device_id_] = state;
+    }
+
+    std::optional<LegacyDeviceState> GetDevice(const std::string &id) const {
+        std::shared_lock lock(mutex_);
+        auto it = devices_.find(id);
+        if (it != devices_.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+private:
+    std::unordered_map<std::string, LegacyDeviceState> devices_;
+
+    mutable std::shared_mutex mutex_;
+};
+
+// ======================= ЗАМЕР =======================
+
+constexpr size_t DEVICE_COUNT = 10'000;
+constexpr size_t OPS_TOTAL = 4'000'000;
+
+// Прежний реестр адресуется строкой, новый - интернированным DeviceId
+struct LegacyBench {
+    LegacyDeviceRegistry registry;
+    std::vector<std::string> keys;
+
+    explicit LegacyBench(const std::vector<std::string>& ids) : keys(ids) {
+        for (const auto& id : keys) {
+            registry.UpdateDevice(LegacyDeviceState{.device_id_ = id, .last_update_ = std::chrono::system_clock::now()});
+        }
+    }
+    double Get(size_t i) const {
+        auto found = registry.GetDevice(keys[i]);
+        return found ? found->temperature_ : 0.0;
+    }
+    void Update(size_t i, double value) {
+        registry.UpdateDevice(LegacyDeviceState{.device_id_ = keys[i], .temperature_ = value,
+                                                .last_update_ = std::chrono::system_clock::now()});
+    }
+};
+
+struct ShardedBench {
+    DeviceIdTable table;
+    DeviceRegistry registry{table};
+    std::vector<DeviceId> keys;
+
+    explicit ShardedBench(const std::vector<std::string>& ids) {
+        for (const auto& id : ids) {
+            keys.push_back(table.Intern(id));
+            registry.UpdateDevice(DeviceState{.device_id_ = keys.back(), .last_update_ = std::chrono::system_clock::now()});
+        }
+    }
+    double Get(size_t i) const {
+        auto found = registry.GetDevice(keys[i]);
+        return found ? found->temperature_ : 0.0;
+    }
+    void Update(size_t i, double value) {
+        registry.UpdateDevice(DeviceState{.device_id_ = keys[i], .temperature_ = value,
+                                          .last_update_ = std::chrono::system_clock::now()});
+    }
+};
+
+template <typename Bench>
+double Run(size_t thread_count, const std::vector<std::string>& ids) {
+    Bench bench(ids);
+
+    const size_t ops_per_thread = OPS_TOTAL / thread_count;
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 rng(static_cast<unsigned>(t));
+            std::uniform_int_distribution<size_t> pick(0, ids.size() - 1);
+            double sink = 0.0;
+
+            for (size_t i = 0; i < ops_per_thread; ++i) {
+                const size_t device = pick(rng);
+                if (i % 10 == 0) {
+                    sink += bench.Get(device);
+                } else {
+                    bench.Update(device, static_cast<double>(i));
+                }
+            }
+            if (sink < 0) {
+                std::cout << sink;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return OPS_TOTAL / seconds / 1e6;
+}
+
+int main() {
+    std::vector<std::string> ids;
+    for (size_t i = 0; i < DEVICE_COUNT; ++i) {
+        ids.push_back("device_" + std::to_string(i));
+    }
+
+    std::cout << "threads  legacy Mops/s  sharded Mops/s" << std::endl;
+    for (size_t threads : {1, 4, 16, 64}) {
+        const double legacy = Run<LegacyBench>(threads, ids);
+        const double sharded = Run<ShardedBench>(threads, ids);
+        std::cout << threads << "\t " << legacy << "\t\t" << sharded << std::endl;
+    }
+
+    return 0;
+}
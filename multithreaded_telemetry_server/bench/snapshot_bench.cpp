@@ -0,0 +1,133 @@
+// Снимок DeviceRegistry: время записи и загрузки для 1M и 4M устройств
+// и влияние записи на прием. Потоки обновляют известные устройства, пока
+// снимок пишется в соседнем потоке; печатаются обновления в секунду и
+// самая долгая задержка одного обновления с записью и без нее.
+
+#include "../src/registry_snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr const char *PATH = "snapshot_bench.snap";
+
+double Seconds(std::chrono::steady_clock::duration elapsed) {
+    return std::chrono::duration<double>(elapsed).count();
+}
+
+void Fill(DeviceRegistry& registry, DeviceIdTable& ids, size_t devices) {
+    const auto now = std::chrono::system_clock::now();
+    for (size_t i = 0; i < devices; ++i) {
+        DeviceState state;
+        state.device_id_ = ids.Intern("device_" + std::to_string(i));
+        state.temperature_ = 20.0 + static_cast<double>(i % 100) / 10.0;
+        state.humidity_ = 45.0;
+        state.pressure_ = 1013.0;
+        state.last_update_ = now;
+        registry.UpdateDevice(state);
+    }
+}
+
+// Обновления известных устройств из threads потоков за duration
+struct IngestResult {
+    double updates_per_second;
+    std::chrono::nanoseconds worst;
+};
+
+IngestResult Ingest(DeviceRegistry& registry, size_t devices, size_t threads, std::chrono::milliseconds duration) {
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> updates{0};
+    std::atomic<int64_t> worst{0};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(static_cast<uint32_t>(t + 1));
+            std::uniform_int_distribution<DeviceId> pick(1, static_cast<DeviceId>(devices));
+            DeviceState state;
+            state.last_update_ = std::chrono::system_clock::now() + std::chrono::hours(1);     // Новее показаний Fill
+            uint64_t local = 0;
+            int64_t local_worst = 0;
+            while (running.load(std::memory_order_relaxed)) {
+                state.device_id_ = pick(rng);
+                state.temperature_ = static_cast<double>(local % 50);
+                const auto start = std::chrono::steady_clock::now();
+                registry.UpdateDevice(state);
+                local_worst = std::max<int64_t>(local_worst, (std::chrono::steady_clock::now() - start).count());
+                ++local;
+            }
+            updates += local;
+            int64_t seen = worst.load();
+            while (seen < local_worst && !worst.compare_exchange_weak(seen, local_worst)) {
+            }
+        });
+    }
+    std::this_thread::sleep_for(duration);
+    running = false;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return {static_cast<double>(updates) / Seconds(duration), std::chrono::nanoseconds(worst.load())};
+}
+
+int main() {
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency() / 2);
+    for (size_t devices : {size_t{1'000'000}, size_t{4'000'000}}) {
+        std::cout << devices << " devices:" << std::endl;
+        {
+            DeviceIdTable ids;
+            DeviceRegistry registry(ids);
+            Fill(registry, ids, devices);
+            RegistrySnapshot snapshot(registry, ids, PATH);
+
+            auto start = std::chrono::steady_clock::now();
+            const size_t saved = snapshot.Save();
+            std::cout << "  save " << saved << " devices: " << Seconds(std::chrono::steady_clock::now() - start) * 1e3
+                      << " ms" << std::endl;
+
+            const auto quiet = Ingest(registry, devices, threads, std::chrono::milliseconds(1000));
+            std::atomic<bool> saving{true};
+            size_t rounds = 0;
+            std::thread saver([&] {
+                while (saving) {
+                    snapshot.Save();
+                    ++rounds;
+                }
+            });
+            const auto busy = Ingest(registry, devices, threads, std::chrono::milliseconds(1000));
+            saving = false;
+            saver.join();
+            std::cout << "  " << threads << " threads updating: " << quiet.updates_per_second / 1e6
+                      << " M updates/s, worst " << quiet.worst.count() / 1000 << " us; during " << rounds
+                      << " saves: " << busy.updates_per_second / 1e6 << " M updates/s, worst "
+                      << busy.worst.count() / 1000 << " us" << std::endl;
+        }
+        {
+            // Как в server.cpp: узлы реестра из пула
+            std::pmr::synchronized_pool_resource pool;
+            DeviceIdTable ids;
+            DeviceRegistry registry(ids, 64, {}, &pool);
+            RegistrySnapshot snapshot(registry, ids, PATH);
+            const auto start = std::chrono::steady_clock::now();
+            const size_t loaded = snapshot.Load();
+            std::cout << "  load " << loaded << " devices: " << Seconds(std::chrono::steady_clock::now() - start) * 1e3
+                      << " ms (registry size " << registry.Size() << ")" << std::endl;
+        }
+        {
+            DeviceIdTable ids;
+            DeviceRegistry registry(ids);
+            const auto start = std::chrono::steady_clock::now();
+            Fill(registry, ids, devices);
+            std::cout << "  cold fill by UpdateDevice, one thread: "
+                      << Seconds(std::chrono::steady_clock::now() - start) * 1e3 << " ms" << std::endl;
+        }
+    }
+    std::remove(PATH);
+    return 0;
+}
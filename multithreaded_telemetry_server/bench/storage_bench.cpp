@@ -0,0 +1,169 @@
+// Хранение показаний: таблица sensor_data в SQLite против столбцовых
+// сжатых чанков. Сравниваются байты на показание, скорость записи и
+// скорость чтения всех показаний каждого устройства за весь интервал.
+// Первый аргумент - каталог для файлов (по умолчанию /tmp).
+
+#include "../src/chunk_storage.h"
+#include "../src/sqlite_storage.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+constexpr size_t DEVICE_COUNT = 32;
+constexpr size_t READINGS_PER_DEVICE = 8192;
+constexpr size_t BATCH_SIZE = 4096;
+
+using Clock = std::chrono::steady_clock;
+
+double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Показания приходят вперемешку от всех устройств раз в секунду с небольшим
+// дрожанием времени приема; значения меняются медленно и округлены, как у датчиков
+std::vector<DeviceState> Generate(DeviceIdTable& ids) {
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> jitter(0, 15);
+    std::uniform_int_distribution<int> step(-1, 1);
+
+    std::vector<DeviceId> devices;
+    std::vector<double> temperature(DEVICE_COUNT, 21.0);
+    std::vector<double> humidity(DEVICE_COUNT, 55.0);
+    std::vector<double> pressure(DEVICE_COUNT, 1013.0);
+    for (size_t d = 0; d < DEVICE_COUNT; ++d) {
+        devices.push_back(ids.Intern("device_" + std::to_string(d)));
+    }
+
+    const auto base = std::chrono::system_clock::time_point(std::chrono::seconds(1'700'000'000));
+    std::vector<DeviceState> readings;
+    readings.reserve(DEVICE_COUNT * READINGS_PER_DEVICE);
+    for (size_t i = 0; i < READINGS_PER_DEVICE; ++i) {
+        for (size_t d = 0; d < DEVICE_COUNT; ++d) {
+            temperature[d] += step(rng) * 0.1;
+            if (i % 10 == 0) {
+                humidity[d] += step(rng);
+                pressure[d] += step(rng) * 0.5;
+            }
+            DeviceState state;
+            state.device_id_ = devices[d];
+            state.temperature_ = std::round(temperature[d] * 10) / 10;
+            state.humidity_ = humidity[d];
+            state.pressure_ = pressure[d];
+            state.last_update_ = base + std::chrono::seconds(i) + std::chrono::milliseconds(jitter(rng));
+            readings.push_back(state);
+        }
+    }
+    return readings;
+}
+
+template <typename S>
+double Write(S& storage, const std::vector<DeviceState>& readings) {
+    const auto start = Clock::now();
+    std::vector<DeviceState> batch;
+    for (size_t i = 0; i < readings.size(); i += BATCH_SIZE) {
+        batch.assign(readings.begin() + i, readings.begin() + std::min(readings.size(), i + BATCH_SIZE));
+        storage.WriteBatch(batch);
+    }
+    return readings.size() / Seconds(start);
+}
+
+int main(int argc, char *argv[]) {
+    const std::filesystem::path dir = argc > 1 ? argv[1] : "/tmp";
+    const std::string db_path = (dir / "storage_bench.db").string();
+    const std::string chunk_dir = (dir / "storage_bench_chunks").string();
+    std::filesystem::remove(db_path);
+    std::filesystem::remove(db_path + "-wal");
+    std::filesystem::remove(db_path + "-shm");
+    std::filesystem::remove_all(chunk_dir);
+
+    DeviceIdTable ids;
+    const std::vector<DeviceState> readings = Generate(ids);
+    const auto from = std::chrono::system_clock::time_point::min();
+    const auto to = std::chrono::system_clock::time_point::max();
+    std::cout << "Readings: " << readings.size() << " (" << DEVICE_COUNT << " devices)" << std::endl;
+
+    // ---------------- SQLite ----------------
+    double sqlite_write;
+    {
+        SqliteStorage storage(ids, db_path, "OFF", 16 * 1024);
+        sqlite_write = Write(storage, readings);
+    }
+    const double sqlite_bytes = static_cast<double>(std::filesystem::file_size(db_path));
+
+    sqlite3 *db;
+    sqlite3_open(db_path.c_str(), &db);
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, "SELECT TIMESTAMP, TEMPERATURE, HUMIDITY, PRESSURE FROM sensor_data "
+                           "WHERE DEVICE_ID = ? AND TIMESTAMP BETWEEN ? AND ?;", -1, &stmt, nullptr);
+    size_t sqlite_rows = 0;
+    double sqlite_sum = 0;
+    auto start = Clock::now();
+    for (size_t d = 0; d < DEVICE_COUNT; ++d) {
+        const std::string name = "device_" + std::to_string(d);
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, 0);
+        sqlite3_bind_int64(stmt, 3, INT64_MAX);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            sqlite_sum += sqlite3_column_double(stmt, 1);
+            ++sqlite_rows;
+        }
+        sqlite3_reset(stmt);
+    }
+    const double sqlite_scan = sqlite_rows / Seconds(start);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    // ---------------- Чанки ----------------
+    double chunk_write;
+    {
+        ChunkStorage storage(ids, chunk_dir);
+        chunk_write = Write(storage, readings);
+    }
+
+    // Читаем после повторного открытия: индекс восстанавливается из сегментов
+    ChunkStorage storage(ids, chunk_dir);
+    const double chunk_bytes = static_cast<double>(storage.SealedBytes());
+    size_t chunk_rows = 0;
+    double chunk_sum = 0;
+    start = Clock::now();
+    for (size_t d = 0; d < DEVICE_COUNT; ++d) {
+        storage.Scan(*ids.Find("device_" + std::to_string(d)), from, to, [&](const DeviceState& state) {
+            chunk_sum += state.temperature_;
+            ++chunk_rows;
+        });
+    }
+    const double chunk_scan = chunk_rows / Seconds(start);
+
+    // Чанки хранят метки с точностью до миллисекунды и значения без потерь
+    size_t mismatches = 0;
+    size_t index = 0;
+    const DeviceId first = readings.front().device_id_;
+    storage.Scan(first, from, to, [&](const DeviceState& state) {
+        const DeviceState& expected = readings[index * DEVICE_COUNT];
+        if (state.last_update_ != expected.last_update_ || state.temperature_ != expected.temperature_ ||
+            state.humidity_ != expected.humidity_ || state.pressure_ != expected.pressure_) {
+            ++mismatches;
+        }
+        ++index;
+    });
+    if (mismatches != 0 || index != READINGS_PER_DEVICE || chunk_rows != readings.size()) {
+        throw std::runtime_error("chunk storage returned different readings");
+    }
+
+    std::cout << "sqlite: " << sqlite_bytes / readings.size() << " bytes/reading, write "
+              << sqlite_write / 1e6 << " M/s, scan " << sqlite_scan / 1e6 << " M/s (" << sqlite_rows << " rows, sum "
+              << sqlite_sum << ")" << std::endl;
+    std::cout << "chunks: " << chunk_bytes / readings.size() << " bytes/reading, write "
+              << chunk_write / 1e6 << " M/s, scan " << chunk_scan / 1e6 << " M/s (" << chunk_rows << " rows, sum "
+              << chunk_sum << ")" << std::endl;
+
+    return 0;
+}
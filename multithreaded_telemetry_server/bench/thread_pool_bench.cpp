@@ -0,0 +1,169 @@
+// Прежний ThreadPool (одна очередь packaged_task под мьютексом) против
+// пула с кражей работы: пропускная способность при внешней постановке,
+// при порождении задач изнутри пула и задержка от enqueue до запуска.
+
+#include "../src/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <queue>
+#include <vector>
+
+// ======================= ПРЕЖНИЙ ПУЛ =======================
+
+class LegacyThreadPool {
+public:
+    LegacyThreadPool(size_t num_threads = std::thread::hardware_concurrency())
+    {
+        for (size_t i = 0; i < num_threads; ++i) {
+            threads_.emplace_back([this] {
+                while (true) {
+                    std::packaged_task<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex_);
+                        cv_.wait(lock, [this] {
+                            return !tasks_.empty() || stop_;
+                        });
+
+                        if (stop_ && tasks_.empty()) {
+                            return;
+                        }
+
+                        task = std::move(tasks_.front());
+                        tasks_.pop();
+                    }
+
+                    task();
+                }
+            });
+        }
+    }
+
+    ~LegacyThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            stop_ = true;
+        }
+
+        cv_.notify_all();
+
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    template <typename F>
+    void enqueue(F&& f) {
+        std::packaged_task<void()> task(std::forward<F>(f));
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            tasks_.emplace(move(task));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    std::vector<std::thread> threads_;
+    std::queue<std::packaged_task<void()>> tasks_;
+    std::mutex queue_mutex_;
+    std::condition_variable cv_;
+
+    bool stop_ = false;
+};
+
+// ======================= ЗАМЕРЫ =======================
+
+constexpr size_t TASK_COUNT = 1'000'000;
+constexpr size_t LATENCY_SAMPLES = 20'000;
+constexpr size_t THREADS = 4;
+
+using Clock = std::chrono::steady_clock;
+
+double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void WaitFor(const std::atomic<size_t>& counter, size_t value) {
+    while (counter.load(std::memory_order_acquire) < value) {
+        std::this_thread::yield();
+    }
+}
+
+// Внешний поток ставит TASK_COUNT пустых задач
+template <typename Pool>
+double ExternalThroughput() {
+    Pool pool(THREADS);
+    std::atomic<size_t> done{0};
+    const auto start = Clock::now();
+    for (size_t i = 0; i < TASK_COUNT; ++i) {
+        pool.enqueue([&done] { done.fetch_add(1, std::memory_order_release); });
+    }
+    WaitFor(done, TASK_COUNT);
+    return TASK_COUNT / Seconds(start) / 1e6;
+}
+
+// Задачи порождают задачи внутри пула (двоичное дерево)
+template <typename Pool>
+void Spawn(Pool& pool, std::atomic<size_t>& done, size_t depth) {
+    done.fetch_add(1, std::memory_order_release);
+    if (depth == 0) {
+        return;
+    }
+    pool.enqueue([&pool, &done, depth] { Spawn(pool, done, depth - 1); });
+    pool.enqueue([&pool, &done, depth] { Spawn(pool, done, depth - 1); });
+}
+
+template <typename Pool>
+double NestedThroughput() {
+    constexpr size_t depth = 19;                // 2^20 - 1 задач
+    constexpr size_t total = (size_t{1} << (depth + 1)) - 1;
+    Pool pool(THREADS);
+    std::atomic<size_t> done{0};
+    const auto start = Clock::now();
+    pool.enqueue([&pool, &done] { Spawn(pool, done, depth); });
+    WaitFor(done, total);
+    return total / Seconds(start) / 1e6;
+}
+
+// Задержка от enqueue до начала выполнения при простаивающем пуле
+template <typename Pool>
+std::pair<double, double> Latency() {
+    Pool pool(THREADS);
+    std::vector<double> samples;
+    samples.reserve(LATENCY_SAMPLES);
+    std::atomic<size_t> done{0};
+    std::atomic<int64_t> started_ns{0};
+
+    for (size_t i = 0; i < LATENCY_SAMPLES; ++i) {
+        const auto enqueued = Clock::now();
+        pool.enqueue([&] {
+            started_ns.store((Clock::now() - enqueued).count(), std::memory_order_relaxed);
+            done.fetch_add(1, std::memory_order_release);
+        });
+        WaitFor(done, i + 1);
+        samples.push_back(std::chrono::duration<double, std::micro>(
+            std::chrono::nanoseconds(started_ns.load(std::memory_order_relaxed))).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2], samples[samples.size() * 99 / 100]};
+}
+
+template <typename Pool>
+void Report(const char *name) {
+    const double external = ExternalThroughput<Pool>();
+    const double nested = NestedThroughput<Pool>();
+    const auto [p50, p99] = Latency<Pool>();
+    std::cout << name << ": external " << external << " Mtasks/s, nested " << nested
+              << " Mtasks/s, enqueue->run p50 " << p50 << " us, p99 " << p99 << " us" << std::endl;
+}
+
+int main() {
+    std::cout << "Threads: " << THREADS << std::endl;
+    Report<LegacyThreadPool>("legacy       ");
+    Report<ThreadPool>("work-stealing");
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Стадия проверки показаний: построчная проверка без синхронизации (нижняя
+// граница: по показанию, ветвления, статистика в массиве структур) и
+// ReadingValidator пакетами по 1 и по 64 показания. Разница между ними -
+// цена seqlock на статистику устройства, выигрыш пакетов - проверки по
+// столбцам. Затем ReadingValidator из нескольких потоков, как из циклов
+// событий. Около 1% показаний - выбросы, результаты всех вариантов совпадают.
+// Перед замером - проверка показаний с частью полей: из одного temp и из
+// одних дополнительных метрик (маска полей 0).
+
+#include "../src/validation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// ======================= ПОСТРОЧНАЯ ПРОВЕРКА =======================
+
+class ScalarValidator {
+public:
+    explicit ScalarValidator(ValidationOptions options) : options_(options), stats_(DEVICE_LIMIT) {}
+
+    uint8_t Check(const DeviceState& state) {
+        Stats& stats = stats_[state.device_id_];
+        const double values[3] = {state.temperature_, state.humidity_, state.pressure_};
+        const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            state.last_update_.time_since_epoch()).count();
+        const double interval = std::max(1.0, static_cast<double>(now_ms - stats.last_ms) / 1000.0);
+
+        uint8_t issues = 0;
+        for (size_t f = 0; f < 3; ++f) {
+            const FieldLimits& limits = options_.fields_[f];
+            if (!(values[f] >= limits.min_ && values[f] <= limits.max_)) {
+                issues |= ISSUE_OUT_OF_RANGE;
+                continue;
+            }
+            if (stats.count > 0 && std::abs(values[f] - stats.last[f]) > limits.max_rate_ * interval) {
+                issues |= ISSUE_RATE;
+            }
+            if (stats.count >= options_.warmup_) {
+                const double z = std::abs(values[f] - stats.mean[f]) / std::sqrt(std::max(stats.variance[f], 1e-4));
+                if (z > options_.z_threshold_) {
+                    issues |= ISSUE_ANOMALY;
+                }
+            }
+        }
+        if (issues & REJECTING_ISSUES) {
+            return issues;
+        }
+
+        const double alpha = options_.ewma_alpha_;
+        for (size_t f = 0; f < 3; ++f) {
+            if (stats.count == 0) {
+                stats.mean[f] = values[f];
+                stats.variance[f] = 0.0;
+            } else {
+                const double diff = values[f] - stats.mean[f];
+                stats.mean[f] += alpha * diff;
+                stats.variance[f] = (1.0 - alpha) * (stats.variance[f] + alpha * diff * diff);
+            }
+            stats.last[f] = values[f];
+        }
+        stats.last_ms = now_ms;
+        ++stats.count;
+        return issues;
+    }
+
+    static constexpr size_t DEVICE_LIMIT = 1 << 16;
+
+private:
+    struct Stats {
+        double last[3] = {};
+        double mean[3] = {};
+        double variance[3] = {};
+        int64_t last_ms = 0;
+        uint32_t count = 0;
+    };
+
+    ValidationOptions options_;
+    std::vector<Stats> stats_;
+};
+
+// ======================= ЗАМЕР =======================
+
+constexpr size_t DEVICES = 10'000;
+constexpr size_t READINGS = 4'000'000;
+constexpr size_t READ_BATCH = 64;       // Показаний за одно чтение из сокета
+
+std::vector<DeviceState> MakeReadings(size_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, 0.2);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const auto start = std::chrono::system_clock::now();
+
+    std::vector<DeviceState> readings(count);
+    for (size_t i = 0; i < count; ++i) {
+        DeviceState& state = readings[i];
+        state.device_id_ = static_cast<DeviceId>(1 + i % DEVICES);
+        state.temperature_ = 21.0 + noise(rng);
+        state.humidity_ = 45.0 + noise(rng);
+        state.pressure_ = 1013.0 + noise(rng);
+        state.last_update_ = start + std::chrono::seconds(i / DEVICES);
+        const double roll = uniform(rng);
+        if (roll < 0.005) {
+            state.temperature_ = 500.0;         // Вне диапазона
+        } else if (roll < 0.01) {
+            state.humidity_ += 8.0;             // Выброс
+        }
+    }
+    return readings;
+}
+
+// Показания с частью полей не отклоняются за нули в непереданных полях
+// и не портят статистику присланных
+bool CheckPartialReadings(const ValidationOptions& options) {
+    ReadingValidator validator(options);
+    const auto start = std::chrono::system_clock::now();
+    std::vector<DeviceState> batch;
+    std::vector<uint8_t> fields;
+    std::vector<uint8_t> issues;
+    bool ok = true;
+    auto expect = [&](const char *name, uint8_t mask, double temperature, double humidity, double pressure,
+                      int seconds, uint8_t expected) {
+        DeviceState state;
+        state.device_id_ = 1;
+        state.temperature_ = temperature;
+        state.humidity_ = humidity;
+        state.pressure_ = pressure;
+        state.last_update_ = start + std::chrono::seconds(seconds);
+        batch.assign(1, state);
+        fields.assign(1, mask);
+        validator.Check(batch, fields, issues);
+        if (issues[0] != expected) {
+            std::cout << "partial readings: " << name << " -> issues " << int(issues[0])
+                      << ", expected " << int(expected) << std::endl;
+            ok = false;
+        }
+    };
+    expect("temp only", FIELD_TEMPERATURE, 20.0, 0.0, 0.0, 0, 0);
+    expect("extras only", 0, 0.0, 0.0, 0.0, 1, 0);
+    expect("hum only after temp", FIELD_HUMIDITY, 0.0, 45.0, 0.0, 2, 0);
+    // Скорость temp считается от его последнего значения (t=0), а не от показания без temp
+    expect("temp after gap", FIELD_TEMPERATURE, 45.0, 0.0, 0.0, 3, 0);
+    expect("temp too fast", FIELD_TEMPERATURE, 70.0, 0.0, 0.0, 4, ISSUE_RATE);
+    expect("press out of range", FIELD_PRESSURE, 0.0, 0.0, 5.0, 5, ISSUE_OUT_OF_RANGE);
+    expect("all fields", ALL_FIELDS, 70.0, 46.0, 1010.0, 6, 0);
+    return ok;
+}
+
+void Report(const char *name, size_t readings, std::chrono::steady_clock::duration elapsed, size_t flagged) {
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << name << ": " << seconds * 1e9 / readings << " ns/reading, "
+              << readings / seconds / 1e6 << " M readings/s (" << flagged << " rejected or flagged)" << std::endl;
+}
+
+int main() {
+    const std::vector<DeviceState> readings = MakeReadings(READINGS, 1);
+    ValidationOptions options;
+    options.side_channel_capacity_ = 1 << 20;
+    if (!CheckPartialReadings(options)) {
+        return 1;
+    }
+
+    {
+        ScalarValidator validator(options);
+        size_t flagged = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& state : readings) {
+            flagged += validator.Check(state) != 0;
+        }
+        Report("per reading, no sync     ", readings.size(), std::chrono::steady_clock::now() - start, flagged);
+    }
+
+    for (size_t batch_size : {size_t{1}, READ_BATCH}) {
+        ReadingValidator validator(options);
+        std::vector<DeviceState> batch;
+        std::vector<uint8_t> fields;
+        std::vector<uint8_t> issues;
+        size_t flagged = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < readings.size(); i += batch_size) {
+            batch.assign(readings.begin() + i, readings.begin() + std::min(readings.size(), i + batch_size));
+            fields.assign(batch.size(), ALL_FIELDS);
+            validator.Check(batch, fields, issues);
+            flagged += std::count_if(issues.begin(), issues.end(), [](uint8_t issue) { return issue != 0; });
+        }
+        Report(batch_size == 1 ? "ReadingValidator, batch 1 " : "ReadingValidator, batch 64",
+               readings.size(), std::chrono::steady_clock::now() - start, flagged);
+    }
+
+    // Каждый поток - свой набор устройств, как соединения разных циклов
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    ReadingValidator validator(options);
+    std::vector<std::vector<DeviceState>> inputs;
+    for (size_t t = 0; t < threads; ++t) {
+        inputs.push_back(MakeReadings(READINGS / threads, static_cast<uint32_t>(t + 2)));
+        for (auto& state : inputs.back()) {
+            state.device_id_ += static_cast<DeviceId>(t * DEVICES);
+        }
+    }
+    std::atomic<size_t> flagged{0};
+    std::atomic<bool> draining{true};
+    std::thread drainer([&] {
+        std::vector<FlaggedReading> out;
+        while (draining.load(std::memory_order_relaxed)) {
+            out.clear();
+            validator.DrainFlagged(out, 1024);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::vector<DeviceState> batch;
+            std::vector<uint8_t> fields;
+            std::vector<uint8_t> issues;
+            size_t local = 0;
+            const auto& input = inputs[t];
+            for (size_t i = 0; i < input.size(); i += READ_BATCH) {
+                batch.assign(input.begin() + i, input.begin() + std::min(input.size(), i + READ_BATCH));
+                fields.assign(batch.size(), ALL_FIELDS);
+                validator.Check(batch, fields, issues);
+                local += std::count_if(issues.begin(), issues.end(), [](uint8_t issue) { return issue != 0; });
+            }
+            flagged += local;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    draining = false;
+    drainer.join();
+    std::cout << threads << " threads:" << std::endl;
+    Report("ReadingValidator, batch 64", READINGS / threads * threads, elapsed, flagged);
+    return 0;
+}
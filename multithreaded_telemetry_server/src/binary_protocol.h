@@ -0,0 +1,259 @@
+#pragma once
+
+#include "device.h"
+#include "protocol.h"
+#include "ring_buffer.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Двоичный протокол устройства. Соединение, первый байт которого равен
+// MAGIC_0, целиком работает в двоичном виде; иначе - в текстовом (protocol.h).
+//
+// Кадр: заголовок из HEADER_SIZE байт и полезная нагрузка. Все числа
+// big-endian, как в tracker_bin_file.
+//   0  magic     2 байта: 0xA5 0x7E
+//   2  version   1 байт
+//   3  type      1 байт, FrameType
+//   4  length    uint16, длина нагрузки
+//
+// BIND связывает номер устройства внутри соединения с его именем:
+//   0  local_id  uint16
+//   2  name      length - 2 байт
+// DATA - показание с фиксированными смещениями полей:
+//   0  local_id     uint16
+//   2  timestamp    int64, мс от начала эпохи; 0 - время приема сервером
+//   10 temperature  int32, сотые доли
+//   14 humidity     int32, сотые доли
+//   18 pressure     int32, сотые доли
+//                INT32_MIN в любом из значений - поле не передано
+//   22 seq          uint32, необязательно: номер показания у устройства для
+//                   отсева повторов; кадр без него короче на 4 байта
+//
+// Подтверждения те же, что у текстового протокола: "Ok <n>\n" / "Err <n>\n",
+// по одному результату на каждый кадр, включая BIND.
+namespace protocol {
+
+enum class Format {
+    kUnknown,       // Еще не пришло ни одного байта
+    kText,
+    kBinary
+};
+
+namespace binary {
+
+constexpr uint8_t MAGIC_0 = 0xA5;
+constexpr uint8_t MAGIC_1 = 0x7E;
+constexpr uint8_t VERSION = 1;
+constexpr size_t HEADER_SIZE = 6;
+constexpr size_t MAX_BINDINGS = 4096;          // Ограничивает память соединения
+constexpr size_t MAX_NAME_SIZE = 255;
+constexpr double VALUE_SCALE = 100.0;
+constexpr int32_t ABSENT_VALUE = std::numeric_limits<int32_t>::min();
+
+enum class FrameType : uint8_t {
+    kBind = 1,
+    kData = 2
+};
+
+namespace bind {
+constexpr size_t LOCAL_ID = 0;
+constexpr size_t NAME = 2;
+} // namespace bind
+
+namespace data {
+constexpr size_t LOCAL_ID = 0;
+constexpr size_t TIMESTAMP = 2;
+constexpr size_t TEMPERATURE = 10;
+constexpr size_t HUMIDITY = 14;
+constexpr size_t PRESSURE = 18;
+constexpr size_t SEQ = 22;
+constexpr size_t SIZE = 22;
+constexpr size_t SIZE_WITH_SEQ = 26;
+} // namespace data
+
+// ======================= BIG-ENDIAN =======================
+
+inline uint16_t LoadU16(const char *p) {
+    const auto *b = reinterpret_cast<const unsigned char *>(p);
+    return static_cast<uint16_t>((b[0] << 8) | b[1]);
+}
+
+inline uint32_t LoadU32(const char *p) {
+    const auto *b = reinterpret_cast<const unsigned char *>(p);
+    return (static_cast<uint32_t>(b[0]) << 24) | (static_cast<uint32_t>(b[1]) << 16) |
+           (static_cast<uint32_t>(b[2]) << 8) | b[3];
+}
+
+inline uint64_t LoadU64(const char *p) {
+    return (static_cast<uint64_t>(LoadU32(p)) << 32) | LoadU32(p + 4);
+}
+
+inline void AppendU16(std::string& out, uint16_t value) {
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+inline void AppendU32(std::string& out, uint32_t value) {
+    AppendU16(out, static_cast<uint16_t>(value >> 16));
+    AppendU16(out, static_cast<uint16_t>(value));
+}
+
+inline void AppendU64(std::string& out, uint64_t value) {
+    AppendU32(out, static_cast<uint32_t>(value >> 32));
+    AppendU32(out, static_cast<uint32_t>(value));
+}
+
+// ======================= РАЗБОР =======================
+
+inline Format DetectFormat(const RingBuffer& buffer) {
+    if (buffer.Empty()) {
+        return Format::kUnknown;
+    }
+    return static_cast<uint8_t>(buffer.At(0)) == MAGIC_0 ? Format::kBinary : Format::kText;
+}
+
+// Выделяет очередной двоичный кадр; type - байт типа из заголовка
+inline FrameStatus NextFrame(const RingBuffer& buffer, std::vector<char>& scratch, Frame& frame, uint8_t& type) {
+    if (buffer.Size() < HEADER_SIZE) {
+        return FrameStatus::kIncomplete;
+    }
+    char header[HEADER_SIZE];
+    buffer.CopyOut(0, HEADER_SIZE, header);
+    if (static_cast<uint8_t>(header[0]) != MAGIC_0 || static_cast<uint8_t>(header[1]) != MAGIC_1 ||
+        static_cast<uint8_t>(header[2]) != VERSION) {
+        return FrameStatus::kError;
+    }
+    const size_t length = LoadU16(header + 4);
+    if (length > MAX_FRAME_SIZE) {
+        return FrameStatus::kError;
+    }
+    if (buffer.Size() < HEADER_SIZE + length) {
+        return FrameStatus::kIncomplete;
+    }
+    type = static_cast<uint8_t>(header[3]);
+    frame.payload = buffer.View(HEADER_SIZE, length, scratch);
+    frame.size = HEADER_SIZE + length;
+    return FrameStatus::kFrame;
+}
+
+// Номера устройств, назначенные в BIND одного соединения
+class Bindings {
+public:
+    bool Bind(uint16_t local_id, DeviceId id) {
+        if (local_id >= MAX_BINDINGS) {
+            return false;
+        }
+        if (local_id >= ids_.size()) {
+            ids_.resize(local_id + 1, INVALID_DEVICE_ID);
+        }
+        ids_[local_id] = id;
+        return true;
+    }
+
+    DeviceId Get(uint16_t local_id) const {
+        return local_id < ids_.size() ? ids_[local_id] : INVALID_DEVICE_ID;
+    }
+
+private:
+    std::vector<DeviceId> ids_;
+};
+
+inline bool DecodeBind(std::string_view payload, Bindings& bindings, DeviceIdTable& ids) {
+    if (payload.size() <= bind::NAME || payload.size() > bind::NAME + MAX_NAME_SIZE) {
+        return false;
+    }
+    return bindings.Bind(LoadU16(payload.data() + bind::LOCAL_ID), ids.Intern(payload.substr(bind::NAME)));
+}
+
+// Показание по фиксированным смещениям: без поиска разделителей и разбора чисел
+inline bool DecodeData(std::string_view payload, const Bindings& bindings, DeviceState& state, uint8_t& fields) {
+    if (payload.size() != data::SIZE && payload.size() != data::SIZE_WITH_SEQ) {
+        return false;
+    }
+    const char *p = payload.data();
+    const DeviceId id = bindings.Get(LoadU16(p + data::LOCAL_ID));
+    const auto timestamp_ms = static_cast<int64_t>(LoadU64(p + data::TIMESTAMP));
+    if (id == INVALID_DEVICE_ID || timestamp_ms < 0 || timestamp_ms > MAX_DEVICE_TIMESTAMP_MS) {
+        return false;
+    }
+
+    fields = 0;
+    double values[3];
+    const size_t offsets[3] = {data::TEMPERATURE, data::HUMIDITY, data::PRESSURE};
+    for (size_t i = 0; i < 3; ++i) {
+        const auto value = static_cast<int32_t>(LoadU32(p + offsets[i]));
+        values[i] = value == ABSENT_VALUE ? 0.0 : value / VALUE_SCALE;
+        fields |= value == ABSENT_VALUE ? 0 : static_cast<uint8_t>(1 << i);
+    }
+    state.device_id_ = id;
+    state.temperature_ = values[0];
+    state.humidity_ = values[1];
+    state.pressure_ = values[2];
+    state.seq_ = payload.size() == data::SIZE_WITH_SEQ ? LoadU32(p + data::SEQ) : 0;
+    state.last_update_ = timestamp_ms == 0
+        ? std::chrono::system_clock::now()
+        : std::chrono::system_clock::time_point(std::chrono::milliseconds(timestamp_ms));
+    return true;
+}
+
+// ======================= ЗАПИСЬ (клиент) =======================
+
+inline void AppendHeader(std::string& out, FrameType type, uint16_t length) {
+    out += static_cast<char>(MAGIC_0);
+    out += static_cast<char>(MAGIC_1);
+    out += static_cast<char>(VERSION);
+    out += static_cast<char>(type);
+    AppendU16(out, length);
+}
+
+inline bool AppendBind(std::string& out, uint16_t local_id, std::string_view name) {
+    if (name.empty() || name.size() > MAX_NAME_SIZE || local_id >= MAX_BINDINGS) {
+        return false;
+    }
+    AppendHeader(out, FrameType::kBind, static_cast<uint16_t>(bind::NAME + name.size()));
+    AppendU16(out, local_id);
+    out += name;
+    return true;
+}
+
+// Значения округляются до сотых; false, если значение не помещается в int32.
+// NaN - поле не передается, нулевой seq тоже.
+inline bool AppendData(std::string& out, uint16_t local_id, int64_t timestamp_ms,
+                       double temperature, double humidity, double pressure, uint32_t seq = 0) {
+    int32_t scaled[3];
+    const double values[3] = {temperature, humidity, pressure};
+    for (size_t i = 0; i < 3; ++i) {
+        if (std::isnan(values[i])) {
+            scaled[i] = ABSENT_VALUE;
+            continue;
+        }
+        const double value = std::round(values[i] * VALUE_SCALE);
+        if (!(value > ABSENT_VALUE && value <= std::numeric_limits<int32_t>::max())) {
+            return false;
+        }
+        scaled[i] = static_cast<int32_t>(value);
+    }
+    if (timestamp_ms < 0 || timestamp_ms > MAX_DEVICE_TIMESTAMP_MS) {
+        return false;
+    }
+
+    AppendHeader(out, FrameType::kData, seq != 0 ? data::SIZE_WITH_SEQ : data::SIZE);
+    AppendU16(out, local_id);
+    AppendU64(out, static_cast<uint64_t>(timestamp_ms));
+    for (int32_t value : scaled) {
+        AppendU32(out, static_cast<uint32_t>(value));
+    }
+    if (seq != 0) {
+        AppendU32(out, seq);
+    }
+    return true;
+}
+
+} // namespace binary
+} // namespace protocol
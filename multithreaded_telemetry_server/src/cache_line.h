@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// Размер строки кэша на x86-64 и большинстве ARM64. Данные, которые пишут
+// разные потоки, выравниваются по нему, чтобы не было ложного разделения.
+constexpr size_t CACHE_LINE_SIZE = 64;
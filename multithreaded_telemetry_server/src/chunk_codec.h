@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Сжатие временных рядов по схеме Gorilla (Pelkonen et al., VLDB 2015):
+// метки времени кодируются разностью второго порядка, значения double -
+// XOR с предыдущим значением. При постоянном периоде опроса и медленно
+// меняющихся значениях большинство точек занимает 1-2 бита на столбец.
+
+// Поток битов в 64-битных словах, старший бит первым
+class BitWriter {
+public:
+    // Пишет bits младших бит value
+    void Write(uint64_t value, unsigned bits) {
+        if (bits == 0) {
+            return;
+        }
+        if (bits < 64) {
+            value &= (uint64_t{1} << bits) - 1;
+        }
+        const unsigned used = bit_size_ % 64;
+        if (used == 0) {
+            words_.push_back(0);
+        }
+        const unsigned free = 64 - used;
+        if (bits <= free) {
+            words_.back() |= value << (free - bits);
+        } else {
+            words_.back() |= value >> (bits - free);
+            words_.push_back(value << (64 - (bits - free)));
+        }
+        bit_size_ += bits;
+    }
+
+    const uint64_t *Data() const { return words_.data(); }
+    size_t WordCount() const { return words_.size(); }
+    size_t BitSize() const { return bit_size_; }
+
+    // Для следующего чанка: память слов остается
+    void Clear() {
+        words_.clear();
+        bit_size_ = 0;
+    }
+
+private:
+    std::vector<uint64_t> words_;
+    size_t bit_size_ = 0;
+};
+
+class BitReader {
+public:
+    explicit BitReader(const uint64_t *words) : words_(words) {}
+
+    uint64_t Read(unsigned bits) {
+        if (bits == 0) {
+            return 0;
+        }
+        const size_t word = pos_ / 64;
+        const unsigned offset = pos_ % 64;
+        const unsigned avail = 64 - offset;
+        const uint64_t high = words_[word] << offset;
+        uint64_t result = high >> (64 - bits);
+        if (bits > avail) {
+            result |= words_[word + 1] >> (64 - (bits - avail));
+        }
+        pos_ += bits;
+        return result;
+    }
+
+    bool ReadBit() { return Read(1) != 0; }
+
+private:
+    const uint64_t *words_;
+    size_t pos_ = 0;
+};
+
+namespace codec {
+
+inline int64_t SignExtend(uint64_t value, unsigned bits) {
+    const unsigned shift = 64 - bits;
+    return static_cast<int64_t>(value << shift) >> shift;
+}
+
+// Произвольные метки (например, после сбоя часов) не должны давать переполнения
+inline int64_t WrappingSub(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b));
+}
+
+inline int64_t WrappingAdd(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+inline bool FitsSigned(int64_t value, unsigned bits) {
+    const int64_t limit = int64_t{1} << (bits - 1);
+    return value >= -limit && value < limit;
+}
+
+} // namespace codec
+
+// Метки времени: первая целиком, дальше разность второго порядка
+// '0' | '10'+7 бит | '110'+9 | '1110'+12 | '1111'+64
+class TimestampEncoder {
+public:
+    void Append(int64_t time, BitWriter& out) {
+        if (first_) {
+            out.Write(static_cast<uint64_t>(time), 64);
+            first_ = false;
+        } else {
+            const int64_t delta = codec::WrappingSub(time, prev_);
+            const int64_t dod = codec::WrappingSub(delta, prev_delta_);
+            if (dod == 0) {
+                out.Write(0b0, 1);
+            } else if (codec::FitsSigned(dod, 7)) {
+                out.Write(0b10, 2);
+                out.Write(static_cast<uint64_t>(dod), 7);
+            } else if (codec::FitsSigned(dod, 9)) {
+                out.Write(0b110, 3);
+                out.Write(static_cast<uint64_t>(dod), 9);
+            } else if (codec::FitsSigned(dod, 12)) {
+                out.Write(0b1110, 4);
+                out.Write(static_cast<uint64_t>(dod), 12);
+            } else {
+                out.Write(0b1111, 4);
+                out.Write(static_cast<uint64_t>(dod), 64);
+            }
+            prev_delta_ = delta;
+        }
+        prev_ = time;
+    }
+
+private:
+    bool first_ = true;
+    int64_t prev_ = 0;
+    int64_t prev_delta_ = 0;
+};
+
+class TimestampDecoder {
+public:
+    int64_t Next(BitReader& in) {
+        if (first_) {
+            first_ = false;
+            prev_ = static_cast<int64_t>(in.Read(64));
+            return prev_;
+        }
+        int64_t dod = 0;
+        if (in.ReadBit()) {
+            if (!in.ReadBit()) {
+                dod = codec::SignExtend(in.Read(7), 7);
+            } else if (!in.ReadBit()) {
+                dod = codec::SignExtend(in.Read(9), 9);
+            } else if (!in.ReadBit()) {
+                dod = codec::SignExtend(in.Read(12), 12);
+            } else {
+                dod = static_cast<int64_t>(in.Read(64));
+            }
+        }
+        prev_delta_ = codec::WrappingAdd(prev_delta_, dod);
+        prev_ = codec::WrappingAdd(prev_, prev_delta_);
+        return prev_;
+    }
+
+private:
+    bool first_ = true;
+    int64_t prev_ = 0;
+    int64_t prev_delta_ = 0;
+};
+
+// Значения: XOR с предыдущим. '0' - значение не изменилось,
+// '10' + значащие биты в прежнем окне, '11' + 5 бит ведущих нулей +
+// 6 бит длины (64 кодируется нулем) + значащие биты
+class XorEncoder {
+public:
+    void Append(double value, BitWriter& out) {
+        const uint64_t bits = std::bit_cast<uint64_t>(value);
+        if (first_) {
+            out.Write(bits, 64);
+            first_ = false;
+            prev_ = bits;
+            return;
+        }
+
+        const uint64_t x = bits ^ prev_;
+        prev_ = bits;
+        if (x == 0) {
+            out.Write(0b0, 1);
+            return;
+        }
+
+        const unsigned leading = std::min(std::countl_zero(x), 31);
+        const unsigned trailing = std::countr_zero(x);
+        if (leading >= prev_leading_ && trailing >= prev_trailing_) {
+            out.Write(0b10, 2);
+            out.Write(x >> prev_trailing_, 64 - prev_leading_ - prev_trailing_);
+            return;
+        }
+
+        const unsigned meaningful = 64 - leading - trailing;
+        out.Write(0b11, 2);
+        out.Write(leading, 5);
+        out.Write(meaningful == 64 ? 0 : meaningful, 6);
+        out.Write(x >> trailing, meaningful);
+        prev_leading_ = leading;
+        prev_trailing_ = trailing;
+    }
+
+private:
+    bool first_ = true;
+    uint64_t prev_ = 0;
+    unsigned prev_leading_ = 64;    // Окна еще нет: первое изменение всегда пишет '11'
+    unsigned prev_trailing_ = 0;
+};
+
+class XorDecoder {
+public:
+    double Next(BitReader& in) {
+        if (first_) {
+            first_ = false;
+            prev_ = in.Read(64);
+        } else if (in.ReadBit()) {
+            if (in.ReadBit()) {
+                leading_ = static_cast<unsigned>(in.Read(5));
+                unsigned meaningful = static_cast<unsigned>(in.Read(6));
+                if (meaningful == 0) {
+                    meaningful = 64;
+                }
+                trailing_ = 64 - leading_ - meaningful;
+            }
+            prev_ ^= in.Read(64 - leading_ - trailing_) << trailing_;
+        }
+        return std::bit_cast<double>(prev_);
+    }
+
+private:
+    bool first_ = true;
+    uint64_t prev_ = 0;
+    unsigned leading_ = 0;
+    unsigned trailing_ = 0;
+};
@@ -0,0 +1,456 @@
+#include "chunk_storage.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+size_t Align8(size_t size) {
+    return (size + 7) & ~size_t{7};
+}
+
+std::string SegmentName(uint32_t number) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment_%06u.dat", number);
+    return name;
+}
+
+// Номер сегмента из имени файла; -1, если файл не сегмент
+int64_t SegmentNumber(const std::string& name) {
+    unsigned number;
+    char tail;
+    if (std::sscanf(name.c_str(), "segment_%u.da%c", &number, &tail) == 2 && tail == 't' && name.size() == 18) {
+        return number;
+    }
+    return -1;
+}
+
+// Версия 1 не хранила агрегаты в заголовке, версия 2 - контрольную сумму
+size_t HeaderSize(uint16_t version) {
+    switch (version) {
+    case 1: return offsetof(ChunkHeader, stats_);
+    case 2: return offsetof(ChunkHeader, checksum_);
+    default: return sizeof(ChunkHeader);
+    }
+}
+
+// FNV-1a, как у записей журнала: заголовок между magic_ и checksum_, затем
+// имя и столбцы. magic_ пишется последним и в сумму не входит.
+uint32_t Checksum(const char *chunk, size_t total_size) {
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const char *data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 16777619u;
+        }
+    };
+    mix(chunk + sizeof(uint32_t), offsetof(ChunkHeader, checksum_) - sizeof(uint32_t));
+    mix(chunk + sizeof(ChunkHeader), total_size - sizeof(ChunkHeader));
+    return hash;
+}
+
+// Представление чанка, лежащего по адресу data
+ChunkView ViewAt(const char *data, DeviceId id) {
+    ChunkHeader header {};
+    std::memcpy(&header, data, offsetof(ChunkHeader, stats_));
+    const size_t header_size = HeaderSize(header.version_);
+    std::memcpy(&header, data, header_size);
+
+    ChunkView view;
+    view.device_id_ = id;
+    view.count_ = header.count_;
+    view.min_ms_ = header.min_ms_;
+    view.max_ms_ = header.max_ms_;
+    const char *column = data + header_size + Align8(header.name_size_);
+    for (size_t i = 0; i < ChunkHeader::COLUMNS; ++i) {
+        view.columns_[i] = reinterpret_cast<const uint64_t*>(column);
+        column += header.column_words_[i] * sizeof(uint64_t);
+    }
+
+    if (header.version_ == 1) {
+        RollupStats stats;
+        view.ForEach([&stats](const DeviceState& state) { stats.Add(ToMs(state.last_update_), state); });
+        std::copy(std::begin(stats.stats_), std::end(stats.stats_), view.stats_);
+    } else {
+        std::copy(std::begin(header.stats_), std::end(header.stats_), view.stats_);
+    }
+    return view;
+}
+
+} // namespace
+
+// Файл сегмента, отображенный в память целиком
+struct ChunkStorage::Segment {
+    int fd_ = -1;
+    char *base_ = nullptr;
+    size_t mapped_ = 0;
+    size_t used_ = 0;
+    bool writable_ = false;
+
+    ~Segment() {
+        if (base_ != nullptr) {
+            munmap(base_, mapped_);
+        }
+        if (fd_ != -1) {
+            // Хвост сегмента, созданного ftruncate, не занят: обрезаем файл
+            if (writable_ && ftruncate(fd_, static_cast<off_t>(used_)) != 0) {
+                LOG_ERROR("Chunk segment truncate: {}", strerror(errno));
+            }
+            close(fd_);
+        }
+    }
+};
+
+// Открытый чанк устройства: столбцы копятся в памяти до запечатывания
+class ChunkStorage::ChunkBuilder {
+public:
+    void Append(const DeviceState& state) {
+        const int64_t ms = ToMs(state.last_update_);
+        stats_.Add(ms, state);
+        min_ms_ = count_ == 0 ? ms : std::min(min_ms_, ms);
+        max_ms_ = count_ == 0 ? ms : std::max(max_ms_, ms);
+        time_.Append(ms, columns_[0]);
+        temperature_.Append(state.temperature_, columns_[1]);
+        humidity_.Append(state.humidity_, columns_[2]);
+        pressure_.Append(state.pressure_, columns_[3]);
+        ++count_;
+    }
+
+    uint32_t Count() const { return count_; }
+
+    // Пустой чанк с уже выделенными столбцами
+    void Reset() {
+        for (auto& column : columns_) {
+            column.Clear();
+        }
+        time_ = {};
+        temperature_ = {};
+        humidity_ = {};
+        pressure_ = {};
+        stats_ = {};
+        count_ = 0;
+        min_ms_ = 0;
+        max_ms_ = 0;
+    }
+
+    ChunkView View(DeviceId id) const {
+        ChunkView view;
+        view.device_id_ = id;
+        view.count_ = count_;
+        view.min_ms_ = min_ms_;
+        view.max_ms_ = max_ms_;
+        for (size_t i = 0; i < ChunkHeader::COLUMNS; ++i) {
+            view.columns_[i] = columns_[i].Data();
+        }
+        std::copy(std::begin(stats_.stats_), std::end(stats_.stats_), view.stats_);
+        return view;
+    }
+
+    size_t SerializedSize(std::string_view name) const {
+        size_t size = sizeof(ChunkHeader) + Align8(name.size());
+        for (const auto& column : columns_) {
+            size += column.WordCount() * sizeof(uint64_t);
+        }
+        return size;
+    }
+
+    // Заголовок пишется последним, magic_ - в самом конце. Порядок записи
+    // страниц на диск это не гарантирует: недописанный чанк после сбоя
+    // отсеивает контрольная сумма.
+    void Serialize(char *dst, std::string_view name) const {
+        ChunkHeader header {};
+        header.version_ = ChunkHeader::VERSION;
+        header.name_size_ = static_cast<uint16_t>(name.size());
+        header.count_ = count_;
+        header.total_size_ = static_cast<uint32_t>(SerializedSize(name));
+        header.min_ms_ = min_ms_;
+        header.max_ms_ = max_ms_;
+        std::copy(std::begin(stats_.stats_), std::end(stats_.stats_), header.stats_);
+
+        char *out = dst + sizeof(ChunkHeader);
+        std::memcpy(out, name.data(), name.size());
+        out += Align8(name.size());
+        for (size_t i = 0; i < ChunkHeader::COLUMNS; ++i) {
+            const size_t bytes = columns_[i].WordCount() * sizeof(uint64_t);
+            std::memcpy(out, columns_[i].Data(), bytes);
+            out += bytes;
+            header.column_words_[i] = static_cast<uint32_t>(columns_[i].WordCount());
+        }
+
+        std::memcpy(dst, &header, sizeof(header));
+        const uint32_t checksum = Checksum(dst, header.total_size_);
+        std::memcpy(dst + offsetof(ChunkHeader, checksum_), &checksum, sizeof(checksum));
+        const uint32_t magic = ChunkHeader::MAGIC;
+        std::memcpy(dst, &magic, sizeof(magic));
+    }
+
+private:
+    BitWriter columns_[ChunkHeader::COLUMNS];
+    TimestampEncoder time_;
+    XorEncoder temperature_;
+    XorEncoder humidity_;
+    XorEncoder pressure_;
+    RollupStats stats_;
+    uint32_t count_ = 0;
+    int64_t min_ms_ = 0;
+    int64_t max_ms_ = 0;
+};
+
+ChunkStorage::ChunkStorage(DeviceIdTable& ids, std::string directory)
+    : ids_(ids), directory_(std::move(directory)) {
+    std::filesystem::create_directories(directory_);
+    LoadSegments();
+}
+
+ChunkStorage::~ChunkStorage() {
+    SealAll();
+}
+
+void ChunkStorage::LoadSegments() {
+    std::vector<std::pair<int64_t, std::string>> files;
+    for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+        const int64_t number = SegmentNumber(entry.path().filename().string());
+        if (number >= 0 && entry.is_regular_file()) {
+            files.emplace_back(number, entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    for (const auto& [number, path] : files) {
+        next_segment_ = static_cast<uint32_t>(number + 1);
+
+        auto segment = std::make_unique<Segment>();
+        segment->fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (segment->fd_ < 0) {
+            throw std::runtime_error("open " + path);
+        }
+        struct stat st {};
+        fstat(segment->fd_, &st);
+        if (st.st_size == 0) {
+            continue;
+        }
+        segment->mapped_ = static_cast<size_t>(st.st_size);
+        void *base = mmap(nullptr, segment->mapped_, PROT_READ, MAP_SHARED, segment->fd_, 0);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("mmap " + path);
+        }
+        segment->base_ = static_cast<char*>(base);
+
+        // Чанки идут подряд; нулевой или поврежденный заголовок, как и
+        // несовпавшая сумма, - конец данных: следующие чанки писались позже
+        size_t offset = 0;
+        while (offset + HeaderSize(1) <= segment->mapped_) {
+            ChunkHeader header {};
+            std::memcpy(&header, segment->base_ + offset, HeaderSize(1));
+            if (header.magic_ != ChunkHeader::MAGIC || header.version_ < 1 || header.version_ > ChunkHeader::VERSION ||
+                header.total_size_ < HeaderSize(header.version_) || offset + header.total_size_ > segment->mapped_) {
+                break;
+            }
+            if (header.version_ >= 3) {
+                std::memcpy(&header, segment->base_ + offset, sizeof(header));
+                if (Checksum(segment->base_ + offset, header.total_size_) != header.checksum_) {
+                    LOG_WARN("Chunk segment {}: checksum mismatch at offset {}, ignoring the rest", path, offset);
+                    break;
+                }
+            }
+            const std::string_view name(segment->base_ + offset + HeaderSize(header.version_), header.name_size_);
+            const DeviceId id = ids_.Intern(name);
+            if (id != INVALID_DEVICE_ID) {
+                index_[id].sealed_.push_back(ViewAt(segment->base_ + offset, id));
+                sealed_bytes_ += header.total_size_;
+                sealed_readings_ += header.count_;
+            }
+            offset += header.total_size_;
+        }
+        segment->used_ = offset;
+        segments_.push_back(std::move(segment));
+    }
+
+    if (!files.empty()) {
+        LOG_INFO("Chunk storage: {} readings in {} segments", sealed_readings_, segments_.size());
+    }
+}
+
+char *ChunkStorage::Allocate(size_t size) {
+    if (segments_.empty() || !segments_.back()->writable_ || segments_.back()->used_ + size > SEGMENT_SIZE) {
+        const std::string path = directory_ + "/" + SegmentName(next_segment_++);
+        auto segment = std::make_unique<Segment>();
+        segment->fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (segment->fd_ < 0) {
+            throw std::runtime_error("open " + path);
+        }
+        segment->writable_ = true;
+        if (ftruncate(segment->fd_, SEGMENT_SIZE) != 0) {
+            throw std::runtime_error("ftruncate " + path);
+        }
+        segment->mapped_ = SEGMENT_SIZE;
+        void *base = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd_, 0);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("mmap " + path);
+        }
+        segment->base_ = static_cast<char*>(base);
+        segments_.push_back(std::move(segment));
+    }
+
+    Segment& segment = *segments_.back();
+    char *dst = segment.base_ + segment.used_;
+    segment.used_ += size;
+    return dst;
+}
+
+void ChunkStorage::Seal(DeviceId id, DeviceChunks& chunks) {
+    const std::string_view name = ids_.Name(id);
+    const size_t size = chunks.open_->SerializedSize(name);
+    char *dst = Allocate(size);
+    chunks.open_->Serialize(dst, name);
+    chunks.sealed_.push_back(ViewAt(dst, id));
+    sealed_bytes_ += size;
+    sealed_readings_ += chunks.open_->Count();
+    if (spare_builders_.size() < MAX_SPARE_BUILDERS) {
+        chunks.open_->Reset();
+        spare_builders_.push_back(std::move(chunks.open_));
+    } else {
+        chunks.open_.reset();
+    }
+}
+
+bool ChunkStorage::WriteBatch(const std::vector<DeviceState>& batch) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& state : batch) {
+        if (state.device_id_ == INVALID_DEVICE_ID) {
+            continue;
+        }
+        DeviceChunks& chunks = index_[state.device_id_];
+        if (!chunks.open_) {
+            if (spare_builders_.empty()) {
+                chunks.open_ = std::make_unique<ChunkBuilder>();
+            } else {
+                chunks.open_ = std::move(spare_builders_.back());
+                spare_builders_.pop_back();
+            }
+        }
+        chunks.open_->Append(state);
+        if (chunks.open_->Count() == CHUNK_CAPACITY) {
+            Seal(state.device_id_, chunks);
+        }
+    }
+    return true;
+}
+
+void ChunkStorage::SealAll() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (auto& [id, chunks] : index_) {
+        if (chunks.open_ && chunks.open_->Count() != 0) {
+            Seal(id, chunks);
+        }
+    }
+}
+
+void ChunkStorage::Checkpoint() {
+    SealAll();
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& segment : segments_) {
+        if (segment->writable_ && msync(segment->base_, segment->mapped_, MS_SYNC) != 0) {
+            LOG_ERROR("msync: {}", strerror(errno));
+        }
+    }
+}
+
+void ChunkStorage::VisitChunks(DeviceId id, std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to,
+                               const std::function<void(const ChunkView&)>& visit) const {
+    const int64_t from_ms = ToMs(from);
+    const int64_t to_ms = ToMs(to);
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = index_.find(id);
+    if (it == index_.end()) {
+        return;
+    }
+    for (const auto& chunk : it->second.sealed_) {
+        if (chunk.Overlaps(from_ms, to_ms)) {
+            visit(chunk);
+        }
+    }
+    if (it->second.open_) {
+        const ChunkView open = it->second.open_->View(id);
+        if (open.Overlaps(from_ms, to_ms)) {
+            visit(open);
+        }
+    }
+}
+
+void ChunkStorage::ScanFrom(std::chrono::system_clock::time_point from,
+                            const std::function<void(const DeviceState&)>& visit) {
+    std::vector<DeviceId> ids;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        ids.reserve(index_.size());
+        for (const auto& [id, chunks] : index_) {
+            ids.push_back(id);
+        }
+    }
+    for (const DeviceId id : ids) {
+        Scan(id, from, std::chrono::system_clock::time_point::max(), visit);
+    }
+}
+
+size_t ChunkStorage::SealedBytes() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return sealed_bytes_;
+}
+
+size_t ChunkStorage::SealedReadings() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return sealed_readings_;
+}
+
+std::vector<AggregatedPoint> ChunkStorage::Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                                     std::chrono::system_clock::time_point to,
+                                                     std::chrono::milliseconds bucket, Aggregation aggregation) const {
+    const int64_t bucket_ms = std::max<int64_t>(1, bucket.count());
+    const int64_t from_ms = ToMs(from);
+    const int64_t to_ms = ToMs(to);
+    auto bucket_of = [bucket_ms](int64_t ms) { return FloorTo(ms, bucket_ms); };
+
+    std::map<int64_t, RollupStats> buckets;
+    VisitChunks(id, from, to, [&](const ChunkView& chunk) {
+        const int64_t start = bucket_of(chunk.min_ms_);
+        if (chunk.min_ms_ >= from_ms && chunk.max_ms_ <= to_ms && start == bucket_of(chunk.max_ms_)) {
+            buckets[start].Merge(chunk.count_, chunk.max_ms_, chunk.stats_);
+            return;
+        }
+
+        // Показания чанка обычно идут по возрастанию: запоминаем текущий интервал
+        auto current = buckets.end();
+        chunk.ForEach([&](const DeviceState& state) {
+            const int64_t ms = ToMs(state.last_update_);
+            if (ms < from_ms || ms > to_ms) {
+                return;
+            }
+            const int64_t b = bucket_of(ms);
+            if (current == buckets.end() || current->first != b) {
+                current = buckets.try_emplace(b).first;
+            }
+            current->second.Add(ms, state);
+        });
+    });
+
+    std::vector<AggregatedPoint> points;
+    points.reserve(buckets.size());
+    for (const auto& [start, accumulator] : buckets) {
+        points.push_back(accumulator.Result(start, aggregation));
+    }
+    return points;
+}
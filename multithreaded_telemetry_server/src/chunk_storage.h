@@ -0,0 +1,164 @@
+#pragma once
+
+#include "chunk_codec.h"
+#include "intern_table.h"
+#include "rollup.h"
+#include "storage.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Хранилище временных рядов: показания каждого устройства копятся в
+// открытом чанке в памяти, по столбцам (метки времени, температура,
+// влажность, давление), сжатые chunk_codec.h. Заполненный чанк
+// запечатывается: дописывается в файл сегмента, отображенный в память,
+// и больше не меняется. Индекс устройство -> чанки живет в памяти и
+// восстанавливается при открытии просмотром сегментов.
+//
+// Формат сегмента - последовательность чанков, каждый выровнен по 8 байт:
+// ChunkHeader, имя устройства (дополнено до 8 байт), столбцы по
+// column_words_[i] слов. Порядок байт - родной для машины.
+//
+// В заголовке хранятся агрегаты столбцов значений: запрос с интервалом
+// группировки, целиком накрывающим чанк, обходится без раскодирования,
+// и контрольная сумма FNV-1a всего чанка (кроме magic_ и самой суммы):
+// чанк, недописанный на диск до сбоя, при открытии не читается.
+
+struct ChunkHeader {
+    static constexpr uint32_t MAGIC = 0x4B484354;   // "TCHK"
+    static constexpr uint16_t VERSION = 3;          // 1 - без stats_, 2 - без checksum_
+    static constexpr size_t COLUMNS = 4;
+
+    uint32_t magic_;
+    uint16_t version_;
+    uint16_t name_size_;
+    uint32_t count_;
+    uint32_t total_size_;       // Весь чанк вместе с заголовком
+    int64_t min_ms_;            // Метки не обязаны возрастать: часы могут идти назад
+    int64_t max_ms_;
+    uint32_t column_words_[COLUMNS];
+    ColumnStats stats_[VALUE_COLUMNS];
+    uint32_t checksum_;
+    uint32_t reserved_;
+};
+
+static_assert(sizeof(ChunkHeader) % 8 == 0);
+
+// Чанк для чтения: запечатанный (указывает в отображенный сегмент) или открытый
+class ChunkView {
+public:
+    DeviceId device_id_ = INVALID_DEVICE_ID;
+    uint32_t count_ = 0;
+    int64_t min_ms_ = 0;
+    int64_t max_ms_ = 0;
+    const uint64_t *columns_[ChunkHeader::COLUMNS] = {};
+    ColumnStats stats_[VALUE_COLUMNS] = {};
+
+    bool Overlaps(int64_t from_ms, int64_t to_ms) const { return count_ != 0 && min_ms_ <= to_ms && max_ms_ >= from_ms; }
+
+    // Раскодирует все показания чанка по порядку записи
+    template <typename F>
+    void ForEach(F&& visit) const {
+        BitReader time_in(columns_[0]);
+        BitReader temperature_in(columns_[1]);
+        BitReader humidity_in(columns_[2]);
+        BitReader pressure_in(columns_[3]);
+        TimestampDecoder time;
+        XorDecoder temperature, humidity, pressure;
+
+        DeviceState state;
+        state.device_id_ = device_id_;
+        for (uint32_t i = 0; i < count_; ++i) {
+            state.last_update_ = std::chrono::system_clock::time_point(std::chrono::milliseconds(time.Next(time_in)));
+            state.temperature_ = temperature.Next(temperature_in);
+            state.humidity_ = humidity.Next(humidity_in);
+            state.pressure_ = pressure.Next(pressure_in);
+            visit(state);
+        }
+    }
+};
+
+class ChunkStorage : public Storage {
+public:
+    static constexpr uint32_t CHUNK_CAPACITY = 1024;            // Показаний в чанке
+    static constexpr size_t SEGMENT_SIZE = 64 * 1024 * 1024;
+    static constexpr size_t MAX_SPARE_BUILDERS = 1024;
+
+    // Открывает каталог directory (создает при необходимости) и
+    // восстанавливает индекс по существующим сегментам
+    ChunkStorage(DeviceIdTable& ids, std::string directory);
+    ~ChunkStorage() override;
+
+    ChunkStorage(const ChunkStorage&) = delete;
+    ChunkStorage &operator=(const ChunkStorage&) = delete;
+
+    bool WriteBatch(const std::vector<DeviceState>& batch) override;
+
+    // Запечатывает все открытые чанки
+    void SealAll();
+
+    // SealAll и msync сегментов, открытых для записи
+    void Checkpoint() override;
+
+    // Чанки всех устройств, пересекающиеся с [from, +inf)
+    void ScanFrom(std::chrono::system_clock::time_point from,
+                  const std::function<void(const DeviceState&)>& visit) override;
+
+    // Чанки устройства, пересекающиеся с [from, to], включая открытый.
+    // Писатель ждет, пока visit не вернется.
+    void VisitChunks(DeviceId id, std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to,
+                     const std::function<void(const ChunkView&)>& visit) const;
+
+    // Показания устройства в [from, to]
+    template <typename F>
+    void Scan(DeviceId id, std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to, F&& visit) const {
+        VisitChunks(id, from, to, [&](const ChunkView& chunk) {
+            chunk.ForEach([&](const DeviceState& state) {
+                if (state.last_update_ >= from && state.last_update_ <= to) {
+                    visit(state);
+                }
+            });
+        });
+    }
+
+    // Агрегаты по интервалам: чанк, целиком лежащий в одном интервале
+    // и в [from, to], берется из заголовка, остальные раскодируются
+    std::vector<AggregatedPoint> Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                           std::chrono::system_clock::time_point to,
+                                           std::chrono::milliseconds bucket, Aggregation aggregation) const override;
+
+    // Байт в запечатанных чанках и число показаний в них
+    size_t SealedBytes() const;
+    size_t SealedReadings() const;
+
+private:
+    class ChunkBuilder;
+    struct Segment;
+
+    struct DeviceChunks {
+        std::vector<ChunkView> sealed_;
+        std::unique_ptr<ChunkBuilder> open_;
+    };
+
+    DeviceIdTable& ids_;
+    std::string directory_;
+    mutable std::shared_mutex mutex_;
+    std::vector<std::unique_ptr<Segment>> segments_;    // Последний - текущий для записи
+    std::unordered_map<DeviceId, DeviceChunks> index_;
+    // Запечатанные построители с уже выросшими столбцами: следующий чанк
+    // любого устройства пишется в них без новых выделений памяти
+    std::vector<std::unique_ptr<ChunkBuilder>> spare_builders_;
+    uint32_t next_segment_ = 0;
+    size_t sealed_bytes_ = 0;
+    size_t sealed_readings_ = 0;
+
+    void LoadSegments();
+    void Seal(DeviceId id, DeviceChunks& chunks);
+    char *Allocate(size_t size);
+};
@@ -1,117 +1,383 @@
+// Генератор нагрузки: N устройств по M соединениям шлют показания серверу
+// и замеряют задержку подтверждений (ACK).
+//
+//   client [--host=127.0.0.1] [--port=8080] [--devices=100] [--connections=4]
+//          [--rate=0] [--duration=10] [--mode=text|pipelined] [--window=128] [--binary]
+//
+// --rate - суммарная частота показаний в секунду, 0 - замкнутый цикл
+// (следующее показание сразу, как освободилось место в окне).
+// --mode=text ждет подтверждения каждого показания, pipelined держит
+// в полете до --window показаний на соединение.
+// --binary шлет двоичные кадры BIND и DATA (binary_protocol.h) вместо строк.
+//
+// При заданной частоте задержка отсчитывается от запланированного момента
+// отправки, а не от фактического: если клиент отстал из-за медленного
+// сервера, ожидание в очереди клиента тоже входит в задержку
+// (поправка на coordinated omission).
+
+#include "binary_protocol.h"
+#include "histogram.h"
 #include "socket_raii.h"
 
-#include <array>
+#include <charconv>
+#include <chrono>
+#include <deque>
 #include <fmt/format.h>
-#include <iostream>
-#include <stdio.h>
-#include <string.h>
+#include <iterator>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
-#include <arpa/inet.h>
-#include <errno.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <unistd.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 
-constexpr auto MAX_RECV_BUFFER_SIZE = 256;
+using Clock = std::chrono::steady_clock;
 
-bool send_request(const int sock, const std::string &request) {
-    size_t req_pos = 0;
-    const auto req_length = request.length();
+constexpr auto DRAIN_TIMEOUT = std::chrono::seconds(5);    // Сколько ждать подтверждений после окончания
+constexpr size_t RECV_BUFFER_SIZE = 64 * 1024;
 
-    while (req_pos < req_length) {
-        if (ssize_t bytes_count = send(sock, request.c_str() + req_pos, req_length - req_pos, 0); bytes_count < 0) {
-            if (EINTR == errno)
-                continue;
-            return false;
+struct Options {
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    size_t devices = 100;
+    size_t connections = 4;
+    double rate = 0.0;
+    std::chrono::seconds duration{10};
+    bool pipelined = false;
+    size_t window = 128;
+    bool binary = false;
+};
+
+struct ConnectionStats {
+    Histogram latency_ns;
+    uint64_t sent = 0;
+    uint64_t ok = 0;
+    uint64_t err = 0;
+    uint64_t lost = 0;      // Не дождались подтверждения за DRAIN_TIMEOUT
+    std::string error;
+};
+
+size_t ParseSize(std::string_view name, std::string_view value) {
+    size_t result = 0;
+    const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc() || ptr != value.data() + value.size()) {
+        throw std::invalid_argument(fmt::format("bad {}: {}", name, value));
+    }
+    return result;
+}
+
+Options ParseOptions(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string_view key = arg.substr(0, eq);
+        const std::string_view value = eq == std::string_view::npos ? std::string_view() : arg.substr(eq + 1);
+
+        if (key == "--host") {
+            options.host = value;
+        } else if (key == "--port") {
+            options.port = value;
+        } else if (key == "--devices") {
+            options.devices = ParseSize(key, value);
+        } else if (key == "--connections") {
+            options.connections = ParseSize(key, value);
+        } else if (key == "--rate") {
+            options.rate = static_cast<double>(ParseSize(key, value));
+        } else if (key == "--duration") {
+            options.duration = std::chrono::seconds(ParseSize(key, value));
+        } else if (key == "--window") {
+            options.window = ParseSize(key, value);
+        } else if (key == "--mode") {
+            if (value != "text" && value != "pipelined") {
+                throw std::invalid_argument(fmt::format("bad mode: {}", value));
+            }
+            options.pipelined = value == "pipelined";
+        } else if (key == "--binary") {
+            options.binary = true;
         } else {
-            req_pos += bytes_count;
+            throw std::invalid_argument(fmt::format("unknown option: {}", arg));
         }
     }
 
-    return true;
+    if (options.devices == 0 || options.connections == 0 || options.window == 0) {
+        throw std::invalid_argument("devices, connections and window must be positive");
+    }
+    if (options.binary && (options.devices + options.connections - 1) / options.connections > protocol::binary::MAX_BINDINGS) {
+        throw std::invalid_argument("too many devices per connection for --binary");
+    }
+    return options;
 }
 
-bool recv_request(const int sock) {
-    std::array<char, MAX_RECV_BUFFER_SIZE> buffer;
+Socket Connect(const Options& options) {
+    AddrInfo addr(options.host.c_str(), options.port.c_str());
+    Socket socket_fd(socket(addr.Get()->ai_family, addr.Get()->ai_socktype, addr.Get()->ai_protocol));
+    if (socket_fd.GetFd() < 0) {
+        throw std::system_error(errno, std::system_category(), "socket");
+    }
+    if (connect(socket_fd.GetFd(), addr.Get()->ai_addr, addr.Get()->ai_addrlen) != 0) {
+        throw std::system_error(errno, std::system_category(), "connect");
+    }
+    int yes = 1;
+    setsockopt(socket_fd.GetFd(), IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    return socket_fd;
+}
+
+// Разбирает строки "Ok <n>" / "Err <n>" из in; для каждого подтвержденного
+// показания вызывает on_ack(ok). Неполная последняя строка остается в in.
+template <typename F>
+void ParseAcks(std::string& in, F&& on_ack) {
+    size_t pos = 0;
     while (true) {
-        const auto recv_bytes = recv(sock, buffer.data(), buffer.size() - 1, 0);
+        const size_t end = in.find('\n', pos);
+        if (end == std::string::npos) {
+            break;
+        }
+        const std::string_view line(in.data() + pos, end - pos);
+        const size_t space = line.find(' ');
+        if (space == std::string_view::npos) {
+            throw std::runtime_error(fmt::format("bad ack: {}", line));
+        }
+        const bool ok = line.substr(0, space) == "Ok";
+        if (!ok && line.substr(0, space) != "Err") {
+            throw std::runtime_error(fmt::format("bad ack: {}", line));
+        }
+        const size_t count = ParseSize("ack", line.substr(space + 1));
+        for (size_t i = 0; i < count; ++i) {
+            on_ack(ok);
+        }
+        pos = end + 1;
+    }
+    in.erase(0, pos);
+}
+
+class LoadConnection {
+public:
+    LoadConnection(const Options& options, size_t index, ConnectionStats& stats)
+        : options_(options), stats_(stats), socket_(Connect(options)) {
+        // Устройства делятся между соединениями по кругу
+        for (size_t d = index; d < options.devices; d += options.connections) {
+            names_.push_back(fmt::format("load_{}", d));
+        }
+        window_ = options.pipelined ? options.window : 1;
+        if (options.rate > 0) {
+            // Частота делится между соединениями, у которых есть устройства
+            const size_t active = std::min(options.connections, options.devices);
+            interval_ = std::chrono::nanoseconds(static_cast<int64_t>(1e9 * static_cast<double>(active) / options.rate));
+        }
+    }
 
-        std::cout << recv_bytes << " was received..." << std::endl;
+    void Run() {
+        if (names_.empty()) {
+            return;
+        }
+        if (options_.binary) {
+            Bind();
+        }
 
-        if (recv_bytes > 0) {
-            buffer[recv_bytes] = '\0';
-            std::cout << "------------\n"
-                      << std::string(buffer.begin(), std::next(buffer.begin(), recv_bytes)) << std::endl;
-            continue;
-        } else if (-1 == recv_bytes) {
-            if (EINTR == errno)
-                continue;
-            if (0 == errno)
+        const auto start = Clock::now();
+        const auto end = start + options_.duration;
+        auto next_due = start;
+
+        while (true) {
+            auto now = Clock::now();
+            const bool sending = now < end;
+            if (!sending && inflight_.empty()) {
                 break;
-            if (EAGAIN == errno)
+            }
+            if (now > end + DRAIN_TIMEOUT) {
+                stats_.lost = inflight_.size();
                 break;
-            return false;
-        }
+            }
 
-        break;
-    }
-    return true;
-}
+            // Окно ограничивает число показаний в полете; при заданной
+            // частоте отставшие показания уходят пачкой со своими плановыми метками
+            while (sending && inflight_.size() < window_ && (interval_.count() == 0 || next_due <= now)) {
+                AppendReading();
+                inflight_.push_back(interval_.count() == 0 ? now : next_due);
+                next_due += interval_;
+                ++stats_.sent;
+            }
 
-int main(int argc, char *argv[]) {
+            Send();
 
-    try {
+            auto timeout = std::chrono::nanoseconds(std::chrono::milliseconds(10));
+            if (sending && interval_.count() != 0 && inflight_.size() < window_) {
+                timeout = std::max(std::chrono::nanoseconds(0), std::min(timeout, next_due - now));
+            }
+            Wait(timeout);
+        }
+    }
 
-        AddrInfo addr("127.0.0.1", "8080", AI_PASSIVE);
-        Socket socket_fd(socket(addr.Get()->ai_family, addr.Get()->ai_socktype, addr.Get()->ai_protocol));
+private:
+    const Options& options_;
+    ConnectionStats& stats_;
+    Socket socket_;
+    std::vector<std::string> names_;
+    size_t window_ = 1;
+    std::chrono::nanoseconds interval_{0};
+    std::deque<Clock::time_point> inflight_;    // Метки отправки показаний, ждущих подтверждения
+    std::string out_;
+    size_t out_pos_ = 0;
+    std::string in_;
+    size_t next_device_ = 0;
+    uint64_t seq_ = 0;
 
-        if (socket_fd.GetFd() < 0) {
-            throw std::system_error(errno, std::system_category(), "socket");
+    // Назначает номера устройствам соединения и ждет подтверждения всех BIND
+    void Bind() {
+        for (size_t i = 0; i < names_.size(); ++i) {
+            protocol::binary::AppendBind(out_, static_cast<uint16_t>(i), names_[i]);
+        }
+        size_t pending = names_.size();
+        while (pending != 0) {
+            Send();
+            char buffer[RECV_BUFFER_SIZE];
+            const ssize_t n = recv(socket_.GetFd(), buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("connection closed during BIND");
+            }
+            in_.append(buffer, static_cast<size_t>(n));
+            ParseAcks(in_, [&](bool ok) {
+                if (!ok) {
+                    throw std::runtime_error("BIND rejected");
+                }
+                --pending;
+            });
         }
+    }
+
+    void AppendReading() {
+        const size_t device = next_device_;
+        next_device_ = next_device_ + 1 == names_.size() ? 0 : next_device_ + 1;
+        const double temperature = 20.0 + static_cast<double>(seq_ % 100) / 10;
+        const double humidity = 40.0 + static_cast<double>(seq_ % 50);
+        ++seq_;
 
-        if (connect(socket_fd.GetFd(), addr.Get()->ai_addr, addr.Get()->ai_addrlen) != 0) {
-            throw std::system_error(errno, std::system_category(), "connect");
+        if (options_.binary) {
+            protocol::binary::AppendData(out_, static_cast<uint16_t>(device), 0, temperature, humidity, 1013.0);
+        } else {
+            fmt::format_to(std::back_inserter(out_), "{}:temp={:.1f},hum={},press=1013\n", names_[device], temperature, humidity);
         }
+    }
 
-        char ipstr[INET6_ADDRSTRLEN];
-        int port;
+    void Send() {
+        while (out_pos_ < out_.size()) {
+            const ssize_t n = send(socket_.GetFd(), out_.data() + out_pos_, out_.size() - out_pos_, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;     // Досылаем, когда сокет станет доступен для записи
+                }
+                throw std::system_error(errno, std::system_category(), "send");
+            }
+            out_pos_ += static_cast<size_t>(n);
+        }
+        out_.clear();
+        out_pos_ = 0;
+    }
 
-        socklen_t addr_size;
-        struct sockaddr_storage their_addr;
-        addr_size = sizeof their_addr;
-        getpeername(socket_fd.GetFd(), (struct sockaddr *)&their_addr, &addr_size);
+    void Wait(std::chrono::nanoseconds timeout) {
+        struct pollfd pfd {};
+        pfd.fd = socket_.GetFd();
+        pfd.events = POLLIN | (out_pos_ < out_.size() ? POLLOUT : 0);
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        const struct timespec ts {seconds.count(), (timeout - seconds).count()};
+        if (ppoll(&pfd, 1, &ts, nullptr) < 0) {
+            if (errno == EINTR) {
+                return;
+            }
+            throw std::system_error(errno, std::system_category(), "ppoll");
+        }
+        if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+            Receive();
+        }
+    }
 
-        if (their_addr.ss_family == AF_INET) {
-            struct sockaddr_in *socket_peer = (struct sockaddr_in *)&their_addr;
-            port = ntohs(socket_peer->sin_port);
-            inet_ntop(AF_INET, &socket_peer->sin_addr, ipstr, sizeof ipstr);
-        } else {
-            struct sockaddr_in6 *socket_peer = (struct sockaddr_in6 *)&their_addr;
-            port = ntohs(socket_peer->sin6_port);
-            inet_ntop(AF_INET6, &socket_peer->sin6_addr, ipstr, sizeof ipstr);
+    void Receive() {
+        char buffer[RECV_BUFFER_SIZE];
+        while (true) {
+            const ssize_t n = recv(socket_.GetFd(), buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n > 0) {
+                in_.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n == 0) {
+                throw std::runtime_error("connection closed by server");
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            throw std::system_error(errno, std::system_category(), "recv");
         }
 
-        printf("Peer IP address: %s\n", ipstr);
-        printf("Peer port: %d\n", port);
+        const auto now = Clock::now();
+        ParseAcks(in_, [&](bool ok) {
+            if (inflight_.empty()) {
+                throw std::runtime_error("more acks than readings sent");
+            }
+            stats_.latency_ns.Record(static_cast<uint64_t>(std::chrono::nanoseconds(now - inflight_.front()).count()));
+            inflight_.pop_front();
+            ++(ok ? stats_.ok : stats_.err);
+        });
+    }
+};
 
-        std::string sent_message{"device_1:temp=23.5,hum=60,press=1013"};
+int main(int argc, char *argv[]) {
+    try {
+        const Options options = ParseOptions(argc, argv);
 
-        if (!send_request(socket_fd.GetFd(), sent_message)) {
-            throw std::system_error(errno, std::system_category(), "send");
+        std::vector<ConnectionStats> stats(options.connections);
+        std::vector<std::thread> threads;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < options.connections; ++i) {
+            threads.emplace_back([&options, &stats, i] {
+                try {
+                    LoadConnection(options, i, stats[i]).Run();
+                } catch (const std::exception& e) {
+                    stats[i].error = e.what();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
         }
+        const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
 
-        if (!recv_request(socket_fd.GetFd())) {
-            throw std::system_error(errno, std::system_category(), "recv");
+        HistogramSnapshot latency;
+        uint64_t sent = 0, ok = 0, err = 0, lost = 0;
+        for (const auto& s : stats) {
+            if (!s.error.empty()) {
+                fmt::print(stderr, "Connection error: {}\n", s.error);
+            }
+            latency.Add(s.latency_ns);
+            sent += s.sent;
+            ok += s.ok;
+            err += s.err;
+            lost += s.lost;
         }
+
+        const auto us = [&latency](double q) { return static_cast<double>(latency.Quantile(q)) / 1000; };
+        fmt::print("Mode: {} ({}), window {}, {}\n", options.pipelined ? "pipelined" : "text",
+                   options.binary ? "binary frames" : "text lines", options.pipelined ? options.window : 1,
+                   options.rate > 0 ? fmt::format("rate {}/s, latency from intended send time", options.rate) : "closed loop");
+        fmt::print("Devices: {} over {} connections, {:.1f} s\n", options.devices, options.connections, elapsed);
+        fmt::print("Sent: {}, Ok: {}, Err: {}, lost: {}\n", sent, ok, err, lost);
+        fmt::print("Throughput: {:.0f} readings/s\n", static_cast<double>(ok + err) / elapsed);
+        fmt::print("ACK latency, us: p50 {:.1f}, p99 {:.1f}, p999 {:.1f}, max {:.1f}\n", us(0.5), us(0.99), us(0.999), us(1.0));
     } catch (const std::exception &e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        fmt::print(stderr, "Error: {}\n", e.what());
         return 1;
     }
 
-    std::cout << "Success!" << std::endl;
-
     return 0;
 }
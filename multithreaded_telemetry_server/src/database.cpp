@@ -1,92 +1,449 @@
 #include "database.h"
+#include "chunk_storage.h"
+#include "logger.h"
+#include "metrics.h"
+#include "sqlite_storage.h"
 
-#include <iostream>
+#include <algorithm>
 #include <condition_variable>
+#include <limits>
 #include <mutex>
 #include <optional>
-#include <queue>
-#include <sqlite3.h>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 
-DataBase::DataBase()
-    : stop_(false) {
-    rc_ = sqlite3_open("example.db", &db_);
-    CheckDbError();
-    CreateTable();
+DataBase::DataBase(DeviceIdTable& ids, MetricSchema& schema, DataBaseOptions options)
+    : options_(std::move(options)),
+      rollup_accumulator_(options_.memory_resource != nullptr ? options_.memory_resource : &writer_pool_),
+      reorder_(options_.reorder_window, options_.reorder_capacity,
+               options_.memory_resource != nullptr ? options_.memory_resource : &writer_pool_),
+      queue_(options_.queue_capacity), metric_queue_(options_.metric_queue_capacity), stop_(false) {
+    switch (options_.storage) {
+    case StorageKind::kSqlite:
+        storage_ = std::make_unique<SqliteStorage>(ids, options_.path, options_.synchronous, options_.cache_size_kib);
+        break;
+    case StorageKind::kChunks:
+        storage_ = std::make_unique<ChunkStorage>(ids, options_.chunk_dir);
+        break;
+    }
+    if (options_.rollup_path.empty()) {
+        options_.rollup_path = options_.storage == StorageKind::kSqlite ? options_.path : options_.chunk_dir + "/rollups.db";
+    }
+    rollups_ = std::make_unique<RollupStore>(ids, options_.rollup_path);
+    if (options_.metric_path.empty()) {
+        options_.metric_path = options_.storage == StorageKind::kSqlite ? options_.path : options_.chunk_dir + "/metrics.db";
+    }
+    metric_store_ = std::make_unique<MetricStore>(ids, schema, options_.metric_path, options_.synchronous);
+    RestoreRollups();
+
+    // Неосвобожденные показания прошлого запуска сохраняются до приема новых
+    if (!options_.journal_dir.empty()) {
+        journal_ = std::make_unique<IngestJournal>(ids, schema, options_.journal_dir);
+        const size_t replayed = journal_->Replay([this](const std::vector<DeviceState>& batch,
+                                                        const std::vector<MetricSample>& metrics) {
+            InsertBatch(batch);
+            if (metric_store_->Write(metrics)) {
+                metrics_persisted_.fetch_add(metrics.size(), std::memory_order_relaxed);
+            }
+        });
+        if (replayed != 0) {
+            storage_->Checkpoint();
+            metric_store_->Checkpoint();
+        }
+    }
     worker_ = std::thread(&DataBase::WorkerThread, this);
 }
 
 DataBase::~DataBase() {
-    stop_ = true;
-    cv_.notify_one();
-    worker_.join();
-    sqlite3_close(db_);
+    Stop();
 }
 
-void DataBase::InsertReadingDataDevice(DeviceState read_data_device) {
+void DataBase::Stop() {
     {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        queue_.push(read_data_device);
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        stop_ = true;
     }
     cv_.notify_one();
+    space_cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
 }
 
-void DataBase::WorkerThread() {
-    while (!stop_) {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        cv_.wait(lock, [this] { return !queue_.empty() || stop_ ;});
-        if (stop_ && queue_.empty()) {
+bool DataBase::InsertReadingDataDevice(DeviceState read_data_device) {
+    std::vector<uint8_t> accepted;
+    InsertReadings({read_data_device}, accepted);
+    return accepted[0] != 0;
+}
+
+void DataBase::InsertReadings(const std::vector<DeviceState>& readings, std::vector<uint8_t>& accepted,
+                              const std::vector<MetricSample>& extras, const std::vector<uint16_t>& extra_counts) {
+    accepted.assign(readings.size(), 0);
+    size_t extra = 0;
+    if (!journal_) {
+        for (size_t i = 0; i < readings.size(); ++i) {
+            accepted[i] = Enqueue(readings[i]);
+            const size_t end = extra + (i < extra_counts.size() ? extra_counts[i] : 0);
+            for (; extra < end; ++extra) {
+                if (accepted[i]) {
+                    EnqueueMetric(extras[extra]);
+                }
+            }
+        }
+        return;
+    }
+
+    uint64_t last = 0;
+    {
+        std::lock_guard<std::mutex> lock(ingest_mutex_);
+        for (size_t i = 0; i < readings.size(); ++i) {
+            if (Enqueue(readings[i])) {
+                accepted[i] = 1;
+                last = journal_->Append(readings[i]);
+            }
+            const size_t end = extra + (i < extra_counts.size() ? extra_counts[i] : 0);
+            for (; extra < end; ++extra) {
+                if (accepted[i] && EnqueueMetric(extras[extra])) {
+                    last = journal_->Append(extras[extra]);
+                }
+            }
+        }
+    }
+    // fdatasync вне блокировки: пока один поток ждет диск, другие пишут в журнал
+    if (last != 0) {
+        journal_->Commit(last);
+    }
+}
+
+// Значения метрик не ждут места и не вытесняют друг друга: писатель забирает
+// их вместе с пакетами показаний, и при его отставании отбрасываются новые
+bool DataBase::EnqueueMetric(const MetricSample& sample) {
+    if (!metric_queue_.TryPush(MetricSample(sample))) {
+        metrics_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool DataBase::Enqueue(const DeviceState& state) {
+    if (stop_) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    while (!queue_.TryPush(DeviceState(state))) {
+        switch (options_.overflow_policy) {
+        case OverflowPolicy::kReject:
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case OverflowPolicy::kDropOldest: {
+            DeviceState oldest;
+            if (queue_.TryPop(oldest)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+            break;
+        }
+        case OverflowPolicy::kBlock:
+            if (stop_) {
+                rejected_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            WaitForSpace();
             break;
         }
-        DeviceState r = std::move(queue_.front());
-        queue_.pop();
-        lock.unlock();
-
-        Insert(std::move(r));
-    }
-}
-
-void DataBase::CreateTable(){
-    std::string sql = "CREATE TABLE IF NOT EXISTS sensor_data("
-                      "ID INT PRIMARY KEY, "
-                      "DEVICE_ID    CHAR(50)    NOT NULL, "
-                      "TIMESTAMP    INTEGER    NOT NULL, "
-                      "TEMPERATURE  REAL    NOT NULL, "
-                      "HUMIDITY     REAL    NOT NULL, "
-                      "PRESSURE     REAL    NOT NULL);";
-    rc_ = sqlite3_exec( // int                                          Возврат
-        db_,            // sqlite3*,                                    Открытая база данных
-        sql.c_str(),    // const char *sql,                             SQL-запрос для выполнения
-        NULL,           // int (*callback)(void*,int,char**,char**),    Функция обратного вызова 
-        0,              // void *,                                      1-й аргумент для функции обратного вызова
-        &messaggeError_ // char **errmsg                                Здесь записывается сообщение об ошибке
-    );
-
-    CheckDbError();
-}
-void DataBase::Insert(const DeviceState&& r) {
-    std::time_t tt = std::chrono::system_clock::to_time_t(r.last_update_); 
-    std::string sql = "INSERT INTO sensor_data (device_id, timestamp, temperature, humidity, pressure) VALUES (?, ?, ?, ?, ?);";
-    
-    sqlite3_stmt *stmt;
-    sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr);
-    sqlite3_bind_text(stmt, 1, r.device_id_.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 2, tt);
-    sqlite3_bind_double(stmt, 3, r.temperature_);
-    sqlite3_bind_double(stmt, 4, r.humidity_);
-    sqlite3_bind_double(stmt, 5, r.pressure_);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-}
-
-void DataBase::CheckDbError() {
-    if (rc_) {
-        // Show an error message
-        std::cerr << "DB Error: " << sqlite3_errmsg(db_) << std::endl;
-
-        sqlite3_close(db_);
     }
+
+    // Будим писателя, только если он спит и ждет именно такой глубины
+    const size_t threshold = wake_threshold_.load();
+    if (threshold != 0 && queue_.Depth() >= threshold) {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        cv_.notify_one();
+    }
+    return true;
+}
+
+// Освобождает в журнале показания, которые уже не нужно повторять: записанные
+// (или потерянные с ошибкой) пакеты и вытесненные из очереди, - и так же
+// записанные значения метрик. Открытые интервалы свертки журнал не держит:
+// при запуске их собирает RestoreRollups из хранилища показаний.
+void DataBase::ReleaseJournal(size_t written, size_t metrics_written) {
+    if (!journal_) {
+        return;
+    }
+    unreleased_ += written;
+    unreleased_metrics_ += metrics_written;
+    if (unreleased_ == 0 && unreleased_metrics_ == 0) {
+        return;
+    }
+    if (!storage_->DurableOnWrite() || !metric_store_->DurableOnWrite()) {
+        if (journal_->SegmentCount() <= options_.journal_checkpoint_segments) {
+            return;
+        }
+        storage_->Checkpoint();
+        metric_store_->Checkpoint();
+    }
+    journal_->Release(unreleased_, unreleased_metrics_);
+    unreleased_ = 0;
+    unreleased_metrics_ = 0;
+}
+
+void DataBase::WaitForSpace() {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    ++blocked_producers_;
+    space_cv_.wait_for(lock, options_.batch_timeout, [this] {
+        return queue_.Depth() < queue_.Capacity() || stop_;
+    });
+    --blocked_producers_;
+}
+
+void DataBase::WaitForDepth(size_t depth, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    wake_threshold_ = depth;
+    cv_.wait_for(lock, timeout, [this, depth] { return queue_.Depth() >= depth || stop_; });
+    wake_threshold_ = 0;
+}
+
+void DataBase::WorkerThread() {
+    // Пакет не может быть больше очереди, иначе писатель ждал бы его до таймаута
+    const size_t batch_size = std::min(options_.batch_size, queue_.Capacity());
+    std::vector<DeviceState> batch;
+    batch.reserve(batch_size);
+    DeviceState r;
+
+    while (true) {
+        if (queue_.Depth() == 0) {
+            if (stop_) {
+                break;
+            }
+            WaitForDepth(1, options_.batch_timeout);
+            reorder_.Drain(std::chrono::system_clock::now(), ordered_);
+            WriteOrdered();
+            WriteMetrics(metric_queue_.Capacity());
+            FlushRollups(false);
+            continue;
+        }
+
+        // Даем пакету наполниться, но не дольше batch_timeout
+        if (queue_.Depth() < batch_size && !stop_) {
+            WaitForDepth(batch_size, options_.batch_timeout);
+        }
+
+        // При остановке остаток очереди уходит пакетами размером с очередь.
+        // Номер в очереди совпадает с номером записи журнала: показания,
+        // вытесненные производителями (kDropOldest), дают пропуск номеров
+        // и отмечаются в буфере отданными на своем месте.
+        const size_t limit = stop_ ? queue_.Capacity() : batch_size;
+        size_t position = 0;
+        while (batch.size() < limit && queue_.TryPop(r, position)) {
+            const uint64_t expected = reorder_.Pushed() + batch.size();
+            if (position != expected) {
+                PushReordered(batch);
+                reorder_.Skip(position - expected);
+            }
+            batch.push_back(std::move(r));
+        }
+
+        if (blocked_producers_ != 0) {
+            std::lock_guard<std::mutex> lock(wait_mutex_);
+            space_cv_.notify_all();
+        }
+
+        PushReordered(batch);
+        WriteOrdered();
+        WriteMetrics(metric_queue_.Capacity());
+        FlushRollups(false);
+    }
+    // Производителей больше нет: вытесненные после последнего пакета
+    // занимают оставшиеся номера
+    reorder_.Skip(queue_.PoppedCount() - reorder_.Pushed());
+    reorder_.DrainAll(ordered_);
+    WriteOrdered();
+    WriteMetrics(metric_queue_.Capacity());
+    FlushRollups(true);
+    storage_->Checkpoint();
+    rollups_->Checkpoint();
+    metric_store_->Checkpoint();
+    if (journal_) {
+        journal_->Release(unreleased_, unreleased_metrics_);
+        unreleased_ = 0;
+        unreleased_metrics_ = 0;
+    }
+}
+
+void DataBase::PushReordered(std::vector<DeviceState>& batch) {
+    if (batch.empty()) {
+        return;
+    }
+    if (const size_t unordered = reorder_.Push(batch, std::chrono::system_clock::now(), ordered_)) {
+        metrics::Increment(metrics::Counter::kReadingsUnordered, unordered);
+    }
+    batch.clear();
+}
+
+// Отдает хранилищу показания, которые буфер переупорядочивания уже выпустил.
+// Журнал освобождается только по сплошному началу очереди.
+void DataBase::WriteOrdered() {
+    InsertBatch(ordered_);
+    ordered_.clear();
+    const uint64_t prefix = reorder_.EmittedPrefix();
+    ReleaseJournal(prefix - released_prefix_, 0);
+    released_prefix_ = prefix;
+}
+
+// Значения метрик - отдельной транзакцией в sensor_metrics, не больше limit за вызов.
+// Незаписанный пакет остается в metric_batch_ и в журнале до следующего вызова:
+// журнал освобождается по порядку, и отпустить его значения раньше нельзя.
+void DataBase::WriteMetrics(size_t limit) {
+    MetricSample sample;
+    while (metric_batch_.size() < limit && metric_queue_.TryPop(sample)) {
+        metric_batch_.push_back(sample);
+    }
+    if (metric_batch_.empty()) {
+        return;
+    }
+    if (!metric_store_->Write(metric_batch_)) {
+        metrics_failed_.fetch_add(metric_batch_.size(), std::memory_order_relaxed);
+        return;
+    }
+    metrics::Increment(metrics::Counter::kMetricValuesCommitted, metric_batch_.size());
+    metrics_persisted_.fetch_add(metric_batch_.size(), std::memory_order_relaxed);
+    ReleaseJournal(0, metric_batch_.size());
+    metric_batch_.clear();
+}
+
+// Пакет целиком отдается хранилищу: для SQLite это одна транзакция
+void DataBase::InsertBatch(const std::vector<DeviceState>& batch) {
+    if (batch.empty()) {
+        return;
+    }
+
+    {
+        metrics::ScopedTimer timer(metrics::Stage::kDbCommit);
+        if (storage_->WriteBatch(batch)) {
+            metrics::Increment(metrics::Counter::kDbRowsCommitted, batch.size());
+            persisted_.fetch_add(batch.size(), std::memory_order_relaxed);
+        } else {
+            failed_.fetch_add(batch.size(), std::memory_order_relaxed);
+        }
+    }
+
+    for (const auto& r : batch) {
+        rollup_accumulator_.Add(r, closed_rollups_);
+    }
+}
+
+// Закрытые интервалы свертки пишутся после пакета; раз в секунду закрываются
+// интервалы устройств, переставших присылать показания
+void DataBase::FlushRollups(bool all) {
+    const int64_t now_ms = ToMs(std::chrono::system_clock::now());
+    const int64_t closed_before = all ? std::numeric_limits<int64_t>::max() : now_ms - options_.rollup_grace.count();
+    const bool sweep = all || now_ms - last_sweep_ms_ >= 1000;
+    if (sweep) {
+        rollup_accumulator_.Sweep(closed_before, closed_rollups_);
+        last_sweep_ms_ = now_ms;
+    }
+
+    // Отметка уровня сдвигается только вместе с записью его закрытых
+    // интервалов и сохраняется в той же транзакции. Если запись не прошла,
+    // строки ждут следующей попытки, а их интервалы читаются из хранилища
+    // показаний.
+    std::array<int64_t, ROLLUP_TIERS> watermark;
+    bool advanced = false;
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        watermark[t] = rollup_watermark_ms_[t].load(std::memory_order_relaxed);
+        if (sweep && !all) {
+            const int64_t next = FloorTo(closed_before, ROLLUP_WIDTH_MS[t]);
+            advanced |= next != watermark[t];
+            watermark[t] = next;
+        }
+    }
+    if (closed_rollups_.empty() && !advanced) {
+        return;
+    }
+    if (!rollups_->Write(closed_rollups_, watermark)) {
+        return;
+    }
+    metrics::Increment(metrics::Counter::kRollupRowsWritten, closed_rollups_.size());
+    closed_rollups_.clear();
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        rollup_watermark_ms_[t].store(watermark[t], std::memory_order_release);
+    }
+}
+
+// Открытые интервалы свертки живут только в памяти писателя, а журнал
+// отпускает показания, как только они в хранилище. Все интервалы после
+// сохраненной отметки собираются заново из показаний хранилища: строки,
+// которые успели закрыться в прошлом запуске, удаляются и пишутся снова.
+// До приема новых показаний и до повтора журнала.
+void DataBase::RestoreRollups() {
+    int64_t from_ms = std::numeric_limits<int64_t>::max();
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        from_ms = std::min(from_ms, rollups_->WrittenBefore(static_cast<RollupTier>(t)));
+    }
+    if (!rollups_->Discard(from_ms)) {
+        throw std::runtime_error("rollup restore: cannot discard rows after the watermark");
+    }
+
+    size_t restored = 0;
+    storage_->ScanFrom(std::chrono::system_clock::time_point(std::chrono::milliseconds(from_ms)),
+                       [this, &restored](const DeviceState& state) {
+        rollup_accumulator_.Add(state, closed_rollups_);
+        ++restored;
+    });
+    // Отметка новой базы - начало свертки, оно еще впереди
+    const int64_t written_ms = std::min(from_ms, ToMs(std::chrono::system_clock::now()));
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        rollup_watermark_ms_[t].store(FloorTo(written_ms, ROLLUP_WIDTH_MS[t]), std::memory_order_release);
+    }
+    if (restored != 0) {
+        LOG_INFO("Rollups: {} readings since {} ms folded back into open intervals", restored, from_ms);
+    }
+}
+
+std::vector<AggregatedPoint> DataBase::Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                                 std::chrono::system_clock::time_point to,
+                                                 std::chrono::milliseconds bucket, Aggregation aggregation) const {
+    using std::chrono::milliseconds;
+    using std::chrono::system_clock;
+
+    // Самый крупный уровень, из интервалов которого складывается bucket
+    const int64_t bucket_ms = bucket.count();
+    int tier = -1;
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        if (bucket_ms > 0 && bucket_ms % ROLLUP_WIDTH_MS[t] == 0) {
+            tier = static_cast<int>(t);
+        }
+    }
+    if (tier < 0) {
+        return storage_->Aggregate(id, from, to, bucket, aggregation);
+    }
+
+    // [from, head) - неполный первый интервал и все, что раньше начала
+    // свертки, [head, middle) - целые интервалы из таблиц свертки,
+    // [middle, end) - еще не свернутый хвост
+    const int64_t from_ms = ToMs(from);
+    const int64_t end_ms = ToMs(to) + 1;
+    const int64_t watermark = rollup_watermark_ms_[tier].load(std::memory_order_acquire);
+    const int64_t covered_ms = std::max(from_ms, rollups_->CoveredFrom(static_cast<RollupTier>(tier)));
+    const int64_t head_ms = covered_ms >= end_ms ? end_ms : std::min(end_ms, FloorTo(covered_ms + bucket_ms - 1, bucket_ms));
+    const int64_t middle_ms = std::max(head_ms, std::min(FloorTo(watermark, bucket_ms), FloorTo(end_ms, bucket_ms)));
+
+    auto raw = [&](int64_t begin, int64_t end, std::vector<AggregatedPoint>& out) {
+        if (begin < end) {
+            auto points = storage_->Aggregate(id, system_clock::time_point(milliseconds(begin)),
+                                              system_clock::time_point(milliseconds(end - 1)), bucket, aggregation);
+            out.insert(out.end(), points.begin(), points.end());
+        }
+    };
+
+    std::vector<AggregatedPoint> points;
+    raw(from_ms, head_ms, points);
+    if (head_ms < middle_ms) {
+        auto rolled = rollups_->Aggregate(static_cast<RollupTier>(tier), id, head_ms, middle_ms, bucket_ms, aggregation);
+        points.insert(points.end(), rolled.begin(), rolled.end());
+    }
+    raw(middle_ms, end_ms, points);
+    return points;
 }
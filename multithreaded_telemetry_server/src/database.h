@@ -1,34 +1,166 @@
 #pragma once
 
 #include "device.h"
+#include "journal.h"
+#include "metric_schema.h"
+#include "metric_store.h"
+#include "mpsc_queue.h"
+#include "reorder_buffer.h"
+#include "rollup.h"
+#include "rollup_store.h"
+#include "storage.h"
+#include <array>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <condition_variable>
 #include <optional>
-#include <sqlite3.h>
 #include <string>
+#include <thread>
 #include <vector>
-#include <queue>
 #include <atomic>
 
+// Что делать с новым показанием, если очередь записи заполнена
+enum class OverflowPolicy {
+    kBlock,         // Ждать, пока писатель освободит место (противодавление на устройство)
+    kDropOldest,    // Вытеснить самое старое показание из очереди
+    kReject         // Отказать: вызывающий отвечает устройству NACK
+};
+
+// Куда писать показания
+enum class StorageKind {
+    kSqlite,        // Строки таблицы sensor_data (path)
+    kChunks         // Столбцовые сжатые чанки по устройствам (chunk_dir)
+};
+
+struct DataBaseOptions {
+    StorageKind storage = StorageKind::kSqlite;
+    std::string path = "example.db";
+    std::string chunk_dir = "chunks";
+    std::string rollup_path;                        // Пусто: path для SQLite, chunk_dir/rollups.db для чанков
+    std::string metric_path;                        // Пусто: path для SQLite, chunk_dir/metrics.db для чанков
+    std::chrono::milliseconds rollup_grace{5000};   // Сколько ждать опоздавших показаний перед закрытием интервала
+    size_t batch_size = 4096;                       // Максимум строк в одной транзакции
+    std::chrono::milliseconds batch_timeout{50};    // Сколько ждать заполнения пакета
+    std::string synchronous = "NORMAL";             // PRAGMA synchronous: OFF, NORMAL, FULL
+    int cache_size_kib = 16 * 1024;                 // PRAGMA cache_size
+    size_t queue_capacity = 64 * 1024;              // Степень двойки
+    size_t metric_queue_capacity = 64 * 1024;       // Значения дополнительных метрик; степень двойки
+    OverflowPolicy overflow_policy = OverflowPolicy::kBlock;
+    std::string journal_dir = "journal";            // Журнал приема; пусто - без журнала
+    // Хранилище, которое не доводит пакет до диска само (чанки, SQLite
+    // с synchronous ниже FULL), получает Checkpoint, когда журнал дорастает
+    // до стольких сегментов; только после этого журнал освобождается
+    size_t journal_checkpoint_segments = 4;
+    // Сколько писатель держит показания, чтобы отдать хранилищу по времени
+    // устройства (reorder_buffer.h); 0 - в порядке очереди
+    std::chrono::milliseconds reorder_window{2000};
+    size_t reorder_capacity = 64 * 1024;
+    // Память писателя (открытые интервалы свертки); используется только из
+    // потока писателя. nullptr - собственный пул без блокировок.
+    std::pmr::memory_resource *memory_resource = nullptr;
+};
+
 class DataBase {
 public:
-    DataBase();
+    // ids не константна: хранилище чанков интернирует имена устройств из файлов.
+    // schema - имена метрик для sensor_metrics и журнала.
+    DataBase(DeviceIdTable& ids, MetricSchema& schema, DataBaseOptions options = {});
     ~DataBase();
 
-    void InsertReadingDataDevice(DeviceState read_data_device);
+    // false, если показание не принято (только при OverflowPolicy::kReject)
+    bool InsertReadingDataDevice(DeviceState read_data_device);
+
+    // Ставит показания в очередь по порядку; accepted[i] - принято ли
+    // readings[i]. С журналом возвращается, когда принятые показания
+    // записаны в журнал на диске: после этого их можно подтверждать.
+    // Один вызов на пакет - один общий fdatasync.
+    //
+    // extras - значения дополнительных метрик показаний подряд, первые
+    // extra_counts[0] относятся к readings[0] и так далее. Они идут только
+    // с принятым показанием и никогда не задерживают его: при заполненной
+    // очереди метрик значения отбрасываются и учитываются в MetricsDropped.
+    void InsertReadings(const std::vector<DeviceState>& readings, std::vector<uint8_t>& accepted,
+                        const std::vector<MetricSample>& extras = {}, const std::vector<uint16_t>& extra_counts = {});
+
+    // Дописывает всю очередь крупными пакетами, сбрасывает свертки, делает
+    // checkpoint хранилищ и останавливает писателя. Новые показания после
+    // этого не принимаются. Вызывать, когда циклы событий уже остановлены:
+    // показание, вставленное одновременно со Stop, может не попасть в базу.
+    // Повторный вызов ничего не делает.
+    void Stop();
+
+    size_t QueueDepth() const { return queue_.Depth(); }
+    size_t QueueHighWaterMark() const { return queue_.HighWaterMark(); }
+    size_t DroppedCount() const { return dropped_.load(std::memory_order_relaxed); }
+    size_t RejectedCount() const { return rejected_.load(std::memory_order_relaxed); }
+    size_t PersistedCount() const { return persisted_.load(std::memory_order_relaxed); }
+    size_t FailedCount() const { return failed_.load(std::memory_order_relaxed); }
+    size_t MetricsDropped() const { return metrics_dropped_.load(std::memory_order_relaxed); }
+    size_t MetricsPersisted() const { return metrics_persisted_.load(std::memory_order_relaxed); }
+    size_t MetricsFailed() const { return metrics_failed_.load(std::memory_order_relaxed); }
+
+    // Запрос из любого потока; показания, еще ждущие в очереди или в буфере
+    // переупорядочивания, не видны.
+    // Интервал, кратный минуте или часу, читается из таблиц свертки там,
+    // где они уже записаны, остальное - из хранилища показаний.
+    std::vector<AggregatedPoint> Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                           std::chrono::system_clock::time_point to,
+                                           std::chrono::milliseconds bucket, Aggregation aggregation) const;
 
 private:
-    sqlite3* db_;
-    std::mutex queue_mutex_;
-    std::queue<DeviceState> queue_;
+    DataBaseOptions options_;
+    std::unique_ptr<Storage> storage_;
+    std::unique_ptr<RollupStore> rollups_;
+    std::unique_ptr<MetricStore> metric_store_;
+    std::pmr::unsynchronized_pool_resource writer_pool_;
+    RollupAccumulator rollup_accumulator_;          // Только поток писателя
+    ReorderBuffer reorder_;                         // Только поток писателя
+    std::vector<DeviceState> ordered_;
+    uint64_t released_prefix_ = 0;                  // EmittedPrefix, уже учтенный в журнале
+    std::vector<RollupRow> closed_rollups_;
+    int64_t last_sweep_ms_ = 0;
+    // Все интервалы уровня, закончившиеся до этой метки, уже в таблице свертки
+    std::array<std::atomic<int64_t>, ROLLUP_TIERS> rollup_watermark_ms_ {};
+    BoundedMpscQueue<DeviceState> queue_;
+    std::atomic<size_t> dropped_{0};        // Вытеснены из очереди (kDropOldest)
+    std::atomic<size_t> rejected_{0};       // Не приняты, устройство получило Err
+    std::atomic<size_t> persisted_{0};      // Зафиксированы хранилищем
+    std::atomic<size_t> failed_{0};         // Потеряны в пакетах, которые хранилище не записало
+    BoundedMpscQueue<MetricSample> metric_queue_;
+    std::vector<MetricSample> metric_batch_;    // Только поток писателя
+    std::atomic<size_t> metrics_dropped_{0};    // Не поместились в очередь метрик
+    std::atomic<size_t> metrics_persisted_{0};
+    std::atomic<size_t> metrics_failed_{0};     // В неудачных записях: остаются в журнале, пишутся повторно
+
+    std::unique_ptr<IngestJournal> journal_;
+    // Очередь и журнал заполняются под одной блокировкой, чтобы порядок записей
+    // журнала совпадал с порядком очереди
+    std::mutex ingest_mutex_;
+    uint64_t unreleased_ = 0;                   // Только поток писателя: записаны, ждут Checkpoint
+    uint64_t unreleased_metrics_ = 0;
+
+    // Мьютекс и условные переменные нужны только для сна: писателя при пустой
+    // очереди и производителей при заполненной (политика kBlock)
+    std::mutex wait_mutex_;
     std::condition_variable cv_;
+    std::condition_variable space_cv_;
+    std::atomic<size_t> wake_threshold_{0};     // Глубина, при которой будить писателя; 0 - не спит
+    std::atomic<size_t> blocked_producers_{0};
     std::thread worker_;
     std::atomic<bool> stop_;
-    int rc_;                      // Сохраняем результат открытия базы
-    char* messaggeError_;
 
+    bool Enqueue(const DeviceState& state);
+    bool EnqueueMetric(const MetricSample& sample);
+    void ReleaseJournal(size_t written, size_t metrics_written);
     void WorkerThread();
-    void CreateTable();
-    void Insert(const DeviceState&& r);
-    void CheckDbError();
+    void WaitForDepth(size_t depth, std::chrono::milliseconds timeout);
+    void WaitForSpace();
+    void InsertBatch(const std::vector<DeviceState>& batch);
+    void PushReordered(std::vector<DeviceState>& batch);
+    void WriteOrdered();
+    void WriteMetrics(size_t limit);
+    void FlushRollups(bool all);
+    void RestoreRollups();
 };
@@ -0,0 +1,93 @@
+#include "dedup.h"
+
+#include <thread>
+
+namespace {
+
+class WindowLock {
+public:
+    explicit WindowLock(std::atomic<uint32_t>& lock) : lock_(lock) {
+        while (lock_.exchange(1, std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+    ~WindowLock() { lock_.store(0, std::memory_order_release); }
+
+    WindowLock(const WindowLock&) = delete;
+    WindowLock &operator=(const WindowLock&) = delete;
+
+private:
+    std::atomic<uint32_t>& lock_;
+};
+
+} // namespace
+
+DuplicateFilter::~DuplicateFilter() {
+    for (auto& segment : segments_) {
+        delete[] segment.load(std::memory_order_relaxed);
+    }
+}
+
+DuplicateFilter::Window& DuplicateFilter::Slot(DeviceId id) {
+    auto& segment_ptr = segments_[id / SEGMENT_SIZE];
+    Window *segment = segment_ptr.load(std::memory_order_acquire);
+    if (segment == nullptr) {
+        auto *fresh = new Window[SEGMENT_SIZE];
+        if (segment_ptr.compare_exchange_strong(segment, fresh, std::memory_order_acq_rel)) {
+            segment = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+    return segment[id % SEGMENT_SIZE];
+}
+
+// false, если seq уже принимался; под блокировкой окна
+bool DuplicateFilter::Mark(Window& window, uint32_t seq) {
+    if (window.highest_ == 0 || seq > window.highest_) {
+        const uint32_t shift = window.highest_ == 0 ? WINDOW : seq - window.highest_;
+        window.seen_ = (shift >= WINDOW ? 0 : window.seen_ << shift) | 1;
+        window.highest_ = seq;
+        return true;
+    }
+    const uint32_t offset = window.highest_ - seq;
+    if (offset >= RESTART_GAP) {
+        window.seen_ = 1;
+        window.highest_ = seq;
+        return true;
+    }
+    if (offset >= WINDOW || (window.seen_ >> offset & 1) != 0) {
+        return false;
+    }
+    window.seen_ |= uint64_t{1} << offset;
+    return true;
+}
+
+size_t DuplicateFilter::Admit(const std::vector<DeviceState>& readings, std::vector<uint8_t>& duplicates) {
+    duplicates.assign(readings.size(), 0);
+    size_t count = 0;
+    for (size_t i = 0; i < readings.size(); ++i) {
+        const DeviceState& state = readings[i];
+        if (state.seq_ == 0) {
+            continue;
+        }
+        Window& window = Slot(state.device_id_);
+        WindowLock lock(window.lock_);
+        if (!Mark(window, state.seq_)) {
+            duplicates[i] = 1;
+            ++count;
+        }
+    }
+    return count;
+}
+
+void DuplicateFilter::Forget(const DeviceState& state) {
+    if (state.seq_ == 0) {
+        return;
+    }
+    Window& window = Slot(state.device_id_);
+    WindowLock lock(window.lock_);
+    if (state.seq_ <= window.highest_ && window.highest_ - state.seq_ < WINDOW) {
+        window.seen_ &= ~(uint64_t{1} << (window.highest_ - state.seq_));
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "device.h"
+#include "intern_table.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Окно идемпотентности по устройствам. Устройство, не получившее Ok,
+// повторяет показание с тем же seq; повтор отсеивается до проверки,
+// реестра и базы и получает Ok, как и первая попытка.
+//
+// На устройство - наибольший принятый номер и битовая маска WINDOW номеров
+// под ним (как окно защиты от повторов в IPsec). Номер в окне сверяется
+// с маской, поэтому показания, пришедшие не по порядку, принимаются один
+// раз. Номер ниже окна считается повтором; номер ниже на RESTART_GAP
+// и больше - новым счетом после перезапуска устройства, окно начинается
+// заново. Показания без seq проходят без проверки.
+//
+// Окна лежат в плотном массиве по DeviceId, у каждого своя спин-блокировка:
+// соединения разных устройств не мешают друг другу.
+class DuplicateFilter {
+public:
+    static constexpr uint32_t WINDOW = 64;
+    static constexpr uint32_t RESTART_GAP = 1 << 16;
+
+    DuplicateFilter() = default;
+    ~DuplicateFilter();
+
+    DuplicateFilter(const DuplicateFilter&) = delete;
+    DuplicateFilter &operator=(const DuplicateFilter&) = delete;
+
+    // duplicates[i] = 1, если readings[i] - повтор. Остальные отмечаются
+    // в окне; повтор внутри пакета тоже отсеивается. Возвращает число повторов.
+    size_t Admit(const std::vector<DeviceState>& readings, std::vector<uint8_t>& duplicates);
+
+    // Снимает отметку с показания, которое после Admit не было принято
+    // (отклонено проверкой или базой): его повтор должен пройти
+    void Forget(const DeviceState& state);
+
+private:
+    static constexpr size_t SEGMENT_SIZE = 4096;
+    static constexpr size_t MAX_SEGMENTS = 4096;    // Как в DeviceIdTable
+
+    struct Window {
+        std::atomic<uint32_t> lock_{0};
+        uint32_t highest_ = 0;      // 0 - номеров еще не было
+        uint64_t seen_ = 0;         // Бит k - принят номер highest_ - k
+    };
+
+    std::atomic<Window*> segments_[MAX_SEGMENTS]{};     // Создаются по мере роста DeviceId
+
+    Window& Slot(DeviceId id);
+    static bool Mark(Window& window, uint32_t seq);
+};
@@ -1,54 +1,414 @@
 #pragma once
 
+#include "cache_line.h"
+#include "intern_table.h"
+#include "seqlock.h"
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <optional>
 #include <shared_mutex>
-#include <string>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+// Запись показания, которая идет по горячему пути: в реестр, в очередь
+// записи и обратно из GetDevice. Тривиально копируемая, без строк:
+// имя устройства восстанавливается через DeviceIdTable только на границах
+// (SQL, запросы).
 struct DeviceState {
-    std::string device_id_;
+    DeviceId device_id_ = INVALID_DEVICE_ID;
+    uint32_t seq_ = 0;              // Номер показания у устройства; 0 - устройство его не присылает
     double temperature_ = 0.0;
     double humidity_ = 0.0;
     double pressure_ = 0.0;
     std::chrono::system_clock::time_point last_update_;
+};
 
-    bool IsStale() const {
-        auto now = std::chrono::system_clock::now();
-        return (now - last_update_) > std::chrono::minutes(5);
-    }
+static_assert(std::is_trivially_copyable_v<DeviceState>);
+static_assert(sizeof(DeviceState) <= 40);
+
+// Какие из temp, hum, press устройство прислало в показании. В DeviceState
+// места нет, маска идет рядом с ним; непереданное поле равно 0.0.
+constexpr uint8_t FIELD_TEMPERATURE = 1 << 0;
+constexpr uint8_t FIELD_HUMIDITY = 1 << 1;
+constexpr uint8_t FIELD_PRESSURE = 1 << 2;
+constexpr uint8_t ALL_FIELDS = FIELD_TEMPERATURE | FIELD_HUMIDITY | FIELD_PRESSURE;
+
+// Метка времени устройства ограничена, чтобы не переполнить наносекунды time_point
+constexpr int64_t MAX_DEVICE_TIMESTAMP_MS = (int64_t{1} << 33) * 1000;
+
+// Сроки, после которых устройство без показаний считается устаревшим и удаляется
+struct DeviceExpiry {
+    std::chrono::seconds stale_after{300};
+    std::chrono::seconds evict_after{3600};     // Не меньше stale_after
+};
+
+// Устройство в снимке реестра: последнее показание и сколько секунд
+// устройство молчало к моменту снимка
+struct DeviceRecord {
+    DeviceState state_;
+    uint32_t idle_s_ = 0;
+};
+
+enum class DeviceEvent {
+    kStale,         // Нет показаний дольше stale_after
+    kEvicted        // Нет показаний дольше evict_after, устройство удалено из реестра
 };
 
+// Реестр последних показаний, разбитый на шарды по идентификатору устройства.
+// Каждый шард выровнен по строке кэша и имеет свой shared_mutex, который
+// защищает только структуру хеш-таблицы. Показания устройства лежат под
+// seqlock: обновление известного устройства и чтение берут лишь разделяемую
+// блокировку шарда, эксклюзивная нужна только при появлении нового устройства.
+//
+// Устаревание отслеживает колесо таймеров с тиком в секунду: у каждого
+// устройства один таймер на ближайший срок. Обновление лишь записывает
+// в запись устройства текущий тик (его ведет Sweep), без вызова часов
+// и без обращения к колесу. Сработавший таймер сверяет срок с последним
+// тиком и либо переставляется, либо помечает устройство устаревшим или
+// удаляет его. Так Sweep обходит только сработавшие таймеры, а не весь реестр.
+//
+// Шарды и записи устройств берутся из resource: записи лежат прямо в узлах
+// хеш-таблицы, одно выделение на новое устройство. Ресурс должен быть
+// потокобезопасным, реестр обновляют все циклы событий.
+//
+// Отсчет тиков начинается не с нуля, а с evict_after: устройству из снимка
+// (Restore) записывается тик в прошлом, и сроки идут от его последнего
+// показания, а не от запуска процесса.
 class DeviceRegistry {
 public:
-    void UpdateDevice(const DeviceState &state) {
-        std::unique_lock lock(mutex_);
-        devices_[state.device_id_] = state;
+    using ExpiryHandler = std::function<void(DeviceId, DeviceEvent)>;
+    using UpdateHandler = std::function<void(const DeviceState&)>;
+
+    explicit DeviceRegistry(const DeviceIdTable& ids, size_t shard_count = 64, DeviceExpiry expiry = {},
+                            std::pmr::memory_resource *resource = std::pmr::new_delete_resource())
+        : ids_(ids), shards_(shard_count, resource), shard_mask_(shard_count - 1), expiry_(expiry),
+          epoch_(std::chrono::steady_clock::now() - expiry.evict_after),
+          now_tick_(static_cast<uint64_t>(std::max<int64_t>(0, expiry.evict_after.count()))),
+          wheel_(now_tick_.load(std::memory_order_relaxed)) {
+        if (shard_count == 0 || (shard_count & shard_mask_) != 0) {
+            throw std::invalid_argument("DeviceRegistry shard count must be a power of two");
+        }
+        if (expiry.stale_after.count() <= 0 || expiry.evict_after < expiry.stale_after) {
+            throw std::invalid_argument("DeviceRegistry expiry: need 0 < stale_after <= evict_after");
+        }
+    }
+
+    // Вызывается из потока Sweep, без блокировок реестра
+    void SetExpiryHandler(ExpiryHandler handler) { expiry_handler_ = std::move(handler); }
+
+    // Вызывается после каждого обновления, в потоке обновления и без
+    // блокировок реестра. Устанавливается до начала приема.
+    void SetUpdateHandler(UpdateHandler handler) { update_handler_ = std::move(handler); }
+
+    // Показание с меткой старше сохраненной (задержанный повтор, ts=
+    // устройства) не откатывает состояние назад: устройство отмечается
+    // живым, но реестр и подписчики его не видят. Возвращает, записано ли.
+    bool UpdateDevice(const DeviceState &state) {
+        if (!Store(state)) {
+            return false;
+        }
+        if (update_handler_) {
+            update_handler_(state);
+        }
+        return true;
     }
 
-    std::optional<DeviceState> GetDevice(const std::string &id) const {
-        std::shared_lock lock(mutex_);
-        auto it = devices_.find(id);
-        if (it != devices_.end()) {
-            return it->second;
+    std::optional<DeviceState> GetDevice(DeviceId id) const {
+        const Shard& shard = ShardFor(id);
+        std::shared_lock lock(shard.mutex_);
+        auto it = shard.devices_.find(id);
+        if (it != shard.devices_.end()) {
+            return it->second.state_.Load();
         }
         return std::nullopt;
     }
 
-    std::vector<DeviceState> GerAllDevices() const {
-        std::shared_lock lock(mutex_);
-        std::vector<DeviceState> result;
-        result.reserve(devices_.size());
-        for (const auto& [_, state] : devices_) {
-            result.push_back(state);
+    std::optional<DeviceState> GetDevice(std::string_view name) const {
+        if (auto id = ids_.Find(name)) {
+            return GetDevice(*id);
+        }
+        return std::nullopt;
+    }
+
+    // Обходит устройства шард за шардом, не копируя реестр целиком.
+    // На время обхода шарда держится его разделяемая блокировка: обновления
+    // известных устройств идут параллельно, ждет только добавление новых.
+    template <typename F>
+    void ForEachDevice(F&& visit) const {
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            const Shard& shard = shards_[i];
+            std::shared_lock lock(shard.mutex_);
+            for (const auto& [_, entry] : shard.devices_) {
+                visit(entry.state_.Load());
+            }
+        }
+    }
+
+    size_t ShardCount() const { return shard_mask_ + 1; }
+
+    // Дописывает в out копии устройств шарда index для снимка. Разделяемая
+    // блокировка шарда держится только на время копирования.
+    void CopyShard(size_t index, std::vector<DeviceRecord>& out) const {
+        const uint64_t tick = now_tick_.load(std::memory_order_relaxed);
+        const Shard& shard = shards_[index];
+        std::shared_lock lock(shard.mutex_);
+        out.reserve(out.size() + shard.devices_.size());
+        for (const auto& [_, entry] : shard.devices_) {
+            const uint64_t last_seen = entry.last_seen_tick_.load(std::memory_order_relaxed);
+            const uint64_t idle = tick > last_seen ? tick - last_seen : 0;
+            out.push_back(DeviceRecord{entry.state_.Load(), static_cast<uint32_t>(std::min<uint64_t>(idle, UINT32_MAX))});
+        }
+    }
+
+    // Готовит шарды к count новым устройствам, до Restore
+    void Reserve(size_t count) {
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            std::unique_lock lock(shards_[i].mutex_);
+            shards_[i].devices_.reserve(shards_[i].devices_.size() + count / (shard_mask_ + 1) +
+                                        count / (4 * (shard_mask_ + 1)));
+        }
+    }
+
+    // Загружает устройства из снимка: до начала приема, можно из нескольких
+    // потоков сразу. Устройство, молчавшее дольше evict_after, пропускается,
+    // дольше stale_after - загружается устаревшим. update_handler_ не
+    // вызывается. Возвращает число загруженных устройств.
+    size_t Restore(const std::vector<DeviceRecord>& records) {
+        const uint64_t tick = now_tick_.load(std::memory_order_relaxed);
+        const auto stale_ticks = static_cast<uint64_t>(expiry_.stale_after.count());
+        const auto evict_ticks = static_cast<uint64_t>(expiry_.evict_after.count());
+
+        // Раскладка по шардам, чтобы брать блокировку шарда один раз
+        std::vector<std::vector<const DeviceRecord*>> by_shard(shard_mask_ + 1);
+        for (const auto& record : records) {
+            if (record.idle_s_ < evict_ticks && record.state_.device_id_ != INVALID_DEVICE_ID) {
+                by_shard[ShardIndex(record.state_.device_id_)].push_back(&record);
+            }
+        }
+
+        size_t restored = 0;
+        int64_t live = 0;
+        int64_t stale = 0;
+        std::vector<std::pair<uint64_t, DeviceId>> deadlines;
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            if (by_shard[i].empty()) {
+                continue;
+            }
+            Shard& shard = shards_[i];
+            std::unique_lock lock(shard.mutex_);
+            for (const DeviceRecord *record : by_shard[i]) {
+                const DeviceId id = record->state_.device_id_;
+                auto [it, inserted] = shard.devices_.try_emplace(id);
+                if (!inserted) {
+                    continue;
+                }
+                const uint64_t last_seen = tick - record->idle_s_;
+                const bool is_stale = record->idle_s_ >= stale_ticks;
+                it->second.state_.Store(record->state_);
+                it->second.last_seen_tick_.store(last_seen, std::memory_order_relaxed);
+                it->second.stale_.store(is_stale, std::memory_order_relaxed);
+                ++(is_stale ? stale : live);
+                deadlines.emplace_back(last_seen + (is_stale ? evict_ticks : stale_ticks), id);
+                ++restored;
+            }
+        }
+        live_.fetch_add(live, std::memory_order_relaxed);
+        stale_.fetch_add(stale, std::memory_order_relaxed);
+
+        std::lock_guard lock(wheel_mutex_);
+        for (const auto& [deadline, id] : deadlines) {
+            wheel_.Schedule(deadline, id);
+        }
+        return restored;
+    }
+
+    size_t Size() const {
+        size_t size = 0;
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            std::shared_lock lock(shards_[i].mutex_);
+            size += shards_[i].devices_.size();
+        }
+        return size;
+    }
+
+    // Счетчики без обхода шардов; на время гонки обновления с Sweep
+    // устройство может ненадолго числиться устаревшим
+    size_t LiveCount() const { return static_cast<size_t>(std::max<int64_t>(0, live_.load(std::memory_order_relaxed))); }
+    size_t StaleCount() const { return static_cast<size_t>(std::max<int64_t>(0, stale_.load(std::memory_order_relaxed))); }
+
+    // Продвигает колесо до now. Вызывается периодически из одного потока.
+    void Sweep(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        const auto tick = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(now - epoch_).count());
+        now_tick_.store(tick, std::memory_order_relaxed);
+        {
+            std::lock_guard lock(wheel_mutex_);
+            wheel_.Advance(tick, [this](DeviceId id) { fired_.push_back(id); });
+        }
+
+        rescheduled_.clear();
+        for (DeviceId id : fired_) {
+            if (auto event = Expire(id, tick); event && expiry_handler_) {
+                expiry_handler_(id, *event);
+            }
+        }
+        fired_.clear();
+
+        std::lock_guard lock(wheel_mutex_);
+        for (const auto& [deadline, id] : rescheduled_) {
+            wheel_.Schedule(deadline, id);
         }
-        return result;
     }
 
 private:
-    std::unordered_map<std::string, DeviceState> devices_;
-    
-    mutable std::shared_mutex mutex_;
-};
\ No newline at end of file
+    struct alignas(CACHE_LINE_SIZE) Entry {
+        SeqLock<DeviceState> state_;
+        std::atomic<uint64_t> last_seen_tick_{0};
+        std::atomic<bool> stale_{false};
+    };
+    static_assert(sizeof(Entry) == CACHE_LINE_SIZE);
+
+    // Узлы таблицы не перемещаются при рехешировании, ссылки на Entry
+    // остаются действительными до удаления устройства
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        // pmr::vector передает свой ресурс каждому шарду при создании
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+
+        explicit Shard(const allocator_type& allocator) : devices_(allocator) {}
+
+        mutable std::shared_mutex mutex_;
+        std::pmr::unordered_map<DeviceId, Entry> devices_;
+    };
+
+    const DeviceIdTable& ids_;
+    mutable std::pmr::vector<Shard> shards_;
+    const size_t shard_mask_;
+
+    const DeviceExpiry expiry_;
+    ExpiryHandler expiry_handler_;
+    UpdateHandler update_handler_;
+    const std::chrono::steady_clock::time_point epoch_;
+    std::atomic<uint64_t> now_tick_;            // Секунды от epoch_ на момент последнего Sweep
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> live_{0};
+    std::atomic<int64_t> stale_{0};
+
+    std::mutex wheel_mutex_;                    // Sweep и добавление новых устройств
+    TimerWheel<DeviceId> wheel_;
+    std::vector<DeviceId> fired_;               // Только поток Sweep
+    std::vector<std::pair<uint64_t, DeviceId>> rescheduled_;
+
+    // Запись в реестр без вызова update_handler_; false, если показание старше сохраненного
+    bool Store(const DeviceState &state) {
+        Shard& shard = ShardFor(state.device_id_);
+        {
+            std::shared_lock lock(shard.mutex_);
+            auto it = shard.devices_.find(state.device_id_);
+            if (it != shard.devices_.end()) {
+                Touch(it->second);
+                return StoreNewer(it->second, state);
+            }
+        }
+        std::unique_lock lock(shard.mutex_);
+        auto [it, inserted] = shard.devices_.try_emplace(state.device_id_);
+        if (inserted) {
+            const uint64_t tick = now_tick_.load(std::memory_order_relaxed);
+            it->second.last_seen_tick_.store(tick, std::memory_order_relaxed);
+            live_.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard wheel_lock(wheel_mutex_);
+            wheel_.Schedule(tick + expiry_.stale_after.count(), state.device_id_);
+        } else {
+            Touch(it->second);
+            return StoreNewer(it->second, state);
+        }
+        it->second.state_.Store(state);
+        return true;
+    }
+
+    static bool StoreNewer(Entry& entry, const DeviceState& state) {
+        return entry.state_.StoreIf(state, [&state](const DeviceState& current) {
+            return state.last_update_ >= current.last_update_;
+        });
+    }
+
+    // Горячий путь: запись тика и, редко, возврат устаревшего устройства в живые
+    void Touch(Entry& entry) {
+        const uint64_t tick = now_tick_.load(std::memory_order_relaxed);
+        if (entry.last_seen_tick_.load(std::memory_order_relaxed) != tick) {
+            entry.last_seen_tick_.store(tick, std::memory_order_relaxed);
+        }
+        if (entry.stale_.load(std::memory_order_relaxed) && entry.stale_.exchange(false, std::memory_order_relaxed)) {
+            stale_.fetch_sub(1, std::memory_order_relaxed);
+            live_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Сработал таймер устройства: переставить его, пометить устройство
+    // устаревшим или удалить. Возвращает событие для обработчика.
+    std::optional<DeviceEvent> Expire(DeviceId id, uint64_t tick) {
+        const auto stale_ticks = static_cast<uint64_t>(expiry_.stale_after.count());
+        const auto evict_ticks = static_cast<uint64_t>(expiry_.evict_after.count());
+        Shard& shard = ShardFor(id);
+        {
+            std::shared_lock lock(shard.mutex_);
+            auto it = shard.devices_.find(id);
+            if (it == shard.devices_.end()) {
+                return std::nullopt;
+            }
+            Entry& entry = it->second;
+            const uint64_t last_seen = entry.last_seen_tick_.load(std::memory_order_relaxed);
+            if (tick < last_seen + stale_ticks) {
+                // Показания шли: ждем нового срока. Снимаем пометку, если
+                // обновление разминулось с прошлой проверкой.
+                if (entry.stale_.exchange(false, std::memory_order_relaxed)) {
+                    stale_.fetch_sub(1, std::memory_order_relaxed);
+                    live_.fetch_add(1, std::memory_order_relaxed);
+                }
+                rescheduled_.emplace_back(last_seen + stale_ticks, id);
+                return std::nullopt;
+            }
+            if (tick < last_seen + evict_ticks) {
+                rescheduled_.emplace_back(last_seen + evict_ticks, id);
+                if (entry.stale_.exchange(true, std::memory_order_relaxed)) {
+                    return std::nullopt;
+                }
+                live_.fetch_sub(1, std::memory_order_relaxed);
+                stale_.fetch_add(1, std::memory_order_relaxed);
+                return DeviceEvent::kStale;
+            }
+        }
+
+        std::unique_lock lock(shard.mutex_);
+        auto it = shard.devices_.find(id);
+        if (it == shard.devices_.end()) {
+            return std::nullopt;
+        }
+        const uint64_t last_seen = it->second.last_seen_tick_.load(std::memory_order_relaxed);
+        if (tick < last_seen + evict_ticks) {
+            rescheduled_.emplace_back(last_seen + stale_ticks, id);     // Обновилось, пока ждали блокировку
+            return std::nullopt;
+        }
+        (it->second.stale_.load(std::memory_order_relaxed) ? stale_ : live_).fetch_sub(1, std::memory_order_relaxed);
+        shard.devices_.erase(it);
+        return DeviceEvent::kEvicted;
+    }
+
+    size_t ShardIndex(DeviceId id) const {
+        // Идентификаторы плотные: перемешиваем их, чтобы соседние устройства
+        // попадали в разные шарды и в разные корзины внутри шарда
+        const uint64_t hash = static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull;
+        return (hash >> 32) & shard_mask_;
+    }
+
+    Shard& ShardFor(DeviceId id) const {
+        return shards_[ShardIndex(id)];
+    }
+};
@@ -0,0 +1,281 @@
+#include "event_loop.h"
+#include "logger.h"
+#include "metrics.h"
+#ifdef TELEMETRY_IO_URING
+#include "uring_loop.h"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+namespace {
+
+constexpr int MAX_EVENTS = 256;
+constexpr int WAIT_TIMEOUT_MS = 100;    // Как часто проверяем флаг остановки
+
+void SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error("fcntl");
+    }
+}
+
+} // namespace
+
+Socket ListenSocket(const char *port) {
+    AddrInfo addr(nullptr, port, AI_PASSIVE);
+    Socket listener(socket(addr.Get()->ai_family, addr.Get()->ai_socktype, addr.Get()->ai_protocol));
+
+    if (listener.GetFd() < 0) {
+        throw std::runtime_error("socket");
+    }
+
+    int yes = 1;
+    if (setsockopt(listener.GetFd(), SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0 ||
+        setsockopt(listener.GetFd(), SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+        throw std::runtime_error("setsockopt");
+    }
+
+    if (bind(listener.GetFd(), addr.Get()->ai_addr, addr.Get()->ai_addrlen) < 0) {
+        throw std::runtime_error("bind");
+    }
+
+    if (listen(listener.GetFd(), SOMAXCONN) < 0) {
+        throw std::runtime_error("listen");
+    }
+    return listener;
+}
+
+std::unique_ptr<IoLoop> MakeIoLoop(const char *port, IoLoop::DataHandler handler, IoBackend backend) {
+#ifdef TELEMETRY_IO_URING
+    if (backend == IoBackend::kUring) {
+        try {
+            return std::make_unique<UringLoop>(port, handler);
+        } catch (const std::exception &ex) {
+            // Ядро без io_uring или он запрещен (seccomp, io_uring_disabled)
+            LOG_RATE_LIMITED(LogLevel::kWarn, 1, "io_uring unavailable, falling back to epoll: {}", ex.what());
+        }
+    }
+#else
+    (void)backend;
+#endif
+    return std::make_unique<EventLoop>(port, std::move(handler));
+}
+
+EventLoop::EventLoop(const char *port, DataHandler handler)
+    : listener_(ListenSocket(port)), handler_(std::move(handler)) {
+
+    SetNonBlocking(listener_.GetFd());
+
+    epoll_.Reset(epoll_create1(EPOLL_CLOEXEC));
+    if (epoll_.GetFd() < 0) {
+        throw std::runtime_error("epoll_create1");
+    }
+
+    struct epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listener_.GetFd();
+    if (epoll_ctl(epoll_.GetFd(), EPOLL_CTL_ADD, listener_.GetFd(), &ev) < 0) {
+        throw std::runtime_error("epoll_ctl");
+    }
+}
+
+void EventLoop::Run(const std::atomic<bool>& stop) {
+    std::array<struct epoll_event, MAX_EVENTS> events;
+
+    while (!stop) {
+        int n = epoll_wait(epoll_.GetFd(), events.data(), events.size(), WAIT_TIMEOUT_MS);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("epoll_wait");
+        }
+
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == listener_.GetFd()) {
+                Accept();
+                continue;
+            }
+
+            auto it = connections_.find(fd);
+            if (it == connections_.end()) {
+                continue;
+            }
+            Connection& conn = *it->second;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                Close(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                Flush(conn);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                Read(conn);     // Может закрыть соединение, conn дальше не используем
+            }
+        }
+    }
+}
+
+size_t EventLoop::Drain(std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    // Закрытие слушающего сокета сбрасывает и очередь еще не принятых соединений
+    listener_.Reset();
+
+    std::vector<int> fds;
+    fds.reserve(connections_.size());
+    for (const auto& [fd, _] : connections_) {
+        fds.push_back(fd);
+    }
+    for (int fd : fds) {
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) {
+            continue;
+        }
+        Read(*it->second);      // Может закрыть соединение
+        it = connections_.find(fd);
+        if (it != connections_.end() && it->second->out_.empty()) {
+            Close(fd);
+        }
+    }
+
+    // Досылаем подтверждения по EPOLLOUT; новые данные больше не читаем
+    std::array<struct epoll_event, MAX_EVENTS> events;
+    while (!connections_.empty()) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            break;
+        }
+        int n = epoll_wait(epoll_.GetFd(), events.data(), events.size(), static_cast<int>(std::min<int64_t>(left.count(), WAIT_TIMEOUT_MS)));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            auto it = connections_.find(fd);
+            if (it == connections_.end()) {
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                Close(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                Flush(*it->second);
+            }
+            if (it->second->out_.empty()) {
+                Close(fd);
+            }
+        }
+    }
+
+    const size_t undrained = connections_.size();
+    connections_.clear();
+    return undrained;
+}
+
+void EventLoop::Accept() {
+    // В режиме edge-triggered принимаем все ожидающие соединения до EAGAIN
+    while (true) {
+        Socket client(accept4(listener_.GetFd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+
+        if (client.GetFd() < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            LOG_ERROR("accept: {}", strerror(errno));
+            return;
+        }
+
+        metrics::Increment(metrics::Counter::kAccepts);
+        LOG_DEBUG("Connected to client.");
+
+        const int fd = client.GetFd();
+        struct epoll_event ev {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_.GetFd(), EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOG_ERROR("epoll_ctl: {}", strerror(errno));
+            continue;
+        }
+
+        auto conn = MakePooled<Connection>(&pool_, &pool_);
+        conn->socket_ = std::move(client);
+        connections_.emplace(fd, std::move(conn));
+    }
+}
+
+void EventLoop::Read(Connection& conn) {
+    const int fd = conn.socket_.GetFd();
+    bool closed = false;
+
+    while (true) {
+        if (conn.in_.Full()) {
+            // Разбираем накопленное, чтобы освободить место для следующего recv
+            if (!handler_(conn) || conn.in_.Full()) {
+                closed = true;
+                break;
+            }
+        }
+
+        auto span = conn.in_.WriteSpan();
+        ssize_t bytes = recv(fd, span.data(), span.size(), 0);
+
+        if (bytes > 0) {
+            conn.in_.Commit(bytes);
+            continue;
+        }
+        if (bytes == 0) {
+            closed = true;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            closed = true;
+        }
+        break;
+    }
+
+    if (!conn.in_.Empty() && !handler_(conn)) {
+        closed = true;
+    }
+    Flush(conn);
+
+    if (closed) {
+        Close(fd);
+    }
+}
+
+void EventLoop::Flush(Connection& conn) {
+    size_t sent_total = 0;
+
+    while (sent_total < conn.out_.size()) {
+        ssize_t sent = send(conn.socket_.GetFd(), conn.out_.data() + sent_total,
+                            conn.out_.size() - sent_total, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            // EAGAIN: досылаем остаток по событию EPOLLOUT
+            break;
+        }
+        sent_total += sent;
+    }
+
+    conn.out_.erase(0, sent_total);
+}
+
+void EventLoop::Close(int fd) {
+    // Закрытие дескриптора само удаляет его из epoll
+    connections_.erase(fd);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "binary_protocol.h"
+#include "metric_schema.h"
+#include "pool.h"
+#include "protocol.h"
+#include "ring_buffer.h"
+#include "socket_raii.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Состояние одного долгоживущего соединения с устройством
+struct Connection {
+    Connection() = default;
+    // Буфер приема - из пула цикла событий, а не из общей кучи
+    explicit Connection(std::pmr::memory_resource *resource)
+        : in_(RingBuffer::DEFAULT_CAPACITY, resource) {}
+
+    Socket socket_;
+    RingBuffer in_;             // Принятые, но ещё не разобранные байты
+    std::string out_;           // Ответы, ожидающие отправки
+    std::vector<char> scratch_; // Для кадров, проходящих через конец in_
+    protocol::AckBatch acks_;   // Подтверждения, накопленные за одно чтение
+    protocol::Format format_ = protocol::Format::kUnknown;     // Определяется по первому байту
+    protocol::binary::Bindings bindings_;                       // Только для двоичного протокола
+    MetricNameBudget metric_names_;                             // Новые имена метрик от этого соединения
+};
+
+// Цикл событий одного потока: принимает соединения на своем слушающем
+// сокете и передает пришедшие байты обработчику
+class IoLoop {
+public:
+    // Вызывается в потоке цикла, когда в Connection::in_ появились новые данные.
+    // Возвращает false при нарушении протокола, тогда соединение закрывается.
+    using DataHandler = std::function<bool(Connection&)>;
+
+    virtual ~IoLoop() = default;
+
+    virtual const char *Name() const = 0;
+
+    virtual void Run(const std::atomic<bool>& stop) = 0;
+
+    // После Run, в том же потоке: закрывает слушающий сокет, разбирает уже
+    // пришедшие данные и ждет отправки подтверждений не дольше timeout.
+    // Показания, пришедшие позже, остаются без подтверждения - устройство
+    // повторит их после переподключения. Возвращает число соединений,
+    // закрытых с неотправленными подтверждениями.
+    virtual size_t Drain(std::chrono::milliseconds timeout) = 0;
+};
+
+enum class IoBackend {
+    kEpoll,
+    kUring          // Только в сборке с TELEMETRY_IO_URING
+};
+
+// Цикл на io_uring, если он собран и ядро его поддерживает, иначе на epoll
+std::unique_ptr<IoLoop> MakeIoLoop(const char *port, IoLoop::DataHandler handler, IoBackend backend);
+
+// Слушающий сокет с SO_REUSEPORT: каждый цикл держит свой на общем порту,
+// и ядро само распределяет входящие соединения между циклами
+Socket ListenSocket(const char *port);
+
+// Реактор на epoll (edge-triggered) с неблокирующими сокетами.
+class EventLoop : public IoLoop {
+public:
+    EventLoop(const char *port, DataHandler handler);
+    EventLoop(const EventLoop&) = delete;
+    EventLoop &operator=(const EventLoop&) = delete;
+
+    const char *Name() const override { return "epoll"; }
+    void Run(const std::atomic<bool>& stop) override;
+    size_t Drain(std::chrono::milliseconds timeout) override;
+
+private:
+    Socket listener_;
+    Socket epoll_;
+    DataHandler handler_;
+    // Соединения и их буферы приема: после закрытия блоки остаются в пуле
+    // и достаются следующему соединению этого цикла. Объявлен раньше
+    // connections_, чтобы пережить их.
+    std::pmr::unsynchronized_pool_resource pool_{ThreadPoolOptions(RingBuffer::DEFAULT_CAPACITY)};
+    std::pmr::unordered_map<int, PoolPtr<Connection>> connections_{&pool_};
+
+    void Accept();
+    void Read(Connection& conn);
+    void Flush(Connection& conn);
+    void Close(int fd);
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+// Лог-линейная гистограмма в духе HDR Histogram: каждая степень двойки
+// делится на SUB_BUCKETS равных корзин, относительная погрешность
+// не превышает 1/SUB_BUCKETS (~6%). Запись - один инкремент без блокировок.
+// Предполагается один писатель на экземпляр (счетчики потока), читать
+// можно из любого потока.
+class Histogram {
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void Record(uint64_t value) {
+        Bump(buckets_[BucketIndex(value)], 1);
+        Bump(count_, 1);
+        Bump(sum_, value);
+    }
+
+    uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t BucketCount(size_t index) const { return buckets_[index].load(std::memory_order_relaxed); }
+
+    static size_t BucketIndex(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        const size_t exponent = std::bit_width(value) - 1;
+        const size_t sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Верхняя граница значений корзины (включительно)
+    static uint64_t BucketUpperBound(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        const size_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        const uint64_t sub = index % SUB_BUCKETS;
+        const uint64_t width = uint64_t{1} << (exponent - SUB_BUCKET_BITS);
+        return ((SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS)) + (width - 1);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+
+    // Писатель один, поэтому load + store дешевле атомарного fetch_add
+    static void Bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+};
+
+// Сумма нескольких гистограмм (например, по всем потокам) для чтения квантилей
+class HistogramSnapshot {
+public:
+    void Add(const Histogram& histogram) {
+        for (size_t i = 0; i < Histogram::BUCKET_COUNT; ++i) {
+            buckets_[i] += histogram.BucketCount(i);
+        }
+        count_ += histogram.Count();
+        sum_ += histogram.Sum();
+    }
+
+    uint64_t Count() const { return count_; }
+    uint64_t Sum() const { return sum_; }
+    uint64_t BucketCount(size_t index) const { return buckets_[index]; }
+
+    // Значение, не меньше которого q-я доля записей (q в [0, 1])
+    uint64_t Quantile(double q) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        const auto rank = static_cast<uint64_t>(q * static_cast<double>(count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < Histogram::BUCKET_COUNT; ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                return Histogram::BucketUpperBound(i);
+            }
+        }
+        return Histogram::BucketUpperBound(Histogram::BUCKET_COUNT - 1);
+    }
+
+private:
+    std::array<uint64_t, Histogram::BUCKET_COUNT> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+};
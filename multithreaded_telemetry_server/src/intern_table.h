@@ -0,0 +1,332 @@
+#pragma once
+
+#include "cache_line.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using DeviceId = uint32_t;
+
+constexpr DeviceId INVALID_DEVICE_ID = 0;
+
+// Таблица интернирования идентификаторов устройств: строка превращается
+// в плотный целочисленный DeviceId один раз, дальше по конвейеру ходит
+// только число. Прямой поиск (строка -> id) идет по шардам под
+// shared_mutex, обратный (id -> строка) не берет блокировок: имена
+// лежат в блоках шарда, которые не перемещаются и не освобождаются.
+//
+// Шард - открытая адресация по своему хешу имени (Hash): в ячейке
+// 32 бита хеша и id, имя сравнивается только при совпадении хеша.
+// Хеш не зависит от сборки и хранится вместе с именем, поэтому снимок
+// реестра сохраняет таблицу в порядке id, а Restore собирает ее заново
+// без вызова Hash и без поиска по одному имени.
+class DeviceIdTable {
+public:
+    // Имя из снимка: id - позиция в векторе плюс один
+    struct SavedName {
+        std::string_view name_;
+        uint64_t hash_;
+    };
+
+    DeviceIdTable() = default;
+    DeviceIdTable(const DeviceIdTable&) = delete;
+    DeviceIdTable &operator=(const DeviceIdTable&) = delete;
+
+    ~DeviceIdTable() {
+        for (auto& segment : segments_) {
+            delete[] segment.load(std::memory_order_relaxed);
+        }
+    }
+
+    DeviceId Intern(std::string_view name) {
+        const uint64_t hash = Hash(name);
+        Shard& shard = ShardFor(hash);
+        {
+            std::shared_lock lock(shard.mutex_);
+            if (const DeviceId id = Lookup(shard, name, hash); id != INVALID_DEVICE_ID) {
+                return id;
+            }
+        }
+
+        std::unique_lock lock(shard.mutex_);
+        if (const DeviceId id = Lookup(shard, name, hash); id != INVALID_DEVICE_ID) {
+            return id;
+        }
+        const DeviceId id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        if (id >= MAX_SEGMENTS * SEGMENT_SIZE) {
+            throw std::length_error("DeviceIdTable is full");
+        }
+        const NameHeader *entry = Store(shard, name, hash);
+        Grow(shard, shard.size_ + 1);
+        Place(shard.slots_, SlotValue(hash, id));
+        ++shard.size_;
+        Slot(id).store(entry, std::memory_order_release);
+        return id;
+    }
+
+    // Готовит шарды к count новым именам
+    void Reserve(size_t count) {
+        for (auto& shard : shards_) {
+            std::unique_lock lock(shard.mutex_);
+            Grow(shard, shard.size_ + count / SHARD_COUNT + count / (4 * SHARD_COUNT));
+        }
+    }
+
+    // Заполняет пустую таблицу именами из снимка до начала приема: names[i]
+    // получает id i + 1, пустое имя оставляет id незанятым. Имена копируются
+    // в один блок, хеши берутся из снимка.
+    void Restore(const std::vector<SavedName>& names) {
+        if (next_id_.load(std::memory_order_relaxed) != INVALID_DEVICE_ID + 1) {
+            throw std::logic_error("DeviceIdTable::Restore: table is not empty");
+        }
+        if (names.size() >= MAX_SEGMENTS * SEGMENT_SIZE) {
+            throw std::length_error("DeviceIdTable is full");
+        }
+
+        // Имена раскладываются по шардам заранее, чтобы заполнять таблицы
+        // по одной: таблица шарда остается в кэше
+        size_t bytes = 0;
+        std::array<size_t, SHARD_COUNT + 1> starts{};
+        for (const auto& saved : names) {
+            if (!saved.name_.empty()) {
+                bytes += EntrySize(saved.name_.size());
+                ++starts[saved.hash_ % SHARD_COUNT + 1];
+            }
+        }
+        for (size_t i = 0; i < SHARD_COUNT; ++i) {
+            starts[i + 1] += starts[i];
+        }
+        std::vector<uint64_t> order(starts[SHARD_COUNT]);    // Ячейки шарда 0, затем 1...
+        std::array<size_t, SHARD_COUNT> fill{};
+        std::copy_n(starts.begin(), SHARD_COUNT, fill.begin());
+
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (auto& shard : shards_) {
+            locks.emplace_back(shard.mutex_);
+        }
+        shards_[0].blocks_.push_back(std::make_unique<char[]>(bytes));
+        char *cursor = shards_[0].blocks_.back().get();
+        for (size_t i = 0; i < names.size(); ++i) {
+            const SavedName& saved = names[i];
+            if (saved.name_.empty()) {
+                continue;
+            }
+            const auto id = static_cast<DeviceId>(i + 1);
+            Slot(id).store(Write(cursor, saved.name_, saved.hash_), std::memory_order_release);
+            cursor += EntrySize(saved.name_.size());
+            order[fill[saved.hash_ % SHARD_COUNT]++] = SlotValue(saved.hash_, id);
+        }
+        for (size_t i = 0; i < SHARD_COUNT; ++i) {
+            Grow(shards_[i], starts[i + 1] - starts[i]);
+            for (size_t k = starts[i]; k < starts[i + 1]; ++k) {
+                Place(shards_[i].slots_, order[k]);
+            }
+            shards_[i].size_ += starts[i + 1] - starts[i];
+        }
+        next_id_.store(static_cast<DeviceId>(names.size() + 1), std::memory_order_release);
+    }
+
+    std::optional<DeviceId> Find(std::string_view name) const {
+        const uint64_t hash = Hash(name);
+        const Shard& shard = ShardFor(hash);
+        std::shared_lock lock(shard.mutex_);
+        if (const DeviceId id = Lookup(shard, name, hash); id != INVALID_DEVICE_ID) {
+            return id;
+        }
+        return std::nullopt;
+    }
+
+    // Пустая строка для неизвестного id
+    std::string_view Name(DeviceId id) const {
+        const NameHeader *entry = Entry(id);
+        return entry ? std::string_view(reinterpret_cast<const char*>(entry + 1), entry->size_) : std::string_view();
+    }
+
+    // Hash(Name(id)) без пересчета; 0 для неизвестного id
+    uint64_t NameHash(DeviceId id) const {
+        const NameHeader *entry = Entry(id);
+        return entry ? entry->hash_ : 0;
+    }
+
+    // Количество выданных идентификаторов
+    size_t Size() const { return next_id_.load(std::memory_order_relaxed) - 1; }
+
+    // Хеш имени, одинаковый во всех сборках на машинах с одним порядком байт
+    static uint64_t Hash(std::string_view name) {
+        uint64_t hash = 0x9E3779B97F4A7C15ull ^ name.size();
+        const char *data = name.data();
+        size_t size = name.size();
+        while (size >= sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            hash = Mix(hash ^ word);
+            data += sizeof(word);
+            size -= sizeof(word);
+        }
+        if (size != 0) {
+            uint64_t word = 0;
+            std::memcpy(&word, data, size);
+            hash = Mix(hash ^ word);
+        }
+        return hash;
+    }
+
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+    static constexpr size_t SEGMENT_SIZE = 4096;
+    static constexpr size_t MAX_SEGMENTS = 4096;      // До 16M устройств
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;   // Блок имен шарда
+
+    // Имя в блоке шарда: заголовок, затем size_ байт, выравнивание до 8
+    struct NameHeader {
+        uint64_t hash_;
+        uint32_t size_;
+    };
+
+    // Ячейка: старшие 32 бита - биты хеша после номера шарда, младшие - id
+    // (0 - пусто). Заполнение не выше половины.
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        mutable std::shared_mutex mutex_;
+        std::vector<uint64_t> slots_;
+        size_t size_ = 0;
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        char *cursor_ = nullptr;
+        size_t left_ = 0;
+    };
+
+    using Segment = std::atomic<const NameHeader*>;
+
+    Shard shards_[SHARD_COUNT];
+    std::atomic<Segment*> segments_[MAX_SEGMENTS]{};
+    std::atomic<DeviceId> next_id_{INVALID_DEVICE_ID + 1};
+
+    static uint64_t Mix(uint64_t x) {
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 31;
+        x *= 0x94D049BB133111EBull;
+        return x ^ (x >> 29);
+    }
+
+    static uint32_t SlotHash(uint64_t hash) {
+        return static_cast<uint32_t>(hash >> 4);
+    }
+
+    static size_t EntrySize(size_t name_size) {
+        return (sizeof(NameHeader) + name_size + 7) & ~size_t{7};
+    }
+
+    Shard& ShardFor(uint64_t hash) {
+        return shards_[hash % SHARD_COUNT];
+    }
+
+    const Shard& ShardFor(uint64_t hash) const {
+        return shards_[hash % SHARD_COUNT];
+    }
+
+    const NameHeader *Entry(DeviceId id) const {
+        if (id >= next_id_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        const auto *segment = segments_[id / SEGMENT_SIZE].load(std::memory_order_acquire);
+        return segment ? segment[id % SEGMENT_SIZE].load(std::memory_order_acquire) : nullptr;
+    }
+
+    // Под блокировкой шарда, разделяемой или эксклюзивной
+    DeviceId Lookup(const Shard& shard, std::string_view name, uint64_t hash) const {
+        if (shard.slots_.empty()) {
+            return INVALID_DEVICE_ID;
+        }
+        const uint32_t slot_hash = SlotHash(hash);
+        const size_t mask = shard.slots_.size() - 1;
+        for (size_t i = slot_hash & mask;; i = (i + 1) & mask) {
+            const uint64_t slot = shard.slots_[i];
+            const auto id = static_cast<DeviceId>(slot);
+            if (id == INVALID_DEVICE_ID) {
+                return INVALID_DEVICE_ID;
+            }
+            if (static_cast<uint32_t>(slot >> 32) == slot_hash && Name(id) == name) {
+                return id;
+            }
+        }
+    }
+
+    static uint64_t SlotValue(uint64_t hash, DeviceId id) {
+        return (uint64_t{SlotHash(hash)} << 32) | id;
+    }
+
+    // Ячейка в первое свободное место от своей позиции
+    static void Place(std::vector<uint64_t>& slots, uint64_t slot) {
+        const size_t mask = slots.size() - 1;
+        size_t i = (slot >> 32) & mask;
+        while (slots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+
+    // Таблица на count имен; ячейки переставляются по сохраненным битам хеша
+    static void Grow(Shard& shard, size_t count) {
+        if (count * 2 <= shard.slots_.size()) {
+            return;
+        }
+        size_t capacity = std::max<size_t>(shard.slots_.size(), 64);
+        while (capacity < count * 2) {
+            capacity *= 2;
+        }
+        std::vector<uint64_t> slots(capacity, 0);
+        for (const uint64_t slot : shard.slots_) {
+            if (slot != 0) {
+                Place(slots, slot);
+            }
+        }
+        shard.slots_.swap(slots);
+    }
+
+    static const NameHeader *Write(char *at, std::string_view name, uint64_t hash) {
+        auto *entry = new (at) NameHeader{hash, static_cast<uint32_t>(name.size())};
+        std::memcpy(entry + 1, name.data(), name.size());
+        return entry;
+    }
+
+    // Копия имени в блоке шарда, под эксклюзивной блокировкой
+    static const NameHeader *Store(Shard& shard, std::string_view name, uint64_t hash) {
+        const size_t size = EntrySize(name.size());
+        if (shard.left_ < size) {
+            const size_t block = std::max(BLOCK_SIZE, size);
+            shard.blocks_.push_back(std::make_unique<char[]>(block));
+            shard.cursor_ = shard.blocks_.back().get();
+            shard.left_ = block;
+        }
+        const NameHeader *entry = Write(shard.cursor_, name, hash);
+        shard.cursor_ += size;
+        shard.left_ -= size;
+        return entry;
+    }
+
+    // Ячейка обратной таблицы; сегменты создаются по мере роста
+    Segment& Slot(DeviceId id) {
+        auto& segment_ptr = segments_[id / SEGMENT_SIZE];
+        Segment *segment = segment_ptr.load(std::memory_order_acquire);
+        if (segment == nullptr) {
+            auto *fresh = new Segment[SEGMENT_SIZE]{};
+            if (segment_ptr.compare_exchange_strong(segment, fresh, std::memory_order_acq_rel)) {
+                segment = fresh;
+            } else {
+                delete[] fresh;
+            }
+        }
+        return segment[id % SEGMENT_SIZE];
+    }
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Минимальная обертка над io_uring на системных вызовах, без liburing:
+// кольца очереди отправки (SQ) и завершений (CQ) отображаются в память,
+// io_uring_enter отправляет все подготовленные SQE одним вызовом и ждет
+// завершений. Используется одним потоком.
+class IoUring {
+public:
+    explicit IoUring(unsigned entries) {
+        // Кольцо завершений больше: multishot-операции дают много CQE на один SQE.
+        // DEFER_TASKRUN: ядро доделывает завершения только внутри io_uring_enter
+        // потока-владельца, без прерываний посреди обработки. Владельцем
+        // становится поток, вызвавший Enable; старые ядра - без этих флагов.
+        struct io_uring_params params {};
+        for (unsigned flags : {IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED,
+                               IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN,
+                               IORING_SETUP_CQSIZE}) {
+            params = {};
+            params.flags = flags;
+            params.cq_entries = entries * 8;
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if (fd_ >= 0 || errno != EINVAL) {
+                break;
+            }
+        }
+        disabled_ = fd_ >= 0 && (params.flags & IORING_SETUP_R_DISABLED);
+        if (fd_ < 0) {
+            throw std::runtime_error(std::string("io_uring_setup: ") + strerror(errno));
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+            close(fd_);
+            throw std::runtime_error("io_uring: kernel is too old");
+        }
+
+        ring_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                              params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+            if (ring_ != MAP_FAILED) {
+                munmap(ring_, ring_size_);
+            }
+            close(fd_);
+            throw std::runtime_error("io_uring: mmap");
+        }
+        sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+        char *base = static_cast<char *>(ring_);
+        sq_head_ = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe *>(base + params.cq_off.cqes);
+
+        // Индексы SQE в массиве SQ совпадают с позицией в кольце
+        auto *array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; ++i) {
+            array[i] = i;
+        }
+        sqe_tail_ = *sq_tail_;
+    }
+
+    ~IoUring() {
+        munmap(sqes_, sqes_size_);
+        munmap(ring_, ring_size_);
+        close(fd_);
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring &operator=(const IoUring&) = delete;
+
+    int Fd() const { return fd_; }
+
+    // Из потока, который будет отправлять SQE
+    void Enable() {
+        if (disabled_) {
+            if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0) {
+                throw std::runtime_error(std::string("io_uring_register(ENABLE_RINGS): ") + strerror(errno));
+            }
+            disabled_ = false;
+        }
+    }
+
+    // Обнуленный SQE или nullptr, если очередь отправки заполнена: тогда нужен Submit
+    struct io_uring_sqe *GetSqe() {
+        const unsigned head = std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+        if (sqe_tail_ - head >= sq_entries_) {
+            return nullptr;
+        }
+        struct io_uring_sqe *sqe = &sqes_[sqe_tail_ & sq_mask_];
+        ++sqe_tail_;
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Отправляет подготовленные SQE и ждет хотя бы wait_nr завершений, но не
+    // дольше timeout. Возвращает false только при ошибке, не при таймауте.
+    bool Submit(unsigned wait_nr, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        std::atomic_ref<unsigned>(*sq_tail_).store(sqe_tail_, std::memory_order_release);
+        const unsigned to_submit = sqe_tail_ - std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+
+        struct __kernel_timespec ts {};
+        ts.tv_sec = timeout.count() / 1000;
+        ts.tv_nsec = (timeout.count() % 1000) * 1'000'000;
+        struct io_uring_getevents_arg arg {};
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+        unsigned flags = IORING_ENTER_EXT_ARG;
+        if (wait_nr != 0) {
+            flags |= IORING_ENTER_GETEVENTS;
+        }
+        while (true) {
+            const long ret = syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr, flags, &arg, sizeof(arg));
+            if (ret >= 0 || errno == ETIME) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // Очередь завершений переполнена: сначала их нужно разобрать
+            return errno == EBUSY || errno == EAGAIN;
+        }
+    }
+
+    // Вызывает f(const io_uring_cqe&) для каждого готового завершения
+    template <typename F>
+    unsigned ForEachCqe(F&& f) {
+        unsigned head = *cq_head_;
+        const unsigned tail = std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+        const unsigned count = tail - head;
+        for (; head != tail; ++head) {
+            f(cqes_[head & cq_mask_]);
+        }
+        std::atomic_ref<unsigned>(*cq_head_).store(head, std::memory_order_release);
+        return count;
+    }
+
+private:
+    int fd_ = -1;
+    bool disabled_ = false;
+    void *ring_ = nullptr;
+    size_t ring_size_ = 0;
+    struct io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned *sq_head_;
+    unsigned *sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sqe_tail_;         // Подготовлено, но еще не видно ядру
+
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe *cqes_;
+};
+
+// Кольцо буферов, которые ядро само выбирает для recv (IOSQE_BUFFER_SELECT):
+// соединению не нужен свой буфер, пока данных нет. Номер буфера приходит
+// в флагах CQE, после копирования буфер возвращается через Recycle.
+class ProvidedBuffers {
+public:
+    ProvidedBuffers(IoUring& ring, uint16_t group, unsigned count, unsigned size)
+        : ring_fd_(ring.Fd()), group_(group), count_(count), size_(size), mask_(count - 1) {
+        if (count == 0 || (count & (count - 1)) != 0 || count > 32768) {
+            throw std::invalid_argument("ProvidedBuffers: count must be a power of two up to 32768");
+        }
+        ring_bytes_ = count_ * sizeof(struct io_uring_buf);
+        void *memory = mmap(nullptr, ring_bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("ProvidedBuffers: mmap");
+        }
+        // Не через io_uring_buf_ring::bufs: в C++ __DECLARE_FLEX_ARRAY старых
+        // заголовков сдвигает массив на 8 байт. Хвост кольца лежит в поле
+        // resv первого элемента.
+        ring_ = static_cast<struct io_uring_buf *>(memory);
+        data_ = new char[static_cast<size_t>(count_) * size_];
+
+        struct io_uring_buf_reg reg {};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring_);
+        reg.ring_entries = count_;
+        reg.bgid = group_;
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            const int error = errno;
+            delete[] data_;
+            munmap(ring_, ring_bytes_);
+            throw std::runtime_error(std::string("io_uring_register(PBUF_RING): ") + strerror(error));
+        }
+        for (unsigned i = 0; i < count_; ++i) {
+            Recycle(static_cast<uint16_t>(i));
+        }
+        Publish();
+    }
+
+    ~ProvidedBuffers() {
+        struct io_uring_buf_reg reg {};
+        reg.bgid = group_;
+        syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(ring_, ring_bytes_);
+        delete[] data_;
+    }
+
+    ProvidedBuffers(const ProvidedBuffers&) = delete;
+    ProvidedBuffers &operator=(const ProvidedBuffers&) = delete;
+
+    uint16_t Group() const { return group_; }
+    const char *Data(uint16_t id) const { return data_ + static_cast<size_t>(id) * size_; }
+
+    // Возвращает буфер ядру; видно ему станет после Publish
+    void Recycle(uint16_t id) {
+        Add(id, pending_);
+        ++pending_;
+    }
+
+    void Publish() {
+        tail_ += pending_;
+        pending_ = 0;
+        std::atomic_ref<uint16_t>(ring_[0].resv).store(tail_, std::memory_order_release);
+    }
+
+private:
+    int ring_fd_;
+    uint16_t group_;
+    unsigned count_;
+    unsigned size_;
+    unsigned mask_;
+    size_t ring_bytes_ = 0;
+    struct io_uring_buf *ring_ = nullptr;
+    char *data_ = nullptr;
+    uint16_t tail_ = 0;
+    uint16_t pending_ = 0;
+
+    void Add(uint16_t id, unsigned offset) {
+        struct io_uring_buf *buf = &ring_[(tail_ + offset) & mask_];
+        buf->addr = reinterpret_cast<uint64_t>(Data(id));
+        buf->len = size_;
+        buf->bid = id;
+    }
+};
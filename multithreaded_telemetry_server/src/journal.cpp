@@ -0,0 +1,461 @@
+#include "journal.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x4C4E524A;      // "JRNL"
+constexpr uint32_t VERSION = 1;
+constexpr size_t RECORD_HEADER_SIZE = 8;
+constexpr size_t RELEASED_OFFSET = 8;       // uint64 в заголовке сегмента
+constexpr size_t RELEASED_METRICS_OFFSET = 16;
+
+enum RecordType : uint16_t {
+    kEnd = 0,
+    kName = 1,
+    kReading = 2,
+    kMetricName = 3,
+    kMetric = 4,
+};
+
+// Нагрузка kReading: номер устройства, время (нс от эпохи), три значения
+constexpr size_t READING_SIZE = sizeof(uint32_t) + sizeof(int64_t) + 3 * sizeof(double);
+// Нагрузка kMetric: номер устройства, номер метрики, время (нс от эпохи), значение
+constexpr size_t METRIC_SIZE = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(int64_t) + sizeof(double);
+
+int64_t ToNanos(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+std::chrono::system_clock::time_point FromNanos(int64_t ns) {
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(ns)));
+}
+
+uint32_t Checksum(uint16_t type, const char *payload, size_t size) {
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](unsigned char byte) {
+        hash ^= byte;
+        hash *= 16777619u;
+    };
+    mix(static_cast<unsigned char>(type));
+    mix(static_cast<unsigned char>(type >> 8));
+    for (size_t i = 0; i < size; ++i) {
+        mix(static_cast<unsigned char>(payload[i]));
+    }
+    return hash;
+}
+
+std::string SegmentName(uint32_t number) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "journal_%06u.log", number);
+    return name;
+}
+
+int64_t SegmentNumber(const std::string& name) {
+    unsigned number = 0;
+    char tail = 0;
+    if (std::sscanf(name.c_str(), "journal_%6u.lo%c", &number, &tail) == 2 && tail == 'g' && name.size() == 18) {
+        return number;
+    }
+    return -1;
+}
+
+} // namespace
+
+struct IngestJournal::Segment {
+    std::string path_;
+    int fd_ = -1;
+    char *base_ = nullptr;
+    size_t used_ = SEGMENT_HEADER_SIZE;
+    uint32_t number_ = 0;
+    uint64_t first_seq_ = 0;        // Номер первого показания сегмента
+    uint64_t count_ = 0;            // Показаний в сегменте
+    uint64_t metric_first_seq_ = 0;
+    uint64_t metric_count_ = 0;
+
+    ~Segment() {
+        if (base_ != nullptr) {
+            munmap(base_, SEGMENT_SIZE);
+        }
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+};
+
+IngestJournal::IngestJournal(DeviceIdTable& ids, MetricSchema& schema, std::string directory)
+    : ids_(ids), schema_(schema), directory_(std::move(directory)) {
+    std::filesystem::create_directories(directory_);
+
+    std::vector<std::pair<int64_t, std::string>> files;
+    for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+        const int64_t number = SegmentNumber(entry.path().filename().string());
+        if (number >= 0 && entry.is_regular_file()) {
+            files.emplace_back(number, entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    for (auto& [number, path] : files) {
+        old_files_.push_back(std::move(path));
+        next_segment_ = static_cast<uint32_t>(number + 1);
+    }
+}
+
+IngestJournal::~IngestJournal() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Все показания сохранены: журнал больше не нужен
+    if (released_ >= appended_ && metrics_released_ >= metrics_appended_) {
+        for (const auto& segment : segments_) {
+            unlink(segment->path_.c_str());
+        }
+    }
+}
+
+size_t IngestJournal::Replay(const ReplaySink& sink) {
+    ReplayBatch batch;
+    batch.readings_.reserve(REPLAY_BATCH);
+    for (const auto& path : old_files_) {
+        ReplayFile(path, sink, batch);
+    }
+    if (!batch.readings_.empty() || !batch.metrics_.empty()) {
+        sink(batch.readings_, batch.metrics_);
+    }
+    for (const auto& path : old_files_) {
+        std::filesystem::remove(path);
+    }
+    if (!old_files_.empty()) {
+        LOG_INFO("Journal: replayed {} readings and {} metric values from {} segments",
+                 batch.replayed_, batch.replayed_metrics_, old_files_.size());
+    }
+    old_files_.clear();
+    return batch.replayed_;
+}
+
+void IngestJournal::ReplayFile(const std::string& path, const ReplaySink& sink, ReplayBatch& batch) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("open " + path);
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < SEGMENT_HEADER_SIZE) {
+        close(fd);
+        LOG_WARN("Journal: skipping short segment {}", path);
+        return;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("mmap " + path);
+    }
+    const char *base = static_cast<const char*>(mapped);
+
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint64_t released = 0;
+    uint64_t released_metrics = 0;
+    std::memcpy(&magic, base, sizeof(magic));
+    std::memcpy(&version, base + sizeof(magic), sizeof(version));
+    std::memcpy(&released, base + RELEASED_OFFSET, sizeof(released));
+    std::memcpy(&released_metrics, base + RELEASED_METRICS_OFFSET, sizeof(released_metrics));
+    if (magic != MAGIC || version != VERSION) {
+        munmap(mapped, size);
+        LOG_WARN("Journal: skipping segment {} with bad header", path);
+        return;
+    }
+
+    // Номера устройств и метрик в журнале - идентификаторы прошлого запуска
+    std::unordered_map<uint32_t, DeviceId> names;
+    std::unordered_map<uint32_t, MetricId> metric_names;
+    uint64_t index = 0;
+    uint64_t metric_index = 0;
+    auto flush = [&] {
+        if (batch.readings_.size() >= REPLAY_BATCH || batch.metrics_.size() >= REPLAY_BATCH) {
+            sink(batch.readings_, batch.metrics_);
+            batch.readings_.clear();
+            batch.metrics_.clear();
+        }
+    };
+    size_t pos = SEGMENT_HEADER_SIZE;
+    while (pos + RECORD_HEADER_SIZE <= size) {
+        uint16_t type = 0;
+        uint16_t length = 0;
+        uint32_t checksum = 0;
+        std::memcpy(&type, base + pos, sizeof(type));
+        std::memcpy(&length, base + pos + 2, sizeof(length));
+        std::memcpy(&checksum, base + pos + 4, sizeof(checksum));
+        const char *payload = base + pos + RECORD_HEADER_SIZE;
+        // Конец записей или оборванная при падении запись
+        if (type == kEnd || pos + RECORD_HEADER_SIZE + length > size || Checksum(type, payload, length) != checksum) {
+            break;
+        }
+        pos += RECORD_HEADER_SIZE + length;
+
+        if (type == kName && length > sizeof(uint32_t)) {
+            uint32_t id = 0;
+            std::memcpy(&id, payload, sizeof(id));
+            names[id] = ids_.Intern(std::string_view(payload + sizeof(id), length - sizeof(id)));
+        } else if (type == kMetricName && length > sizeof(uint32_t)) {
+            uint32_t id = 0;
+            std::memcpy(&id, payload, sizeof(id));
+            if (auto metric = schema_.Intern(std::string_view(payload + sizeof(id), length - sizeof(id)))) {
+                metric_names[id] = *metric;
+            }
+        } else if (type == kMetric && length == METRIC_SIZE) {
+            if (metric_index++ < released_metrics) {
+                continue;
+            }
+            uint32_t id = 0;
+            uint16_t metric = 0;
+            int64_t ns = 0;
+            MetricSample sample;
+            std::memcpy(&id, payload, sizeof(id));
+            std::memcpy(&metric, payload + 4, sizeof(metric));
+            std::memcpy(&ns, payload + 6, sizeof(ns));
+            std::memcpy(&sample.value_, payload + 14, sizeof(double));
+            auto device = names.find(id);
+            auto name = metric_names.find(metric);
+            if (device == names.end() || name == metric_names.end()) {
+                continue;
+            }
+            sample.device_id_ = device->second;
+            sample.metric_ = name->second;
+            sample.time_ = FromNanos(ns);
+            batch.metrics_.push_back(sample);
+            ++batch.replayed_metrics_;
+            flush();
+        } else if (type == kReading && length == READING_SIZE) {
+            if (index++ < released) {
+                continue;
+            }
+            uint32_t id = 0;
+            int64_t ns = 0;
+            DeviceState state;
+            std::memcpy(&id, payload, sizeof(id));
+            std::memcpy(&ns, payload + 4, sizeof(ns));
+            std::memcpy(&state.temperature_, payload + 12, sizeof(double));
+            std::memcpy(&state.humidity_, payload + 20, sizeof(double));
+            std::memcpy(&state.pressure_, payload + 28, sizeof(double));
+            auto it = names.find(id);
+            if (it == names.end()) {
+                continue;
+            }
+            state.device_id_ = it->second;
+            state.last_update_ = FromNanos(ns);
+            batch.readings_.push_back(state);
+            ++batch.replayed_;
+            flush();
+        }
+    }
+    munmap(mapped, size);
+}
+
+void IngestJournal::OpenSegment() {
+    auto segment = std::make_shared<Segment>();
+    segment->number_ = next_segment_++;
+    segment->path_ = directory_ + "/" + SegmentName(segment->number_);
+    segment->first_seq_ = appended_;
+    segment->metric_first_seq_ = metrics_appended_;
+    segment->fd_ = open(segment->path_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (segment->fd_ < 0) {
+        throw std::runtime_error("open " + segment->path_);
+    }
+    if (ftruncate(segment->fd_, SEGMENT_SIZE) != 0) {
+        throw std::runtime_error("ftruncate " + segment->path_);
+    }
+    void *base = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd_, 0);
+    if (base == MAP_FAILED) {
+        throw std::runtime_error("mmap " + segment->path_);
+    }
+    segment->base_ = static_cast<char*>(base);
+    std::memcpy(segment->base_, &MAGIC, sizeof(MAGIC));
+    std::memcpy(segment->base_ + sizeof(MAGIC), &VERSION, sizeof(VERSION));
+
+    // Новый файл должен пережить сбой вместе с записью о нем в каталоге
+    if (fdatasync(segment->fd_) != 0) {
+        LOG_ERROR("Journal fdatasync: {}", strerror(errno));
+    }
+    const int dir = open(directory_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    segments_.push_back(std::move(segment));
+}
+
+void IngestJournal::Rotate() {
+    // Заполненный сегмент дописывается на диск сразу: Commit синхронизирует только текущий
+    if (!segments_.empty() && fdatasync(segments_.back()->fd_) != 0) {
+        LOG_ERROR("Journal fdatasync: {}", strerror(errno));
+    }
+    OpenSegment();
+}
+
+// Место в текущем сегменте; Append заранее проверил, что оно есть
+char *IngestJournal::Reserve(size_t size) {
+    Segment& segment = *segments_.back();
+    char *dst = segment.base_ + segment.used_;
+    segment.used_ += size;
+    return dst;
+}
+
+void IngestJournal::WriteRecord(uint16_t type, const char *payload, size_t size) {
+    char *dst = Reserve(RECORD_HEADER_SIZE + size);
+    const auto length = static_cast<uint16_t>(size);
+    const uint32_t checksum = Checksum(type, payload, size);
+    std::memcpy(dst + 2, &length, sizeof(length));
+    std::memcpy(dst + 4, &checksum, sizeof(checksum));
+    std::memcpy(dst + RECORD_HEADER_SIZE, payload, size);
+    std::memcpy(dst, &type, sizeof(type));
+}
+
+// Перед записью: при нехватке места - новый сегмент, затем имена устройства
+// и метрики, если в текущем сегменте их еще нет. Имена пишутся в каждый
+// сегмент, где встречаются: сегменты удаляются независимо.
+void IngestJournal::PrepareSegment(DeviceId id, std::optional<MetricId> metric, size_t record) {
+    const std::string_view name = ids_.Name(id);
+    const std::string_view metric_name = metric ? schema_.Name(*metric) : std::string_view();
+    const size_t names = 2 * (RECORD_HEADER_SIZE + sizeof(uint32_t)) + name.size() + metric_name.size();
+    if (segments_.empty() || segments_.back()->used_ + names + record > SEGMENT_SIZE) {
+        Rotate();
+    }
+    const uint32_t segment_tag = segments_.back()->number_ + 1;
+    if (named_in_.size() <= id) {
+        named_in_.resize(id + 1, 0);
+    }
+    if (named_in_[id] != segment_tag) {
+        WriteName(kName, id, name);
+        named_in_[id] = segment_tag;
+    }
+    if (metric) {
+        if (metric_named_in_.size() <= *metric) {
+            metric_named_in_.resize(*metric + 1, 0);
+        }
+        if (metric_named_in_[*metric] != segment_tag) {
+            WriteName(kMetricName, *metric, metric_name);
+            metric_named_in_[*metric] = segment_tag;
+        }
+    }
+}
+
+void IngestJournal::WriteName(uint16_t type, uint32_t id, std::string_view name) {
+    std::string payload(sizeof(id) + name.size(), '\0');
+    std::memcpy(payload.data(), &id, sizeof(id));
+    std::memcpy(payload.data() + sizeof(id), name.data(), name.size());
+    WriteRecord(type, payload.data(), payload.size());
+}
+
+uint64_t IngestJournal::Append(const DeviceState& state) {
+    char payload[READING_SIZE];
+    const auto id = static_cast<uint32_t>(state.device_id_);
+    const int64_t ns = ToNanos(state.last_update_);
+    std::memcpy(payload, &id, sizeof(id));
+    std::memcpy(payload + 4, &ns, sizeof(ns));
+    std::memcpy(payload + 12, &state.temperature_, sizeof(double));
+    std::memcpy(payload + 20, &state.humidity_, sizeof(double));
+    std::memcpy(payload + 28, &state.pressure_, sizeof(double));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    PrepareSegment(state.device_id_, std::nullopt, RECORD_HEADER_SIZE + READING_SIZE);
+    WriteRecord(kReading, payload, READING_SIZE);
+    ++segments_.back()->count_;
+    ++appended_;
+    return ++records_;
+}
+
+uint64_t IngestJournal::Append(const MetricSample& sample) {
+    char payload[METRIC_SIZE];
+    const auto id = static_cast<uint32_t>(sample.device_id_);
+    const int64_t ns = ToNanos(sample.time_);
+    std::memcpy(payload, &id, sizeof(id));
+    std::memcpy(payload + 4, &sample.metric_, sizeof(sample.metric_));
+    std::memcpy(payload + 6, &ns, sizeof(ns));
+    std::memcpy(payload + 14, &sample.value_, sizeof(double));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    PrepareSegment(sample.device_id_, sample.metric_, RECORD_HEADER_SIZE + METRIC_SIZE);
+    WriteRecord(kMetric, payload, METRIC_SIZE);
+    ++segments_.back()->metric_count_;
+    ++metrics_appended_;
+    return ++records_;
+}
+
+void IngestJournal::Commit(uint64_t seq) {
+    std::unique_lock<std::mutex> lock(sync_mutex_);
+    while (synced_ < seq) {
+        if (syncing_) {
+            sync_cv_.wait(lock);
+            continue;
+        }
+        // Ведущий: один fdatasync покрывает все, что записано к этому моменту
+        syncing_ = true;
+        lock.unlock();
+
+        uint64_t target = 0;
+        std::shared_ptr<Segment> segment;
+        {
+            std::lock_guard<std::mutex> segments_lock(mutex_);
+            target = records_;
+            segment = segments_.back();
+        }
+        {
+            metrics::ScopedTimer timer(metrics::Stage::kJournalSync);
+            if (fdatasync(segment->fd_) != 0) {
+                LOG_RATE_LIMITED(LogLevel::kError, 10, "Journal fdatasync: {}", strerror(errno));
+            }
+        }
+
+        lock.lock();
+        synced_ = std::max(synced_, target);
+        syncing_ = false;
+        sync_cv_.notify_all();
+    }
+}
+
+void IngestJournal::Release(uint64_t count, uint64_t metric_count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    released_ += count;
+    metrics_released_ += metric_count;
+    ReleaseSegments();
+}
+
+// Под mutex_. Показания и метрики освобождаются независимо, поэтому число
+// освобожденных записей обновляется в заголовке каждого оставшегося сегмента.
+void IngestJournal::ReleaseSegments() {
+    auto released_in = [](uint64_t released, uint64_t first, uint64_t count) {
+        return std::min(released - std::min(released, first), count);
+    };
+    while (segments_.size() > 1) {
+        const Segment& front = *segments_.front();
+        if (front.first_seq_ + front.count_ > released_ ||
+            front.metric_first_seq_ + front.metric_count_ > metrics_released_) {
+            break;
+        }
+        unlink(front.path_.c_str());
+        segments_.pop_front();
+    }
+    for (const auto& segment : segments_) {
+        const uint64_t released = released_in(released_, segment->first_seq_, segment->count_);
+        const uint64_t released_metrics = released_in(metrics_released_, segment->metric_first_seq_, segment->metric_count_);
+        std::memcpy(segment->base_ + RELEASED_OFFSET, &released, sizeof(released));
+        std::memcpy(segment->base_ + RELEASED_METRICS_OFFSET, &released_metrics, sizeof(released_metrics));
+    }
+}
+
+size_t IngestJournal::SegmentCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segments_.size();
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "device.h"
+#include "metric_schema.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Журнал приема: последовательная запись показаний в сегменты, отображенные
+// в память, до того как устройство получит подтверждение.
+//
+// Записи идут в том же порядке, в каком показания попадают в очередь
+// DataBase (вызывающий держит общую блокировку), поэтому освобождение
+// ведется счетчиком: Release(n, m) - следующие n показаний и m значений
+// дополнительных метрик журнала сохранены хранилищем. Показания и метрики
+// идут в базе через разные очереди и считаются раздельно. Сегмент, все
+// записи которого освобождены, удаляется; в заголовке текущего сегмента
+// хранятся оба числа освобожденных записей, чтобы после падения процесса
+// не повторять их.
+//
+// Commit - групповая фиксация: один поток делает fdatasync за всех,
+// кто ждет, остальные спят на условной переменной.
+//
+// Сегмент: заголовок SEGMENT_HEADER_SIZE байт, затем записи
+//   type (uint16), size (uint16), checksum (uint32, FNV-1a), нагрузка size байт.
+// NAME связывает номер устройства в журнале с именем и пишется в сегмент
+// перед первым показанием этого устройства, METRIC_NAME так же связывает
+// номер метрики. Нулевой type - конец записей.
+class IngestJournal {
+public:
+    static constexpr size_t SEGMENT_SIZE = 16 * 1024 * 1024;
+    static constexpr size_t SEGMENT_HEADER_SIZE = 64;
+    static constexpr size_t REPLAY_BATCH = 4096;
+
+    // Показания и значения метрик одного отрезка журнала
+    using ReplaySink = std::function<void(const std::vector<DeviceState>&, const std::vector<MetricSample>&)>;
+
+    // Открывает каталог directory (создает при необходимости). Сегменты
+    // прошлого запуска не трогаются до Replay.
+    IngestJournal(DeviceIdTable& ids, MetricSchema& schema, std::string directory);
+    ~IngestJournal();
+
+    IngestJournal(const IngestJournal&) = delete;
+    IngestJournal &operator=(const IngestJournal&) = delete;
+
+    // Отдает sink неосвобожденные показания прошлого запуска пакетами по
+    // порядку, затем удаляет их сегменты. Когда sink вернулся, показания
+    // должны быть сохранены. Вызывать один раз, до первого Append.
+    size_t Replay(const ReplaySink& sink);
+
+    // Под блокировкой вызывающего, в порядке очереди. Возвращает номер
+    // записи для Commit.
+    uint64_t Append(const DeviceState& state);
+    uint64_t Append(const MetricSample& sample);
+
+    // Ждет, пока записи с номерами до seq включительно не окажутся на диске
+    void Commit(uint64_t seq);
+
+    // Только поток писателя базы
+    void Release(uint64_t count, uint64_t metric_count = 0);
+
+    size_t SegmentCount() const;
+
+private:
+    struct Segment;
+
+    DeviceIdTable& ids_;
+    MetricSchema& schema_;
+    std::string directory_;
+    std::vector<std::string> old_files_;        // До Replay
+
+    mutable std::mutex mutex_;                  // Сегменты и счетчики
+    std::deque<std::shared_ptr<Segment>> segments_;     // Последний - текущий для записи
+    std::vector<uint32_t> named_in_;            // Номер сегмента + 1, где уже записано имя устройства
+    std::vector<uint32_t> metric_named_in_;     // То же для имен метрик
+    uint32_t next_segment_ = 0;
+    uint64_t records_ = 0;                      // Записей для Commit
+    uint64_t appended_ = 0;                     // Показаний записано
+    uint64_t released_ = 0;                     // Показаний освобождено
+    uint64_t metrics_appended_ = 0;
+    uint64_t metrics_released_ = 0;
+
+    std::mutex sync_mutex_;
+    std::condition_variable sync_cv_;
+    uint64_t synced_ = 0;
+    bool syncing_ = false;
+
+    void OpenSegment();
+    void Rotate();
+    void PrepareSegment(DeviceId id, std::optional<MetricId> metric, size_t record);
+    char *Reserve(size_t size);
+    void WriteRecord(uint16_t type, const char *payload, size_t size);
+    void WriteName(uint16_t type, uint32_t id, std::string_view name);
+    void ReleaseSegments();
+
+    struct ReplayBatch {
+        std::vector<DeviceState> readings_;
+        std::vector<MetricSample> metrics_;
+        size_t replayed_ = 0;
+        size_t replayed_metrics_ = 0;
+    };
+
+    void ReplayFile(const std::string& path, const ReplaySink& sink, ReplayBatch& batch);
+};
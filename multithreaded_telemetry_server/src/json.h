@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cmath>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+
+// Дописывает строку в кавычках JSON, экранируя кавычки, обратную косую черту
+// и управляющие символы. Общая для ответов HTTP (/query, /flagged, /device).
+inline void AppendJsonString(std::string& out, std::string_view value) {
+    out += '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fmt::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned>(c));
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// NaN и бесконечность в JSON не представимы: вместо них null
+inline void AppendJsonNumber(std::string& out, double value) {
+    if (std::isfinite(value)) {
+        fmt::format_to(std::back_inserter(out), "{}", value);
+    } else {
+        out += "null";
+    }
+}
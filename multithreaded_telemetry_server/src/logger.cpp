@@ -0,0 +1,177 @@
+#include "logger.h"
+
+#include <condition_variable>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace logging {
+
+namespace {
+
+constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(50);
+
+const char *LevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::kDebug: return "DEBUG";
+    case LogLevel::kInfo: return "INFO ";
+    case LogLevel::kWarn: return "WARN ";
+    case LogLevel::kError: return "ERROR";
+    }
+    return "?    ";
+}
+
+void WriteAll(int fd, const std::string& text) {
+    size_t written = 0;
+    while (written < text.size()) {
+        ssize_t n = ::write(fd, text.data() + written, text.size() - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        written += n;
+    }
+}
+
+// Фоновый поток вывода. Создается при первой записи, при завершении
+// процесса выводит оставшиеся записи.
+class Flusher {
+public:
+    Flusher() : thread_(&Flusher::Run, this) {}
+
+    ~Flusher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    void Register(std::shared_ptr<ThreadBuffer> buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.push_back(std::move(buffer));
+    }
+
+    void Flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const uint64_t target = ++requested_;
+        cv_.notify_one();
+        done_cv_.wait(lock, [this, target] { return completed_ >= target || stop_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+    uint64_t requested_ = 0;
+    uint64_t completed_ = 0;
+    bool stop_ = false;
+    std::vector<LogRecord> pending_;
+    std::string out_;
+    std::string err_;
+    std::thread thread_;
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait_for(lock, FLUSH_INTERVAL, [this] { return stop_ || requested_ > completed_; });
+            const bool stopping = stop_;
+            const uint64_t target = requested_;
+            auto buffers = buffers_;
+            lock.unlock();
+
+            DrainAndWrite(buffers);
+
+            lock.lock();
+            // Буферы завершившихся потоков удаляем, когда из них всё выведено
+            std::erase_if(buffers_, [](const auto& buffer) {
+                return buffer->orphaned_.load() && buffer->Empty();
+            });
+            completed_ = target;
+            done_cv_.notify_all();
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    void DrainAndWrite(const std::vector<std::shared_ptr<ThreadBuffer>>& buffers) {
+        pending_.clear();
+        uint64_t dropped = 0;
+        for (const auto& buffer : buffers) {
+            buffer->Drain([this](const LogRecord& record) { pending_.push_back(record); });
+            dropped += buffer->TakeDropped();
+        }
+        if (pending_.empty() && dropped == 0) {
+            return;
+        }
+
+        // Записи разных потоков выводим в порядке времени
+        std::stable_sort(pending_.begin(), pending_.end(), [](const LogRecord& a, const LogRecord& b) {
+            return a.time_ < b.time_;
+        });
+
+        out_.clear();
+        err_.clear();
+        for (const auto& record : pending_) {
+            std::string& target = record.level_ >= LogLevel::kWarn ? err_ : out_;
+            AppendRecord(target, record);
+        }
+        if (dropped != 0) {
+            fmt::format_to(std::back_inserter(err_), "[logger] {} messages dropped, thread buffer full\n", dropped);
+        }
+
+        WriteAll(STDOUT_FILENO, out_);
+        WriteAll(STDERR_FILENO, err_);
+    }
+
+    static void AppendRecord(std::string& target, const LogRecord& record) {
+        const auto since_epoch = record.time_.time_since_epoch();
+        const std::time_t seconds = std::chrono::system_clock::to_time_t(record.time_);
+        const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch).count() % 1000;
+        std::tm tm;
+        localtime_r(&seconds, &tm);
+
+        char stamp[32];
+        const size_t stamp_size = std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+        fmt::format_to(std::back_inserter(target), "{}.{:03} {} {}\n",
+                       std::string_view(stamp, stamp_size), millis, LevelName(record.level_),
+                       std::string_view(record.text_, record.size_));
+    }
+};
+
+Flusher& GetFlusher() {
+    static Flusher flusher;
+    return flusher;
+}
+
+// Владеет буфером потока; при завершении потока помечает буфер, чтобы
+// фоновый поток дочитал его и удалил
+struct BufferHolder {
+    std::shared_ptr<ThreadBuffer> buffer_ = std::make_shared<ThreadBuffer>();
+
+    BufferHolder() { GetFlusher().Register(buffer_); }
+    ~BufferHolder() { buffer_->orphaned_ = true; }
+};
+
+} // namespace
+
+ThreadBuffer& LocalBuffer() {
+    thread_local BufferHolder holder;
+    return *holder.buffer_;
+}
+
+void Flush() {
+    GetFlusher().Flush();
+}
+
+} // namespace logging
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "cache_line.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include <fmt/format.h>
+
+// Асинхронный журнал сервера. Каждый поток пишет записи в свой
+// SPSC-буфер, фоновый поток периодически забирает их из всех буферов
+// и выводит одним системным вызовом на поток вывода. Рабочие потоки
+// не берут блокировок и не ждут ввода-вывода; если буфер потока
+// переполнен, запись отбрасывается и учитывается.
+//
+// Макросы LOG_* проверяют уровень до вычисления аргументов, поэтому
+// отключенный уровень стоит одного сравнения.
+
+enum class LogLevel {
+    kDebug,
+    kInfo,
+    kWarn,
+    kError
+};
+
+inline std::atomic<LogLevel> g_log_level{LogLevel::kInfo};
+
+inline bool LogEnabled(LogLevel level) {
+    return level >= g_log_level.load(std::memory_order_relaxed);
+}
+
+inline std::optional<LogLevel> ParseLogLevel(std::string_view name) {
+    if (name == "debug") return LogLevel::kDebug;
+    if (name == "info") return LogLevel::kInfo;
+    if (name == "warn") return LogLevel::kWarn;
+    if (name == "error") return LogLevel::kError;
+    return std::nullopt;
+}
+
+namespace logging {
+
+struct LogRecord {
+    static constexpr size_t MAX_TEXT_SIZE = 232;
+
+    std::chrono::system_clock::time_point time_;
+    LogLevel level_;
+    uint16_t size_;
+    char text_[MAX_TEXT_SIZE];
+};
+
+// Кольцевой буфер записей одного потока: пишет только владелец, читает только фоновый поток
+class ThreadBuffer {
+public:
+    static constexpr size_t CAPACITY = 512;
+
+    LogRecord *BeginWrite() {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == CAPACITY) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &records_[tail % CAPACITY];
+    }
+
+    void CommitWrite() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Только фоновый поток
+    template <typename F>
+    void Drain(F&& consume) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            consume(records_[head % CAPACITY]);
+        }
+        head_.store(head, std::memory_order_release);
+    }
+
+    uint64_t TakeDropped() { return dropped_.exchange(0, std::memory_order_relaxed); }
+
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    std::atomic<bool> orphaned_{false};     // Поток-владелец завершился
+
+private:
+    std::array<LogRecord, CAPACITY> records_;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+// Буфер текущего потока, при первом обращении регистрируется в фоновом потоке
+ThreadBuffer& LocalBuffer();
+
+// Будит фоновый поток и ждет, пока он выведет всё записанное до вызова
+void Flush();
+
+template <typename... Args>
+void Write(LogLevel level, fmt::format_string<Args...> format, Args&&... args) {
+    ThreadBuffer& buffer = LocalBuffer();
+    LogRecord *record = buffer.BeginWrite();
+    if (record == nullptr) {
+        return;
+    }
+    const auto result = fmt::format_to_n(record->text_, LogRecord::MAX_TEXT_SIZE, format, std::forward<Args>(args)...);
+    record->size_ = static_cast<uint16_t>(std::min<size_t>(result.size, LogRecord::MAX_TEXT_SIZE));
+    record->level_ = level;
+    record->time_ = std::chrono::system_clock::now();
+    buffer.CommitWrite();
+}
+
+// Не более per_second сообщений в секунду с одного места вызова
+class RateLimiter {
+public:
+    explicit RateLimiter(uint32_t per_second) : per_second_(per_second) {}
+
+    // suppressed - сколько сообщений подавлено с момента прошлого разрешения
+    bool Allow(uint64_t& suppressed) {
+        const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t window = window_.load(std::memory_order_relaxed);
+        if (window != now && window_.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+            in_window_.store(0, std::memory_order_relaxed);
+        }
+        if (in_window_.fetch_add(1, std::memory_order_relaxed) < per_second_) {
+            suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    const uint32_t per_second_;
+    std::atomic<int64_t> window_{0};
+    std::atomic<uint32_t> in_window_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+} // namespace logging
+
+#define LOG_AT(level, ...)                                      \
+    do {                                                        \
+        if (LogEnabled(level)) {                                \
+            ::logging::Write(level, __VA_ARGS__);               \
+        }                                                       \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LogLevel::kDebug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::kInfo, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LogLevel::kWarn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::kError, __VA_ARGS__)
+
+// Для повторяющихся ошибок (например, мусор от одного сломанного устройства):
+// лимит на место вызова, число подавленных сообщений выводится с очередным
+#define LOG_RATE_LIMITED(level, per_second, ...)                                        \
+    do {                                                                                \
+        if (LogEnabled(level)) {                                                        \
+            static ::logging::RateLimiter log_limiter_(per_second);                     \
+            uint64_t log_suppressed_ = 0;                                               \
+            if (log_limiter_.Allow(log_suppressed_)) {                                  \
+                if (log_suppressed_ != 0) {                                             \
+                    ::logging::Write(level, "({} similar messages suppressed)", log_suppressed_); \
+                }                                                                       \
+                ::logging::Write(level, __VA_ARGS__);                                   \
+            }                                                                           \
+        }                                                                               \
+    } while (0)
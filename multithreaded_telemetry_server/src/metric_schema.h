@@ -0,0 +1,193 @@
+#pragma once
+
+#include "cache_line.h"
+#include "intern_table.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+using MetricId = uint16_t;
+
+// Ключи с постоянным смещением в DeviceState. Они занимают первые номера
+// схемы, но по конвейеру идут полями показания, а не отдельными значениями.
+constexpr MetricId METRIC_TEMPERATURE = 0;
+constexpr MetricId METRIC_HUMIDITY = 1;
+constexpr MetricId METRIC_PRESSURE = 2;
+constexpr MetricId FIXED_METRICS = 3;
+
+// Сколько новых имен метрик может добавить в схему один источник
+// (соединение): устройство, которое шлет случайные ключи, не займет
+// все MAX_METRICS номеров за остальных
+struct MetricNameBudget {
+    static constexpr uint32_t DEFAULT = 64;
+
+    uint32_t left_ = DEFAULT;
+    uint64_t refused_ = 0;      // Новые имена, не добавленные из-за исчерпания
+};
+
+// Схема метрик: имя ключа показания ("co2", "voltage") превращается в
+// компактный MetricId один раз, как имя устройства в DeviceIdTable.
+// Ключей мало и новые появляются редко, поэтому прямой поиск идет по одной
+// таблице под shared_mutex, обратный (id -> имя) - без блокировок.
+class MetricSchema {
+public:
+    static constexpr size_t MAX_METRICS = 4096;
+    static constexpr size_t MAX_NAME_SIZE = 64;
+
+    MetricSchema() {
+        Intern("temp");
+        Intern("hum");
+        Intern("press");
+    }
+
+    MetricSchema(const MetricSchema&) = delete;
+    MetricSchema &operator=(const MetricSchema&) = delete;
+
+    // nullopt, если схема заполнена или имя длиннее MAX_NAME_SIZE: такой
+    // ключ пропускается, как раньше пропускались все неизвестные ключи
+    std::optional<MetricId> Intern(std::string_view name) {
+        if (auto id = Find(name)) {
+            return id;
+        }
+        if (name.empty() || name.size() > MAX_NAME_SIZE) {
+            return std::nullopt;
+        }
+
+        std::unique_lock lock(mutex_);
+        const size_t size = size_.load(std::memory_order_relaxed);
+        if (size >= MAX_METRICS) {
+            auto it = ids_.find(name);
+            return it != ids_.end() ? std::optional<MetricId>(it->second) : std::nullopt;
+        }
+        auto [it, inserted] = ids_.try_emplace(std::string(name), static_cast<MetricId>(size));
+        if (inserted) {
+            names_[size].store(&it->first, std::memory_order_release);
+            size_.store(size + 1, std::memory_order_release);
+        }
+        return it->second;
+    }
+
+    // Известное имя - без ограничений, новое расходует budget
+    std::optional<MetricId> Intern(std::string_view name, MetricNameBudget& budget) {
+        if (auto id = Find(name)) {
+            return id;
+        }
+        if (budget.left_ == 0) {
+            ++budget.refused_;
+            return std::nullopt;
+        }
+        const auto id = Intern(name);
+        budget.left_ -= id.has_value();
+        return id;
+    }
+
+    std::optional<MetricId> Find(std::string_view name) const {
+        std::shared_lock lock(mutex_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    // Пустая строка для неизвестного id
+    std::string_view Name(MetricId id) const {
+        if (id >= size_.load(std::memory_order_acquire)) {
+            return {};
+        }
+        const std::string *name = names_[id].load(std::memory_order_acquire);
+        return name ? std::string_view(*name) : std::string_view();
+    }
+
+    size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+private:
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, MetricId, StringHash, std::equal_to<>> ids_;
+    std::array<std::atomic<const std::string*>, MAX_METRICS> names_{};
+    std::atomic<size_t> size_{0};
+};
+
+// Значение метрики вне фиксированной раскладки. Идет рядом с показанием,
+// к которому относится, и несет его устройство и время.
+struct MetricSample {
+    DeviceId device_id_ = INVALID_DEVICE_ID;
+    MetricId metric_ = 0;
+    double value_ = 0.0;
+    std::chrono::system_clock::time_point time_;
+};
+
+static_assert(std::is_trivially_copyable_v<MetricSample>);
+
+struct MetricValue {
+    MetricId metric_;
+    double value_;
+};
+
+// Последние значения дополнительных метрик по устройствам: короткий
+// отсортированный по MetricId вектор на устройство, только ключи, которые
+// устройство присылало. Шарды по DeviceId со своим мьютексом; устройства
+// с одними temp/hum/press сюда не попадают и ничего не платят.
+class DeviceMetrics {
+public:
+    // samples[0, count) - значения одного показания устройства id
+    void Update(DeviceId id, const MetricSample *samples, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        Shard& shard = shards_[id % SHARD_COUNT];
+        std::lock_guard lock(shard.mutex_);
+        auto& values = shard.values_[id];
+        for (size_t i = 0; i < count; ++i) {
+            const MetricId metric = samples[i].metric_;
+            auto it = std::lower_bound(values.begin(), values.end(), metric,
+                                       [](const MetricValue& value, MetricId key) { return value.metric_ < key; });
+            if (it != values.end() && it->metric_ == metric) {
+                it->value_ = samples[i].value_;
+            } else {
+                values.insert(it, MetricValue{metric, samples[i].value_});
+            }
+        }
+    }
+
+    std::vector<MetricValue> Get(DeviceId id) const {
+        const Shard& shard = shards_[id % SHARD_COUNT];
+        std::lock_guard lock(shard.mutex_);
+        auto it = shard.values_.find(id);
+        return it != shard.values_.end() ? it->second : std::vector<MetricValue>();
+    }
+
+    // Вызывается при удалении устройства из реестра
+    void Erase(DeviceId id) {
+        Shard& shard = shards_[id % SHARD_COUNT];
+        std::lock_guard lock(shard.mutex_);
+        shard.values_.erase(id);
+    }
+
+private:
+    static constexpr size_t SHARD_COUNT = 64;
+
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        mutable std::mutex mutex_;
+        std::unordered_map<DeviceId, std::vector<MetricValue>> values_;
+    };
+
+    Shard shards_[SHARD_COUNT];
+};
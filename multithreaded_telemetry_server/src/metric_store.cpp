@@ -0,0 +1,81 @@
+#include "metric_store.h"
+#include "logger.h"
+
+#include <chrono>
+#include <stdexcept>
+
+MetricStore::MetricStore(const DeviceIdTable& ids, const MetricSchema& schema, const std::string& path,
+                         const std::string& synchronous)
+    : ids_(ids), schema_(schema) {
+    if (sqlite3_open(path.c_str(), &db_) != SQLITE_OK) {
+        throw std::runtime_error("metric store open: " + std::string(sqlite3_errmsg(db_)));
+    }
+    // Соединение делит файл с SqliteStorage: ждем, пока другой писатель отпустит блокировку
+    sqlite3_busy_timeout(db_, 5000);
+    Exec("PRAGMA journal_mode=WAL;");
+    Exec(("PRAGMA synchronous=" + synchronous + ";").c_str());
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, "PRAGMA synchronous;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        durable_on_write_ = sqlite3_column_int(stmt, 0) >= 2;
+    }
+    sqlite3_finalize(stmt);
+
+    Exec("CREATE TABLE IF NOT EXISTS sensor_metrics("
+         "DEVICE_ID TEXT NOT NULL, TIMESTAMP INTEGER NOT NULL, METRIC TEXT NOT NULL, VALUE REAL NOT NULL);");
+    Exec("CREATE INDEX IF NOT EXISTS sensor_metrics_device_metric_time ON sensor_metrics(DEVICE_ID, METRIC, TIMESTAMP);");
+    if (sqlite3_prepare_v2(db_, "INSERT INTO sensor_metrics VALUES (?, ?, ?, ?);", -1, &insert_stmt_, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("metric store prepare: " + std::string(sqlite3_errmsg(db_)));
+    }
+}
+
+MetricStore::~MetricStore() {
+    sqlite3_finalize(insert_stmt_);
+    sqlite3_close(db_);
+}
+
+bool MetricStore::Exec(const char* sql) {
+    char* error = nullptr;
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+        LOG_ERROR("Metric DB Error: {}", error ? error : sqlite3_errmsg(db_));
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+bool MetricStore::Write(const std::vector<MetricSample>& samples) {
+    if (samples.empty()) {
+        return true;
+    }
+
+    if (!Exec("BEGIN;")) {
+        return false;
+    }
+    for (const auto& sample : samples) {
+        const std::string_view device_id = ids_.Name(sample.device_id_);
+        const std::string_view metric = schema_.Name(sample.metric_);
+        sqlite3_bind_text(insert_stmt_, 1, device_id.data(), static_cast<int>(device_id.size()), SQLITE_STATIC);
+        sqlite3_bind_int64(insert_stmt_, 2, std::chrono::system_clock::to_time_t(sample.time_));
+        sqlite3_bind_text(insert_stmt_, 3, metric.data(), static_cast<int>(metric.size()), SQLITE_STATIC);
+        sqlite3_bind_double(insert_stmt_, 4, sample.value_);
+        const bool done = sqlite3_step(insert_stmt_) == SQLITE_DONE;
+        if (!done) {
+            LOG_RATE_LIMITED(LogLevel::kError, 10, "Metric DB Error: {}", sqlite3_errmsg(db_));
+        }
+        sqlite3_reset(insert_stmt_);
+        if (!done) {
+            if (sqlite3_get_autocommit(db_) == 0) {     // Часть ошибок SQLite откатывает сама
+                Exec("ROLLBACK;");
+            }
+            return false;
+        }
+    }
+
+    if (!Exec("COMMIT;")) {
+        if (sqlite3_get_autocommit(db_) == 0) {     // COMMIT не прошел, транзакция еще открыта
+            Exec("ROLLBACK;");
+        }
+        return false;
+    }
+    return true;
+}
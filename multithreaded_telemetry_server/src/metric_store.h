@@ -0,0 +1,41 @@
+#pragma once
+
+#include "intern_table.h"
+#include "metric_schema.h"
+
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+// Значения дополнительных метрик в таблице sensor_metrics SQLite: строка -
+// одно значение (устройство, время, имя метрики). Набор ключей у устройств
+// разный, поэтому таблица узкая, а не столбец на метрику. TIMESTAMP - в
+// секундах, как в sensor_data: значения одного показания соединяются с его
+// строкой по (DEVICE_ID, TIMESTAMP).
+class MetricStore {
+public:
+    MetricStore(const DeviceIdTable& ids, const MetricSchema& schema, const std::string& path,
+                const std::string& synchronous);
+    ~MetricStore();
+
+    MetricStore(const MetricStore&) = delete;
+    MetricStore &operator=(const MetricStore&) = delete;
+
+    // Только поток писателя; одна транзакция на вызов
+    bool Write(const std::vector<MetricSample>& samples);     // false - ничего не записано
+
+    // Только поток писателя
+    void Checkpoint() { Exec("PRAGMA wal_checkpoint(TRUNCATE);"); }
+
+    // Как у SqliteStorage: synchronous=FULL или EXTRA
+    bool DurableOnWrite() const { return durable_on_write_; }
+
+private:
+    const DeviceIdTable& ids_;
+    const MetricSchema& schema_;
+    sqlite3* db_ = nullptr;
+    sqlite3_stmt* insert_stmt_ = nullptr;
+    bool durable_on_write_ = false;
+
+    bool Exec(const char* sql);
+};
@@ -0,0 +1,332 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+
+namespace metrics {
+
+namespace {
+
+constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::kCount);
+constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::kCount);
+constexpr size_t MAX_THREADS = 256;
+constexpr int POLL_TIMEOUT_MS = 100;
+
+struct CounterInfo {
+    const char *name;
+    const char *help;
+};
+
+constexpr std::array<CounterInfo, COUNTER_COUNT> COUNTERS = {{
+    {"telemetry_accepts_total", "Accepted device connections"},
+    {"telemetry_readings_parsed_total", "Readings parsed successfully"},
+    {"telemetry_parse_failures_total", "Readings rejected by the parser"},
+    {"telemetry_registry_updates_total", "DeviceRegistry updates"},
+    {"telemetry_db_rows_committed_total", "Rows committed to the database"},
+    {"telemetry_rollup_rows_written_total", "Rows written to the rollup tables"},
+    {"telemetry_devices_stale_total", "Devices that went stale"},
+    {"telemetry_devices_evicted_total", "Devices evicted from the registry"},
+    {"telemetry_feed_deltas_sent_total", "Device state changes sent to subscribers"},
+    {"telemetry_feed_coalesced_total", "Changes that replaced an undelivered change of the same device"},
+    {"telemetry_feed_dropped_total", "Changes dropped because a subscriber queue was full"},
+    {"telemetry_readings_rejected_total", "Readings rejected by validation"},
+    {"telemetry_readings_flagged_total", "Readings accepted but flagged by validation"},
+    {"telemetry_validation_side_channel_dropped_total", "Rejected or flagged readings dropped from a full side channel"},
+    {"telemetry_metric_values_committed_total", "Values of metrics outside temp/hum/press committed to the database"},
+    {"telemetry_readings_duplicate_total", "Retried readings dropped by the per-device sequence window"},
+    {"telemetry_readings_unordered_total", "Readings written outside time order: older than written ones or too far ahead"},
+    {"telemetry_metric_names_refused_total", "New metric names refused after a connection used up its limit"},
+}};
+
+constexpr std::array<CounterInfo, STAGE_COUNT> STAGES = {{
+    {"telemetry_parse_duration_seconds", "Time to parse one reading"},
+    {"telemetry_registry_duration_seconds", "Time to update DeviceRegistry with one reading"},
+    {"telemetry_db_commit_duration_seconds", "Time to commit one batch to the database"},
+    {"telemetry_journal_sync_duration_seconds", "Time of one group fdatasync of the ingest journal"},
+    {"telemetry_validate_duration_seconds", "Time to validate the readings of one socket read"},
+    {"telemetry_registry_snapshot_duration_seconds", "Time to write one DeviceRegistry snapshot"},
+}};
+
+struct alignas(CACHE_LINE_SIZE) ThreadSlot {
+    std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters_{};
+    std::array<Histogram, STAGE_COUNT> histograms_;
+};
+
+struct Gauge {
+    std::string name;
+    std::string help;
+    std::function<double()> read;
+};
+
+struct Route {
+    std::string path;
+    std::string content_type;
+    RouteHandler handler;
+};
+
+// Слот 0 общий для потоков, которым не хватило собственного, пишется под мьютексом
+struct Registry {
+    std::array<std::atomic<ThreadSlot*>, MAX_THREADS> slots_{};
+    std::atomic<size_t> used_{1};
+    std::mutex overflow_mutex_;
+    std::mutex gauges_mutex_;
+    std::vector<Gauge> gauges_;
+    std::mutex routes_mutex_;
+    std::vector<Route> routes_;
+
+    Registry() { slots_[0].store(new ThreadSlot); }
+
+    ~Registry() {
+        for (auto& slot : slots_) {
+            delete slot.load();
+        }
+    }
+};
+
+Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+ThreadSlot *AcquireSlot() {
+    Registry& registry = GetRegistry();
+    const size_t index = registry.used_.fetch_add(1);
+    if (index < MAX_THREADS) {
+        auto *slot = new ThreadSlot;
+        registry.slots_[index].store(slot, std::memory_order_release);
+        return slot;
+    }
+    return nullptr;
+}
+
+// Слот текущего потока; nullptr, если слоты закончились
+ThreadSlot *LocalSlot() {
+    thread_local ThreadSlot *slot = AcquireSlot();
+    return slot;
+}
+
+template <typename F>
+void ForEachSlot(F&& visit) {
+    for (const auto& slot : GetRegistry().slots_) {
+        if (const ThreadSlot *s = slot.load(std::memory_order_acquire)) {
+            visit(*s);
+        }
+    }
+}
+
+// Потоки без собственного слота пишут в общий под мьютексом
+template <typename F>
+void WithSlot(F&& update) {
+    if (ThreadSlot *slot = LocalSlot()) {
+        update(*slot);
+        return;
+    }
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.overflow_mutex_);
+    update(*registry.slots_[0].load(std::memory_order_acquire));
+}
+
+} // namespace
+
+void Increment(Counter counter, uint64_t delta) {
+    WithSlot([counter, delta](ThreadSlot& slot) {
+        auto& value = slot.counters_[static_cast<size_t>(counter)];
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    });
+}
+
+void RecordLatency(Stage stage, std::chrono::nanoseconds duration) {
+    WithSlot([stage, duration](ThreadSlot& slot) {
+        slot.histograms_[static_cast<size_t>(stage)].Record(static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)));
+    });
+}
+
+void RegisterGauge(std::string name, std::string help, std::function<double()> read) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.gauges_mutex_);
+    registry.gauges_.push_back({std::move(name), std::move(help), std::move(read)});
+}
+
+void RegisterRoute(std::string path, std::string content_type, RouteHandler handler) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.routes_mutex_);
+    registry.routes_.push_back({std::move(path), std::move(content_type), std::move(handler)});
+}
+
+std::string RenderPrometheus() {
+    std::ostringstream out;
+
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        uint64_t total = 0;
+        ForEachSlot([&](const ThreadSlot& slot) { total += slot.counters_[i].load(std::memory_order_relaxed); });
+
+        out << "# HELP " << COUNTERS[i].name << ' ' << COUNTERS[i].help << '\n'
+            << "# TYPE " << COUNTERS[i].name << " counter\n"
+            << COUNTERS[i].name << ' ' << total << '\n';
+    }
+
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.gauges_mutex_);
+        for (const auto& gauge : registry.gauges_) {
+            out << "# HELP " << gauge.name << ' ' << gauge.help << '\n'
+                << "# TYPE " << gauge.name << " gauge\n"
+                << gauge.name << ' ' << gauge.read() << '\n';
+        }
+    }
+
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        HistogramSnapshot snapshot;
+        ForEachSlot([&](const ThreadSlot& slot) { snapshot.Add(slot.histograms_[i]); });
+
+        const std::string name = STAGES[i].name;
+        out << "# HELP " << name << ' ' << STAGES[i].help << '\n'
+            << "# TYPE " << name << " histogram\n";
+
+        // Внутренние корзины мельче; наружу отдаем границы по степеням двойки
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < Histogram::BUCKET_COUNT; ++b) {
+            cumulative += snapshot.BucketCount(b);
+            if ((b + 1) % Histogram::SUB_BUCKETS == 0 && b >= Histogram::SUB_BUCKETS * 3) {
+                const double le = static_cast<double>(Histogram::BucketUpperBound(b) + 1) * 1e-9;
+                out << name << "_bucket{le=\"" << le << "\"} " << cumulative << '\n';
+                if (le > 60.0) {
+                    break;
+                }
+            }
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << snapshot.Count() << '\n'
+            << name << "_sum " << static_cast<double>(snapshot.Sum()) * 1e-9 << '\n'
+            << name << "_count " << snapshot.Count() << '\n';
+
+        const std::string quantiles = name.substr(0, name.size() - 8) + "_quantile_seconds";
+        out << "# HELP " << quantiles << ' ' << STAGES[i].help << ", quantiles\n"
+            << "# TYPE " << quantiles << " gauge\n";
+        for (double q : {0.5, 0.99, 0.999}) {
+            out << quantiles << "{quantile=\"" << q << "\"} "
+                << static_cast<double>(snapshot.Quantile(q)) * 1e-9 << '\n';
+        }
+    }
+
+    return out.str();
+}
+
+namespace {
+
+struct Response {
+    std::string status;
+    std::string content_type;
+    std::string body;
+};
+
+Response Dispatch(std::string_view target) {
+    const size_t question = target.find('?');
+    const std::string_view path = target.substr(0, question);
+    const std::string_view params = question == std::string_view::npos ? std::string_view() : target.substr(question + 1);
+
+    RouteHandler handler;
+    std::string content_type;
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.routes_mutex_);
+        for (const auto& route : registry.routes_) {
+            if (route.path == path) {
+                handler = route.handler;
+                content_type = route.content_type;
+                break;
+            }
+        }
+    }
+
+    if (!handler) {
+        return {"200 OK", "text/plain; version=0.0.4", RenderPrometheus()};
+    }
+    try {
+        return {"200 OK", content_type, handler(params)};
+    } catch (const std::invalid_argument& ex) {
+        return {"400 Bad Request", "text/plain", std::string(ex.what()) + "\n"};
+    } catch (const std::exception& ex) {
+        return {"500 Internal Server Error", "text/plain", std::string(ex.what()) + "\n"};
+    }
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(const char *port, const std::atomic<bool>& stop)
+    : stop_(stop) {
+
+    AddrInfo addr("127.0.0.1", port, AI_PASSIVE);
+    listener_.Reset(socket(addr.Get()->ai_family, addr.Get()->ai_socktype, addr.Get()->ai_protocol));
+
+    if (listener_.GetFd() < 0) {
+        throw std::runtime_error("socket");
+    }
+
+    int yes = 1;
+    setsockopt(listener_.GetFd(), SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if (bind(listener_.GetFd(), addr.Get()->ai_addr, addr.Get()->ai_addrlen) < 0) {
+        throw std::runtime_error("bind");
+    }
+
+    if (listen(listener_.GetFd(), SOMAXCONN) < 0) {
+        throw std::runtime_error("listen");
+    }
+
+    thread_ = std::thread(&MetricsServer::Serve, this);
+}
+
+MetricsServer::~MetricsServer() {
+    thread_.join();
+}
+
+void MetricsServer::Serve() {
+    while (!stop_) {
+        struct pollfd pfd {listener_.GetFd(), POLLIN, 0};
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+
+        Socket client(accept(listener_.GetFd(), nullptr, nullptr));
+        if (client.GetFd() < 0) {
+            continue;
+        }
+
+        // Из запроса нужна только первая строка: "GET /path?params HTTP/1.x"
+        struct timeval timeout {1, 0};
+        setsockopt(client.GetFd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char request[4096];
+        const ssize_t received = recv(client.GetFd(), request, sizeof(request), 0);
+        std::string_view target(request, received > 0 ? static_cast<size_t>(received) : 0);
+        const size_t path_start = target.find(' ');
+        target = path_start == std::string_view::npos ? std::string_view() : target.substr(path_start + 1);
+        target = target.substr(0, target.find_first_of(" \r\n"));
+
+        const auto [status, content_type, body] = Dispatch(target);
+        const std::string response = "HTTP/1.0 " + status + "\r\n"
+                                     "Content-Type: " + content_type + "\r\n"
+                                     "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                                     "Connection: close\r\n\r\n" + body;
+
+        size_t sent_total = 0;
+        while (sent_total < response.size()) {
+            ssize_t sent = send(client.GetFd(), response.data() + sent_total,
+                                response.size() - sent_total, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                if (sent < 0 && errno == EINTR)
+                    continue;
+                break;
+            }
+            sent_total += sent;
+        }
+    }
+}
+
+} // namespace metrics
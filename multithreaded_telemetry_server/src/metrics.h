@@ -0,0 +1,100 @@
+#pragma once
+
+#include "cache_line.h"
+#include "histogram.h"
+#include "socket_raii.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Метрики сервера. Счетчики и гистограммы хранятся по потокам, каждый
+// поток пишет только в свой слот, выровненный по строке кэша, поэтому
+// запись на горячем пути - это обычный инкремент без разделяемых строк кэша.
+// Экспорт суммирует слоты всех потоков.
+namespace metrics {
+
+enum class Counter {
+    kAccepts,           // Принятые соединения
+    kReadingsParsed,    // Успешно разобранные показания
+    kParseFailures,     // Отклоненные разбором показания
+    kRegistryUpdates,   // Обновления DeviceRegistry
+    kDbRowsCommitted,   // Строки, зафиксированные в базе
+    kRollupRowsWritten, // Строки таблиц свертки
+    kDevicesStale,      // Переходы устройств в устаревшие
+    kDevicesEvicted,    // Устройства, удаленные из реестра по сроку
+    kFeedDeltasSent,    // Изменения, отправленные подписчикам
+    kFeedCoalesced,     // Изменения, заменившие недоставленное изменение того же устройства
+    kFeedDropped,       // Изменения, не поместившиеся в очередь подписчика
+    kReadingsRejected,  // Отклоненные проверкой показания (вне диапазона)
+    kReadingsFlagged,   // Принятые, но помеченные проверкой показания
+    kFlaggedDropped,    // Отклоненные и помеченные показания, не поместившиеся в боковой канал
+    kMetricValuesCommitted,     // Значения дополнительных метрик, записанные в sensor_metrics
+    kReadingsDuplicate, // Повторы показаний, отсеянные по seq
+    kReadingsUnordered, // Показания, записанные вне порядка времени (опоздавшие или из будущего)
+    kMetricNamesRefused,        // Новые имена метрик сверх лимита соединения
+    kCount
+};
+
+enum class Stage {
+    kParse,             // Разбор одного показания
+    kRegistry,          // Обновление реестра
+    kDbCommit,          // Запись одного пакета в базу
+    kJournalSync,       // Один групповой fdatasync журнала приема
+    kValidate,          // Проверка пакета показаний одного чтения
+    kSnapshot,          // Запись одного снимка реестра
+    kCount
+};
+
+void Increment(Counter counter, uint64_t delta = 1);
+void RecordLatency(Stage stage, std::chrono::nanoseconds duration);
+
+// Значение, которое вычисляется в момент экспорта (глубина очереди и т.п.)
+void RegisterGauge(std::string name, std::string help, std::function<double()> read);
+
+// Текстовый формат экспорта Prometheus (version 0.0.4)
+std::string RenderPrometheus();
+
+// Обработчик пути HTTP-сервера метрик: получает строку параметров после '?',
+// возвращает тело ответа. std::invalid_argument превращается в ответ 400.
+using RouteHandler = std::function<std::string(std::string_view params)>;
+void RegisterRoute(std::string path, std::string content_type, RouteHandler handler);
+
+// Замер длительности участка кода
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Stage stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { RecordLatency(stage_, std::chrono::steady_clock::now() - start_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer &operator=(const ScopedTimer&) = delete;
+
+private:
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// HTTP-сервер метрик на отдельном локальном порту. Запрос к
+// зарегистрированному пути уходит его обработчику, любой другой
+// получает в ответ RenderPrometheus().
+class MetricsServer {
+public:
+    MetricsServer(const char *port, const std::atomic<bool>& stop);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer &operator=(const MetricsServer&) = delete;
+
+private:
+    Socket listener_;
+    const std::atomic<bool>& stop_;
+    std::thread thread_;
+
+    void Serve();
+};
+
+} // namespace metrics
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "cache_line.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// Ограниченная lock-free очередь на кольцевом буфере (алгоритм Д. Вьюкова).
+// У каждой ячейки свой счетчик последовательности, поэтому производители
+// и потребитель не берут общих блокировок. Алгоритм допускает нескольких
+// потребителей: это нужно политике "вытеснить старейшее", при которой
+// производитель сам снимает голову очереди.
+template <typename T>
+class BoundedMpscQueue {
+public:
+    explicit BoundedMpscQueue(size_t capacity)
+        : cells_(new Cell[capacity]), mask_(capacity - 1) {
+        if (capacity < 2 || (capacity & mask_) != 0) {
+            throw std::invalid_argument("BoundedMpscQueue capacity must be a power of two");
+        }
+        for (size_t i = 0; i < capacity; ++i) {
+            cells_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedMpscQueue(const BoundedMpscQueue&) = delete;
+    BoundedMpscQueue &operator=(const BoundedMpscQueue&) = delete;
+
+    // false, если очередь заполнена
+    bool TryPush(T&& value) {
+        Cell *cell;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence_.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value_ = std::move(value);
+        cell->sequence_.store(pos + 1, std::memory_order_release);
+        UpdateHighWaterMark();
+        return true;
+    }
+
+    // false, если очередь пуста
+    bool TryPop(T& value) {
+        size_t position;
+        return TryPop(value, position);
+    }
+
+    // position - номер элемента в порядке TryPush за все время очереди
+    bool TryPop(T& value, size_t& position) {
+        Cell *cell;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence_.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->value_);
+        cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+        position = pos;
+        return true;
+    }
+
+    size_t Capacity() const { return mask_ + 1; }
+
+    // Сколько элементов снято с головы за все время
+    size_t PoppedCount() const { return dequeue_pos_.load(std::memory_order_acquire); }
+
+    // Текущая глубина (приблизительная при конкурентных операциях)
+    size_t Depth() const {
+        const size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+        const size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t HighWaterMark() const { return high_water_mark_.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence_;
+        T value_;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    const size_t mask_;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> high_water_mark_{0};
+
+    void UpdateHighWaterMark() {
+        const size_t depth = Depth();
+        size_t current = high_water_mark_.load(std::memory_order_relaxed);
+        while (depth > current &&
+               !high_water_mark_.compare_exchange_weak(current, depth, std::memory_order_relaxed)) {
+        }
+    }
+};
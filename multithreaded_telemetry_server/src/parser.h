@@ -0,0 +1,165 @@
+#pragma once
+
+#include "device.h"
+#include "metric_schema.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// Разбор показания вида "device_1:temp=23.5,hum=60,press=1013".
+// Работает прямо по буферу приема через string_view, числа читаются
+// std::from_chars: без выделений памяти и без исключений (кроме первой
+// встречи нового устройства, когда его имя интернируется).
+// Токены без '=' пропускаются; пустой идентификатор или некорректное
+// число отклоняют всё показание. temp, hum и press сравниваются первыми
+// и ложатся в поля DeviceState. Остальные ключи либо пропускаются, либо
+// (перегрузка со схемой) становятся значениями MetricSample.
+// Необязательные ts=<мс от эпохи> и seq=<номер> - время показания
+// у устройства и его номер для отсева повторов. Без ts время показания -
+// момент разбора, без seq показание не сверяется с окном повторов.
+// fields получает маску FIELD_* присланных temp, hum, press.
+
+namespace parser {
+
+inline bool ParseDouble(std::string_view text, double& value) noexcept {
+    const char *first = text.data();
+    const char *last = text.data() + text.size();
+    auto [ptr, ec] = std::from_chars(first, last, value);
+    return ec == std::errc() && ptr == last;
+}
+
+template <typename Integer>
+bool ParseInteger(std::string_view text, Integer& value) noexcept {
+    const char *last = text.data() + text.size();
+    auto [ptr, ec] = std::from_chars(text.data(), last, value);
+    return ec == std::errc() && ptr == last;
+}
+
+// Общий разбор: ключи вне фиксированной раскладки отдаются on_extra(key, value)
+template <typename OnExtra>
+bool ParseFields(std::string_view data, DeviceState& state, uint8_t& fields, DeviceIdTable& ids,
+                 OnExtra&& on_extra) {
+    const auto colon_pos = data.find(':');
+    if (colon_pos == std::string_view::npos || colon_pos == 0) {
+        return false;
+    }
+
+    const std::string_view device_id = data.substr(0, colon_pos);
+    std::string_view readings = data.substr(colon_pos + 1);
+
+    double temperature = 0.0;
+    double humidity = 0.0;
+    double pressure = 0.0;
+    int64_t timestamp_ms = 0;
+    uint32_t seq = 0;
+    uint8_t present = 0;
+
+    while (!readings.empty()) {
+        const auto comma_pos = readings.find(',');
+        const std::string_view token = readings.substr(0, comma_pos);
+        readings.remove_prefix(comma_pos == std::string_view::npos ? readings.size() : comma_pos + 1);
+
+        const auto eq_pos = token.find('=');
+        if (eq_pos == std::string_view::npos) continue;
+
+        const std::string_view key = token.substr(0, eq_pos);
+        const std::string_view text = token.substr(eq_pos + 1);
+        if (key == "ts") {
+            if (!ParseInteger(text, timestamp_ms) || timestamp_ms < 0 || timestamp_ms > MAX_DEVICE_TIMESTAMP_MS) {
+                return false;
+            }
+            continue;
+        }
+        if (key == "seq") {
+            if (!ParseInteger(text, seq)) {
+                return false;
+            }
+            continue;
+        }
+
+        double value;
+        if (!ParseDouble(text, value)) {
+            return false;
+        }
+
+        if (key == "temp") {
+            temperature = value;
+            present |= FIELD_TEMPERATURE;
+        } else if (key == "hum") {
+            humidity = value;
+            present |= FIELD_HUMIDITY;
+        } else if (key == "press") {
+            pressure = value;
+            present |= FIELD_PRESSURE;
+        } else {
+            on_extra(key, value);
+        }
+    }
+
+    // Состояние меняем только после успешного разбора всей строки.
+    // Для уже известного устройства Intern не выделяет память.
+    state.device_id_ = ids.Intern(device_id);
+    state.temperature_ = temperature;
+    state.humidity_ = humidity;
+    state.pressure_ = pressure;
+    state.seq_ = seq;
+    state.last_update_ = timestamp_ms == 0
+        ? std::chrono::system_clock::now()
+        : std::chrono::system_clock::time_point(std::chrono::milliseconds(timestamp_ms));
+    fields = present;
+
+    return true;
+}
+
+} // namespace parser
+
+inline bool ParseReading(std::string_view data, DeviceState& state, DeviceIdTable& ids) {
+    uint8_t fields;
+    return parser::ParseFields(data, state, fields, ids, [](std::string_view, double) {});
+}
+
+// Ключи вне temp/hum/press интернируются в schema и дописываются в extras
+// с устройством и временем показания; повтор ключа в строке заменяет
+// значение. Ключи интернируются только после разбора всей строки:
+// отклоненное показание не добавляет имен в схему, а новые имена
+// расходуют budget источника. Если показание отклонено, extras остается
+// прежним.
+inline bool ParseReading(std::string_view data, DeviceState& state, uint8_t& fields, DeviceIdTable& ids,
+                         MetricSchema& schema, MetricNameBudget& budget, std::vector<MetricSample>& extras) {
+    // Ключи указывают в data и живут до конца вызова
+    thread_local std::vector<std::pair<std::string_view, double>> pairs;
+    pairs.clear();
+    const bool parsed = parser::ParseFields(data, state, fields, ids, [](std::string_view key, double value) {
+        pairs.emplace_back(key, value);
+    });
+    if (!parsed) {
+        return false;
+    }
+
+    const size_t first = extras.size();
+    for (const auto& [key, value] : pairs) {
+        const auto metric = schema.Intern(key, budget);
+        if (!metric) {
+            continue;
+        }
+        auto it = std::find_if(extras.begin() + static_cast<std::ptrdiff_t>(first), extras.end(),
+                               [&metric](const MetricSample& sample) { return sample.metric_ == *metric; });
+        if (it != extras.end()) {
+            it->value_ = value;
+            continue;
+        }
+        MetricSample sample;
+        sample.device_id_ = state.device_id_;
+        sample.metric_ = *metric;
+        sample.value_ = value;
+        sample.time_ = state.last_update_;
+        extras.push_back(sample);
+    }
+    return true;
+}
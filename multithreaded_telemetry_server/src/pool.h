@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+// Объекты из std::pmr::memory_resource под unique_ptr: удаление возвращает
+// память в тот же ресурс. Цикл событий берет так соединения из своего пула,
+// реестр - записи устройств из ресурса, переданного владельцем.
+template <typename T>
+struct PoolDelete {
+    std::pmr::memory_resource *resource_;
+
+    void operator()(T *p) const {
+        std::pmr::polymorphic_allocator<T>(resource_).delete_object(p);
+    }
+};
+
+template <typename T>
+using PoolPtr = std::unique_ptr<T, PoolDelete<T>>;
+
+template <typename T, typename... Args>
+PoolPtr<T> MakePooled(std::pmr::memory_resource *resource, Args&&... args) {
+    std::pmr::polymorphic_allocator<T> allocator(resource);
+    return PoolPtr<T>(allocator.template new_object<T>(std::forward<Args>(args)...), PoolDelete<T>{resource});
+}
+
+// Пул одного потока: блоки до largest_block байт переиспользуются после
+// освобождения, память возвращается системе только вместе с пулом
+inline std::pmr::pool_options ThreadPoolOptions(size_t largest_block) {
+    std::pmr::pool_options options;
+    options.max_blocks_per_chunk = 64;
+    options.largest_required_pool_block = largest_block;
+    return options;
+}
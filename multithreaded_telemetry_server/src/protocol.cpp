@@ -0,0 +1,44 @@
+#include "protocol.h"
+
+namespace protocol {
+
+FrameStatus NextFrame(const RingBuffer& buffer, std::vector<char>& scratch, Frame& frame) {
+    if (buffer.Empty()) {
+        return FrameStatus::kIncomplete;
+    }
+
+    if (static_cast<uint8_t>(buffer.At(0)) == LENGTH_PREFIX_MARKER) {
+        if (buffer.Size() < LENGTH_PREFIX_HEADER_SIZE) {
+            return FrameStatus::kIncomplete;
+        }
+        const size_t length = (static_cast<size_t>(static_cast<uint8_t>(buffer.At(1))) << 8) |
+                              static_cast<uint8_t>(buffer.At(2));
+        if (length > MAX_FRAME_SIZE) {
+            return FrameStatus::kError;
+        }
+        if (buffer.Size() < LENGTH_PREFIX_HEADER_SIZE + length) {
+            return FrameStatus::kIncomplete;
+        }
+        frame.payload = buffer.View(LENGTH_PREFIX_HEADER_SIZE, length, scratch);
+        frame.size = LENGTH_PREFIX_HEADER_SIZE + length;
+        return FrameStatus::kFrame;
+    }
+
+    const size_t end = buffer.Find('\n');
+    if (end == RingBuffer::npos) {
+        return buffer.Size() > MAX_FRAME_SIZE ? FrameStatus::kError : FrameStatus::kIncomplete;
+    }
+    if (end > MAX_FRAME_SIZE) {
+        return FrameStatus::kError;
+    }
+
+    std::string_view line = buffer.View(0, end, scratch);
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    frame.payload = line;
+    frame.size = end + 1;
+    return FrameStatus::kFrame;
+}
+
+} // namespace protocol
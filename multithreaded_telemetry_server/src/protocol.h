@@ -0,0 +1,76 @@
+#pragma once
+
+#include "ring_buffer.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Потоковый протокол устройства. В одном соединении передается
+// последовательность показаний, каждое в одном из двух видов кадра:
+//   * строка текста, завершенная '\n' (допускается "\r\n");
+//   * кадр с префиксом длины: байт 0x01, длина полезной нагрузки
+//     (uint16, big-endian), затем сама нагрузка без разделителя.
+// Нагрузка в обоих случаях имеет вид "device_1:temp=23.5,hum=60,press=1013".
+// Двоичный протокол с фиксированными смещениями полей - binary_protocol.h.
+//
+// Сервер подтверждает показания пакетами: подряд идущие результаты
+// сворачиваются в одну строку "Ok <n>\n" или "Err <n>\n", порядок строк
+// совпадает с порядком показаний.
+namespace protocol {
+
+constexpr uint8_t LENGTH_PREFIX_MARKER = 0x01;
+constexpr size_t LENGTH_PREFIX_HEADER_SIZE = 3;
+constexpr size_t MAX_FRAME_SIZE = 1024;
+
+enum class FrameStatus {
+    kFrame,         // Кадр выделен
+    kIncomplete,    // Нужно дочитать данные из сокета
+    kError          // Нарушение протокола, соединение нужно закрыть
+};
+
+struct Frame {
+    std::string_view payload;   // Действителен до вызова RingBuffer::Consume()
+    size_t size = 0;            // Сколько байт кадр занимает в буфере
+};
+
+// Выделяет очередной кадр с головы буфера. Если кадр проходит через конец
+// кольцевого буфера, нагрузка копируется в scratch.
+FrameStatus NextFrame(const RingBuffer& buffer, std::vector<char>& scratch, Frame& frame);
+
+// Сворачивает результаты обработки подряд идущих показаний в подтверждения
+class AckBatch {
+public:
+    void Add(bool ok) {
+        if (count_ != 0 && ok != ok_) {
+            Flush();
+        }
+        ok_ = ok;
+        ++count_;
+    }
+
+    // Дописывает накопленные подтверждения в выходной буфер соединения
+    void WriteTo(std::string& out) {
+        Flush();
+        out += pending_;
+        pending_.clear();
+    }
+
+private:
+    std::string pending_;
+    size_t count_ = 0;
+    bool ok_ = true;
+
+    void Flush() {
+        if (count_ == 0) {
+            return;
+        }
+        pending_ += ok_ ? "Ok " : "Err ";
+        pending_ += std::to_string(count_);
+        pending_ += '\n';
+        count_ = 0;
+    }
+};
+
+} // namespace protocol
@@ -0,0 +1,171 @@
+#include "query.h"
+#include "json.h"
+
+#include <charconv>
+#include <iterator>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace {
+
+const char *AggregationName(Aggregation aggregation) {
+    switch (aggregation) {
+    case Aggregation::kMin: return "min";
+    case Aggregation::kMax: return "max";
+    case Aggregation::kAvg: return "avg";
+    case Aggregation::kLast: return "last";
+    }
+    return "?";
+}
+
+int64_t ParseInt(std::string_view name, std::string_view value) {
+    int64_t result = 0;
+    const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc() || ptr != value.data() + value.size()) {
+        throw std::invalid_argument("bad " + std::string(name) + ": " + std::string(value));
+    }
+    return result;
+}
+
+// Секунды от начала эпохи; ограничение не дает переполниться наносекундам time_point
+int64_t ParseSeconds(std::string_view name, std::string_view value) {
+    constexpr int64_t LIMIT = int64_t{1} << 33;     // Около 270 лет
+    const int64_t result = ParseInt(name, value);
+    if (result < -LIMIT || result > LIMIT) {
+        throw std::invalid_argument("out of range " + std::string(name) + ": " + std::string(value));
+    }
+    return result;
+}
+
+// Раскодирует %XX и '+' из строки запроса
+std::string UrlDecode(std::string_view value) {
+    std::string result;
+    result.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '+') {
+            result += ' ';
+        } else if (value[i] == '%' && i + 2 < value.size()) {
+            int code = 0;
+            const auto [ptr, ec] = std::from_chars(value.data() + i + 1, value.data() + i + 3, code, 16);
+            if (ec != std::errc() || ptr != value.data() + i + 3) {
+                throw std::invalid_argument("bad escape in query");
+            }
+            result += static_cast<char>(code);
+            i += 2;
+        } else {
+            result += value[i];
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+Query QueryService::ParseParams(std::string_view params) {
+    using namespace std::chrono;
+
+    Query query;
+    query.to_ = system_clock::now();
+    bool has_from = false;
+
+    while (!params.empty()) {
+        const size_t amp = params.find('&');
+        const std::string_view pair = params.substr(0, amp);
+        params = amp == std::string_view::npos ? std::string_view() : params.substr(amp + 1);
+
+        const size_t eq = pair.find('=');
+        const std::string_view key = pair.substr(0, eq);
+        const std::string value = eq == std::string_view::npos ? std::string() : UrlDecode(pair.substr(eq + 1));
+
+        if (key == "devices") {
+            std::string_view list = value;
+            while (!list.empty()) {
+                const size_t comma = list.find(',');
+                if (comma != 0) {
+                    query.device_ids_.emplace_back(list.substr(0, comma));
+                }
+                list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            }
+        } else if (key == "from") {
+            query.from_ = system_clock::time_point(seconds(ParseSeconds(key, value)));
+            has_from = true;
+        } else if (key == "to") {
+            query.to_ = system_clock::time_point(seconds(ParseSeconds(key, value)));
+        } else if (key == "bucket") {
+            query.bucket_ = seconds(ParseSeconds(key, value));
+        } else if (key == "agg") {
+            if (value == "min") query.aggregation_ = Aggregation::kMin;
+            else if (value == "max") query.aggregation_ = Aggregation::kMax;
+            else if (value == "avg") query.aggregation_ = Aggregation::kAvg;
+            else if (value == "last") query.aggregation_ = Aggregation::kLast;
+            else throw std::invalid_argument("bad agg: " + value);
+        }
+    }
+
+    if (!has_from) {
+        query.from_ = query.to_ - hours(1);
+    }
+    return query;
+}
+
+std::vector<QuerySeries> QueryService::Run(const Query& query) const {
+    if (query.device_ids_.empty()) {
+        throw std::invalid_argument("no devices");
+    }
+    if (query.device_ids_.size() > MAX_DEVICES) {
+        throw std::invalid_argument("too many devices");
+    }
+    if (query.bucket_.count() <= 0) {
+        throw std::invalid_argument("bucket must be positive");
+    }
+    if (query.to_ < query.from_) {
+        throw std::invalid_argument("to is before from");
+    }
+    const auto span = std::chrono::duration_cast<std::chrono::milliseconds>(query.to_ - query.from_);
+    if (span / query.bucket_ > MAX_BUCKETS) {
+        throw std::invalid_argument("too many buckets, increase bucket");
+    }
+
+    std::vector<QuerySeries> result;
+    result.reserve(query.device_ids_.size());
+    for (const auto& device_id : query.device_ids_) {
+        QuerySeries series;
+        series.device_id_ = device_id;
+        if (const auto id = ids_.Find(device_id)) {
+            series.points_ = db_.Aggregate(*id, query.from_, query.to_, query.bucket_, query.aggregation_);
+        }
+        result.push_back(std::move(series));
+    }
+    return result;
+}
+
+std::string QueryService::HandleHttp(std::string_view params) const {
+    const Query query = ParseParams(params);
+    const std::vector<QuerySeries> result = Run(query);
+
+    // Точка - [начало интервала (unix s), число показаний, температура, влажность, давление]
+    std::string out;
+    fmt::format_to(std::back_inserter(out), "{{\"aggregation\":\"{}\",\"bucket\":{},\"series\":[",
+                   AggregationName(query.aggregation_), std::chrono::duration<double>(query.bucket_).count());
+    for (size_t i = 0; i < result.size(); ++i) {
+        out += i == 0 ? "{\"device\":" : ",{\"device\":";
+        AppendJsonString(out, result[i].device_id_);
+        out += ",\"points\":[";
+        for (size_t j = 0; j < result[i].points_.size(); ++j) {
+            const AggregatedPoint& point = result[i].points_[j];
+            // NaN и бесконечность (без проверки показаний) - null, иначе ответ не JSON
+            fmt::format_to(std::back_inserter(out), "{}[{},{}", j == 0 ? "" : ",",
+                           std::chrono::duration<double>(point.bucket_start_.time_since_epoch()).count(),
+                           point.count_);
+            for (const double value : {point.temperature_, point.humidity_, point.pressure_}) {
+                out += ',';
+                AppendJsonNumber(out, value);
+            }
+            out += ']';
+        }
+        out += "]}";
+    }
+    out += "]}\n";
+    return out;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "database.h"
+#include "intern_table.h"
+#include "storage.h"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Запрос истории показаний: несколько устройств, интервал времени,
+// длина интервала группировки и агрегат. Группировка выполняется
+// хранилищем (SQL GROUP BY или агрегаты чанков).
+struct Query {
+    std::vector<std::string> device_ids_;
+    std::chrono::system_clock::time_point from_;
+    std::chrono::system_clock::time_point to_;
+    std::chrono::milliseconds bucket_{60'000};
+    Aggregation aggregation_ = Aggregation::kAvg;
+};
+
+struct QuerySeries {
+    std::string device_id_;
+    std::vector<AggregatedPoint> points_;   // Пусто, если устройство неизвестно
+};
+
+class QueryService {
+public:
+    static constexpr size_t MAX_DEVICES = 64;
+    static constexpr int64_t MAX_BUCKETS = 100'000;     // На одно устройство
+
+    QueryService(const DeviceIdTable& ids, const DataBase& db) : ids_(ids), db_(db) {}
+
+    // std::invalid_argument, если запрос превышает ограничения
+    std::vector<QuerySeries> Run(const Query& query) const;
+
+    // Параметры HTTP: devices=a,b&from=<unix s>&to=<unix s>&bucket=<s>&agg=min|max|avg|last.
+    // По умолчанию: последний час, интервал 60 с, avg. Ответ - JSON.
+    std::string HandleHttp(std::string_view params) const;
+
+    static Query ParseParams(std::string_view params);
+
+private:
+    const DeviceIdTable& ids_;
+    const DataBase& db_;
+};
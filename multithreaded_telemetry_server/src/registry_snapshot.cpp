@@ -0,0 +1,441 @@
+#include "registry_snapshot.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x504E5352;      // "RSNP"
+constexpr uint32_t VERSION = 3;            // 2 - без checksum_
+constexpr size_t BLOCK_HEADER_SIZE = 2 * sizeof(uint32_t);
+constexpr uint32_t SAVE_CHUNK = 64 * 1024;      // Имен на один write при записи
+
+// Заголовок файла, остаток до HEADER_SIZE - нули
+struct SnapshotHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint64_t devices_;
+    int64_t created_ms_;        // system_clock
+    uint32_t blocks_;
+    uint32_t ids_;              // Имен в таблице идентификаторов
+    uint64_t ids_offset_;       // Начало таблицы идентификаторов
+    uint64_t names_size_;
+    uint64_t checksum_;         // BodyChecksum от конца заголовка до конца файла
+};
+
+// Запись устройства
+struct SnapshotRecord {
+    int64_t last_update_ns_;
+    double temperature_;
+    double humidity_;
+    double pressure_;
+    uint32_t seq_;
+    uint32_t idle_s_;
+    DeviceId device_id_;
+    uint32_t reserved_;
+};
+
+// Имя с id = номер записи плюс один; name_offset_ - от начала имен
+struct SnapshotName {
+    uint64_t hash_;
+    uint64_t name_offset_;
+    uint32_t name_size_;
+    uint32_t reserved_;
+};
+
+static_assert(sizeof(SnapshotHeader) <= RegistrySnapshot::HEADER_SIZE);
+static_assert(sizeof(SnapshotRecord) == 48 && std::is_trivially_copyable_v<SnapshotRecord>);
+static_assert(sizeof(SnapshotName) == 24 && std::is_trivially_copyable_v<SnapshotName>);
+
+// Разобранный блок файла
+struct Block {
+    const char *records_;
+    uint32_t count_;
+};
+
+int64_t ToMillis(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+size_t Align8(size_t size) {
+    return (size + 7) & ~size_t{7};
+}
+
+// FNV-1a по 64-битным словам в четыре независимые цепочки: умножения не
+// ждут друг друга, и сумма сотен мегабайт снимка стоит доли времени
+// загрузки. size кратен 8: файл выровнен.
+uint64_t BodyChecksum(const char *data, size_t size) {
+    constexpr uint64_t BASIS = 14695981039346656037ull;
+    constexpr uint64_t PRIME = 1099511628211ull;
+    uint64_t lanes[4] = {BASIS, BASIS + 1, BASIS + 2, BASIS + 3};
+    size_t pos = 0;
+    for (; pos + sizeof(lanes) <= size; pos += sizeof(lanes)) {
+        for (size_t lane = 0; lane < 4; ++lane) {
+            uint64_t word;
+            std::memcpy(&word, data + pos + lane * sizeof(word), sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * PRIME;
+        }
+    }
+    for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + pos, sizeof(word));
+        lanes[0] = (lanes[0] ^ word) * PRIME;
+    }
+    uint64_t hash = (BASIS ^ size) * PRIME;
+    for (const uint64_t lane : lanes) {
+        hash = (hash ^ lane) * PRIME;
+    }
+    return hash;
+}
+
+void WriteAll(int fd, const char *data, size_t size, const std::string& path) {
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("write " + path + ": " + strerror(errno));
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+// fsync каталога файла: после rename запись каталога тоже должна дойти до диска
+void SyncDirectory(const std::string& path) {
+    const size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error("open " + dir + ": " + strerror(errno));
+    }
+    const int rc = fsync(fd);
+    const int error = errno;
+    close(fd);
+    if (rc != 0) {
+        throw std::runtime_error("fsync " + dir + ": " + strerror(error));
+    }
+}
+
+} // namespace
+
+RegistrySnapshot::RegistrySnapshot(DeviceRegistry& registry, DeviceIdTable& ids, std::string path)
+    : registry_(registry), ids_(ids), path_(std::move(path)) {}
+
+// Без последнего снимка: при выходе по исключению реестр может быть
+// неполным и не должен заменить снимок прошлого запуска
+RegistrySnapshot::~RegistrySnapshot() {
+    StopThread();
+}
+
+size_t RegistrySnapshot::Save() {
+    metrics::ScopedTimer timer(metrics::Stage::kSnapshot);
+    const std::string temp_path = path_ + ".tmp";
+    // Чтение нужно для суммы: она считается по уже записанному файлу
+    const int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("open " + temp_path);
+    }
+
+    SnapshotHeader header{MAGIC, VERSION, 0, ToMillis(std::chrono::system_clock::now()), 0, 0, 0, 0, 0};
+    std::vector<DeviceRecord> devices;
+    std::string block;
+    try {
+        char header_bytes[HEADER_SIZE] = {};
+        WriteAll(fd, header_bytes, HEADER_SIZE, temp_path);
+        uint64_t offset = HEADER_SIZE;
+
+        // Копия шарда берется под его блокировкой, разметка и запись - уже без нее
+        for (size_t shard = 0; shard < registry_.ShardCount(); ++shard) {
+            devices.clear();
+            registry_.CopyShard(shard, devices);
+
+            const size_t records_size = devices.size() * sizeof(SnapshotRecord);
+            block.assign(BLOCK_HEADER_SIZE + records_size, '\0');
+            const uint32_t count = static_cast<uint32_t>(devices.size());
+            std::memcpy(block.data(), &count, sizeof(count));
+            char *records = block.data() + BLOCK_HEADER_SIZE;
+            for (size_t i = 0; i < devices.size(); ++i) {
+                const DeviceState& state = devices[i].state_;
+                const SnapshotRecord record{
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(state.last_update_.time_since_epoch()).count(),
+                    state.temperature_, state.humidity_, state.pressure_, state.seq_, devices[i].idle_s_,
+                    state.device_id_, 0};
+                std::memcpy(records + i * sizeof(SnapshotRecord), &record, sizeof(record));
+            }
+            WriteAll(fd, block.data(), block.size(), temp_path);
+            offset += block.size();
+            header.devices_ += count;
+            ++header.blocks_;
+        }
+
+        // Таблица идентификаторов - после реестра: id всех записанных
+        // устройств уже выданы, их имена опубликованы до обновления реестра
+        const auto ids = static_cast<DeviceId>(ids_.Size());
+        std::vector<uint32_t> sizes(size_t{ids} + 1, 0);
+        header.ids_ = ids;
+        header.ids_offset_ = offset;
+        for (DeviceId first = 1; first <= ids; first += SAVE_CHUNK) {
+            const DeviceId last = std::min<DeviceId>(ids, first + SAVE_CHUNK - 1);
+            block.assign(size_t{last - first + 1} * sizeof(SnapshotName), '\0');
+            for (DeviceId id = first; id <= last; ++id) {
+                sizes[id] = static_cast<uint32_t>(ids_.Name(id).size());
+                const SnapshotName name{ids_.NameHash(id), header.names_size_, sizes[id], 0};
+                std::memcpy(block.data() + size_t{id - first} * sizeof(SnapshotName), &name, sizeof(name));
+                header.names_size_ += sizes[id];
+            }
+            WriteAll(fd, block.data(), block.size(), temp_path);
+        }
+        for (DeviceId first = 1; first <= ids; first += SAVE_CHUNK) {
+            const DeviceId last = std::min<DeviceId>(ids, first + SAVE_CHUNK - 1);
+            block.clear();
+            for (DeviceId id = first; id <= last; ++id) {
+                block.append(ids_.Name(id).substr(0, sizes[id]));
+            }
+            WriteAll(fd, block.data(), block.size(), temp_path);
+        }
+        const uint64_t names_end = offset + uint64_t{ids} * sizeof(SnapshotName) + header.names_size_;
+        const char padding[8] = {};
+        WriteAll(fd, padding, Align8(names_end) - names_end, temp_path);
+
+        const size_t file_size = Align8(names_end);
+        void *written = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (written == MAP_FAILED) {
+            throw std::runtime_error("mmap " + temp_path + ": " + strerror(errno));
+        }
+        header.checksum_ = BodyChecksum(static_cast<const char*>(written) + HEADER_SIZE, file_size - HEADER_SIZE);
+        munmap(written, file_size);
+
+        char header_bytes_final[HEADER_SIZE] = {};
+        std::memcpy(header_bytes_final, &header, sizeof(header));
+        if (pwrite(fd, header_bytes_final, HEADER_SIZE, 0) != static_cast<ssize_t>(HEADER_SIZE)) {
+            throw std::runtime_error("write " + temp_path + ": " + strerror(errno));
+        }
+        if (fdatasync(fd) != 0) {
+            throw std::runtime_error("fdatasync " + temp_path + ": " + strerror(errno));
+        }
+    } catch (...) {
+        close(fd);
+        unlink(temp_path.c_str());
+        throw;
+    }
+    close(fd);
+    if (rename(temp_path.c_str(), path_.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("rename " + temp_path + ": " + strerror(errno));
+    }
+    // Без fsync каталога после сбоя питания в нем может остаться прежняя запись
+    SyncDirectory(path_);
+    return header.devices_;
+}
+
+size_t RegistrySnapshot::Load() {
+    const auto start = std::chrono::steady_clock::now();
+    const int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            LOG_WARN("Registry snapshot: cannot open {}: {}", path_, strerror(errno));
+        }
+        return 0;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_SIZE) {
+        close(fd);
+        LOG_WARN("Registry snapshot: skipping short file {}", path_);
+        return 0;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        LOG_WARN("Registry snapshot: mmap {}: {}", path_, strerror(errno));
+        return 0;
+    }
+    const char *base = static_cast<const char*>(mapped);
+
+    // Сначала сверяется сумма и проверяются границы всех блоков и имен:
+    // поврежденный файл не загружается даже частично
+    SnapshotHeader header{};
+    std::memcpy(&header, base, sizeof(header));
+    std::vector<Block> blocks;
+    bool valid = header.magic_ == MAGIC && header.version_ == VERSION && size % 8 == 0 &&
+                 BodyChecksum(base + HEADER_SIZE, size - HEADER_SIZE) == header.checksum_ &&
+                 header.ids_offset_ >= HEADER_SIZE && header.ids_offset_ <= size;
+    size_t pos = HEADER_SIZE;
+    uint64_t devices = 0;
+    for (uint32_t i = 0; valid && i < header.blocks_; ++i) {
+        Block block{};
+        if (header.ids_offset_ - pos < BLOCK_HEADER_SIZE) {
+            valid = false;
+            break;
+        }
+        std::memcpy(&block.count_, base + pos, sizeof(block.count_));
+        const size_t block_size = BLOCK_HEADER_SIZE + size_t{block.count_} * sizeof(SnapshotRecord);
+        if (header.ids_offset_ - pos < block_size) {
+            valid = false;
+            break;
+        }
+        block.records_ = base + pos + BLOCK_HEADER_SIZE;
+        blocks.push_back(block);
+        devices += block.count_;
+        pos += block_size;
+    }
+    std::vector<DeviceIdTable::SavedName> names;
+    if (valid && pos == header.ids_offset_ && devices == header.devices_ &&
+        (size - pos) / sizeof(SnapshotName) >= header.ids_) {
+        const char *table = base + pos;
+        const char *name_bytes = table + size_t{header.ids_} * sizeof(SnapshotName);
+        const size_t names_size = static_cast<size_t>(base + size - name_bytes);
+        valid = header.names_size_ <= names_size && Align8(size - names_size + header.names_size_) == size;
+        names.reserve(header.ids_);
+        for (uint32_t i = 0; valid && i < header.ids_; ++i) {
+            SnapshotName name;
+            std::memcpy(&name, table + size_t{i} * sizeof(SnapshotName), sizeof(name));
+            if (name.name_offset_ > header.names_size_ || name.name_size_ > header.names_size_ - name.name_offset_) {
+                valid = false;
+                break;
+            }
+            names.push_back({std::string_view(name_bytes + name.name_offset_, name.name_size_), name.hash_});
+        }
+    } else {
+        valid = false;
+    }
+    if (!valid) {
+        munmap(mapped, size);
+        LOG_WARN("Registry snapshot: skipping damaged file {}", path_);
+        return 0;
+    }
+    if (ids_.Size() != 0) {
+        munmap(mapped, size);
+        LOG_WARN("Registry snapshot: device ids already assigned, skipping {}", path_);
+        return 0;
+    }
+
+    // Время между снимком и запуском устройства тоже молчали
+    const int64_t age_ms = ToMillis(std::chrono::system_clock::now()) - header.created_ms_;
+    const auto age_s = static_cast<uint64_t>(std::max<int64_t>(0, age_ms / 1000));
+
+    registry_.Reserve(devices);
+
+    // Блоки разбираются параллельно: вставка в реестр берет блокировки
+    // своих шардов и почти не пересекается. Реестру нужны только id,
+    // поэтому таблица идентификаторов заполняется одновременно с ним.
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> restored{0};
+    std::atomic<size_t> skipped{0};
+    auto worker = [&] {
+        std::vector<DeviceRecord> records;
+        try {
+            for (size_t b = next++; b < blocks.size(); b = next++) {
+                const Block& block = blocks[b];
+                records.clear();
+                records.reserve(block.count_);
+                for (uint32_t i = 0; i < block.count_; ++i) {
+                    SnapshotRecord record;
+                    std::memcpy(&record, block.records_ + size_t{i} * sizeof(SnapshotRecord), sizeof(record));
+                    if (record.device_id_ == INVALID_DEVICE_ID || record.device_id_ > header.ids_ ||
+                        names[record.device_id_ - 1].name_.empty()) {
+                        ++skipped;
+                        continue;
+                    }
+                    DeviceRecord device;
+                    device.state_.device_id_ = record.device_id_;
+                    device.state_.seq_ = record.seq_;
+                    device.state_.temperature_ = record.temperature_;
+                    device.state_.humidity_ = record.humidity_;
+                    device.state_.pressure_ = record.pressure_;
+                    device.state_.last_update_ = std::chrono::system_clock::time_point(
+                        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                            std::chrono::nanoseconds(record.last_update_ns_)));
+                    device.idle_s_ = static_cast<uint32_t>(std::min<uint64_t>(uint64_t{record.idle_s_} + age_s,
+                                                                              UINT32_MAX));
+                    records.push_back(device);
+                }
+                restored += registry_.Restore(records);
+            }
+        } catch (const std::exception& ex) {
+            LOG_WARN("Registry snapshot: {}", ex.what());
+            next = blocks.size();
+        }
+    };
+    const size_t thread_count = std::min<size_t>(blocks.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    std::exception_ptr error;
+    try {
+        ids_.Restore(names);        // Прежние id, одним проходом по таблице
+    } catch (...) {
+        error = std::current_exception();
+        next = blocks.size();
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    munmap(mapped, size);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    LOG_INFO("Registry snapshot: restored {} of {} devices ({} ids) from {} in {} ms ({} s old)",
+             restored.load(), devices, header.ids_, path_, elapsed.count(), age_s);
+    if (skipped != 0) {
+        LOG_WARN("Registry snapshot: {} records with unknown device ids skipped", skipped.load());
+    }
+    return restored;
+}
+
+void RegistrySnapshot::Start(std::chrono::seconds interval) {
+    if (interval.count() <= 0) {
+        return;
+    }
+    thread_ = std::thread([this, interval] { Run(interval); });
+}
+
+void RegistrySnapshot::Stop() {
+    StopThread();
+    const size_t saved = Save();
+    LOG_INFO("Registry snapshot: saved {} devices to {}", saved, path_);
+}
+
+void RegistrySnapshot::StopThread() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void RegistrySnapshot::Run(std::chrono::seconds interval) {
+    std::unique_lock lock(mutex_);
+    while (!cv_.wait_for(lock, interval, [this] { return stop_; })) {
+        lock.unlock();
+        try {
+            const size_t saved = Save();
+            LOG_DEBUG("Registry snapshot: saved {} devices", saved);
+        } catch (const std::exception& ex) {
+            LOG_RATE_LIMITED(LogLevel::kError, 10, "Registry snapshot: {}", ex.what());
+        }
+        lock.lock();
+    }
+}
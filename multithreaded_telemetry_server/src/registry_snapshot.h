@@ -0,0 +1,72 @@
+#pragma once
+
+#include "device.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Снимок DeviceRegistry на диске: после перезапуска реестр заполняется из
+// него сразу, а не по мере того, как устройства пришлют новые показания.
+//
+// Запись не останавливает прием: шарды копируются по одному под
+// разделяемой блокировкой (обновления известных устройств идут
+// параллельно), блок шарда дописывается во временный файл, который
+// в конце заменяет прежний снимок через rename, за ним - fsync каталога.
+// Упавшая на середине запись оставляет прежний снимок целым.
+//
+// Файл: заголовок HEADER_SIZE байт (magic, версия, число устройств, время
+// снимка в мс, число блоков, число имен, смещение таблицы имен, размер
+// имен, контрольная сумма всего, что после заголовка), затем блок на
+// шард реестра:
+//   count (uint32), 0 (uint32), count записей по 48 байт с DeviceId,
+// затем таблица идентификаторов в порядке id: записи по 24 байта (хеш
+// DeviceIdTable::Hash, смещение и длина имени), имена подряд,
+// выравнивание до 8 байт.
+// Числа в порядке байт машины, как в журнале приема. Load отображает файл
+// в память, сверяет сумму и возвращает устройствам прежние id: таблица
+// собирается одним проходом без хеширования имен (хешам из файла можно
+// верить только после сверки), блоки реестра разбираются параллельно
+// с ней в нескольких потоках.
+class RegistrySnapshot {
+public:
+    static constexpr size_t HEADER_SIZE = 64;
+
+    RegistrySnapshot(DeviceRegistry& registry, DeviceIdTable& ids, std::string path);
+    ~RegistrySnapshot();
+
+    RegistrySnapshot(const RegistrySnapshot&) = delete;
+    RegistrySnapshot &operator=(const RegistrySnapshot&) = delete;
+
+    // Загружает снимок в реестр и пустую таблицу идентификаторов до начала
+    // приема. Время с момента снимка добавляется к простою устройств. Нет
+    // файла, он поврежден или id уже выдавались - 0, реестр остается
+    // пустым. Возвращает число загруженных устройств.
+    size_t Load();
+
+    // Пишет снимок. std::runtime_error при ошибке записи.
+    size_t Save();
+
+    // Пишет снимок каждые interval в своем потоке; 0 - только при Stop
+    void Start(std::chrono::seconds interval);
+
+    // Останавливает поток и пишет последний снимок. Деструктор только
+    // останавливает поток.
+    void Stop();
+
+private:
+    DeviceRegistry& registry_;
+    DeviceIdTable& ids_;
+    const std::string path_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+
+    void Run(std::chrono::seconds interval);
+    void StopThread();
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory_resource>
+#include <vector>
+
+// Буфер переупорядочивания перед хранилищем. Показания с меткой времени
+// устройства приходят не по порядку (повторы, буферизация на устройстве,
+// разные соединения), а хранилище полагается на порядок записи: kLast в
+// SQLite берет последнюю записанную строку, чанки сжимают разности меток.
+// Буфер держит показания window по времени и отдает их по возрастанию
+// метки, поэтому запросам не нужна сортировка.
+//
+// Ограничен capacity показаниями: при переполнении раньше срока уходят
+// самые ранние. Показание старше уже отданных или с меткой дальше
+// now + window идет в хранилище сразу, вне порядка.
+//
+// Журнал приема освобождается по порядку очереди, а буфер отдает по
+// времени, поэтому EmittedPrefix - сколько первых показаний (в порядке
+// Push) уже отдано целиком, без пропусков. Только поток писателя базы.
+class ReorderBuffer {
+public:
+    using Clock = std::chrono::system_clock;
+
+    ReorderBuffer(std::chrono::milliseconds window, size_t capacity,
+                  std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : window_(window), capacity_(std::max<size_t>(capacity, 1)), heap_(resource), pending_(resource) {
+        heap_.reserve(capacity_ + 1);
+    }
+
+    // Принимает пакет в порядке очереди и дописывает в out созревшие к now
+    // показания. Возвращает число показаний, отданных вне порядка.
+    size_t Push(const std::vector<DeviceState>& batch, Clock::time_point now, std::vector<DeviceState>& out) {
+        if (window_.count() <= 0) {
+            out.insert(out.end(), batch.begin(), batch.end());
+            prefix_ += batch.size();
+            next_ += batch.size();
+            return 0;
+        }
+
+        size_t unordered = 0;
+        for (const auto& state : batch) {
+            const uint64_t ordinal = next_++;
+            if ((emitted_any_ && state.last_update_ < emitted_until_) || state.last_update_ > now + window_) {
+                out.push_back(state);
+                pending_.push_back(1);
+                ++unordered;
+                continue;
+            }
+            heap_.push_back(Entry{ordinal, state});
+            std::push_heap(heap_.begin(), heap_.end(), Later);
+            pending_.push_back(0);
+            if (heap_.size() > capacity_) {
+                PopEarliest(out);
+            }
+        }
+        Drain(now, out);
+        return unordered;
+    }
+
+    // count номеров очереди, которые до буфера не дошли (вытеснены из
+    // очереди записи): они считаются отданными
+    void Skip(uint64_t count) {
+        if (pending_.empty()) {
+            prefix_ += count;
+        } else {
+            pending_.insert(pending_.end(), count, 1);
+        }
+        next_ += count;
+    }
+
+    // Отдает показания с меткой не позже now - window
+    void Drain(Clock::time_point now, std::vector<DeviceState>& out) {
+        while (!heap_.empty() && heap_.front().state_.last_update_ <= now - window_) {
+            PopEarliest(out);
+        }
+        AdvancePrefix();
+    }
+
+    // При остановке
+    void DrainAll(std::vector<DeviceState>& out) {
+        while (!heap_.empty()) {
+            PopEarliest(out);
+        }
+        AdvancePrefix();
+    }
+
+    uint64_t EmittedPrefix() const { return prefix_; }
+    uint64_t Pushed() const { return next_; }      // Номеров принято, с пропущенными
+    size_t Size() const { return heap_.size(); }
+
+private:
+    struct Entry {
+        uint64_t ordinal_;          // Номер в порядке Push
+        DeviceState state_;
+    };
+
+    // Сравнение для кучи с самым ранним показанием наверху
+    static bool Later(const Entry& a, const Entry& b) {
+        return a.state_.last_update_ != b.state_.last_update_ ? a.state_.last_update_ > b.state_.last_update_
+                                                              : a.ordinal_ > b.ordinal_;
+    }
+
+    void PopEarliest(std::vector<DeviceState>& out) {
+        std::pop_heap(heap_.begin(), heap_.end(), Later);
+        const Entry& entry = heap_.back();
+        out.push_back(entry.state_);
+        emitted_until_ = std::max(emitted_until_, entry.state_.last_update_);
+        emitted_any_ = true;
+        pending_[entry.ordinal_ - prefix_] = 1;
+        heap_.pop_back();
+    }
+
+    void AdvancePrefix() {
+        while (!pending_.empty() && pending_.front() != 0) {
+            pending_.pop_front();
+            ++prefix_;
+        }
+    }
+
+    const std::chrono::milliseconds window_;
+    const size_t capacity_;
+    std::pmr::vector<Entry> heap_;
+    std::pmr::deque<uint8_t> pending_;      // По номерам от prefix_: 1 - уже отдано
+    uint64_t prefix_ = 0;
+    uint64_t next_ = 0;
+    Clock::time_point emitted_until_;       // Наибольшая метка, отданная по порядку
+    bool emitted_any_ = false;
+};
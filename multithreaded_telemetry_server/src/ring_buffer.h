@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+// Кольцевой буфер байт фиксированной ёмкости (степень двойки).
+// Используется для сборки сообщений из частичных чтений сокета без
+// сдвига данных: recv пишет в свободную непрерывную область, разбор
+// читает с головы, байты освобождаются вызовом Consume().
+// Память берется из resource: цикл событий отдает сюда свой пул.
+class RingBuffer {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr size_t DEFAULT_CAPACITY = 16 * 1024;
+
+    explicit RingBuffer(size_t capacity = DEFAULT_CAPACITY,
+                        std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : data_(capacity, resource), mask_(capacity - 1) {
+        if (capacity == 0 || (capacity & mask_) != 0) {
+            throw std::invalid_argument("RingBuffer capacity must be a power of two");
+        }
+    }
+
+    size_t Capacity() const { return data_.size(); }
+    size_t Size() const { return tail_ - head_; }
+    size_t Free() const { return Capacity() - Size(); }
+    bool Empty() const { return head_ == tail_; }
+    bool Full() const { return Size() == Capacity(); }
+
+    // Непрерывная свободная область после хвоста (до конца массива или до головы)
+    std::span<char> WriteSpan() {
+        const size_t pos = tail_ & mask_;
+        const size_t len = std::min(Free(), Capacity() - pos);
+        return {data_.data() + pos, len};
+    }
+
+    void Commit(size_t n) { tail_ += n; }
+
+    // Непрерывная занятая область, начиная с головы
+    std::string_view ReadSpan() const {
+        const size_t pos = head_ & mask_;
+        const size_t len = std::min(Size(), Capacity() - pos);
+        return {data_.data() + pos, len};
+    }
+
+    char At(size_t offset) const { return data_[(head_ + offset) & mask_]; }
+
+    // Смещение первого байта c относительно головы или npos
+    size_t Find(char c, size_t from = 0) const {
+        const std::string_view first = ReadSpan();
+        if (from < first.size()) {
+            if (auto pos = first.find(c, from); pos != std::string_view::npos) {
+                return pos;
+            }
+            from = first.size();
+        }
+        const std::string_view second(data_.data(), Size() - first.size());
+        if (auto pos = second.find(c, from - first.size()); pos != std::string_view::npos) {
+            return first.size() + pos;
+        }
+        return npos;
+    }
+
+    // Копирует n байт начиная со смещения offset, с учетом перехода через конец массива
+    void CopyOut(size_t offset, size_t n, char *dst) const {
+        const size_t pos = (head_ + offset) & mask_;
+        const size_t first = std::min(n, Capacity() - pos);
+        std::memcpy(dst, data_.data() + pos, first);
+        std::memcpy(dst + first, data_.data(), n - first);
+    }
+
+    // Возвращает n байт со смещения offset как непрерывный view. Если данные
+    // переходят через конец массива, они копируются в scratch.
+    std::string_view View(size_t offset, size_t n, std::vector<char>& scratch) const {
+        const size_t pos = (head_ + offset) & mask_;
+        if (pos + n <= Capacity()) {
+            return {data_.data() + pos, n};
+        }
+        scratch.resize(n);
+        CopyOut(offset, n, scratch.data());
+        return {scratch.data(), n};
+    }
+
+    void Consume(size_t n) {
+        head_ += n;
+        if (head_ == tail_) {
+            head_ = tail_ = 0;      // Пустой буфер: следующее чтение получит максимальную область
+        }
+    }
+
+private:
+    std::pmr::vector<char> data_;
+    size_t mask_;
+    size_t head_ = 0;       // Монотонные счетчики, позиция в массиве = счетчик & mask_
+    size_t tail_ = 0;
+};
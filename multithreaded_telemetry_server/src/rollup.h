@@ -0,0 +1,176 @@
+#pragma once
+
+#include "device.h"
+#include "storage.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+// Агрегаты показаний за интервал: их хранят заголовки чанков, строки
+// таблиц свертки и аккумуляторы запросов.
+
+inline int64_t ToMs(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+inline int64_t FloorDiv(int64_t a, int64_t b) {
+    const int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// Начало интервала длиной width, содержащего ms
+inline int64_t FloorTo(int64_t ms, int64_t width) {
+    return FloorDiv(ms, width) * width;
+}
+
+// Агрегаты одного столбца значений
+struct ColumnStats {
+    double min_;
+    double max_;
+    double sum_;
+    double last_;       // Значение показания с наибольшей меткой времени
+};
+
+constexpr size_t VALUE_COLUMNS = 3;     // Температура, влажность, давление
+
+struct RollupStats {
+    static constexpr ColumnStats EMPTY {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0.0, 0.0};
+
+    uint64_t count_ = 0;
+    int64_t last_ms_ = std::numeric_limits<int64_t>::min();
+    ColumnStats stats_[VALUE_COLUMNS] = {EMPTY, EMPTY, EMPTY};
+
+    void Add(int64_t ms, const DeviceState& state) {
+        const double values[VALUE_COLUMNS] = {state.temperature_, state.humidity_, state.pressure_};
+        const bool last = ms >= last_ms_;
+        for (size_t i = 0; i < VALUE_COLUMNS; ++i) {
+            stats_[i].min_ = std::min(stats_[i].min_, values[i]);
+            stats_[i].max_ = std::max(stats_[i].max_, values[i]);
+            stats_[i].sum_ += values[i];
+            if (last) {
+                stats_[i].last_ = values[i];
+            }
+        }
+        last_ms_ = std::max(last_ms_, ms);
+        ++count_;
+    }
+
+    void Merge(uint64_t count, int64_t last_ms, const ColumnStats (&stats)[VALUE_COLUMNS]) {
+        const bool last = last_ms >= last_ms_;
+        for (size_t i = 0; i < VALUE_COLUMNS; ++i) {
+            stats_[i].min_ = std::min(stats_[i].min_, stats[i].min_);
+            stats_[i].max_ = std::max(stats_[i].max_, stats[i].max_);
+            stats_[i].sum_ += stats[i].sum_;
+            if (last) {
+                stats_[i].last_ = stats[i].last_;
+            }
+        }
+        last_ms_ = std::max(last_ms_, last_ms);
+        count_ += count;
+    }
+
+    AggregatedPoint Result(int64_t bucket_start_ms, Aggregation aggregation) const {
+        double values[VALUE_COLUMNS];
+        for (size_t i = 0; i < VALUE_COLUMNS; ++i) {
+            switch (aggregation) {
+            case Aggregation::kMin: values[i] = stats_[i].min_; break;
+            case Aggregation::kMax: values[i] = stats_[i].max_; break;
+            case Aggregation::kAvg: values[i] = stats_[i].sum_ / static_cast<double>(count_); break;
+            case Aggregation::kLast: values[i] = stats_[i].last_; break;
+            }
+        }
+        AggregatedPoint point;
+        point.bucket_start_ = std::chrono::system_clock::time_point(std::chrono::milliseconds(bucket_start_ms));
+        point.count_ = count_;
+        point.temperature_ = values[0];
+        point.humidity_ = values[1];
+        point.pressure_ = values[2];
+        return point;
+    }
+};
+
+// Уровни свертки
+enum class RollupTier {
+    kMinute,
+    kHour,
+    kCount
+};
+
+constexpr size_t ROLLUP_TIERS = static_cast<size_t>(RollupTier::kCount);
+constexpr std::array<int64_t, ROLLUP_TIERS> ROLLUP_WIDTH_MS = {60'000, 3'600'000};
+
+// Закрытый интервал свертки одного устройства. Для одного интервала
+// может быть несколько строк (опоздавшие показания), при чтении они складываются.
+struct RollupRow {
+    RollupTier tier_;
+    DeviceId device_id_;
+    int64_t bucket_start_ms_;
+    RollupStats stats_;
+};
+
+// Открытые интервалы всех уровней по устройствам. Используется одним
+// потоком (писателем базы): показание добавляется во все уровни сразу,
+// интервал закрывается, когда у устройства приходит показание из
+// следующего интервала или когда время вышло (Sweep).
+class RollupAccumulator {
+public:
+    // Открытые интервалы создаются и удаляются каждую минуту на каждое
+    // устройство: узлы таблиц берутся из resource
+    explicit RollupAccumulator(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : open_{Map(resource), Map(resource)} {
+        static_assert(ROLLUP_TIERS == 2);
+    }
+
+    void Add(const DeviceState& state, std::vector<RollupRow>& closed) {
+        const int64_t ms = ToMs(state.last_update_);
+        for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+            const int64_t start = FloorTo(ms, ROLLUP_WIDTH_MS[t]);
+            auto [it, inserted] = open_[t].try_emplace(state.device_id_, OpenBucket{start, {}});
+            OpenBucket& bucket = it->second;
+            if (start != bucket.start_ms_) {
+                if (start < bucket.start_ms_) {
+                    // Опоздавшее показание: отдельная строка для уже закрытого интервала
+                    RollupStats late;
+                    late.Add(ms, state);
+                    closed.push_back({static_cast<RollupTier>(t), state.device_id_, start, late});
+                    continue;
+                }
+                closed.push_back({static_cast<RollupTier>(t), state.device_id_, bucket.start_ms_, bucket.stats_});
+                bucket = OpenBucket{start, {}};
+            }
+            bucket.stats_.Add(ms, state);
+        }
+    }
+
+    // Закрывает интервалы, закончившиеся не позже now_ms
+    void Sweep(int64_t now_ms, std::vector<RollupRow>& closed) {
+        for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+            for (auto it = open_[t].begin(); it != open_[t].end();) {
+                if (it->second.start_ms_ + ROLLUP_WIDTH_MS[t] <= now_ms) {
+                    closed.push_back({static_cast<RollupTier>(t), it->first, it->second.start_ms_, it->second.stats_});
+                    it = open_[t].erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    // Все открытые интервалы, при остановке
+    void CloseAll(std::vector<RollupRow>& closed) { Sweep(std::numeric_limits<int64_t>::max(), closed); }
+
+private:
+    struct OpenBucket {
+        int64_t start_ms_;
+        RollupStats stats_;
+    };
+
+    using Map = std::pmr::unordered_map<DeviceId, OpenBucket>;
+    std::array<Map, ROLLUP_TIERS> open_;
+};
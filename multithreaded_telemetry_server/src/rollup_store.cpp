@@ -0,0 +1,226 @@
+#include "rollup_store.h"
+#include "logger.h"
+
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+constexpr const char* TABLES[ROLLUP_TIERS] = {"sensor_rollup_1m", "sensor_rollup_1h"};
+
+// Для kLast SQLite берет голые столбцы из строки с MAX(LAST_MS)
+constexpr const char* AGGREGATE_COLUMNS[] = {
+    "MIN(MIN_T), MIN(MIN_H), MIN(MIN_P)",
+    "MAX(MAX_T), MAX(MAX_H), MAX(MAX_P)",
+    "SUM(SUM_T) / SUM(COUNT), SUM(SUM_H) / SUM(COUNT), SUM(SUM_P) / SUM(COUNT)",
+    "LAST_T, LAST_H, LAST_P, MAX(LAST_MS)",
+};
+
+sqlite3_stmt* Prepare(sqlite3* db, const std::string& sql) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("rollup prepare: " + std::string(sqlite3_errmsg(db)));
+    }
+    return stmt;
+}
+
+} // namespace
+
+RollupStore::RollupStore(const DeviceIdTable& ids, const std::string& path) : ids_(ids) {
+    if (sqlite3_open(path.c_str(), &db_) != SQLITE_OK) {
+        throw std::runtime_error("rollup open: " + std::string(sqlite3_errmsg(db_)));
+    }
+    // Соединение делит файл с SqliteStorage: ждем, пока другой писатель отпустит блокировку
+    sqlite3_busy_timeout(db_, 5000);
+    Exec("PRAGMA journal_mode=WAL;");
+    Exec("PRAGMA synchronous=NORMAL;");
+
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        const std::string table = TABLES[t];
+        Exec(("CREATE TABLE IF NOT EXISTS " + table + "("
+              "DEVICE_ID TEXT NOT NULL, BUCKET_START INTEGER NOT NULL, COUNT INTEGER NOT NULL, LAST_MS INTEGER NOT NULL, "
+              "MIN_T REAL, MAX_T REAL, SUM_T REAL, LAST_T REAL, "
+              "MIN_H REAL, MAX_H REAL, SUM_H REAL, LAST_H REAL, "
+              "MIN_P REAL, MAX_P REAL, SUM_P REAL, LAST_P REAL);").c_str());
+        Exec(("CREATE INDEX IF NOT EXISTS " + table + "_device_time ON " + table + "(DEVICE_ID, BUCKET_START);").c_str());
+        insert_stmts_[t] = Prepare(db_, "INSERT INTO " + table + " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
+    }
+
+    // Первый интервал, начавшийся после открытия: в более ранние могли
+    // попасть показания прошлых запусков, которые не сворачивались
+    Exec("CREATE TABLE IF NOT EXISTS rollup_coverage(TIER INTEGER PRIMARY KEY, START_MS INTEGER NOT NULL);");
+    sqlite3_stmt* coverage = Prepare(db_, "INSERT OR IGNORE INTO rollup_coverage VALUES (?, ?);");
+    const int64_t now_ms = ToMs(std::chrono::system_clock::now());
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        sqlite3_bind_int64(coverage, 1, static_cast<int64_t>(t));
+        sqlite3_bind_int64(coverage, 2, FloorTo(now_ms, ROLLUP_WIDTH_MS[t]) + ROLLUP_WIDTH_MS[t]);
+        if (sqlite3_step(coverage) != SQLITE_DONE) {
+            sqlite3_finalize(coverage);
+            throw std::runtime_error("rollup coverage: " + std::string(sqlite3_errmsg(db_)));
+        }
+        sqlite3_reset(coverage);
+    }
+    sqlite3_finalize(coverage);
+    coverage = Prepare(db_, "SELECT TIER, START_MS FROM rollup_coverage;");
+    covered_from_ms_.fill(std::numeric_limits<int64_t>::max());
+    while (sqlite3_step(coverage) == SQLITE_ROW) {
+        const int64_t tier = sqlite3_column_int64(coverage, 0);
+        if (tier >= 0 && tier < static_cast<int64_t>(ROLLUP_TIERS)) {
+            covered_from_ms_[static_cast<size_t>(tier)] = sqlite3_column_int64(coverage, 1);
+        }
+    }
+    sqlite3_finalize(coverage);
+
+    // Отметка записанных интервалов: интервалы после нее при запуске
+    // собираются заново из хранилища показаний
+    Exec("CREATE TABLE IF NOT EXISTS rollup_written(TIER INTEGER PRIMARY KEY, BEFORE_MS INTEGER NOT NULL);");
+    written_before_ms_ = covered_from_ms_;
+    sqlite3_stmt* written = Prepare(db_, "SELECT TIER, BEFORE_MS FROM rollup_written;");
+    while (sqlite3_step(written) == SQLITE_ROW) {
+        const int64_t tier = sqlite3_column_int64(written, 0);
+        if (tier >= 0 && tier < static_cast<int64_t>(ROLLUP_TIERS)) {
+            written_before_ms_[static_cast<size_t>(tier)] = sqlite3_column_int64(written, 1);
+        }
+    }
+    sqlite3_finalize(written);
+    written_stmt_ = Prepare(db_, "INSERT OR REPLACE INTO rollup_written VALUES (?, ?);");
+
+    if (sqlite3_open_v2(path.c_str(), &read_db_, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("rollup reader: " + std::string(sqlite3_errmsg(read_db_)));
+    }
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        for (size_t a = 0; a < aggregate_stmts_[t].size(); ++a) {
+            aggregate_stmts_[t][a] = Prepare(read_db_, std::string("SELECT BUCKET_START / ?1 AS bucket, SUM(COUNT), ") +
+                                                       AGGREGATE_COLUMNS[a] + " FROM " + TABLES[t] +
+                                                       " WHERE DEVICE_ID = ?2 AND BUCKET_START >= ?3 AND BUCKET_START < ?4"
+                                                       " GROUP BY bucket ORDER BY bucket;");
+        }
+    }
+}
+
+RollupStore::~RollupStore() {
+    for (auto& stmts : aggregate_stmts_) {
+        for (auto* stmt : stmts) {
+            sqlite3_finalize(stmt);
+        }
+    }
+    for (auto* stmt : insert_stmts_) {
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_finalize(written_stmt_);
+    sqlite3_close(read_db_);
+    sqlite3_close(db_);
+}
+
+bool RollupStore::Exec(const char* sql) {
+    char* error = nullptr;
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+        LOG_ERROR("Rollup DB Error: {}", error ? error : sqlite3_errmsg(db_));
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+bool RollupStore::Step(sqlite3_stmt* stmt) {
+    const bool done = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!done) {
+        LOG_RATE_LIMITED(LogLevel::kError, 10, "Rollup DB Error: {}", sqlite3_errmsg(db_));
+    }
+    sqlite3_reset(stmt);
+    if (!done && sqlite3_get_autocommit(db_) == 0) {    // Часть ошибок SQLite откатывает сама
+        Exec("ROLLBACK;");
+    }
+    return done;
+}
+
+bool RollupStore::Write(const std::vector<RollupRow>& rows, const std::array<int64_t, ROLLUP_TIERS>& written_before) {
+    if (rows.empty() && written_before == written_before_ms_) {
+        return true;
+    }
+
+    if (!Exec("BEGIN;")) {
+        return false;
+    }
+    for (const auto& row : rows) {
+        sqlite3_stmt* stmt = insert_stmts_[static_cast<size_t>(row.tier_)];
+        const std::string_view device_id = ids_.Name(row.device_id_);
+        sqlite3_bind_text(stmt, 1, device_id.data(), static_cast<int>(device_id.size()), SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, row.bucket_start_ms_);
+        sqlite3_bind_int64(stmt, 3, static_cast<int64_t>(row.stats_.count_));
+        sqlite3_bind_int64(stmt, 4, row.stats_.last_ms_);
+        for (size_t i = 0; i < VALUE_COLUMNS; ++i) {
+            const ColumnStats& column = row.stats_.stats_[i];
+            sqlite3_bind_double(stmt, static_cast<int>(5 + i * 4), column.min_);
+            sqlite3_bind_double(stmt, static_cast<int>(6 + i * 4), column.max_);
+            sqlite3_bind_double(stmt, static_cast<int>(7 + i * 4), column.sum_);
+            sqlite3_bind_double(stmt, static_cast<int>(8 + i * 4), column.last_);
+        }
+        if (!Step(stmt)) {
+            return false;
+        }
+    }
+    for (size_t t = 0; t < ROLLUP_TIERS; ++t) {
+        if (written_before[t] == written_before_ms_[t]) {
+            continue;
+        }
+        sqlite3_bind_int64(written_stmt_, 1, static_cast<int64_t>(t));
+        sqlite3_bind_int64(written_stmt_, 2, written_before[t]);
+        if (!Step(written_stmt_)) {
+            return false;
+        }
+    }
+
+    if (!Exec("COMMIT;")) {
+        if (sqlite3_get_autocommit(db_) == 0) {     // COMMIT не прошел, транзакция еще открыта
+            Exec("ROLLBACK;");
+        }
+        return false;
+    }
+    written_before_ms_ = written_before;
+    return true;
+}
+
+bool RollupStore::Discard(int64_t from_ms) {
+    std::string sql = "BEGIN;";
+    for (const char* table : TABLES) {
+        sql += std::string(" DELETE FROM ") + table + " WHERE BUCKET_START >= " + std::to_string(from_ms) + ";";
+    }
+    if (!Exec((sql + " COMMIT;").c_str())) {
+        if (sqlite3_get_autocommit(db_) == 0) {
+            Exec("ROLLBACK;");
+        }
+        return false;
+    }
+    return true;
+}
+
+std::vector<AggregatedPoint> RollupStore::Aggregate(RollupTier tier, DeviceId id, int64_t from_ms, int64_t to_ms,
+                                                    int64_t bucket_ms, Aggregation aggregation) const {
+    const std::string_view device_id = ids_.Name(id);
+
+    std::vector<AggregatedPoint> points;
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    sqlite3_stmt* stmt = aggregate_stmts_[static_cast<size_t>(tier)][static_cast<size_t>(aggregation)];
+    sqlite3_bind_int64(stmt, 1, bucket_ms);
+    sqlite3_bind_text(stmt, 2, device_id.data(), static_cast<int>(device_id.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, from_ms);
+    sqlite3_bind_int64(stmt, 4, to_ms);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        AggregatedPoint point;
+        point.bucket_start_ = std::chrono::system_clock::time_point(std::chrono::milliseconds(sqlite3_column_int64(stmt, 0) * bucket_ms));
+        point.count_ = static_cast<uint64_t>(sqlite3_column_int64(stmt, 1));
+        point.temperature_ = sqlite3_column_double(stmt, 2);
+        point.humidity_ = sqlite3_column_double(stmt, 3);
+        point.pressure_ = sqlite3_column_double(stmt, 4);
+        points.push_back(point);
+    }
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Rollup DB Error: {}", sqlite3_errmsg(read_db_));
+    }
+    sqlite3_reset(stmt);
+    return points;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "intern_table.h"
+#include "rollup.h"
+
+#include <array>
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+// Таблицы свертки sensor_rollup_1m и sensor_rollup_1h в SQLite. Строка -
+// агрегаты одного устройства за минуту или час, поэтому запрос за месяц
+// с интервалом в час читает сотни строк вместо миллионов показаний.
+class RollupStore {
+public:
+    RollupStore(const DeviceIdTable& ids, const std::string& path);
+    ~RollupStore();
+
+    RollupStore(const RollupStore&) = delete;
+    RollupStore &operator=(const RollupStore&) = delete;
+
+    // Только поток писателя; одна транзакция на вызов, false - ничего не
+    // записано. written_before[t] - отметка уровня t: все его интервалы,
+    // закончившиеся до нее, записаны; сохраняется в той же транзакции.
+    bool Write(const std::vector<RollupRow>& rows, const std::array<int64_t, ROLLUP_TIERS>& written_before);
+    bool Write(const std::vector<RollupRow>& rows) { return Write(rows, written_before_ms_); }
+
+    // Последняя сохраненная отметка уровня; без нее - CoveredFrom
+    int64_t WrittenBefore(RollupTier tier) const { return written_before_ms_[static_cast<size_t>(tier)]; }
+
+    // Удаляет строки всех уровней с началом интервала не раньше from_ms:
+    // перед тем как собрать эти интервалы заново из показаний
+    bool Discard(int64_t from_ms);
+
+    // Только поток писателя, при остановке
+    void Checkpoint() { Exec("PRAGMA wal_checkpoint(TRUNCATE);"); }
+
+    // Начало первого интервала уровня, свернутого целиком. Запоминается в
+    // rollup_coverage при первом открытии базы: показания, записанные до
+    // этого, в таблицы свертки не попали, и более ранние интервалы
+    // читаются из хранилища показаний.
+    int64_t CoveredFrom(RollupTier tier) const { return covered_from_ms_[static_cast<size_t>(tier)]; }
+
+    // Интервалы длиной bucket_ms (кратной ширине уровня), составленные из
+    // строк уровня tier с началом в [from_ms, to_ms). Из любого потока.
+    std::vector<AggregatedPoint> Aggregate(RollupTier tier, DeviceId id, int64_t from_ms, int64_t to_ms,
+                                           int64_t bucket_ms, Aggregation aggregation) const;
+
+private:
+    const DeviceIdTable& ids_;
+    sqlite3* db_ = nullptr;
+    sqlite3* read_db_ = nullptr;
+    std::array<sqlite3_stmt*, ROLLUP_TIERS> insert_stmts_ {};
+    std::array<std::array<sqlite3_stmt*, 4>, ROLLUP_TIERS> aggregate_stmts_ {};    // [уровень][Aggregation]
+    std::array<int64_t, ROLLUP_TIERS> covered_from_ms_ {};
+    std::array<int64_t, ROLLUP_TIERS> written_before_ms_ {};
+    sqlite3_stmt* written_stmt_ = nullptr;
+    mutable std::mutex read_mutex_;
+
+    bool Exec(const char* sql);     // false - ошибка уже в журнале
+    bool Step(sqlite3_stmt* stmt);  // false - транзакция уже откачена
+};
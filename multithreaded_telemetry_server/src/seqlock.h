@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+// Значение под seqlock: чтение не берет блокировок и не мешает писателям,
+// при гонке с записью читатель просто повторяет попытку.
+// Данные хранятся в атомарных словах, поэтому конкурентное чтение
+// не является гонкой данных с точки зрения модели памяти C++.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock requires a trivially copyable type");
+
+public:
+    SeqLock() = default;
+    explicit SeqLock(const T& value) { Store(value); }
+
+    void Store(const T& value) {
+        const uint64_t seq = Lock();
+        Write(value);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Записывает value, только если accept(текущее значение) истинно.
+    // Проверка идет под блокировкой писателя, без гонки с другими записями.
+    template <typename F>
+    bool StoreIf(const T& value, F&& accept) {
+        const uint64_t seq = Lock();
+        uint64_t buffer[WORDS];
+        for (size_t i = 0; i < WORDS; ++i) {
+            buffer[i] = words_[i].load(std::memory_order_relaxed);
+        }
+        T current;
+        std::memcpy(&current, buffer, sizeof(T));
+        if (!accept(current)) {
+            seq_.store(seq, std::memory_order_release);     // Данные не менялись, читателям повторять не нужно
+            return false;
+        }
+        Write(value);
+        seq_.store(seq + 2, std::memory_order_release);
+        return true;
+    }
+
+    T Load() const {
+        uint64_t buffer[WORDS];
+        while (true) {
+            const uint64_t before = seq_.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; ++i) {
+                buffer[i] = words_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == before) {
+                break;
+            }
+        }
+
+        T value;
+        std::memcpy(&value, buffer, sizeof(T));
+        return value;
+    }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // Нечетное значение счетчика - идет запись. CAS исключает одновременных писателей.
+    // Возвращает четное значение до блокировки.
+    uint64_t Lock() {
+        uint64_t seq = seq_.load(std::memory_order_relaxed);
+        while (true) {
+            if ((seq & 1) == 0 &&
+                seq_.compare_exchange_weak(seq, seq + 1, std::memory_order_relaxed)) {
+                break;
+            }
+            std::this_thread::yield();
+            seq = seq_.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return seq;
+    }
+
+    void Write(const T& value) {
+        uint64_t buffer[WORDS] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        for (size_t i = 0; i < WORDS; ++i) {
+            words_[i].store(buffer[i], std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> seq_{0};
+    std::atomic<uint64_t> words_[WORDS]{};
+};
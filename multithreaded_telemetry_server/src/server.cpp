@@ -1,13 +1,27 @@
 #include "device.h"
+#include "event_loop.h"
+#include "json.h"
+#include "logger.h"
+#include "metric_schema.h"
+#include "metrics.h"
+#include "parser.h"
+#include "query.h"
+#include "registry_snapshot.h"
 #include "socket_raii.h"
+#include "subscription.h"
 #include "thread_pool.h"
+#include "validation.h"
 #include "database.h"
+#include "dedup.h"
 
 #include <algorithm>
+#include <cstdlib>
 #include <fmt/format.h>
-#include <iostream>
+#include <latch>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <ranges>
-#include <sstream>
 #include <stdio.h>
 #include <string.h>
 #include <string_view>
@@ -25,93 +39,267 @@
 #include <unistd.h>
 
 std::atomic<bool> stop_flag{false};
+std::atomic<int> stop_signal{0};
 
+// В обработчике сигнала журнал недоступен: только запоминаем номер
 void HandleSignal(int signal) {
+    stop_signal = signal;
     stop_flag = true;
-    std::cerr << " -received signal " << signal << std::endl;
 }
 
-bool ParserData(std::string data, DeviceState& state) {
+bool UpdateDataMapDevice(DeviceRegistry& device_registry, DeviceState& state){
+    //std::cout << "Обновляем данные DeviceRegistry" << std::endl;
+    return device_registry.UpdateDevice(state);
+}
 
-    auto colon_pos = data.find(':');
-    if (colon_pos == std::string::npos) {
-        return false;
+// Показания одного чтения из сокета: база принимает их одним вызовом,
+// чтобы журнал приема синхронизировался на диск один раз на весь пакет
+struct PendingReadings {
+    std::vector<int8_t> results;            // По кадру: 1 - Ok, 0 - Err, -1 - показание ждет базы
+    std::vector<DeviceState> readings;
+    std::vector<uint8_t> fields;            // По readings: маска FIELD_* присланных полей
+    std::vector<uint8_t> accepted;
+    std::vector<uint8_t> issues;            // Маски проверки ReadingValidator по readings
+    std::vector<uint8_t> duplicates;        // По readings: 1 - повтор по seq
+    std::vector<MetricSample> extras;       // Метрики вне temp/hum/press, подряд по readings
+    std::vector<uint16_t> extra_counts;     // По readings: сколько значений в extras
+};
+
+// Разобранное показание откладывается до SubmitReadings, ошибка разбора сразу дает Err.
+// extra_count последних значений pending.extras относятся к этому показанию.
+void AddReading(bool parsed, const DeviceState& state, uint8_t fields, PendingReadings& pending,
+                size_t extra_count = 0) {
+    if (!parsed) {
+        metrics::Increment(metrics::Counter::kParseFailures);
+        LOG_RATE_LIMITED(LogLevel::kWarn, 10, "Exception: PARSER");
+        pending.results.push_back(0);
+        return;
     }
 
-    std::string device_id = data.substr(0, colon_pos);
-    std::string readings = data.substr(colon_pos + 1);
+    metrics::Increment(metrics::Counter::kReadingsParsed);
+    pending.readings.push_back(state);
+    pending.fields.push_back(fields);
+    pending.extra_counts.push_back(static_cast<uint16_t>(extra_count));
+    pending.results.push_back(-1);
+}
 
-    state.device_id_ = device_id;
-    state.last_update_ = std::chrono::system_clock::now();
+// Убирает из пакета показания, для которых drop(i) истинно, вместе со
+// значениями их метрик; такие показания сразу получают result
+template <typename Drop>
+void DropReadings(PendingReadings& pending, int8_t dropped_result, Drop&& drop) {
+    size_t next = 0;
+    size_t kept = 0;
+    size_t extra = 0;
+    size_t extras_kept = 0;
+    for (int8_t& result : pending.results) {
+        if (result >= 0) {
+            continue;
+        }
+        const uint16_t extra_count = pending.extra_counts[next];
+        if (drop(next)) {
+            result = dropped_result;
+        } else {
+            pending.readings[kept] = pending.readings[next];
+            pending.fields[kept] = pending.fields[next];
+            pending.extra_counts[kept++] = extra_count;
+            std::copy(pending.extras.begin() + extra, pending.extras.begin() + extra + extra_count,
+                      pending.extras.begin() + extras_kept);
+            extras_kept += extra_count;
+        }
+        extra += extra_count;
+        ++next;
+    }
+    pending.readings.resize(kept);
+    pending.fields.resize(kept);
+    pending.extra_counts.resize(kept);
+    pending.extras.resize(extras_kept);
+}
 
-    std::istringstream ss(readings);
-    std::string token;
+// Повтор уже принятого показания получает Ok, но дальше не идет
+void DropDuplicates(PendingReadings& pending, DuplicateFilter& duplicates) {
+    if (const size_t count = duplicates.Admit(pending.readings, pending.duplicates)) {
+        metrics::Increment(metrics::Counter::kReadingsDuplicate, count);
+        DropReadings(pending, 1, [&pending](size_t i) { return pending.duplicates[i] != 0; });
+    }
+}
 
-    while (std::getline(ss, token, ',')) {
-        auto eq_pos = token.find('=');
-        if (eq_pos == std::string::npos) continue;
+// Убирает из пакета показания, отклоненные проверкой: они сразу получают Err
+void ValidateReadings(PendingReadings& pending, ReadingValidator& validator, DuplicateFilter& duplicates) {
+    {
+        metrics::ScopedTimer timer(metrics::Stage::kValidate);
+        validator.Check(pending.readings, pending.fields, pending.issues);
+    }
+    DropReadings(pending, 0, [&](size_t i) {
+        if (pending.issues[i] & REJECTING_ISSUES) {
+            duplicates.Forget(pending.readings[i]);
+            return true;
+        }
+        return false;
+    });
+}
 
-        std::string key = token.substr(0,eq_pos);
-        double value = std::stod(token.substr(eq_pos + 1));
+// Отправляет отложенные показания в базу и реестр и дописывает подтверждения по порядку кадров
+void SubmitReadings(Connection& conn, PendingReadings& pending, DeviceRegistry& device_registry,
+                    DeviceMetrics& device_metrics, DataBase& db, ReadingValidator *validator,
+                    DuplicateFilter& duplicates) {
+    if (!pending.readings.empty()) {
+        DropDuplicates(pending, duplicates);
+    }
+    if (validator != nullptr && !pending.readings.empty()) {
+        ValidateReadings(pending, *validator, duplicates);
+    }
 
-        if (key == "temp") {
-            state.temperature_ = value;
-        } else if (key == "hum") {
-            state.humidity_ = value;
-        } else if (key == "press") {
-            state.pressure_ = value;
+    // Очередь записи переполнена: устройство получит Err и повторит показание
+    db.InsertReadings(pending.readings, pending.accepted, pending.extras, pending.extra_counts);
+
+    size_t next = 0;
+    size_t extra = 0;
+    for (int8_t result : pending.results) {
+        if (result >= 0) {
+            conn.acks_.Add(result != 0);
+            continue;
         }
+        const bool accepted = pending.accepted[next] != 0;
+        const uint16_t extra_count = pending.extra_counts[next];
+        if (accepted) {
+            metrics::ScopedTimer timer(metrics::Stage::kRegistry);
+            // Опоздавшее показание идет в хранилище, но не откатывает последнее состояние
+            if (UpdateDataMapDevice(device_registry, pending.readings[next])) {
+                device_metrics.Update(pending.readings[next].device_id_, pending.extras.data() + extra, extra_count);
+            }
+            metrics::Increment(metrics::Counter::kRegistryUpdates);
+        } else {
+            duplicates.Forget(pending.readings[next]);
+        }
+        conn.acks_.Add(accepted);
+        extra += extra_count;
+        ++next;
     }
-
-    return true;
+    pending.results.clear();
+    pending.readings.clear();
+    pending.fields.clear();
+    pending.extras.clear();
+    pending.extra_counts.clear();
+    conn.acks_.WriteTo(conn.out_);
 }
 
-void UpdateDataMapDevice(DeviceRegistry& device_registry, DeviceState& state){
-    //std::cout << "Обновляем данные DeviceRegistry" << std::endl;
-    device_registry.UpdateDevice(state);
+// Параметры HTTP: id=<имя устройства>. Ответ - JSON с последним показанием
+// из реестра и последними значениями дополнительных метрик.
+std::string HandleDeviceHttp(std::string_view params, const DeviceIdTable& device_ids,
+                             const DeviceRegistry& device_registry, const MetricSchema& metric_schema,
+                             const DeviceMetrics& device_metrics) {
+    std::string_view name;
+    while (!params.empty()) {
+        const size_t amp = params.find('&');
+        const std::string_view pair = params.substr(0, amp);
+        params = amp == std::string_view::npos ? std::string_view() : params.substr(amp + 1);
+        if (pair.starts_with("id=")) {
+            name = pair.substr(3);
+        }
+    }
+    const auto id = device_ids.Find(name);
+    const auto state = id ? device_registry.GetDevice(*id) : std::nullopt;
+    if (!state) {
+        throw std::invalid_argument("unknown device: " + std::string(name));
+    }
+
+    std::string out = "{\"device\":";
+    AppendJsonString(out, name);
+    fmt::format_to(std::back_inserter(out), ",\"ts\":{}", std::chrono::duration_cast<std::chrono::milliseconds>(
+        state->last_update_.time_since_epoch()).count());
+    out += ",\"metrics\":{\"temp\":";
+    AppendJsonNumber(out, state->temperature_);
+    out += ",\"hum\":";
+    AppendJsonNumber(out, state->humidity_);
+    out += ",\"press\":";
+    AppendJsonNumber(out, state->pressure_);
+    for (const auto& value : device_metrics.Get(*id)) {
+        out += ',';
+        AppendJsonString(out, metric_schema.Name(value.metric_));
+        out += ':';
+        AppendJsonNumber(out, value.value_);
+    }
+    out += "}}\n";
+    return out;
 }
 
-void SaveDataToDB(DataBase& db, DeviceState& state){
-    //std::cout << "Передаем в очередь на запись в базу " << std::endl;
-    db.InsertReadingDataDevice(state);
+// Кадр двоичного протокола: BIND подтверждается как показание, DATA разбирается по смещениям
+void HandleBinaryFrame(Connection& conn, uint8_t type, std::string_view payload, DeviceIdTable& device_ids,
+                       PendingReadings& pending, DeviceState& state, uint8_t& fields) {
+    using protocol::binary::FrameType;
 
-}
+    if (type == static_cast<uint8_t>(FrameType::kBind)) {
+        const bool bound = protocol::binary::DecodeBind(payload, conn.bindings_, device_ids);
+        if (!bound) {
+            LOG_RATE_LIMITED(LogLevel::kWarn, 10, "Exception: BIND");
+        }
+        pending.results.push_back(bound ? 1 : 0);
+        return;
+    }
 
-void handleClient(Socket &&client_fd, DeviceRegistry& device_registry, DataBase& db) {
-    try {
-        std::cout << "Connected to client." << std::endl;
+    bool parsed = false;
+    if (type == static_cast<uint8_t>(FrameType::kData)) {
+        metrics::ScopedTimer timer(metrics::Stage::kParse);
+        parsed = protocol::binary::DecodeData(payload, conn.bindings_, state, fields);
+    }
+    AddReading(parsed, state, fields, pending);
+}
 
-        char buf[1024];
+// Разбирает все полные кадры, накопленные в соединении, и готовит пакет
+// подтверждений. Вызывается в потоке цикла событий.
+bool handleClient(Connection& conn, DeviceIdTable& device_ids, MetricSchema& metric_schema,
+                  DeviceRegistry& device_registry, DeviceMetrics& device_metrics, DataBase& db,
+                  ReadingValidator *validator, DuplicateFilter& duplicates) {
+    protocol::Frame frame;
+    DeviceState state;      // Переиспользуется для всех кадров пакета
+    uint8_t fields = 0;
+    thread_local PendingReadings pending;
 
-        int byte_received = recv(client_fd.GetFd(), buf, sizeof(buf), 0);
+    if (conn.format_ == protocol::Format::kUnknown) {
+        conn.format_ = protocol::binary::DetectFormat(conn.in_);
+    }
+    const bool binary = conn.format_ == protocol::Format::kBinary;
 
-        if (byte_received < 0) {
-            throw std::runtime_error("RECV");
-        } else if (byte_received == 0) {
-            throw std::runtime_error("Client disconnected");
+    while (true) {
+        uint8_t type = 0;
+        auto status = binary ? protocol::binary::NextFrame(conn.in_, conn.scratch_, frame, type)
+                             : protocol::NextFrame(conn.in_, conn.scratch_, frame);
+        if (status == protocol::FrameStatus::kIncomplete) {
+            break;
+        }
+        if (status == protocol::FrameStatus::kError) {
+            LOG_RATE_LIMITED(LogLevel::kWarn, 10, "Exception: FRAME");
+            // Кадры до ошибки все равно принимаются и подтверждаются
+            SubmitReadings(conn, pending, device_registry, device_metrics, db, validator, duplicates);
+            return false;
         }
 
-        buf[byte_received] = '\0';
-        std::cout << "Received: " << buf << std::endl;
-
-        DeviceState state;  // Создаем объект для парсинга структуры данных
+        if (binary) {
+            HandleBinaryFrame(conn, type, frame.payload, device_ids, pending, state, fields);
+        } else {
+            LOG_DEBUG("Received: {}", frame.payload);
 
-        if (ParserData(buf, state)){
-            if (send(client_fd.GetFd(), "Ok", 2, 0) < 0) {
-                throw std::runtime_error("SEND");
+            bool parsed;
+            const size_t extras_before = pending.extras.size();
+            const uint64_t refused_before = conn.metric_names_.refused_;
+            {
+                metrics::ScopedTimer timer(metrics::Stage::kParse);
+                parsed = ParseReading(frame.payload, state, fields, device_ids, metric_schema, conn.metric_names_,
+                                      pending.extras);
             }
-        } else {
-            throw std::runtime_error("PARSER");
+            if (conn.metric_names_.refused_ != refused_before) {
+                metrics::Increment(metrics::Counter::kMetricNamesRefused, conn.metric_names_.refused_ - refused_before);
+                LOG_RATE_LIMITED(LogLevel::kWarn, 10, "Metric names: connection limit of {} reached",
+                                 MetricNameBudget::DEFAULT);
+            }
+            AddReading(parsed, state, fields, pending, pending.extras.size() - extras_before);
         }
-        
-        //std::cout << "Parsing, ok" << std::endl;
-        
-        UpdateDataMapDevice(device_registry, state);
-        SaveDataToDB(db, state);
 
-    } catch (const std::exception &ex) {
-        std::cerr << "Exception: " << ex.what() << ", " << strerror(errno) << std::endl;
+        conn.in_.Consume(frame.size);
     }
+
+    SubmitReadings(conn, pending, device_registry, device_metrics, db, validator, duplicates);
+    return true;
 }
 
 int main(int argc, char *argv[]) {
@@ -124,53 +312,196 @@ int main(int argc, char *argv[]) {
     sigaddset(&sa.sa_mask, SIGINT);
     sigaction(SIGINT, &sa, 0);
     
+    const char *metrics_port = "9464";
+    const char *feed_port = "9465";
+    DataBaseOptions db_options;
+    DeviceExpiry expiry;
+    ValidationOptions validation;
+    bool validate = true;
+    std::chrono::milliseconds drain_timeout{5000};
+    std::string snapshot_path = "registry.snap";   // Пусто - без снимка реестра
+    std::chrono::seconds snapshot_interval{30};
+    IoBackend io_backend = IoBackend::kUring;       // Без io_uring в сборке или ядре - epoll
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--log-level=")) {
+            if (auto level = ParseLogLevel(arg.substr(12))) {
+                g_log_level = *level;
+            }
+        } else if (arg.starts_with("--metrics-port=")) {
+            metrics_port = argv[i] + 15;
+        } else if (arg.starts_with("--feed-port=")) {
+            feed_port = argv[i] + 12;
+        } else if (arg.starts_with("--drain-timeout=")) {
+            drain_timeout = std::chrono::milliseconds(std::atoi(argv[i] + 16));
+        } else if (arg.starts_with("--stale-after=")) {
+            expiry.stale_after = std::chrono::seconds(std::atoi(argv[i] + 14));
+        } else if (arg.starts_with("--evict-after=")) {
+            expiry.evict_after = std::chrono::seconds(std::atoi(argv[i] + 14));
+        } else if (arg.starts_with("--snapshot-path=")) {
+            snapshot_path = argv[i] + 16;
+        } else if (arg.starts_with("--snapshot-interval=")) {
+            snapshot_interval = std::chrono::seconds(std::atoi(argv[i] + 20));
+        } else if (arg == "--no-snapshot") {
+            snapshot_path.clear();
+        } else if (arg == "--no-validation") {
+            validate = false;
+        } else if (arg.starts_with("--reorder-window=")) {
+            db_options.reorder_window = std::chrono::milliseconds(std::atoi(argv[i] + 17));
+        } else if (arg.starts_with("--anomaly-z=")) {
+            validation.z_threshold_ = std::atof(argv[i] + 12);
+        } else if (arg == "--io=epoll") {
+            io_backend = IoBackend::kEpoll;
+        } else if (arg == "--io=uring") {
+            io_backend = IoBackend::kUring;
+        } else if (arg.starts_with("--journal-dir=")) {
+            db_options.journal_dir = argv[i] + 14;
+        } else if (arg == "--no-journal") {
+            db_options.journal_dir.clear();
+        } else if (arg == "--storage=chunks") {
+            db_options.storage = StorageKind::kChunks;
+        } else if (arg == "--storage=sqlite") {
+            db_options.storage = StorageKind::kSqlite;
+        }
+    }
+
     try {
         
-        AddrInfo addr(nullptr, "8080", AI_PASSIVE);
-        Socket socket_fd(socket(addr.Get()->ai_family, addr.Get()->ai_socktype, addr.Get()->ai_protocol));
-        
-        if (socket_fd.GetFd() < 0) {
-            throw std::runtime_error("socket");
+        DeviceIdTable device_ids;               // Интернированные идентификаторы устройств
+        MetricSchema metric_schema;             // Имена метрик показаний -> MetricId
+        std::pmr::synchronized_pool_resource registry_pool;    // Узлы реестра: без выделения из кучи на устройство
+        DeviceRegistry device_registry(device_ids, 64, expiry, &registry_pool);    // Создаем объект для регистрации устройств
+        DeviceMetrics device_metrics;           // Последние значения метрик вне temp/hum/press
+        device_registry.SetExpiryHandler([&device_ids, &device_metrics](DeviceId id, DeviceEvent event) {
+            if (event == DeviceEvent::kStale) {
+                metrics::Increment(metrics::Counter::kDevicesStale);
+                LOG_RATE_LIMITED(LogLevel::kInfo, 10, "Device {} went stale", device_ids.Name(id));
+            } else {
+                device_metrics.Erase(id);
+                metrics::Increment(metrics::Counter::kDevicesEvicted);
+                LOG_RATE_LIMITED(LogLevel::kInfo, 10, "Device {} evicted", device_ids.Name(id));
+            }
+        });
+        SubscriptionHub subscriptions(device_ids);      // Подписки на изменения показаний
+        device_registry.SetUpdateHandler([&subscriptions](const DeviceState& state) { subscriptions.Publish(state); });
+        std::optional<RegistrySnapshot> snapshot;       // Реестр прошлого запуска, затем снимки раз в interval
+        if (!snapshot_path.empty()) {
+            snapshot.emplace(device_registry, device_ids, snapshot_path);
+            snapshot->Load();
+            snapshot->Start(snapshot_interval);
         }
-        
-        if (bind(socket_fd.GetFd(), addr.Get()->ai_addr, addr.Get()->ai_addrlen) < 0) {
-            throw std::runtime_error("bind");
+        DataBase data_base(device_ids, metric_schema, db_options);     // SQLite или чанки (--storage=)
+        std::optional<ReadingValidator> validator;      // Диапазоны, скорость изменения, z-score
+        if (validate) {
+            validator.emplace(validation);
         }
-        
-        if (listen(socket_fd.GetFd(), SOMAXCONN) < 0) {
-            throw std::runtime_error("listen");
+        ReadingValidator *validator_ptr = validator ? &*validator : nullptr;
+        DuplicateFilter duplicates;             // Окна повторов по seq устройств
+
+        // По одному циклу событий на ядро, у каждого свой слушающий сокет на порту 8080
+        const size_t num_loops = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::unique_ptr<IoLoop>> loops;
+        for (size_t i = 0; i < num_loops; ++i) {
+            loops.push_back(MakeIoLoop("8080", [&, validator_ptr](Connection& conn) {
+                return handleClient(conn, device_ids, metric_schema, device_registry, device_metrics, data_base,
+                                    validator_ptr, duplicates);
+            }, io_backend));
         }
-        
-        std::cout << "Server is listening for connections..." << std::endl;
-        
-        struct sockaddr_storage their_addr;
-        
-        socklen_t addr_size = sizeof(their_addr);
-        
-        ThreadPool pool(4);                     // Создаем пулл с 4 потоками
-        DeviceRegistry device_registry;         // Создаем объект для регистрации устройств
-        DataBase data_base;                     // Создаем объект для доступа к базе SQLite
 
-        while (!stop_flag) {
-            Socket client_fd(accept(socket_fd.GetFd(), (struct sockaddr *)&their_addr, &addr_size));
+        metrics::RegisterGauge("telemetry_db_queue_depth", "Readings waiting in the DB queue",
+                               [&data_base] { return static_cast<double>(data_base.QueueDepth()); });
+        metrics::RegisterGauge("telemetry_db_queue_high_water_mark", "Maximum observed DB queue depth",
+                               [&data_base] { return static_cast<double>(data_base.QueueHighWaterMark()); });
+        metrics::RegisterGauge("telemetry_db_queue_dropped", "Readings evicted from a full DB queue",
+                               [&data_base] { return static_cast<double>(data_base.DroppedCount()); });
+        metrics::RegisterGauge("telemetry_devices", "Devices known to DeviceRegistry",
+                               [&device_registry] { return static_cast<double>(device_registry.Size()); });
+        metrics::RegisterGauge("telemetry_devices_live", "Devices with a reading within stale_after",
+                               [&device_registry] { return static_cast<double>(device_registry.LiveCount()); });
+        metrics::RegisterGauge("telemetry_devices_stale", "Devices without readings for stale_after, not yet evicted",
+                               [&device_registry] { return static_cast<double>(device_registry.StaleCount()); });
+        metrics::RegisterGauge("telemetry_metric_values_dropped", "Metric values dropped from a full metric queue",
+                               [&data_base] { return static_cast<double>(data_base.MetricsDropped()); });
+        metrics::RegisterGauge("telemetry_metric_values_failed", "Metric values in failed writes, kept for a retry",
+                               [&data_base] { return static_cast<double>(data_base.MetricsFailed()); });
+        metrics::RegisterGauge("telemetry_metric_schema_size", "Metric names known to the schema",
+                               [&metric_schema] { return static_cast<double>(metric_schema.Size()); });
+        metrics::RegisterRoute("/device", "application/json", [&](std::string_view params) {
+            return HandleDeviceHttp(params, device_ids, device_registry, metric_schema, device_metrics);
+        });
+        QueryService query_service(device_ids, data_base);
+        metrics::RegisterRoute("/query", "application/json",
+                               [&query_service](std::string_view params) { return query_service.HandleHttp(params); });
+        if (validator) {
+            metrics::RegisterRoute("/flagged", "application/json", [&validator, &device_ids](std::string_view params) {
+                return validator->HandleHttp(params, device_ids);
+            });
+            metrics::RegisterGauge("telemetry_validation_side_channel_depth", "Rejected and flagged readings not yet read",
+                                   [&validator] { return static_cast<double>(validator->SideChannelDepth()); });
+        }
+        metrics::RegisterGauge("telemetry_feed_subscribers", "Active state change subscriptions",
+                               [&subscriptions] { return static_cast<double>(subscriptions.Count()); });
+        metrics::MetricsServer metrics_server(metrics_port, stop_flag);     // Только 127.0.0.1
+        FeedServer feed_server(feed_port, subscriptions, device_ids, stop_flag);   // Только 127.0.0.1
 
-            if (client_fd.GetFd() < 0) {
-                if (errno == EINTR)
-                    continue;
-                throw std::runtime_error("accept");
-            }
+        LOG_INFO("Server is listening for connections ({} event loops on {})...", num_loops, loops.front()->Name());
 
-            pool.enqueue([client_fd = std::move(client_fd), &device_registry, &data_base]() mutable {
-                handleClient(std::move(client_fd), device_registry, data_base);
+        ThreadPool pool(num_loops);             // Каждый поток пула обслуживает свой цикл событий
+        std::latch loops_drained(static_cast<std::ptrdiff_t>(num_loops));
+        std::atomic<size_t> undrained{0};
+        for (auto& loop : loops) {
+            pool.enqueue([&loop, &loops_drained, &undrained, drain_timeout] {
+                try {
+                    loop->Run(stop_flag);
+                } catch (const std::exception &ex) {
+                    LOG_ERROR("Event loop: {}, {}", ex.what(), strerror(errno));
+                    stop_flag = true;
+                }
+                // Ошибка досылки не должна оставить main ждать latch вечно
+                try {
+                    undrained += loop->Drain(drain_timeout);
+                } catch (const std::exception &ex) {
+                    LOG_ERROR("Event loop drain: {}, {}", ex.what(), strerror(errno));
+                }
+                loops_drained.count_down();
             });
         }
 
+        while (!stop_flag) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));   // Ждем SIGINT
+            device_registry.Sweep();
+        }
+        LOG_INFO("Received signal {}, draining connections", stop_signal.load());
+
+        // Остановка по шагам: новых соединений нет, пришедшие показания
+        // разобраны и подтверждены, затем очередь базы дописана и checkpoint
+        const auto shutdown_start = std::chrono::steady_clock::now();
+        loops_drained.wait();
+        if (undrained != 0) {
+            LOG_WARN("{} connections closed with unsent acks after {} ms", undrained.load(), drain_timeout.count());
+        }
+        const size_t queued = data_base.QueueDepth();
+        data_base.Stop();
+        if (snapshot) {
+            try {
+                snapshot->Stop();
+            } catch (const std::exception &ex) {
+                LOG_ERROR("Registry snapshot: {}", ex.what());
+            }
+        }
+        const auto shutdown_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - shutdown_start);
+        LOG_INFO("Shutdown in {} ms: flushed {} queued readings; persisted {}, dropped {}, rejected {}, failed {}",
+                 shutdown_ms.count(), queued, data_base.PersistedCount(), data_base.DroppedCount(),
+                 data_base.RejectedCount(), data_base.FailedCount());
+
     } catch (const std::exception &e) {
-        std::cerr << "Error: " << e.what() << " -> " << strerror(errno) << std::endl;
+        LOG_ERROR("Error: {} -> {}", e.what(), strerror(errno));
+        logging::Flush();
         return 1;
     }
 
-    std::cout << "Server terminates" << std::endl;
+    LOG_INFO("Server terminates");
+    logging::Flush();
 
     return 0;
 }
@@ -0,0 +1,214 @@
+#include "sqlite_storage.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+SqliteStorage::SqliteStorage(DeviceIdTable& ids, const std::string& path, const std::string& synchronous, int cache_size_kib)
+    : ids_(ids) {
+    rc_ = sqlite3_open(path.c_str(), &db_);
+    CheckDbError();
+    Configure(synchronous, cache_size_kib);
+    CreateTable();
+    PrepareStatements();
+    OpenReader(path);
+}
+
+SqliteStorage::~SqliteStorage() {
+    for (auto* stmt : aggregate_stmts_) {
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(read_db_);
+    sqlite3_finalize(insert_stmt_);
+    sqlite3_close(db_);
+}
+
+void SqliteStorage::Configure(const std::string& synchronous, int cache_size_kib) {
+    // WAL: писатель не блокирует читателей, fsync только на checkpoint при synchronous=NORMAL
+    Exec("PRAGMA journal_mode=WAL;");
+    Exec(("PRAGMA synchronous=" + synchronous + ";").c_str());
+    // Читаем итоговое значение: 0 OFF, 1 NORMAL, 2 FULL, 3 EXTRA
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, "PRAGMA synchronous;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        durable_on_write_ = sqlite3_column_int(stmt, 0) >= 2;
+    }
+    sqlite3_finalize(stmt);
+    // Отрицательное значение cache_size задает размер в КиБ, а не в страницах
+    Exec(("PRAGMA cache_size=-" + std::to_string(cache_size_kib) + ";").c_str());
+}
+
+void SqliteStorage::CreateTable(){
+    std::string sql = "CREATE TABLE IF NOT EXISTS sensor_data("
+                      "ID INT PRIMARY KEY, "
+                      "DEVICE_ID    CHAR(50)    NOT NULL, "
+                      "TIMESTAMP    INTEGER    NOT NULL, "
+                      "TEMPERATURE  REAL    NOT NULL, "
+                      "HUMIDITY     REAL    NOT NULL, "
+                      "PRESSURE     REAL    NOT NULL);";
+    rc_ = sqlite3_exec( // int                                          Возврат
+        db_,            // sqlite3*,                                    Открытая база данных
+        sql.c_str(),    // const char *sql,                             SQL-запрос для выполнения
+        NULL,           // int (*callback)(void*,int,char**,char**),    Функция обратного вызова 
+        0,              // void *,                                      1-й аргумент для функции обратного вызова
+        &messaggeError_ // char **errmsg                                Здесь записывается сообщение об ошибке
+    );
+
+    CheckDbError();
+
+    // Запросы по устройству и интервалу времени читают только свои строки
+    Exec("CREATE INDEX IF NOT EXISTS sensor_data_device_time ON sensor_data(DEVICE_ID, TIMESTAMP);");
+}
+
+void SqliteStorage::PrepareStatements() {
+    const char* sql = "INSERT INTO sensor_data (device_id, timestamp, temperature, humidity, pressure) VALUES (?, ?, ?, ?, ?);";
+    rc_ = sqlite3_prepare_v2(db_, sql, -1, &insert_stmt_, nullptr);
+    CheckDbError();
+}
+
+void SqliteStorage::OpenReader(const std::string& path) {
+    if (sqlite3_open_v2(path.c_str(), &read_db_, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        throw std::runtime_error(std::string("sqlite reader: ") + sqlite3_errmsg(read_db_));
+    }
+
+    // Для kLast SQLite берет голые столбцы из строки с MAX(rowid): TIMESTAMP хранится
+    // в секундах и не различает показания одной секунды, а rowid растет в порядке записи
+    static constexpr const char* COLUMNS[] = {
+        "MIN(TEMPERATURE), MIN(HUMIDITY), MIN(PRESSURE)",
+        "MAX(TEMPERATURE), MAX(HUMIDITY), MAX(PRESSURE)",
+        "AVG(TEMPERATURE), AVG(HUMIDITY), AVG(PRESSURE)",
+        "TEMPERATURE, HUMIDITY, PRESSURE, MAX(rowid)",
+    };
+    for (size_t i = 0; i < aggregate_stmts_.size(); ++i) {
+        const std::string sql = std::string("SELECT TIMESTAMP / ?1 AS bucket, COUNT(*), ") + COLUMNS[i] +
+                                " FROM sensor_data WHERE DEVICE_ID = ?2 AND TIMESTAMP BETWEEN ?3 AND ?4"
+                                " GROUP BY bucket ORDER BY bucket;";
+        if (sqlite3_prepare_v2(read_db_, sql.c_str(), -1, &aggregate_stmts_[i], nullptr) != SQLITE_OK) {
+            throw std::runtime_error(std::string("sqlite prepare: ") + sqlite3_errmsg(read_db_));
+        }
+    }
+}
+
+std::vector<AggregatedPoint> SqliteStorage::Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                                      std::chrono::system_clock::time_point to,
+                                                      std::chrono::milliseconds bucket, Aggregation aggregation) const {
+    using namespace std::chrono;
+    // TIMESTAMP хранится в секундах, интервал короче секунды не имеет смысла
+    const int64_t bucket_s = std::max<int64_t>(1, duration_cast<seconds>(bucket).count());
+    const std::string_view device_id = ids_.Name(id);
+
+    std::vector<AggregatedPoint> points;
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    sqlite3_stmt* stmt = aggregate_stmts_[static_cast<size_t>(aggregation)];
+    sqlite3_bind_int64(stmt, 1, bucket_s);
+    sqlite3_bind_text(stmt, 2, device_id.data(), static_cast<int>(device_id.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, duration_cast<seconds>(from.time_since_epoch()).count());
+    sqlite3_bind_int64(stmt, 4, duration_cast<seconds>(to.time_since_epoch()).count());
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        AggregatedPoint point;
+        point.bucket_start_ = system_clock::time_point(seconds(sqlite3_column_int64(stmt, 0) * bucket_s));
+        point.count_ = static_cast<uint64_t>(sqlite3_column_int64(stmt, 1));
+        point.temperature_ = sqlite3_column_double(stmt, 2);
+        point.humidity_ = sqlite3_column_double(stmt, 3);
+        point.pressure_ = sqlite3_column_double(stmt, 4);
+        points.push_back(point);
+    }
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("DB Error: {}", sqlite3_errmsg(read_db_));
+    }
+    sqlite3_reset(stmt);
+    return points;
+}
+
+void SqliteStorage::ScanFrom(std::chrono::system_clock::time_point from,
+                             const std::function<void(const DeviceState&)>& visit) {
+    using namespace std::chrono;
+    std::lock_guard<std::mutex> lock(read_mutex_);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(read_db_, "SELECT DEVICE_ID, TIMESTAMP, TEMPERATURE, HUMIDITY, PRESSURE FROM sensor_data"
+                                     " WHERE TIMESTAMP >= ? ORDER BY rowid;", -1, &stmt, nullptr) != SQLITE_OK) {
+        LOG_ERROR("DB Error: {}", sqlite3_errmsg(read_db_));
+        return;
+    }
+    sqlite3_bind_int64(stmt, 1, duration_cast<seconds>(from.time_since_epoch()).count());
+
+    int rc;
+    DeviceState state;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const auto* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        state.device_id_ = ids_.Intern(std::string_view(name, static_cast<size_t>(sqlite3_column_bytes(stmt, 0))));
+        state.last_update_ = system_clock::time_point(seconds(sqlite3_column_int64(stmt, 1)));
+        state.temperature_ = sqlite3_column_double(stmt, 2);
+        state.humidity_ = sqlite3_column_double(stmt, 3);
+        state.pressure_ = sqlite3_column_double(stmt, 4);
+        visit(state);
+    }
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("DB Error: {}", sqlite3_errmsg(read_db_));
+    }
+    sqlite3_finalize(stmt);
+}
+
+// Весь пакет пишется одной транзакцией: один fsync на пакет вместо одного на строку.
+// Ошибка любой строки откатывает пакет целиком: он не считается записанным.
+bool SqliteStorage::WriteBatch(const std::vector<DeviceState>& batch) {
+    Exec("BEGIN;");
+    if (rc_ != SQLITE_OK) {
+        return false;
+    }
+
+    for (const auto& r : batch) {
+        std::time_t tt = std::chrono::system_clock::to_time_t(r.last_update_);
+        const std::string_view device_id = ids_.Name(r.device_id_);     // Имя нужно только здесь, на границе SQL
+        sqlite3_bind_text(insert_stmt_, 1, device_id.data(), static_cast<int>(device_id.size()), SQLITE_STATIC);
+        sqlite3_bind_int64(insert_stmt_, 2, tt);
+        sqlite3_bind_double(insert_stmt_, 3, r.temperature_);
+        sqlite3_bind_double(insert_stmt_, 4, r.humidity_);
+        sqlite3_bind_double(insert_stmt_, 5, r.pressure_);
+        const bool done = sqlite3_step(insert_stmt_) == SQLITE_DONE;
+        if (!done) {
+            LOG_RATE_LIMITED(LogLevel::kError, 10, "DB Error: {}", sqlite3_errmsg(db_));
+        }
+        sqlite3_reset(insert_stmt_);
+        if (!done) {
+            if (sqlite3_get_autocommit(db_) == 0) {     // Часть ошибок SQLite откатывает сама
+                Exec("ROLLBACK;");
+            }
+            return false;
+        }
+    }
+
+    Exec("COMMIT;");
+    if (rc_ != SQLITE_OK) {
+        if (sqlite3_get_autocommit(db_) == 0) {     // COMMIT не прошел, транзакция еще открыта
+            Exec("ROLLBACK;");
+        }
+        return false;
+    }
+    return true;
+}
+
+void SqliteStorage::Checkpoint() {
+    Exec("PRAGMA wal_checkpoint(TRUNCATE);");
+}
+
+void SqliteStorage::Exec(const char* sql) {
+    rc_ = sqlite3_exec(db_, sql, nullptr, nullptr, &messaggeError_);
+    if (rc_ != SQLITE_OK) {
+        LOG_ERROR("DB Error: {}", messaggeError_ ? messaggeError_ : sqlite3_errmsg(db_));
+        sqlite3_free(messaggeError_);
+        messaggeError_ = nullptr;
+    }
+}
+
+void SqliteStorage::CheckDbError() {
+    if (rc_) {
+        // Show an error message
+        LOG_ERROR("DB Error: {}", sqlite3_errmsg(db_));
+
+        sqlite3_close(db_);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "intern_table.h"
+#include "storage.h"
+
+#include <array>
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+
+// Построчное хранение в таблице sensor_data базы SQLite
+class SqliteStorage : public Storage {
+public:
+    SqliteStorage(DeviceIdTable& ids, const std::string& path, const std::string& synchronous, int cache_size_kib);
+    ~SqliteStorage() override;
+
+    SqliteStorage(const SqliteStorage&) = delete;
+    SqliteStorage &operator=(const SqliteStorage&) = delete;
+
+    bool WriteBatch(const std::vector<DeviceState>& batch) override;
+
+    // Переносит WAL в основной файл базы и усекает его
+    void Checkpoint() override;
+
+    // В режиме WAL каждую транзакцию синхронизирует только synchronous=FULL или EXTRA
+    bool DurableOnWrite() const override { return durable_on_write_; }
+
+    // Полный просмотр sensor_data по TIMESTAMP: только при запуске
+    void ScanFrom(std::chrono::system_clock::time_point from,
+                  const std::function<void(const DeviceState&)>& visit) override;
+
+    // GROUP BY по индексу (DEVICE_ID, TIMESTAMP) на отдельном соединении для чтения
+    std::vector<AggregatedPoint> Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                           std::chrono::system_clock::time_point to,
+                                           std::chrono::milliseconds bucket, Aggregation aggregation) const override;
+
+private:
+    DeviceIdTable& ids_;
+    sqlite3* db_;
+    sqlite3_stmt* insert_stmt_ = nullptr;   // Готовится один раз, переиспользуется для всех строк
+    // В режиме WAL чтение на своем соединении не ждет писателя
+    sqlite3* read_db_ = nullptr;
+    std::array<sqlite3_stmt*, 4> aggregate_stmts_ {};   // По одному на Aggregation
+    mutable std::mutex read_mutex_;
+    bool durable_on_write_ = false;
+    int rc_;                      // Сохраняем результат открытия базы
+    char* messaggeError_ = nullptr;
+
+    void Configure(const std::string& synchronous, int cache_size_kib);
+    void CreateTable();
+    void PrepareStatements();
+    void OpenReader(const std::string& path);
+    void Exec(const char* sql);
+    void CheckDbError();
+};
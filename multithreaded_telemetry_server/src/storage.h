@@ -0,0 +1,55 @@
+#pragma once
+
+#include "device.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Агрегат показаний внутри интервала
+enum class Aggregation {
+    kMin,
+    kMax,
+    kAvg,
+    kLast       // Показание с наибольшей меткой времени
+};
+
+// Один интервал результата запроса: значения всех трех величин по выбранному агрегату
+struct AggregatedPoint {
+    std::chrono::system_clock::time_point bucket_start_;
+    uint64_t count_ = 0;
+    double temperature_ = 0.0;
+    double humidity_ = 0.0;
+    double pressure_ = 0.0;
+};
+
+// Хранилище показаний, в которое DataBase::WorkerThread пишет пакеты.
+// WriteBatch вызывается только из потока писателя, Aggregate - из любого.
+class Storage {
+public:
+    virtual ~Storage() = default;
+
+    // true, если пакет зафиксирован целиком
+    virtual bool WriteBatch(const std::vector<DeviceState>& batch) = 0;
+
+    // При остановке, из потока писателя: довести записанное до файлов на диске
+    virtual void Checkpoint() {}
+
+    // true, если пакет на диске, как только WriteBatch вернул true; иначе
+    // это гарантирует только Checkpoint
+    virtual bool DurableOnWrite() const { return false; }
+
+    // Все показания с меткой времени не раньше from, в любом порядке. Только
+    // поток писателя при запуске: по ним заново собираются открытые
+    // интервалы свертки, которые до падения жили только в памяти.
+    virtual void ScanFrom(std::chrono::system_clock::time_point from,
+                          const std::function<void(const DeviceState&)>& visit) = 0;
+
+    // Показания устройства в [from, to], сгруппированные в интервалы
+    // длиной bucket от начала эпохи, по возрастанию. Группировка
+    // выполняется внутри хранилища, сырые показания наружу не выходят.
+    virtual std::vector<AggregatedPoint> Aggregate(DeviceId id, std::chrono::system_clock::time_point from,
+                                                   std::chrono::system_clock::time_point to,
+                                                   std::chrono::milliseconds bucket, Aggregation aggregation) const = 0;
+};
@@ -0,0 +1,314 @@
+#include "subscription.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <poll.h>
+
+namespace {
+
+constexpr int POLL_TIMEOUT_MS = 50;         // Как часто изменения уходят подписчикам
+constexpr size_t MAX_REQUEST = 4096;
+
+std::vector<std::string> SplitList(std::string_view list) {
+    std::vector<std::string> result;
+    while (!list.empty()) {
+        const size_t comma = list.find(',');
+        if (comma != 0) {
+            result.emplace_back(list.substr(0, comma));
+        }
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+    }
+    return result;
+}
+
+template <typename T>
+T ParseNumber(std::string_view name, std::string_view value) {
+    T result {};
+    const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc() || ptr != value.data() + value.size()) {
+        throw std::invalid_argument("bad " + std::string(name) + ": " + std::string(value));
+    }
+    return result;
+}
+
+} // namespace
+
+SubscriptionFilter SubscriptionFilter::Parse(std::string_view params) {
+    SubscriptionFilter filter;
+    while (!params.empty()) {
+        const size_t amp = params.find('&');
+        const std::string_view pair = params.substr(0, amp);
+        params = amp == std::string_view::npos ? std::string_view() : params.substr(amp + 1);
+
+        const size_t eq = pair.find('=');
+        const std::string_view key = pair.substr(0, eq);
+        const std::string_view value = eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+
+        if (key == "devices") {
+            filter.devices_ = SplitList(value);
+        } else if (key == "prefixes") {
+            filter.prefixes_ = SplitList(value);
+        } else if (key == "deadband") {
+            filter.deadband_ = ParseNumber<double>(key, value);
+            if (!(filter.deadband_ >= 0.0)) {
+                throw std::invalid_argument("deadband must be >= 0");
+            }
+        } else if (key == "capacity") {
+            filter.capacity_ = ParseNumber<size_t>(key, value);
+            if (filter.capacity_ == 0 || filter.capacity_ > Subscription::NOT_QUEUED) {
+                throw std::invalid_argument("bad capacity: " + std::string(value));
+            }
+        } else {
+            throw std::invalid_argument("unknown parameter: " + std::string(key));
+        }
+    }
+    if (filter.devices_.empty() && filter.prefixes_.empty()) {
+        throw std::invalid_argument("need devices= or prefixes=");
+    }
+    return filter;
+}
+
+size_t Subscription::Drain(std::vector<DeviceState>& out) {
+    out.clear();
+    std::lock_guard lock(mutex_);
+    out.swap(pending_);
+    for (const auto& state : out) {
+        devices_[state.device_id_].queued_ = NOT_QUEUED;
+    }
+    return out.size();
+}
+
+bool Subscription::Matches(std::string_view name) const {
+    return std::find(filter_.devices_.begin(), filter_.devices_.end(), name) != filter_.devices_.end() ||
+           std::any_of(filter_.prefixes_.begin(), filter_.prefixes_.end(),
+                       [name](const std::string& prefix) { return name.starts_with(prefix); });
+}
+
+void Subscription::Offer(const DeviceState& state, const DeviceIdTable& ids) {
+    const double values[3] = {state.temperature_, state.humidity_, state.pressure_};
+
+    std::lock_guard lock(mutex_);
+    auto [it, inserted] = devices_.try_emplace(state.device_id_);
+    DeviceSlot& slot = it->second;
+    if (inserted) {
+        slot.matches_ = Matches(ids.Name(state.device_id_));
+    }
+    if (!slot.matches_) {
+        return;
+    }
+
+    if (slot.has_last_) {
+        bool changed = false;
+        for (size_t i = 0; i < 3; ++i) {
+            changed |= std::abs(values[i] - slot.last_[i]) > filter_.deadband_;
+        }
+        if (!changed) {
+            return;
+        }
+    }
+
+    if (slot.queued_ != NOT_QUEUED) {
+        pending_[slot.queued_] = state;
+        coalesced_.fetch_add(1, std::memory_order_relaxed);
+        metrics::Increment(metrics::Counter::kFeedCoalesced);
+    } else if (pending_.size() < filter_.capacity_) {
+        slot.queued_ = static_cast<uint32_t>(pending_.size());
+        pending_.push_back(state);
+    } else {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        metrics::Increment(metrics::Counter::kFeedDropped);
+        return;
+    }
+    std::copy(std::begin(values), std::end(values), slot.last_);
+    slot.has_last_ = true;
+}
+
+std::shared_ptr<Subscription> SubscriptionHub::Subscribe(SubscriptionFilter filter) {
+    std::unique_lock lock(mutex_);
+    auto subscription = std::make_shared<Subscription>(next_id_++, std::move(filter));
+    subscriptions_.push_back(subscription);
+    count_.store(subscriptions_.size(), std::memory_order_relaxed);
+    return subscription;
+}
+
+void SubscriptionHub::Unsubscribe(const std::shared_ptr<Subscription>& subscription) {
+    std::unique_lock lock(mutex_);
+    std::erase(subscriptions_, subscription);
+    count_.store(subscriptions_.size(), std::memory_order_relaxed);
+}
+
+FeedServer::FeedServer(const char *port, SubscriptionHub& hub, const DeviceIdTable& ids, const std::atomic<bool>& stop)
+    : hub_(hub), ids_(ids), stop_(stop) {
+
+    AddrInfo addr("127.0.0.1", port, AI_PASSIVE);
+    listener_.Reset(socket(addr.Get()->ai_family, addr.Get()->ai_socktype | SOCK_NONBLOCK, addr.Get()->ai_protocol));
+
+    if (listener_.GetFd() < 0) {
+        throw std::runtime_error("socket");
+    }
+
+    int yes = 1;
+    setsockopt(listener_.GetFd(), SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if (bind(listener_.GetFd(), addr.Get()->ai_addr, addr.Get()->ai_addrlen) < 0) {
+        throw std::runtime_error("bind");
+    }
+
+    if (listen(listener_.GetFd(), SOMAXCONN) < 0) {
+        throw std::runtime_error("listen");
+    }
+
+    thread_ = std::thread(&FeedServer::Serve, this);
+}
+
+FeedServer::~FeedServer() {
+    thread_.join();
+}
+
+void FeedServer::Serve() {
+    std::vector<std::unique_ptr<Client>> clients;
+    std::vector<struct pollfd> fds;
+    std::vector<DeviceState> changes;
+
+    while (!stop_) {
+        fds.clear();
+        fds.push_back({listener_.GetFd(), POLLIN, 0});
+        for (const auto& client : clients) {
+            fds.push_back({client->socket_.GetFd(), static_cast<short>(client->out_.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        }
+        if (poll(fds.data(), fds.size(), POLL_TIMEOUT_MS) < 0 && errno != EINTR) {
+            LOG_ERROR("Feed poll: {}", strerror(errno));
+            return;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            Accept(clients);
+        }
+        for (size_t i = 0; i + 1 < fds.size(); ++i) {
+            Client& client = *clients[i];
+            bool alive = true;
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                alive = Read(client);
+            }
+            // Новые изменения берутся, только пока клиент успевает читать:
+            // остальное копится в его очереди с заменой по устройству
+            if (alive && client.subscription_ && client.out_.size() < MAX_PENDING_BYTES) {
+                Fill(client, changes);
+            }
+            if (alive) {
+                alive = Flush(client);
+            }
+            if (!alive || (client.closing_ && client.out_.empty())) {
+                if (client.subscription_) {
+                    hub_.Unsubscribe(client.subscription_);
+                    client.subscription_.reset();
+                }
+                client.socket_.Reset();
+            }
+        }
+        std::erase_if(clients, [](const auto& client) { return client->socket_.GetFd() < 0; });
+    }
+
+    for (auto& client : clients) {
+        if (client->subscription_) {
+            hub_.Unsubscribe(client->subscription_);
+        }
+    }
+}
+
+void FeedServer::Accept(std::vector<std::unique_ptr<Client>>& clients) {
+    while (true) {
+        Socket socket(accept4(listener_.GetFd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+        if (socket.GetFd() < 0) {
+            return;
+        }
+        if (clients.size() >= MAX_CLIENTS) {
+            LOG_RATE_LIMITED(LogLevel::kWarn, 1, "Feed: too many subscribers");
+            continue;
+        }
+        auto client = std::make_unique<Client>();
+        client->socket_ = std::move(socket);
+        clients.push_back(std::move(client));
+    }
+}
+
+// Первая строка - подписка; после нее входящие данные не нужны, читаем
+// только чтобы заметить закрытие. false - соединение закрыто.
+bool FeedServer::Read(Client& client) {
+    char buffer[1024];
+    while (true) {
+        const ssize_t n = recv(client.socket_.GetFd(), buffer, sizeof(buffer), 0);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        if (client.subscription_ || client.closing_) {
+            continue;
+        }
+
+        client.in_.append(buffer, static_cast<size_t>(n));
+        const size_t end = client.in_.find('\n');
+        if (end == std::string::npos) {
+            if (client.in_.size() > MAX_REQUEST) {
+                client.out_ += "Err request is too long\n";
+                client.closing_ = true;
+            }
+            continue;
+        }
+
+        std::string_view request(client.in_.data(), end);
+        if (request.ends_with('\r')) {
+            request.remove_suffix(1);
+        }
+        try {
+            client.subscription_ = hub_.Subscribe(SubscriptionFilter::Parse(request));
+            client.out_ += "Ok\n";
+            LOG_INFO("Feed subscriber {}: {}", client.subscription_->Id(), request);
+        } catch (const std::invalid_argument& ex) {
+            client.out_ += fmt::format("Err {}\n", ex.what());
+            client.closing_ = true;
+        }
+        client.in_.clear();
+        client.in_.shrink_to_fit();
+    }
+}
+
+bool FeedServer::Flush(Client& client) {
+    size_t sent_total = 0;
+    while (sent_total < client.out_.size()) {
+        const ssize_t sent = send(client.socket_.GetFd(), client.out_.data() + sent_total,
+                                  client.out_.size() - sent_total, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            break;
+        }
+        sent_total += static_cast<size_t>(sent);
+    }
+    client.out_.erase(0, sent_total);
+    return true;
+}
+
+void FeedServer::Fill(Client& client, std::vector<DeviceState>& changes) {
+    if (client.subscription_->Drain(changes) == 0) {
+        return;
+    }
+    auto out = std::back_inserter(client.out_);
+    for (const auto& state : changes) {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(state.last_update_.time_since_epoch()).count();
+        fmt::format_to(out, "{}:temp={},hum={},press={},ts={}\n", ids_.Name(state.device_id_),
+                       state.temperature_, state.humidity_, state.pressure_, ms);
+    }
+    metrics::Increment(metrics::Counter::kFeedDeltasSent, changes.size());
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "device.h"
+#include "intern_table.h"
+#include "socket_raii.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Подписка на изменения показаний: точные имена устройств и префиксы имен.
+// Изменение доставляется, если хотя бы одно значение ушло от последнего
+// поставленного в очередь дальше deadband.
+struct SubscriptionFilter {
+    std::vector<std::string> devices_;
+    std::vector<std::string> prefixes_;
+    double deadband_ = 0.0;
+    size_t capacity_ = 4096;            // Устройств с недоставленными изменениями
+
+    // devices=a,b&prefixes=floor1_,floor2_&deadband=0.5&capacity=1024.
+    // std::invalid_argument, если параметр неверен или не задано ни одного устройства.
+    static SubscriptionFilter Parse(std::string_view params);
+};
+
+// Очередь изменений одного подписчика. Ограничена числом устройств, а не
+// изменений: новое изменение устройства, которое уже ждет доставки, заменяет
+// прежнее. Медленный подписчик получает последние значения, а прием не ждет
+// его дольше короткой блокировки очереди. Если очередь заполнена, изменение
+// нового устройства отбрасывается; опорное значение deadband при этом не
+// сдвигается, и следующее изменение устройства дойдет, когда место появится.
+class Subscription {
+public:
+    static constexpr uint32_t NOT_QUEUED = static_cast<uint32_t>(-1);
+
+    Subscription(uint64_t id, SubscriptionFilter filter) : id_(id), filter_(std::move(filter)) {}
+
+    Subscription(const Subscription&) = delete;
+    Subscription &operator=(const Subscription&) = delete;
+
+    uint64_t Id() const { return id_; }
+
+    // Забирает накопленные изменения, не больше одного на устройство.
+    // out очищается; возвращает число изменений.
+    size_t Drain(std::vector<DeviceState>& out);
+
+    size_t DroppedCount() const { return dropped_.load(std::memory_order_relaxed); }
+    size_t CoalescedCount() const { return coalesced_.load(std::memory_order_relaxed); }
+
+private:
+    friend class SubscriptionHub;
+
+    // Решение о совпадении принимается один раз на устройство
+    struct DeviceSlot {
+        bool matches_ = false;
+        bool has_last_ = false;
+        double last_[3] = {};           // Последнее поставленное в очередь значение
+        uint32_t queued_ = NOT_QUEUED;  // Позиция в pending_
+    };
+
+    const uint64_t id_;
+    const SubscriptionFilter filter_;
+    std::mutex mutex_;
+    std::unordered_map<DeviceId, DeviceSlot> devices_;
+    std::vector<DeviceState> pending_;
+    std::atomic<size_t> dropped_{0};
+    std::atomic<size_t> coalesced_{0};
+
+    // Из потоков приема
+    void Offer(const DeviceState& state, const DeviceIdTable& ids);
+    bool Matches(std::string_view name) const;
+};
+
+// Подписки всех клиентов. Publish вызывается на каждое обновление реестра:
+// без подписчиков это одна атомарная загрузка.
+class SubscriptionHub {
+public:
+    explicit SubscriptionHub(const DeviceIdTable& ids) : ids_(ids) {}
+
+    SubscriptionHub(const SubscriptionHub&) = delete;
+    SubscriptionHub &operator=(const SubscriptionHub&) = delete;
+
+    std::shared_ptr<Subscription> Subscribe(SubscriptionFilter filter);
+    void Unsubscribe(const std::shared_ptr<Subscription>& subscription);
+
+    void Publish(const DeviceState& state) {
+        if (count_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        std::shared_lock lock(mutex_);
+        for (const auto& subscription : subscriptions_) {
+            subscription->Offer(state, ids_);
+        }
+    }
+
+    size_t Count() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    const DeviceIdTable& ids_;
+    mutable std::shared_mutex mutex_;
+    std::vector<std::shared_ptr<Subscription>> subscriptions_;
+    std::atomic<size_t> count_{0};
+    uint64_t next_id_ = 1;
+};
+
+// Поток доставки на отдельном локальном порту. Клиент присылает одну строку
+// с параметрами SubscriptionFilter::Parse и получает "Ok", затем изменения
+// строками в формате показаний с меткой времени:
+// "device_1:temp=23.5,hum=60,press=1013,ts=<мс от эпохи>". Неверная строка
+// подписки получает "Err <причина>" и закрытие соединения.
+class FeedServer {
+public:
+    static constexpr size_t MAX_CLIENTS = 256;
+    static constexpr size_t MAX_PENDING_BYTES = 64 * 1024;     // Не отправлено клиенту
+
+    FeedServer(const char *port, SubscriptionHub& hub, const DeviceIdTable& ids, const std::atomic<bool>& stop);
+    ~FeedServer();
+
+    FeedServer(const FeedServer&) = delete;
+    FeedServer &operator=(const FeedServer&) = delete;
+
+private:
+    struct Client {
+        Socket socket_;
+        std::string in_;                // Строка подписки, пока не пришла целиком
+        std::string out_;
+        std::shared_ptr<Subscription> subscription_;
+        bool closing_ = false;          // Досылаем out_ и закрываем
+    };
+
+    Socket listener_;
+    SubscriptionHub& hub_;
+    const DeviceIdTable& ids_;
+    const std::atomic<bool>& stop_;
+    std::thread thread_;
+
+    void Serve();
+    void Accept(std::vector<std::unique_ptr<Client>>& clients);
+    bool Read(Client& client);
+    bool Flush(Client& client);
+    void Fill(Client& client, std::vector<DeviceState>& changes);
+};
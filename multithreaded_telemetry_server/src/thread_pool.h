@@ -1,71 +1,405 @@
 
 #pragma once
 
+#include "cache_line.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <functional>
-#include <iostream>
+#include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <random>
 #include <thread>
-#include <future>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+// ======================= ЗАДАЧА С ВНУТРЕННИМ БУФЕРОМ =======================
+
+// Стирание типа для move-only вызываемого объекта. Небольшие лямбды
+// (до INLINE_SIZE байт) хранятся прямо внутри задачи, без обращения к куче.
+class SmallTask {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    SmallTask() = default;
+
+    template <typename F, typename Fn = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<Fn, SmallTask>>>
+    SmallTask(F&& f) {
+        if constexpr (sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible_v<Fn>) {
+            new (storage_) Fn(std::forward<F>(f));
+            ops_ = &InlineOps<Fn>::ops;
+        } else {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+            ops_ = &HeapOps<Fn>::ops;
+        }
+    }
+
+    SmallTask(SmallTask&& other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(other.storage_, storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    SmallTask &operator=(SmallTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(other.storage_, storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    SmallTask(const SmallTask&) = delete;
+    SmallTask &operator=(const SmallTask&) = delete;
+
+    ~SmallTask() { Reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() { ops_->invoke(storage_); }
+
+    void Reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
 
+private:
+    struct Ops {
+        void (*invoke)(void *storage);
+        void (*move)(void *from, void *to);
+        void (*destroy)(void *storage);
+    };
+
+    template <typename Fn>
+    struct InlineOps {
+        static constexpr Ops ops = {
+            [](void *s) { (*static_cast<Fn*>(s))(); },
+            [](void *from, void *to) {
+                new (to) Fn(std::move(*static_cast<Fn*>(from)));
+                static_cast<Fn*>(from)->~Fn();
+            },
+            [](void *s) { static_cast<Fn*>(s)->~Fn(); },
+        };
+    };
+
+    template <typename Fn>
+    struct HeapOps {
+        static constexpr Ops ops = {
+            [](void *s) { (**static_cast<Fn**>(s))(); },
+            [](void *from, void *to) { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); },
+            [](void *s) { delete *static_cast<Fn**>(s); },
+        };
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+    const Ops *ops_ = nullptr;
+};
+
+// ======================= ДЕК ЧЕЙЗА-ЛЕВА =======================
+
+// Дек фиксированной емкости: владелец кладет и забирает с нижнего конца
+// без блокировок, остальные потоки крадут с верхнего через CAS.
+// Реализация по Lê, Pop, Cohen, Zappa Nardelli, "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (PPoPP 2013).
+template <typename T>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    explicit WorkStealingDeque(size_t capacity = 4096)
+        : buffer_(new std::atomic<T>[capacity]), mask_(capacity - 1) {}
+
+    // Только поток-владелец. false, если дек заполнен.
+    bool Push(T value) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t > static_cast<int64_t>(mask_)) {
+            return false;
+        }
+        buffer_[b & mask_].store(value, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Только поток-владелец
+    bool Pop(T& value) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = buffer_[b & mask_].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Последний элемент: соревнуемся с ворами
+            const bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                          std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Любой поток
+    bool Steal(T& value) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        value = buffer_[t & mask_].load(std::memory_order_relaxed);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
+    }
+
+    bool Empty() const {
+        return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::unique_ptr<std::atomic<T>[]> buffer_;
+    const size_t mask_;
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom_{0};
+};
+
+// ======================= ПУЛ ПОТОКОВ =======================
+
+// Пул с кражей работы. У каждого потока свой дек Чейза-Лева: задачи,
+// порожденные внутри пула, кладутся в дек текущего потока, внешние -
+// в общую очередь. Свободный поток сначала берет свое, затем из общей
+// очереди, затем крадет у соседей. Узлы задач переиспользуются через
+// кэш потока, поэтому enqueue небольшой лямбды не обращается к malloc.
 class ThreadPool {
 public:
-    ThreadPool(size_t num_threads = std::thread::hardware_concurrency())
+    ThreadPool(size_t num_threads = std::thread::hardware_concurrency(), bool pin_threads = false)
+        : workers_(num_threads)
     {
         for (size_t i = 0; i < num_threads; ++i) {
-            threads_.emplace_back([this] {
-                while (true) {
-                    std::packaged_task<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex_);
-                        cv_.wait(lock, [this] {
-                            return !tasks_.empty() || stop_;
-                        });
-
-                        if (stop_ && tasks_.empty()) {
-                            return;
-                        }
-
-                        task = std::move(tasks_.front());
-                        tasks_.pop();
-                    }
-
-                    task();
+            workers_[i].thread_ = std::thread([this, i, pin_threads] {
+                if (pin_threads) {
+                    PinToCpu(i);
                 }
+                WorkerLoop(i);
             });
         }
     }
 
     ~ThreadPool() {
         {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
             stop_ = true;
         }
 
         cv_.notify_all();
 
-        for (auto& thread : threads_) {
+        for (auto& worker : workers_) {
             //std::cerr << "Join " << thread.get_id() << std::endl;
-            thread.join();
+            worker.thread_.join();
         }
     }
 
     template <typename F>
     void enqueue(F&& f) {
-        std::packaged_task<void()> task(std::forward<F>(f));
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            tasks_.emplace(move(task));
-        }
-        cv_.notify_one();
+        Schedule(NewNode(SmallTask(std::forward<F>(f))));
+    }
+
+    // Как enqueue, но возвращает future с результатом или исключением задачи
+    template <typename F>
+    auto submit(F&& f) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        std::packaged_task<Result()> task(std::forward<F>(f));
+        auto future = task.get_future();
+        enqueue(std::move(task));
+        return future;
     }
 
 private:
-    std::vector<std::thread> threads_;
-    std::queue<std::packaged_task<void()>> tasks_;
-    std::mutex queue_mutex_;
+    struct TaskNode {
+        SmallTask task_;
+        TaskNode *next_ = nullptr;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Worker {
+        WorkStealingDeque<TaskNode*> deque_;
+        std::thread thread_;
+    };
+
+    // Кэш свободных узлов потока. Узел может освободиться в другом потоке,
+    // чем был создан, поэтому размер кэша ограничен.
+    struct NodeCache {
+        static constexpr size_t MAX_SIZE = 1024;
+        TaskNode *head_ = nullptr;
+        size_t size_ = 0;
+
+        ~NodeCache() {
+            while (head_) {
+                delete std::exchange(head_, head_->next_);
+            }
+        }
+    };
+
+    static NodeCache& LocalNodeCache() {
+        static thread_local NodeCache cache;
+        return cache;
+    }
+
+    // Индекс текущего потока в пуле или -1 для внешних потоков
+    static const ThreadPool*& CurrentPool() {
+        static thread_local const ThreadPool *pool = nullptr;
+        return pool;
+    }
+    static size_t& CurrentIndex() {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    std::vector<Worker> workers_;
+
+    std::mutex global_mutex_;
+    std::deque<TaskNode*> global_;          // Задачи от потоков вне пула
+
+    std::mutex sleep_mutex_;
     std::condition_variable cv_;
+    std::atomic<size_t> sleeping_{0};
+    std::atomic<bool> stop_{false};
+
+    static TaskNode *NewNode(SmallTask&& task) {
+        NodeCache& cache = LocalNodeCache();
+        TaskNode *node;
+        if (cache.head_) {
+            node = std::exchange(cache.head_, cache.head_->next_);
+            --cache.size_;
+        } else {
+            node = new TaskNode;
+        }
+        node->task_ = std::move(task);
+        node->next_ = nullptr;
+        return node;
+    }
 
-    bool stop_ = false;
-};
\ No newline at end of file
+    static void FreeNode(TaskNode *node) {
+        node->task_.Reset();
+        NodeCache& cache = LocalNodeCache();
+        if (cache.size_ >= NodeCache::MAX_SIZE) {
+            delete node;
+            return;
+        }
+        node->next_ = cache.head_;
+        cache.head_ = node;
+        ++cache.size_;
+    }
+
+    void Schedule(TaskNode *node) {
+        if (CurrentPool() != this || !workers_[CurrentIndex()].deque_.Push(node)) {
+            std::lock_guard<std::mutex> lock(global_mutex_);
+            global_.push_back(node);
+        }
+        // Пара к ++sleeping_ в WorkerLoop: либо спящий увидит задачу, либо мы увидим спящего
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed) != 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            cv_.notify_one();
+        }
+    }
+
+    TaskNode *FindTask(size_t index, std::minstd_rand& rng) {
+        TaskNode *node = nullptr;
+        if (workers_[index].deque_.Pop(node)) {
+            return node;
+        }
+        {
+            std::lock_guard<std::mutex> lock(global_mutex_);
+            if (!global_.empty()) {
+                node = global_.front();
+                global_.pop_front();
+                return node;
+            }
+        }
+        // Крадем у соседей, начиная со случайного
+        const size_t count = workers_.size();
+        const size_t start = rng();
+        for (size_t i = 0; i < count; ++i) {
+            const size_t victim = (start + i) % count;
+            if (victim != index && workers_[victim].deque_.Steal(node)) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    bool HasWork() {
+        {
+            std::lock_guard<std::mutex> lock(global_mutex_);
+            if (!global_.empty()) {
+                return true;
+            }
+        }
+        for (const auto& worker : workers_) {
+            if (!worker.deque_.Empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t index) {
+        CurrentPool() = this;
+        CurrentIndex() = index;
+        std::minstd_rand rng(static_cast<unsigned>(index + 1));
+
+        while (true) {
+            if (TaskNode *node = FindTask(index, rng)) {
+                try {
+                    node->task_();
+                } catch (const std::exception &ex) {
+                    LOG_ERROR("Task: {}", ex.what());
+                }
+                FreeNode(node);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            ++sleeping_;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // Перепроверяем под мьютексом сна: Schedule будит только под ним
+            cv_.wait(lock, [this] { return stop_ || HasWork(); });
+            --sleeping_;
+            if (stop_ && !HasWork()) {
+                return;
+            }
+        }
+    }
+
+    static void PinToCpu(size_t index) {
+        const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+};
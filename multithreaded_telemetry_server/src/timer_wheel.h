@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Иерархическое колесо таймеров: LEVELS уровней по SLOTS слотов, время
+// измеряется целыми тиками. Таймер кладется на уровень старшей группы бит,
+// в которой его срок отличается от текущего тика, поэтому постановка - O(1),
+// а при переходе через границу уровня слот каскадом опускается ниже.
+// Отмены нет: владелец, получив таймер, сам проверяет, актуален ли он,
+// и при необходимости ставит заново. Не потокобезопасно.
+template <typename T>
+class TimerWheel {
+public:
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t{1} << SLOT_BITS;
+    static constexpr size_t LEVELS = 4;     // 64^4 тиков, дальше - список overflow_
+
+    explicit TimerWheel(uint64_t now = 0) : now_(now) {}
+
+    uint64_t Now() const { return now_; }
+    size_t Size() const { return size_; }
+
+    // Просроченный срок срабатывает на следующем тике
+    void Schedule(uint64_t deadline, T value) {
+        ++size_;
+        Place(Timer{std::max(deadline, now_ + 1), std::move(value)});
+    }
+
+    // Продвигает колесо до тика now и вызывает fire(T) для каждого
+    // сработавшего таймера. fire может ставить новые таймеры.
+    template <typename F>
+    void Advance(uint64_t now, F&& fire) {
+        while (now_ < now) {
+            ++now_;
+            Cascade();
+
+            auto& slot = slots_[0][now_ & (SLOTS - 1)];
+            fired_.swap(slot);
+            size_ -= fired_.size();
+            for (auto& timer : fired_) {
+                fire(std::move(timer.value_));
+            }
+            fired_.clear();
+        }
+    }
+
+private:
+    struct Timer {
+        uint64_t deadline_;
+        T value_;
+    };
+
+    std::array<std::array<std::vector<Timer>, SLOTS>, LEVELS> slots_;
+    std::vector<Timer> overflow_;
+    std::vector<Timer> fired_;
+    uint64_t now_;
+    size_t size_ = 0;
+
+    void Place(Timer&& timer) {
+        const uint64_t diff = timer.deadline_ ^ now_;
+        size_t level = 0;
+        while (level < LEVELS && (diff >> (SLOT_BITS * (level + 1))) != 0) {
+            ++level;
+        }
+        if (level == LEVELS) {
+            overflow_.push_back(std::move(timer));
+            return;
+        }
+        slots_[level][(timer.deadline_ >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(std::move(timer));
+    }
+
+    // На границе уровня его текущий слот раскладывается по нижним уровням,
+    // начиная с самого старшего пересеченного
+    void Cascade() {
+        size_t top = 0;
+        while (top < LEVELS && (now_ & ((uint64_t{1} << (SLOT_BITS * (top + 1))) - 1)) == 0) {
+            ++top;
+        }
+        if (top == LEVELS) {
+            Redistribute(overflow_);
+            top = LEVELS - 1;
+        }
+        for (size_t level = top; level >= 1; --level) {
+            Redistribute(slots_[level][(now_ >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+        }
+    }
+
+    void Redistribute(std::vector<Timer>& timers) {
+        std::vector<Timer> moved;
+        moved.swap(timers);
+        for (auto& timer : moved) {
+            Place(std::move(timer));
+        }
+    }
+};
@@ -0,0 +1,285 @@
+#include "uring_loop.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::chrono::milliseconds WAIT_TIMEOUT{100};     // Как часто проверяем флаг остановки
+constexpr std::chrono::milliseconds FORCE_CLOSE_TIMEOUT{100};
+constexpr uint16_t BUFFER_GROUP = 0;
+constexpr unsigned OP_SHIFT = 56;
+
+uint64_t UserData(uint8_t op, uint64_t id) {
+    return (static_cast<uint64_t>(op) << OP_SHIFT) | id;
+}
+
+} // namespace
+
+UringLoop::UringLoop(const char *port, DataHandler handler)
+    : listener_(ListenSocket(port)), handler_(std::move(handler)), ring_(RING_ENTRIES),
+      buffers_(ring_, BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE) {
+}
+
+void UringLoop::Run(const std::atomic<bool>& stop) {
+    ring_.Enable();
+    ArmAccept();
+    while (!stop) {
+        Poll(WAIT_TIMEOUT);
+    }
+}
+
+size_t UringLoop::Drain(std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    draining_ = true;
+
+    // Ядро держит ссылку на слушающий сокет, пока accept не отменен
+    if (accepting_) {
+        struct io_uring_sqe *sqe = Sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UserData(static_cast<uint8_t>(Op::kAccept), 0);
+        sqe->user_data = UserData(static_cast<uint8_t>(Op::kCancel), 0);
+    }
+    listener_.Reset();
+
+    // Разбираем уже пришедшие данные, затем только досылаем подтверждения
+    Poll(std::chrono::milliseconds(0));
+    for (auto& [id, peer] : peers_) {
+        StartClose(*peer);
+    }
+    Service();
+    while (!peers_.empty()) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            break;
+        }
+        Poll(std::min(left, WAIT_TIMEOUT));
+    }
+
+    // Оставшиеся закрываем принудительно: send и recv завершатся с ошибкой,
+    // после чего буферы соединений можно освободить
+    const size_t undrained = peers_.size();
+    for (auto& [id, peer] : peers_) {
+        shutdown(peer->conn_.socket_.GetFd(), SHUT_RDWR);
+    }
+    const auto force_deadline = std::chrono::steady_clock::now() + FORCE_CLOSE_TIMEOUT;
+    while (!peers_.empty() && std::chrono::steady_clock::now() < force_deadline) {
+        Poll(std::chrono::milliseconds(10));
+    }
+    peers_.clear();
+    return undrained;
+}
+
+struct io_uring_sqe *UringLoop::Sqe() {
+    struct io_uring_sqe *sqe = ring_.GetSqe();
+    if (sqe == nullptr) {
+        // Очередь отправки заполнена: отдаем ядру накопленное
+        ring_.Submit(0);
+        sqe = ring_.GetSqe();
+        if (sqe == nullptr) {
+            throw std::runtime_error("io_uring: submission queue is full");
+        }
+    }
+    return sqe;
+}
+
+void UringLoop::ArmAccept() {
+    struct io_uring_sqe *sqe = Sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener_.GetFd();
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = UserData(static_cast<uint8_t>(Op::kAccept), 0);
+    accepting_ = true;
+}
+
+void UringLoop::ArmRecv(Peer& peer) {
+    struct io_uring_sqe *sqe = Sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = peer.conn_.socket_.GetFd();
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffers_.Group();
+    sqe->user_data = UserData(static_cast<uint8_t>(Op::kRecv), peer.id_);
+    peer.recv_armed_ = true;
+}
+
+void UringLoop::Touch(Peer& peer) {
+    if (!peer.queued_) {
+        peer.queued_ = true;
+        touched_.push_back(&peer);
+    }
+}
+
+void UringLoop::StartClose(Peer& peer) {
+    peer.closing_ = true;
+    Touch(peer);
+}
+
+// Один io_uring_enter: отправка накопленных SQE и ожидание завершений
+void UringLoop::Poll(std::chrono::milliseconds timeout) {
+    if (!ring_.Submit(1, timeout)) {
+        throw std::runtime_error(std::string("io_uring_enter: ") + strerror(errno));
+    }
+    ring_.ForEachCqe([this](const struct io_uring_cqe& cqe) { OnCompletion(cqe); });
+    buffers_.Publish();
+    Service();
+}
+
+void UringLoop::OnCompletion(const struct io_uring_cqe& cqe) {
+    const auto op = static_cast<Op>(cqe.user_data >> OP_SHIFT);
+    if (op == Op::kAccept) {
+        OnAccept(cqe);
+        return;
+    }
+    if (op == Op::kCancel) {
+        return;
+    }
+
+    auto it = peers_.find(cqe.user_data & ((uint64_t{1} << OP_SHIFT) - 1));
+    if (it == peers_.end()) {
+        // Буфер все равно нужно вернуть ядру
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            buffers_.Recycle(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        return;
+    }
+    if (op == Op::kRecv) {
+        OnRecv(*it->second, cqe);
+    } else if (op == Op::kSend) {
+        OnSend(*it->second, cqe);
+    }
+}
+
+void UringLoop::OnAccept(const struct io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        accepting_ = false;
+    }
+    if (cqe.res < 0) {
+        if (cqe.res != -ECANCELED) {
+            LOG_RATE_LIMITED(LogLevel::kError, 10, "accept: {}", strerror(-cqe.res));
+        }
+    } else if (draining_) {
+        close(cqe.res);
+    } else {
+        metrics::Increment(metrics::Counter::kAccepts);
+        LOG_DEBUG("Connected to client.");
+
+        auto peer = MakePooled<Peer>(&pool_, &pool_);
+        peer->conn_.socket_.Reset(cqe.res);
+        peer->id_ = next_id_++;
+        ArmRecv(*peer);
+        peers_.emplace(peer->id_, std::move(peer));
+    }
+    if (!accepting_ && !draining_) {
+        ArmAccept();
+    }
+}
+
+void UringLoop::OnRecv(Peer& peer, const struct io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        peer.recv_armed_ = false;
+    }
+    Touch(peer);
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        const auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        const char *data = buffers_.Data(id);
+        size_t size = cqe.res > 0 && !peer.closing_ ? static_cast<size_t>(cqe.res) : 0;
+        Connection& conn = peer.conn_;
+        while (size != 0) {
+            if (conn.in_.Full()) {
+                // Разбираем накопленное, чтобы освободить место
+                if (!handler_(conn) || conn.in_.Full()) {
+                    StartClose(peer);
+                    break;
+                }
+            }
+            auto span = conn.in_.WriteSpan();
+            const size_t n = std::min(span.size(), size);
+            std::memcpy(span.data(), data, n);
+            conn.in_.Commit(n);
+            data += n;
+            size -= n;
+            peer.has_data_ = true;
+        }
+        buffers_.Recycle(id);
+    }
+
+    // ENOBUFS: кольцо буферов опустело, recv ставится заново после Publish
+    if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)) {
+        StartClose(peer);
+    }
+}
+
+void UringLoop::OnSend(Peer& peer, const struct io_uring_cqe& cqe) {
+    peer.send_in_flight_ = false;
+    Touch(peer);
+    if (cqe.res < 0) {
+        peer.sending_.clear();
+        peer.conn_.out_.clear();
+        StartClose(peer);
+        return;
+    }
+    peer.sending_.erase(0, static_cast<size_t>(cqe.res));
+}
+
+// После прохода по CQE: обработчик раз на соединение, затем send и recv заново
+void UringLoop::Service() {
+    finished_.clear();
+    for (size_t i = 0; i < touched_.size(); ++i) {
+        Peer& peer = *touched_[i];
+        peer.queued_ = false;
+        Connection& conn = peer.conn_;
+
+        if (peer.has_data_) {
+            peer.has_data_ = false;
+            if (!conn.in_.Empty() && !handler_(conn)) {
+                peer.closing_ = true;
+            }
+        }
+
+        if (!peer.send_in_flight_) {
+            if (peer.sending_.empty()) {
+                peer.sending_.swap(conn.out_);
+            } else {
+                peer.sending_ += conn.out_;
+                conn.out_.clear();
+            }
+            if (!peer.sending_.empty()) {
+                struct io_uring_sqe *sqe = Sqe();
+                sqe->opcode = IORING_OP_SEND;
+                sqe->fd = conn.socket_.GetFd();
+                sqe->addr = reinterpret_cast<uint64_t>(peer.sending_.data());
+                sqe->len = static_cast<uint32_t>(peer.sending_.size());
+                sqe->msg_flags = MSG_NOSIGNAL;
+                sqe->user_data = UserData(static_cast<uint8_t>(Op::kSend), peer.id_);
+                peer.send_in_flight_ = true;
+            }
+        }
+
+        if (!peer.closing_) {
+            if (!peer.recv_armed_) {
+                ArmRecv(peer);
+            }
+            continue;
+        }
+        if (peer.recv_armed_ && !peer.shut_down_) {
+            struct io_uring_sqe *sqe = Sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = UserData(static_cast<uint8_t>(Op::kRecv), peer.id_);
+            sqe->user_data = UserData(static_cast<uint8_t>(Op::kCancel), peer.id_);
+            peer.shut_down_ = true;
+        }
+        if (!peer.recv_armed_ && !peer.send_in_flight_ && peer.sending_.empty()) {
+            finished_.push_back(peer.id_);
+        }
+    }
+    touched_.clear();
+    for (uint64_t id : finished_) {
+        peers_.erase(id);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "event_loop.h"
+#include "io_uring.h"
+
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Цикл событий на io_uring. Вместо системного вызова на каждое accept,
+// recv и send:
+// * один multishot accept на слушающий сокет дает CQE на каждое соединение;
+// * multishot recv на соединение с буферами из общего кольца ProvidedBuffers:
+//   данные приходят в CQE без повторной постановки и без буфера на соединение;
+// * подтверждения всех соединений, накопленные за один проход по CQE,
+//   уходят пачкой SQE send в одном io_uring_enter, который заодно ждет
+//   следующих завершений.
+class UringLoop : public IoLoop {
+public:
+    static constexpr unsigned RING_ENTRIES = 1024;
+    static constexpr unsigned BUFFER_COUNT = 1024;
+    static constexpr unsigned BUFFER_SIZE = 4096;
+
+    // Бросает std::runtime_error, если io_uring недоступен
+    UringLoop(const char *port, DataHandler handler);
+    UringLoop(const UringLoop&) = delete;
+    UringLoop &operator=(const UringLoop&) = delete;
+
+    const char *Name() const override { return "io_uring"; }
+    void Run(const std::atomic<bool>& stop) override;
+    size_t Drain(std::chrono::milliseconds timeout) override;
+
+private:
+    enum class Op : uint8_t {
+        kAccept = 1,
+        kRecv,
+        kSend,
+        kCancel
+    };
+
+    // Соединение живет, пока по нему есть операция в ядре: recv и send
+    // ссылаются на его сокет и буфер отправки
+    struct Peer {
+        explicit Peer(std::pmr::memory_resource *resource) : conn_(resource) {}
+
+        Connection conn_;
+        uint64_t id_ = 0;
+        std::string sending_;           // Отдано ядру в SQE send, не трогаем до CQE
+        bool recv_armed_ = false;
+        bool send_in_flight_ = false;
+        bool has_data_ = false;         // Пришли байты, обработчик еще не вызван
+        bool closing_ = false;
+        bool shut_down_ = false;
+        bool queued_ = false;           // Уже в touched_
+    };
+
+    Socket listener_;
+    DataHandler handler_;
+    IoUring ring_;
+    ProvidedBuffers buffers_;
+    // Соединения и их буферы приема переиспользуются внутри цикла, как в EventLoop
+    std::pmr::unsynchronized_pool_resource pool_{ThreadPoolOptions(RingBuffer::DEFAULT_CAPACITY)};
+    std::pmr::unordered_map<uint64_t, PoolPtr<Peer>> peers_{&pool_};
+    std::vector<uint64_t> finished_;    // Закрытые за проход Service, переиспользуется
+    std::vector<Peer*> touched_;        // Соединения с событиями за текущий проход
+    uint64_t next_id_ = 1;
+    bool accepting_ = false;
+    bool draining_ = false;
+
+    struct io_uring_sqe *Sqe();
+    void ArmAccept();
+    void ArmRecv(Peer& peer);
+    void Touch(Peer& peer);
+    void Poll(std::chrono::milliseconds timeout);
+    void OnCompletion(const struct io_uring_cqe& cqe);
+    void OnAccept(const struct io_uring_cqe& cqe);
+    void OnRecv(Peer& peer, const struct io_uring_cqe& cqe);
+    void OnSend(Peer& peer, const struct io_uring_cqe& cqe);
+    void Service();
+    void StartClose(Peer& peer);
+};
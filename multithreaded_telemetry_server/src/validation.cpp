@@ -0,0 +1,276 @@
+#include "validation.h"
+#include "json.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+namespace {
+
+constexpr size_t FIELDS = 3;
+constexpr double MIN_INTERVAL_S = 1.0;      // Более частые показания проверяются как секундные
+constexpr double VARIANCE_FLOOR = 1e-4;     // Ровный сигнал не дает пометок на шуме в сотых
+constexpr size_t DEFAULT_LIMIT = 100;
+constexpr size_t MAX_LIMIT = 10'000;
+
+int64_t ToMillis(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+} // namespace
+
+ReadingValidator::ReadingValidator(ValidationOptions options)
+    : options_(options), side_channel_(options.side_channel_capacity_) {
+    for (const auto& field : options_.fields_) {
+        if (!(field.min_ <= field.max_) || !(field.max_rate_ > 0.0)) {
+            throw std::invalid_argument("ReadingValidator: need min <= max and max_rate > 0");
+        }
+    }
+    if (!(options_.ewma_alpha_ > 0.0 && options_.ewma_alpha_ <= 1.0) || !(options_.z_threshold_ > 0.0)) {
+        throw std::invalid_argument("ReadingValidator: need 0 < ewma_alpha <= 1 and z_threshold > 0");
+    }
+}
+
+ReadingValidator::~ReadingValidator() {
+    for (auto& segment : segments_) {
+        delete[] segment.load(std::memory_order_relaxed);
+    }
+}
+
+ReadingValidator::StatsSlot& ReadingValidator::Slot(DeviceId id) {
+    auto& segment_ptr = segments_[id / SEGMENT_SIZE];
+    StatsSlot *segment = segment_ptr.load(std::memory_order_acquire);
+    if (segment == nullptr) {
+        auto *fresh = new StatsSlot[SEGMENT_SIZE];
+        if (segment_ptr.compare_exchange_strong(segment, fresh, std::memory_order_acq_rel)) {
+            segment = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+    return segment[id % SEGMENT_SIZE];
+}
+
+void ReadingValidator::Check(const std::vector<DeviceState>& readings, const std::vector<uint8_t>& fields,
+                             std::vector<uint8_t>& issues) {
+    issues.assign(readings.size(), 0);
+
+    // Блок не должен содержать устройство дважды: второе показание
+    // проверяется против первого, поэтому оно начинает следующий блок.
+    // Повтор ищется в маленькой таблице с открытой адресацией.
+    constexpr size_t TABLE_SIZE = 2 * BLOCK;
+    DeviceId seen[TABLE_SIZE];
+
+    size_t begin = 0;
+    while (begin < readings.size()) {
+        std::fill(std::begin(seen), std::end(seen), INVALID_DEVICE_ID);
+        size_t end = begin;
+        for (; end < readings.size() && end - begin < BLOCK; ++end) {
+            const DeviceId id = readings[end].device_id_;
+            size_t pos = (static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull >> 57) % TABLE_SIZE;
+            while (seen[pos] != INVALID_DEVICE_ID && seen[pos] != id) {
+                pos = (pos + 1) % TABLE_SIZE;
+            }
+            if (seen[pos] == id) {
+                break;
+            }
+            seen[pos] = id;
+        }
+        CheckBlock(readings.data() + begin, fields.data() + begin, end - begin, issues.data() + begin);
+        begin = end;
+    }
+}
+
+void ReadingValidator::CheckBlock(const DeviceState *readings, const uint8_t *fields, size_t count,
+                                  uint8_t *issues) {
+    // Все столбцы - double, признаки хранятся как 0.0/1.0: циклы проверок
+    // не смешивают типы элементов и векторизуются даже на базовом SSE2
+    alignas(64) double value[FIELDS][BLOCK];
+    alignas(64) double last[FIELDS][BLOCK];
+    alignas(64) double mean[FIELDS][BLOCK];
+    alignas(64) double variance[FIELDS][BLOCK];
+    alignas(64) double present[FIELDS][BLOCK];      // Поле есть в показании
+    alignas(64) double elapsed_ms[FIELDS][BLOCK];   // От прошлого значения поля
+    alignas(64) double seen[FIELDS][BLOCK];         // Принятых значений поля
+    alignas(64) double out_of_range[BLOCK];
+    alignas(64) double too_fast[BLOCK];
+    alignas(64) double anomaly[BLOCK];
+    DeviceStats stats[BLOCK];
+    StatsSlot *slots[BLOCK];
+    int64_t now_ms[BLOCK];
+
+    // Сбор: статистика устройств и значения показаний в столбцы
+    for (size_t i = 0; i < count; ++i) {
+        const DeviceState& state = readings[i];
+        slots[i] = &Slot(state.device_id_);
+        stats[i] = slots[i]->Load();
+        now_ms[i] = ToMillis(state.last_update_);
+        value[0][i] = state.temperature_;
+        value[1][i] = state.humidity_;
+        value[2][i] = state.pressure_;
+        // Первое значение поля становится средним с нулевой дисперсией
+        for (size_t f = 0; f < FIELDS; ++f) {
+            present[f][i] = (fields[i] >> f) & 1 ? 1.0 : 0.0;
+            last[f][i] = stats[i].last_[f];
+            mean[f][i] = stats[i].count_[f] == 0 ? value[f][i] : stats[i].mean_[f];
+            variance[f][i] = stats[i].variance_[f];
+            elapsed_ms[f][i] = static_cast<double>(now_ms[i] - stats[i].last_ms_[f]);
+            seen[f][i] = stats[i].count_[f];
+        }
+        out_of_range[i] = 0.0;
+        too_fast[i] = 0.0;
+        anomaly[i] = 0.0;
+    }
+
+    // Проверки: по столбцу на поле, без ветвлений. NaN не проходит
+    // сравнение диапазона и отклоняется вместе с выходом за границы.
+    // Непереданное поле проходит все проверки.
+    const double z2 = options_.z_threshold_ * options_.z_threshold_;
+    const double warmup = options_.warmup_;
+    for (size_t f = 0; f < FIELDS; ++f) {
+        const double min = options_.fields_[f].min_;
+        const double max = options_.fields_[f].max_;
+        const double max_rate = options_.fields_[f].max_rate_;
+        const double *v = value[f];
+        const double *l = last[f];
+        const double *m = mean[f];
+        const double *var = variance[f];
+        const double *p = present[f];
+        const double *e = elapsed_ms[f];
+        const double *n = seen[f];
+        for (size_t i = 0; i < count; ++i) {
+            const double diff = v[i] - m[i];
+            const double interval = std::max(MIN_INTERVAL_S, e[i] * 0.001);
+            const bool has = p[i] > 0.0;
+            const bool in_range = ((v[i] >= min) & (v[i] <= max)) | !has;
+            const bool fast = has & (n[i] > 0.0) & (std::abs(v[i] - l[i]) > max_rate * interval);
+            const bool outlier = has & (n[i] >= warmup) & (diff * diff > z2 * std::max(var[i], VARIANCE_FLOOR));
+            out_of_range[i] = in_range ? out_of_range[i] : 1.0;
+            too_fast[i] = fast ? 1.0 : too_fast[i];
+            anomaly[i] = outlier ? 1.0 : anomaly[i];
+        }
+    }
+
+    // EWMA для всех показаний подряд, у непереданных полей остаются прежние
+    // значения; отклоненные показания не сохраняются при раздаче.
+    // Помеченные сохраняются: иначе настоящий сдвиг уровня помечался бы
+    // бесконечно.
+    const double alpha = options_.ewma_alpha_;
+    for (size_t f = 0; f < FIELDS; ++f) {
+        const double *v = value[f];
+        const double *p = present[f];
+        double *m = mean[f];
+        double *var = variance[f];
+        for (size_t i = 0; i < count; ++i) {
+            const double diff = v[i] - m[i];
+            const double next_variance = (1.0 - alpha) * (var[i] + alpha * diff * diff);
+            const double next_mean = m[i] + alpha * diff;
+            var[i] = p[i] > 0.0 ? next_variance : var[i];
+            m[i] = p[i] > 0.0 ? next_mean : m[i];
+        }
+    }
+
+    // Раздача: статистика обратно устройствам, проблемы - в боковой канал
+    for (size_t i = 0; i < count; ++i) {
+        issues[i] = static_cast<uint8_t>((out_of_range[i] != 0.0 ? ISSUE_OUT_OF_RANGE : 0) |
+                                         (too_fast[i] != 0.0 ? ISSUE_RATE : 0) |
+                                         (anomaly[i] != 0.0 ? ISSUE_ANOMALY : 0));
+        if ((issues[i] & REJECTING_ISSUES) == 0 && fields[i] != 0) {
+            DeviceStats& next = stats[i];
+            for (size_t f = 0; f < FIELDS; ++f) {
+                if (present[f][i] == 0.0) {
+                    continue;
+                }
+                next.last_[f] = value[f][i];
+                next.mean_[f] = mean[f][i];
+                next.variance_[f] = variance[f][i];
+                next.last_ms_[f] = now_ms[i];
+                next.count_[f] += next.count_[f] != UINT32_MAX;
+            }
+            slots[i]->Store(next);
+        }
+        if (issues[i] != 0) {
+            Report(readings[i], fields[i], issues[i]);
+        }
+    }
+}
+
+void ReadingValidator::Report(const DeviceState& state, uint8_t fields, uint8_t issues) {
+    metrics::Increment((issues & REJECTING_ISSUES) ? metrics::Counter::kReadingsRejected
+                                                   : metrics::Counter::kReadingsFlagged);
+    if (!side_channel_.TryPush(FlaggedReading{state, fields, issues})) {
+        metrics::Increment(metrics::Counter::kFlaggedDropped);
+    }
+}
+
+size_t ReadingValidator::DrainFlagged(std::vector<FlaggedReading>& out, size_t max) {
+    size_t drained = 0;
+    FlaggedReading reading;
+    while (drained < max && side_channel_.TryPop(reading)) {
+        out.push_back(reading);
+        ++drained;
+    }
+    return drained;
+}
+
+std::string ReadingValidator::HandleHttp(std::string_view params, const DeviceIdTable& ids) {
+    size_t limit = DEFAULT_LIMIT;
+    while (!params.empty()) {
+        const size_t amp = params.find('&');
+        const std::string_view pair = params.substr(0, amp);
+        params = amp == std::string_view::npos ? std::string_view() : params.substr(amp + 1);
+
+        const size_t eq = pair.find('=');
+        const std::string_view key = pair.substr(0, eq);
+        const std::string_view value = eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+        if (key == "limit") {
+            const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), limit);
+            if (ec != std::errc() || ptr != value.data() + value.size() || limit == 0 || limit > MAX_LIMIT) {
+                throw std::invalid_argument("bad limit: " + std::string(value));
+            }
+        }
+    }
+
+    std::vector<FlaggedReading> readings;
+    DrainFlagged(readings, limit);
+
+    // Показание - {"device", "ts" (мс), значения, "issues", "rejected"}
+    std::string out = "{\"readings\":[";
+    for (size_t i = 0; i < readings.size(); ++i) {
+        const FlaggedReading& reading = readings[i];
+        out += i == 0 ? "{\"device\":" : ",{\"device\":";
+        AppendJsonString(out, ids.Name(reading.state_.device_id_));
+        fmt::format_to(std::back_inserter(out), ",\"ts\":{}", ToMillis(reading.state_.last_update_));
+        // Непереданное поле - null
+        const double values[FIELDS] = {reading.state_.temperature_, reading.state_.humidity_,
+                                       reading.state_.pressure_};
+        const char *keys[FIELDS] = {",\"temp\":", ",\"hum\":", ",\"press\":"};
+        for (size_t f = 0; f < FIELDS; ++f) {
+            out += keys[f];
+            if ((reading.fields_ >> f) & 1) {
+                AppendJsonNumber(out, values[f]);
+            } else {
+                out += "null";
+            }
+        }
+        out += ",\"issues\":[";
+        const char *separator = "";
+        for (const auto& [bit, name] : {std::pair{ISSUE_OUT_OF_RANGE, "range"}, std::pair{ISSUE_RATE, "rate"},
+                                        std::pair{ISSUE_ANOMALY, "anomaly"}}) {
+            if (reading.issues_ & bit) {
+                fmt::format_to(std::back_inserter(out), "{}\"{}\"", separator, name);
+                separator = ",";
+            }
+        }
+        fmt::format_to(std::back_inserter(out), "],\"rejected\":{}}}",
+                       (reading.issues_ & REJECTING_ISSUES) != 0);
+    }
+    fmt::format_to(std::back_inserter(out), "],\"pending\":{}}}\n", side_channel_.Depth());
+    return out;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "device.h"
+#include "intern_table.h"
+#include "mpsc_queue.h"
+#include "seqlock.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Допустимые значения одного поля показания
+struct FieldLimits {
+    double min_;
+    double max_;
+    double max_rate_;               // Изменение за секунду относительно прошлого показания
+};
+
+struct ValidationOptions {
+    // temp, hum, press. Вне диапазона (и NaN/inf) - показание отклоняется.
+    std::array<FieldLimits, 3> fields_ = {{{-60.0, 85.0, 10.0}, {0.0, 100.0, 20.0}, {300.0, 1100.0, 10.0}}};
+    double z_threshold_ = 6.0;      // Отклонение от EWMA в сигмах, после которого показание помечается
+    double ewma_alpha_ = 0.05;      // Вес нового показания в среднем и дисперсии
+    uint32_t warmup_ = 20;          // Показаний устройства до начала проверки z-score
+    size_t side_channel_capacity_ = 4096;   // Степень двойки
+};
+
+// Причины отказа и пометки показания, битовая маска
+constexpr uint8_t ISSUE_OUT_OF_RANGE = 1 << 0;  // Отклоняется: вне диапазона или не число
+constexpr uint8_t ISSUE_RATE = 1 << 1;          // Помечается: слишком быстрое изменение
+constexpr uint8_t ISSUE_ANOMALY = 1 << 2;       // Помечается: z-score выше порога
+constexpr uint8_t REJECTING_ISSUES = ISSUE_OUT_OF_RANGE;
+
+// Показание, попавшее в боковой канал
+struct FlaggedReading {
+    DeviceState state_;
+    uint8_t fields_ = ALL_FIELDS;
+    uint8_t issues_ = 0;
+};
+
+// Стадия проверки между разбором и записью. Пакет показаний одного чтения
+// проверяется блоками: значения транспонируются в столбцы (SoA), и проверки
+// диапазона, скорости изменения и z-score идут циклами без ветвлений,
+// которые компилятор векторизует. Состояние устройства (последнее принятое
+// значение, EWMA среднего и дисперсии) лежит в плотном массиве по DeviceId
+// под seqlock: чтение и запись без блокировок реестра.
+//
+// Проверяются и входят в статистику только присланные поля: показание
+// из одного temp или из одних дополнительных метрик не сравнивается
+// с нулями вместо hum и press.
+//
+// Отклоненные показания не записываются и получают Err, помеченные
+// записываются как обычно. И те, и другие уходят в ограниченный боковой
+// канал; при его переполнении учитываются только счетчиком.
+class ReadingValidator {
+public:
+    explicit ReadingValidator(ValidationOptions options = {});
+    ~ReadingValidator();
+
+    ReadingValidator(const ReadingValidator&) = delete;
+    ReadingValidator &operator=(const ReadingValidator&) = delete;
+
+    // issues[i] - маска для readings[i], fields[i] - его присланные поля
+    // (FIELD_*). Из потоков циклов событий.
+    // Показания одного устройства из разных соединений одновременно
+    // обновляют его статистику по принципу "последний записавший прав".
+    void Check(const std::vector<DeviceState>& readings, const std::vector<uint8_t>& fields,
+               std::vector<uint8_t>& issues);
+
+    // Забирает из бокового канала не больше max показаний
+    size_t DrainFlagged(std::vector<FlaggedReading>& out, size_t max);
+
+    // Параметры HTTP: limit=<n> (по умолчанию 100). Ответ - JSON со
+    // снятыми из бокового канала показаниями.
+    std::string HandleHttp(std::string_view params, const DeviceIdTable& ids);
+
+    size_t SideChannelDepth() const { return side_channel_.Depth(); }
+
+private:
+    static constexpr size_t BLOCK = 64;
+    static constexpr size_t SEGMENT_SIZE = 4096;
+    static constexpr size_t MAX_SEGMENTS = 4096;    // Как в DeviceIdTable
+
+    // Статистика устройства по полям temp, hum, press: у каждого поля
+    // свои время и число показаний, поля приходят независимо
+    struct DeviceStats {
+        double last_[3];
+        double mean_[3];
+        double variance_[3];
+        int64_t last_ms_[3];
+        uint32_t count_[3];         // 0 - поле еще не приходило
+    };
+
+    using StatsSlot = SeqLock<DeviceStats>;
+
+    const ValidationOptions options_;
+    std::atomic<StatsSlot*> segments_[MAX_SEGMENTS]{};      // Создаются по мере роста DeviceId
+    BoundedMpscQueue<FlaggedReading> side_channel_;
+
+    StatsSlot& Slot(DeviceId id);
+    void CheckBlock(const DeviceState *readings, const uint8_t *fields, size_t count, uint8_t *issues);
+    void Report(const DeviceState& state, uint8_t fields, uint8_t issues);
+};